@@ -7,6 +7,8 @@ namespace Analytics {
         this->maxSupportError = maxSupportError;
         this->minConfidence   = minConfidence;
 
+        this->itemDictionary = NULL;
+
         // Stats for the UI.
         this->allBatchesNumPageViews = 0;
         this->allBatchesNumTransactions = 0;
@@ -21,11 +23,14 @@ namespace Analytics {
 #endif
 
         this->fpstream = new FPStream(this->minSupport, this->maxSupportError, &this->itemIDNameHash, &this->itemNameIDHash, &this->sortedFrequentItemIDs);
+        this->itemHierarchy = NULL;
+        this->setConceptHierarchyPruning(true);
         connect(this->fpstream, SIGNAL(batchProcessed()), this, SLOT(fpstreamProcessedBatch()));
     }
 
     Analyst::~Analyst() {
         delete this->fpstream;
+        delete this->itemHierarchy;
     }
 
     /**
@@ -64,6 +69,26 @@ namespace Analytics {
         this->ruleConsequentItemConstraints.addItemConstraint(item, type);
     }
 
+    /**
+     * Enable or disable pruning of itemsets that contain both an item and
+     * one of its ancestors or descendants in the concept hierarchy (e.g.
+     * {location:EU, location:EU:BE}): these are redundant, since every
+     * transaction that contains an item also contains its ancestors.
+     * Enabled by default. Must be set before the first batch is analyzed.
+     *
+     * @param prune
+     *   Whether to prune.
+     */
+    void Analyst::setConceptHierarchyPruning(bool prune) {
+        if (prune && this->itemHierarchy == NULL)
+            this->itemHierarchy = new ItemHierarchy();
+        else if (!prune) {
+            delete this->itemHierarchy;
+            this->itemHierarchy = NULL;
+        }
+        this->fpstream->setItemHierarchy(this->itemHierarchy);
+    }
+
     /**
      * Override of QObject::moveToThread(), to automatically also move the
      * FPStream object to the other thread.
@@ -107,23 +132,43 @@ namespace Analytics {
     //------------------------------------------------------------------------
     // Public slots.
 
-    void Analyst::analyzeTransactions(const QList<QStringList> &transactions, double transactionsPerEvent, Time start, Time end) {
-        // Stats for the UI.
+    /**
+     * Analyze a batch of transactions.
+     *
+     * @param transactions
+     *   A batch of transactions, as item IDs of the item dictionary.
+     * @param transactionsPerEvent
+     *   The number of transactions per event.
+     * @param samplingRate
+     *   The fraction of events that was sampled to generate the
+     *   transactions. Support counts are scaled by its inverse.
+     * @param start
+     *   The time of the first event in the batch.
+     * @param end
+     *   The time of the last event in the batch.
+     */
+    void Analyst::analyzeTransactions(const TransactionBatch & transactions, double transactionsPerEvent, double samplingRate, Time start, Time end) {
+        // Stats for the UI. The number of page views is an estimate of the
+        // number before sampling.
+        const SupportCount numTransactions = transactions.totalWeight();
         this->currentBatchStartTime = start;
         this->currentBatchEndTime = end;
-        this->currentBatchNumPageViews = transactions.size() / transactionsPerEvent;
-        this->currentBatchNumTransactions = transactions.size();
+        this->currentBatchNumPageViews = numTransactions / transactionsPerEvent / samplingRate;
+        this->currentBatchNumTransactions = numTransactions;
         this->timer.start();
 
         // Necessary to be able to update the browsable concept hierarchy in
         // Analyst::fpstreamProcessedBatch().
         this->uniqueItemsBeforeMining = this->itemIDNameHash.size();
 
+        // Learn the names of the items that are new in this batch.
+        this->updateItems();
+
         // Notify the UI.
         emit analyzing(true, this->currentBatchStartTime, this->currentBatchEndTime, this->currentBatchNumPageViews, this->currentBatchNumTransactions);
 
         // Perform the actual mining.
-        this->performMining(transactions, transactionsPerEvent);
+        this->performMining(transactions, transactionsPerEvent, samplingRate);
 
         // Since the mining above is performed asynchronously, this is NOT the
         // place where we know the calculations end. Only FP-Stream can know,
@@ -319,20 +364,38 @@ namespace Analytics {
     //------------------------------------------------------------------------
     // Protected methods.
 
-    void Analyst::performMining(const QList<QStringList> & transactions, double transactionsPerEvent) {
+    /**
+     * Mirror the items that have been added to the item dictionary since the
+     * previous batch in the item ID <-> name hashes, which are used by
+     * FPGrowth (for constraints) and by the UI. Item IDs are dense, so the
+     * hashes' size is the ID of the first item they're missing.
+     */
+    void Analyst::updateItems() {
+        if (this->itemDictionary == NULL)
+            return;
+
+        ItemID itemID = this->itemIDNameHash.size();
+        foreach (const ItemName & itemName, this->itemDictionary->namesFrom(itemID)) {
+            this->itemIDNameHash.insert(itemID, itemName);
+            this->itemNameIDHash.insert(itemName, itemID);
+            itemID++;
+        }
+    }
+
+    void Analyst::performMining(const TransactionBatch & transactions, double transactionsPerEvent, double samplingRate) {
         bool fpstream = true;
 
         if (!fpstream) {
 //            qDebug() << "----------------------> FPGROWTH";
-        // Clear these every time, to ensure the original behavior.
-        this->itemIDNameHash.clear();
-        this->itemNameIDHash.clear();
+        // Clear this every time, to ensure the original behavior. The item
+        // ID <-> name hashes are kept: they mirror the item dictionary.
         this->sortedFrequentItemIDs.clear();
 
         qDebug() << "starting mining, # transactions: " << transactions.size();
-        FPGrowth * fpgrowth = new FPGrowth(transactions, ceil(this->minSupport * transactions.size() / transactionsPerEvent), &this->itemIDNameHash, &this->itemNameIDHash, &this->sortedFrequentItemIDs);
+        FPGrowth * fpgrowth = new FPGrowth(transactions, ceil(this->minSupport * transactions.totalWeight() / transactionsPerEvent), &this->itemIDNameHash, &this->itemNameIDHash, &this->sortedFrequentItemIDs);
         fpgrowth->setConstraints(this->frequentItemsetItemConstraints);
         fpgrowth->setConstraintsForRuleConsequents(this->ruleConsequentItemConstraints);
+        fpgrowth->setItemHierarchy(this->itemHierarchy);
         QList<FrequentItemset> frequentItemsets = fpgrowth->mineFrequentItemsets(false);
         qDebug() << "frequent itemset mining complete, # frequent itemsets:" << frequentItemsets.size();
 
@@ -357,7 +420,7 @@ namespace Analytics {
             this->fpstream->setConstraintsToPreprocess(this->ruleConsequentItemConstraints);
             initial = false;
         }
-        this->fpstream->processBatchTransactions(transactions, transactionsPerEvent);
+        this->fpstream->processBatchTransactions(transactions, transactionsPerEvent, samplingRate);
         /*
         qDebug() << this->fpstream->getPatternTree().getNodeCount();
         qDebug() << this->itemIDNameHash.size() << this->itemNameIDHash.size() << this->sortedFrequentItemIDs.size();
@@ -15,6 +15,9 @@
 #include <QMutex>
 
 #include "Item.h"
+#include "ItemDictionary.h"
+#include "ItemHierarchy.h"
+#include "TransactionBatch.h"
 #include "Constraints.h"
 #include "FPGrowth.h"
 #include "FPStream.h"
@@ -32,6 +35,8 @@ namespace Analytics {
         ~Analyst();
         void addFrequentItemsetItemConstraint(ItemName item, ItemConstraintType type);
         void addRuleConsequentItemConstraint(ItemName item, ItemConstraintType type);
+        void setItemDictionary(ItemDictionary * itemDictionary) { this->itemDictionary = itemDictionary; }
+        void setConceptHierarchyPruning(bool prune);
 
         // Override moveToThread to also move the FPStream instance.
         void moveToThread(QThread * thread);
@@ -64,7 +69,7 @@ namespace Analytics {
                                 Analytics::SupportCount eventsInNewerTimeRange);
 
     public slots:
-        void analyzeTransactions(const QList<QStringList> & transactions, double transactionsPerEvent, Time start, Time end);
+        void analyzeTransactions(const Analytics::TransactionBatch & transactions, double transactionsPerEvent, double samplingRate, Time start, Time end);
         void mineRules(uint from, uint to);
         void mineAndCompareRules(uint fromOlder, uint toOlder, uint fromNewer, uint toNewer);
 
@@ -72,7 +77,8 @@ namespace Analytics {
         void fpstreamProcessedBatch();
 
     protected:
-        void performMining(const QList<QStringList> & transactions, double transactionsPerEvent);
+        void updateItems();
+        void performMining(const TransactionBatch & transactions, double transactionsPerEvent, double samplingRate);
         void updateConceptHierarchyModel(int itemsAlreadyProcessed);
 
         FPStream * fpstream;
@@ -83,9 +89,15 @@ namespace Analytics {
         Constraints frequentItemsetItemConstraints;
         Constraints ruleConsequentItemConstraints;
 
+        // Assigns the item IDs in the transactions. The item ID <-> name
+        // hashes mirror it, see updateItems().
+        ItemDictionary * itemDictionary;
         ItemIDNameHash itemIDNameHash;
         ItemNameIDHash itemNameIDHash;
         ItemIDList sortedFrequentItemIDs;
+        // The concept hierarchy of the items, used to prune redundant
+        // itemsets; NULL when disabled.
+        ItemHierarchy * itemHierarchy;
 
         // Stats for the UI.
         int currentBatchStartTime;
@@ -5,6 +5,8 @@ INCLUDEPATH += $${PWD}
 
 SOURCES += \
     $${PWD}/Item.cpp \
+    $${PWD}/ItemHierarchy.cpp \
+    $${PWD}/TransactionBatch.cpp \
     $${PWD}/FPTree.cpp \
     $${PWD}/FPGrowth.cpp\
     $${PWD}/RuleMiner.cpp \
@@ -15,6 +17,9 @@ SOURCES += \
     $${PWD}/TiltedTimeWindow.cpp
 HEADERS += \
     $${PWD}/Item.h \
+    $${PWD}/ItemDictionary.h \
+    $${PWD}/ItemHierarchy.h \
+    $${PWD}/TransactionBatch.h \
     $${PWD}/FPNode.h \
     $${PWD}/FPTree.h \
     $${PWD}/FPGrowth.h \
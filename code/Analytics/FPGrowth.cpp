@@ -2,19 +2,23 @@
 
 namespace Analytics {
 
-    FPGrowth::FPGrowth(const QList<QStringList> & transactions, SupportCount minSupportAbsolute, ItemIDNameHash * itemIDNameHash, ItemNameIDHash * itemNameIDHash, ItemIDList * sortedFrequentItemIDs) {
-        this->itemIDNameHash        = itemIDNameHash;
-        this->itemNameIDHash        = itemNameIDHash;
-        this->sortedFrequentItemIDs = sortedFrequentItemIDs;
-
-        this->transactions = transactions;
-
-        this->minSupportAbsolute = minSupportAbsolute;
+    /**
+     * @param transactions
+     *   A batch of transactions. The names of all items in them must already
+     *   be in itemIDNameHash and itemNameIDHash (e.g. because the Analyst
+     *   keeps these in sync with its ItemDictionary).
+     */
+    FPGrowth::FPGrowth(const TransactionBatch & transactions, SupportCount minSupportAbsolute, ItemIDNameHash * itemIDNameHash, ItemNameIDHash * itemNameIDHash, ItemIDList * sortedFrequentItemIDs) {
+        this->init(transactions, minSupportAbsolute, itemIDNameHash, itemNameIDHash, sortedFrequentItemIDs);
+    }
 
-        this->tree = new FPTree();
-#ifdef DEBUG
-        this->tree->itemIDNameHash = this->itemIDNameHash;
-#endif
+    /**
+     * @param transactions
+     *   A batch of transactions, as item names. New item names are assigned
+     *   item IDs in itemIDNameHash and itemNameIDHash.
+     */
+    FPGrowth::FPGrowth(const QList<QStringList> & transactions, SupportCount minSupportAbsolute, ItemIDNameHash * itemIDNameHash, ItemNameIDHash * itemNameIDHash, ItemIDList * sortedFrequentItemIDs) {
+        this->init(FPGrowth::mapTransactionsToItemIDs(transactions, itemIDNameHash, itemNameIDHash), minSupportAbsolute, itemIDNameHash, itemNameIDHash, sortedFrequentItemIDs);
     }
 
     FPGrowth::~FPGrowth() {
@@ -22,8 +26,9 @@ namespace Analytics {
     }
 
     /**
-     * Mine frequent itemsets. (First scan the transactions, then build the
-     * FP-tree, then generate the frequent itemsets from there.)
+     * Mine frequent itemsets. (First collapse identical transactions, then
+     * scan the transactions, then build the FP-tree, then generate the
+     * frequent itemsets from there.)
      *
      * @param asynchronous
      *   See the explanation for the identically named parameter of @fn
@@ -32,6 +37,16 @@ namespace Analytics {
      *   The frequent itemsets that were found.
      */
     QList<FrequentItemset> FPGrowth::mineFrequentItemsets(bool asynchronous) {
+        // Identical transactions are inserted into the FP-tree only once, as
+        // a weighted transaction: support counts stay exact.
+#ifdef FPGROWTH_DEBUG
+        int numTransactions = this->transactions.size();
+#endif
+        this->transactions = this->transactions.deduplicated();
+#ifdef FPGROWTH_DEBUG
+        qDebug() << "Deduplicated" << numTransactions << "transactions into" << this->transactions.size() << "weighted transactions.";
+#endif
+
         this->scanTransactions();
         this->buildFPTree();
         return this->generateFrequentItemsets(this->tree, FrequentItemset(), asynchronous);
@@ -98,6 +113,44 @@ namespace Analytics {
     }
 
 
+    /**
+     * Map transactions of item names to a TransactionBatch, maintaining two
+     * dictionaries: one for each look-up direction (name -> id and id ->
+     * name). Only for transactions that weren't generated as item IDs in the
+     * first place.
+     *
+     * @param transactions
+     *   Transactions, as item names.
+     * @param itemIDNameHash
+     *   Item ID -> item name dictionary. New item names are added.
+     * @param itemNameIDHash
+     *   Item name -> item ID dictionary. New item names are added.
+     * @return
+     *   The same transactions, as item IDs.
+     */
+    TransactionBatch FPGrowth::mapTransactionsToItemIDs(const QList<QStringList> & transactions, ItemIDNameHash * itemIDNameHash, ItemNameIDHash * itemNameIDHash) {
+        TransactionBatch batch;
+        QVector<ItemID> transactionItemIDs;
+        ItemID itemID;
+        foreach (const QStringList & transaction, transactions) {
+            transactionItemIDs.clear();
+            foreach (const ItemName & itemName, transaction) {
+                // Look up the itemID for this itemName, or create it.
+                if (!itemNameIDHash->contains(itemName)) {
+                    itemID = itemNameIDHash->size();
+                    itemNameIDHash->insert(itemName, itemID);
+                    itemIDNameHash->insert(itemID, itemName);
+                }
+                else
+                    itemID = itemNameIDHash->value(itemName);
+                transactionItemIDs.append(itemID);
+            }
+            batch.append(transactionItemIDs.constData(), transactionItemIDs.size());
+        }
+        return batch;
+    }
+
+
     //------------------------------------------------------------------------------
     // Protected slots.
 
@@ -202,24 +255,70 @@ namespace Analytics {
     }
 
 
+    /**
+     * Remove items from the prefix paths that are an ancestor or a
+     * descendant of an item in the itemset whose prefix paths they are.
+     *
+     * @param prefixPaths
+     *   The prefix paths to filter.
+     * @param itemset
+     *   The itemset of which these are the prefix paths.
+     * @param itemHierarchy
+     *   The concept hierarchy of the items.
+     * @return
+     *   The filtered prefix paths.
+     */
+    QList<ItemList> FPGrowth::filterRelatedItems(const QList<ItemList> & prefixPaths, const ItemIDList & itemset, const ItemHierarchy * itemHierarchy) {
+        QList<ItemList> filteredPrefixPaths;
+        ItemList filteredPrefixPath;
+        foreach (const ItemList & prefixPath, prefixPaths) {
+            foreach (const Item & item, prefixPath) {
+                if (!itemHierarchy->relatedToAny(item.id, itemset))
+                    filteredPrefixPath.append(item);
+            }
+            if (filteredPrefixPath.size() > 0)
+                filteredPrefixPaths.append(filteredPrefixPath);
+            filteredPrefixPath.clear();
+        }
+
+        return filteredPrefixPaths;
+    }
+
+
     //------------------------------------------------------------------------
     // Protected methods.
 
+    void FPGrowth::init(const TransactionBatch & transactions, SupportCount minSupportAbsolute, ItemIDNameHash * itemIDNameHash, ItemNameIDHash * itemNameIDHash, ItemIDList * sortedFrequentItemIDs) {
+        this->itemIDNameHash        = itemIDNameHash;
+        this->itemNameIDHash        = itemNameIDHash;
+        this->sortedFrequentItemIDs = sortedFrequentItemIDs;
+        this->itemHierarchy         = NULL;
+
+        // Implicitly shared: not copied.
+        this->transactions = transactions;
+
+        this->minSupportAbsolute = minSupportAbsolute;
+
+        this->tree = new FPTree();
+#ifdef DEBUG
+        this->tree->itemIDNameHash = this->itemIDNameHash;
+#endif
+    }
+
     /**
      * Preprocess the transactions:
-     * 1) map the item names to item IDs, so we only have to store numeric IDs
-     *    in the FP-tree and conditional FP-trees, instead of entire strings
-     * 2) determine the support count of each item (happens simultaneously
-     *    with step 1)
-     * 3) discard infrequent items' support count
-     * 4) sort the frequent items by decreasing support count
+     * 1) determine the support count of each item
+     * 2) discard infrequent items' support count
+     * 3) sort the frequent items by decreasing support count
      *
-     * Also, each time when a new item name is mapped to an item id, it is
-     * processed for use in constraints as well.
+     * The transactions already consist of item IDs, so we only have to store
+     * numeric IDs in the FP-tree and conditional FP-trees, and never have to
+     * hash entire strings. All known items are processed for use in
+     * constraints as well.
      */
     void FPGrowth::scanTransactions() {
-        // Consider items with item names that have been mapped to  item IDs
-        // in previous executions of FPGrowth for use with constraints.
+        // Consider items with item names that have been mapped to item IDs
+        // (in this batch or in previous ones) for use with constraints.
         if (!this->itemIDNameHash->isEmpty()) {
             foreach (ItemID itemID, this->itemIDNameHash->keys()) {
                 ItemName itemName = this->itemIDNameHash->value(itemID);
@@ -228,28 +327,28 @@ namespace Analytics {
             }
         }
 
-        // Map the item names to item IDs. Maintain two dictionaries: one for
-        // each look-up direction (name -> id and id -> name).
-        ItemID itemID;
-        foreach (QStringList transaction, this->transactions) {
-            foreach (QString itemName, transaction) {
-                // Look up the itemID for this itemName, or create it.
-                if (!this->itemNameIDHash->contains(itemName)) {
-                    itemID = this->itemNameIDHash->size();
-                    this->itemNameIDHash->insert(itemName, itemID);
-                    this->itemIDNameHash->insert(itemID, itemName);
-                    this->totalFrequentSupportCounts.insert(itemID, 0);
-
-                    // Consider this item for use with constraints.
-                    this->constraints.preprocessItem(itemName, itemID);
-                    this->constraintsForRuleConsequents.preprocessItem(itemName, itemID);
-                }
-                else
-                    itemID = this->itemNameIDHash->value(itemName);
-
-                this->totalFrequentSupportCounts[itemID]++;
+        // Learn the concept hierarchy of the items that are new.
+        if (this->itemHierarchy != NULL)
+            this->itemHierarchy->update(*this->itemIDNameHash, *this->itemNameIDHash);
+
+        // Determine the support count of each item. Item IDs are dense, so
+        // they can be counted in an array rather than in a hash.
+        QVector<SupportCount> supportCounts(this->itemIDNameHash->size(), 0);
+        SupportCount * counts = supportCounts.data();
+        const ItemID * items = this->transactions.items.constData();
+        const quint32 * offsets = this->transactions.offsets.constData();
+        const SupportCount * weights = this->transactions.weights.constData();
+        for (int t = 0; t < this->transactions.size(); t++) {
+            for (quint32 i = offsets[t]; i < offsets[t + 1]; i++) {
+                Q_ASSERT((int) items[i] < supportCounts.size());
+                counts[items[i]] += weights[t];
             }
         }
+        ItemID itemID;
+        for (itemID = 0; (int) itemID < supportCounts.size(); itemID++) {
+            if (counts[itemID] > 0)
+                this->totalFrequentSupportCounts.insert(itemID, counts[itemID]);
+        }
 
         // Discard infrequent items' SupportCount.
         foreach (itemID, this->totalFrequentSupportCounts.keys()) {
@@ -284,18 +383,25 @@ namespace Analytics {
      */
     void FPGrowth::buildFPTree() {
         Transaction transaction;
+        const ItemID * items;
+        int numItems;
+        SupportCount weight;
+
+        for (int t = 0; t < this->transactions.size(); t++) {
+            items = this->transactions.transaction(t);
+            numItems = this->transactions.transactionSize(t);
+            weight = this->transactions.weight(t);
 
-        foreach (QStringList transactionAsStrings, this->transactions) {
             transaction.clear();
-            foreach (ItemName name, transactionAsStrings) {
+            for (int i = 0; i < numItems; i++) {
 #ifdef DEBUG
-                transaction << Item((ItemID) this->itemNameIDHash->value(name), this->itemIDNameHash);
+                transaction << Item(items[i], weight, this->itemIDNameHash);
 #else
-                transaction << Item((ItemID) this->itemNameIDHash->value(name));
+                transaction << Item(items[i], weight);
 #endif
             }
 
-            // The transaction in QStringList form has been converted to
+            // The transaction in TransactionBatch form has been converted to
             // QList<Item> form. Now process the transaction in this form.
             this->processTransaction(transaction);
         }
@@ -517,6 +623,15 @@ namespace Analytics {
         // frequent itemset that we've just found).
         QList<ItemList> prefixPaths = ctree->calculatePrefixPaths(frequentItemset[0]);
 
+        // Never extend the frequent itemset with an ancestor or descendant
+        // of one of its items (e.g. {location:EU, location:EU:BE}): the
+        // ancestor occurs in every transaction that contains the descendant,
+        // so such itemsets are redundant. Removing these items from the
+        // prefix paths keeps them out of the entire conditional FP-tree,
+        // and hence out of all supersets.
+        if (this->itemHierarchy != NULL)
+            prefixPaths = FPGrowth::filterRelatedItems(prefixPaths, frequentItemset, this->itemHierarchy);
+
         // Remove items from the prefix paths that no longer have sufficient
         // support.
         // (i.e. remove items *within* prefix paths; this keeps every prefix
@@ -10,6 +10,8 @@
 #include <math.h>
 
 #include "Item.h"
+#include "TransactionBatch.h"
+#include "ItemHierarchy.h"
 #include "Constraints.h"
 #include "FPNode.h"
 #include "FPTree.h"
@@ -28,12 +30,14 @@ namespace Analytics {
         Q_OBJECT
 
     public:
+        FPGrowth(const TransactionBatch & transactions, SupportCount minSupportAbsolute, ItemIDNameHash * itemIDNameHash, ItemNameIDHash * itemNameIDHash, ItemIDList * sortedFrequentItemIDs);
         FPGrowth(const QList<QStringList> & transactions, SupportCount minSupportAbsolute, ItemIDNameHash * itemIDNameHash, ItemNameIDHash * itemNameIDHash, ItemIDList * sortedFrequentItemIDs);
         ~FPGrowth();
 
         void setConstraints(const Constraints & constraints) { this->constraints = constraints; }
         void setConstraintsForRuleConsequents(const Constraints & constraints) { this->constraintsForRuleConsequents = constraints; }
         const Constraints & getConstraintsForRuleConsequents() const { return this->constraintsForRuleConsequents; }
+        void setItemHierarchy(ItemHierarchy * itemHierarchy) { this->itemHierarchy = itemHierarchy; }
 
         QList<FrequentItemset> mineFrequentItemsets(bool asynchronous = true);
 
@@ -46,6 +50,8 @@ namespace Analytics {
         ItemIDNameHash * getItemIDNameHash() { return this->itemIDNameHash; }
 #endif
 
+        static TransactionBatch mapTransactionsToItemIDs(const QList<QStringList> & transactions, ItemIDNameHash * itemIDNameHash, ItemNameIDHash * itemNameIDHash);
+
     signals:
         void minedFrequentItemset(const FrequentItemset & frequentItemset, bool frequentItemsetMatchesConstraints, const FPTree * ctree);
         void branchCompleted(const ItemIDList & itemset);
@@ -60,8 +66,10 @@ namespace Analytics {
         // Static methods.
         static ItemIDList sortItemIDsByDecreasingSupportCount(const QHash<ItemID, SupportCount> & itemSupportCounts, const ItemIDList * const ignoreList);
         static QList<ItemList> filterPrefixPaths(const QList<ItemList> & prefixPaths, SupportCount minSupportAbsolute);
+        static QList<ItemList> filterRelatedItems(const QList<ItemList> & prefixPaths, const ItemIDList & itemset, const ItemHierarchy * itemHierarchy);
 
         // Methods.
+        void init(const TransactionBatch & transactions, SupportCount minSupportAbsolute, ItemIDNameHash * itemIDNameHash, ItemNameIDHash * itemNameIDHash, ItemIDList * sortedFrequentItemIDs);
         void scanTransactions();
         void buildFPTree();
         FPTree * considerFrequentItemsupersets(const FPTree * ctree, const ItemIDList & frequentItemset);
@@ -76,8 +84,9 @@ namespace Analytics {
         ItemIDNameHash * itemIDNameHash;
         ItemNameIDHash * itemNameIDHash;
         ItemIDList     * sortedFrequentItemIDs;
+        ItemHierarchy  * itemHierarchy;
 
-        QList<QStringList> transactions;
+        TransactionBatch transactions;
 
         SupportCount minSupportAbsolute;
 
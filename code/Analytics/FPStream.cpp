@@ -11,7 +11,9 @@ namespace Analytics {
         this->itemIDNameHash        = itemIDNameHash;
         this->itemNameIDHash        = itemNameIDHash;
         this->f_list                = sortedFrequentItemIDs;
+        this->itemHierarchy         = NULL;
         this->initialBatchProcessed = false;
+        this->currentSamplingRate   = 1.0;
 
         this->statusMutex.lock();
         this->processingBatch = false;
@@ -43,29 +45,38 @@ namespace Analytics {
      * window (i.e. a quarter).
      *
      * @param transactions
-     *   A batch of transactions.
+     *   A batch of transactions. The names of all items in them must already
+     *   be in the item ID -> name and name -> ID hashes.
      * @param transactionsPerEvent
      *   The number of transactions per event. Necessary to determine the
      *   correct minimum absolute support when a single event is expanded
      *   into multiple transactions..
+     * @param samplingRate
+     *   The fraction of events that was sampled to generate this batch of
+     *   transactions. Batch sizes and the supports of the frequent
+     *   itemsets are scaled by its inverse, so that they are comparable
+     *   with those of unsampled batches.
      */
-    void FPStream::processBatchTransactions(const QList<QStringList> & transactions, double transactionsPerEvent) {
+    void FPStream::processBatchTransactions(const TransactionBatch & transactions, double transactionsPerEvent, double samplingRate) {
         this->statusMutex.lock();
         this->processingBatch = true;
         this->currentBatchID++;
+        this->currentSamplingRate = samplingRate;
         this->statusMutex.unlock();
 
         // Store the batch sizes. By storing it in a tilted time window, they
         // will automatically be summed in the same way as any other tilted
         // time window's support counts.
-        this->transactionsPerBatch.appendQuarter(transactions.size(), this->currentBatchID);
-        this->eventsPerBatch.appendQuarter(transactions.size() / transactionsPerEvent, this->currentBatchID);
+        const SupportCount numTransactions = transactions.totalWeight();
+        this->transactionsPerBatch.appendQuarter(numTransactions / samplingRate, this->currentBatchID);
+        this->eventsPerBatch.appendQuarter(numTransactions / transactionsPerEvent / samplingRate, this->currentBatchID);
 
         // Mine the frequent itemsets in this batch.
-        this->currentFPGrowth = new FPGrowth(transactions, (SupportCount) (this->maxSupportError * transactions.size() / transactionsPerEvent), this->itemIDNameHash, this->itemNameIDHash, this->f_list);
-//        this->currentFPGrowth = new FPGrowth(transactions, (SupportCount) ceil(this->minSupport * transactions.size() / transactionsPerEvent), this->itemIDNameHash, this->itemNameIDHash, this->f_list);
+        this->currentFPGrowth = new FPGrowth(transactions, (SupportCount) (this->maxSupportError * numTransactions / transactionsPerEvent), this->itemIDNameHash, this->itemNameIDHash, this->f_list);
+//        this->currentFPGrowth = new FPGrowth(transactions, (SupportCount) ceil(this->minSupport * numTransactions / transactionsPerEvent), this->itemIDNameHash, this->itemNameIDHash, this->f_list);
         this->currentFPGrowth->setConstraints(this->constraints);
         this->currentFPGrowth->setConstraintsForRuleConsequents(this->constraintsToPreprocess);
+        this->currentFPGrowth->setItemHierarchy(this->itemHierarchy);
 
         // Initial batch.
         if (!this->initialBatchProcessed) {
@@ -75,7 +86,7 @@ namespace Analytics {
 
             // Add all frequent itemsets to the PatternTree.
             foreach (FrequentItemset frequentItemset, frequentItemsets)
-                this->patternTree.addPattern(frequentItemset, this->currentBatchID);
+                this->patternTree.addPattern(this->scaleSupport(frequentItemset), this->currentBatchID);
 
             this->initialBatchProcessed = true;
 
@@ -120,6 +131,14 @@ namespace Analytics {
         }
     }
 
+    /**
+     * Process a batch of transactions of item names, see above. New item
+     * names are assigned item IDs first.
+     */
+    void FPStream::processBatchTransactions(const QList<QStringList> & transactions, double transactionsPerEvent, double samplingRate) {
+        this->processBatchTransactions(FPGrowth::mapTransactionsToItemIDs(transactions, this->itemIDNameHash, this->itemNameIDHash), transactionsPerEvent, samplingRate);
+    }
+
     /**
      * Process a single frequent itemset: update the pattern tree with the
      * information it carries (possibly adding it to the pattern tree).
@@ -156,7 +175,7 @@ namespace Analytics {
         // If the current pattern exists in the pattern tree.
         if (tiltedTimeWindow != NULL) {
             // Add the frequent itemset to the pattern tree.
-            this->patternTree.addPattern(frequentItemset, this->currentBatchID);
+            this->patternTree.addPattern(this->scaleSupport(frequentItemset), this->currentBatchID);
 
             // Conduct tail pruning.
             dropTailStartGranularity = FPStream::calculateDroppableTail(*tiltedTimeWindow, this->minSupport, this->maxSupportError, this->eventsPerBatch);
@@ -218,7 +237,7 @@ namespace Analytics {
             if (frequentItemsetMatchesConstraints || ctree != NULL) {
                 // Add it (it meets the minimum support minus the error rate
                 // because it was returned by FP-Growth).
-                this->patternTree.addPattern(frequentItemset, this->currentBatchID);
+                this->patternTree.addPattern(this->scaleSupport(frequentItemset), this->currentBatchID);
             }
 
             // Note: this also applies type I pruning: this pattern was not
@@ -373,6 +392,24 @@ namespace Analytics {
     //----------------------------------------------------------------------
     // Protected methods.
 
+    /**
+     * Scale the support of a frequent itemset that was mined from a sampled
+     * batch to an estimate of its support in the entire batch.
+     *
+     * @param frequentItemset
+     *   A frequent itemset, mined from the current batch.
+     * @return
+     *   The same frequent itemset, with its support scaled.
+     */
+    FrequentItemset FPStream::scaleSupport(const FrequentItemset & frequentItemset) const {
+        if (this->currentSamplingRate >= 1.0)
+            return frequentItemset;
+
+        FrequentItemset scaled = frequentItemset;
+        scaled.support = (SupportCount) (frequentItemset.support / this->currentSamplingRate + 0.5);
+        return scaled;
+    }
+
     /**
      * Update the nodes that have remained unaffected during the processing
      * of the current batch.
@@ -8,6 +8,8 @@
 #include <QMutexLocker>
 
 #include "Item.h"
+#include "TransactionBatch.h"
+#include "ItemHierarchy.h"
 #include "Constraints.h"
 #include "FPNode.h"
 #include "FPTree.h"
@@ -35,6 +37,7 @@ namespace Analytics {
         const TiltedTimeWindow * const getEventsPerBatch() const { return &this->eventsPerBatch; }
         void setConstraints(const Constraints & constraints) { this->constraints = constraints; }
         void setConstraintsToPreprocess(const Constraints & constraints) { this->constraintsToPreprocess = constraints; }
+        void setItemHierarchy(ItemHierarchy * itemHierarchy) { this->itemHierarchy = itemHierarchy; }
 
         // Stats for UI.
         int getNumFrequentItems() const { return this->f_list->size(); }
@@ -55,7 +58,8 @@ namespace Analytics {
         void batchProcessed();
 
     public slots:
-        void processBatchTransactions(const QList<QStringList> & transactions, double transactionsPerEvent = 1.0);
+        void processBatchTransactions(const Analytics::TransactionBatch & transactions, double transactionsPerEvent = 1.0, double samplingRate = 1.0);
+        void processBatchTransactions(const QList<QStringList> & transactions, double transactionsPerEvent = 1.0, double samplingRate = 1.0);
         void processFrequentItemset(const FrequentItemset & frequentItemset,
                                     bool frequentItemsetMatchesConstraints,
                                     const FPTree * ctree);
@@ -64,6 +68,7 @@ namespace Analytics {
     protected:
         // Methods.
         void updateUnaffectedNodes(FPNode<TiltedTimeWindow> * node);
+        FrequentItemset scaleSupport(const FrequentItemset & frequentItemset) const;
 
         // Properties related to the entire state over time.
         PatternTree patternTree;
@@ -76,6 +81,9 @@ namespace Analytics {
         double maxSupportError;
         Constraints constraints;
         Constraints constraintsToPreprocess;
+        // When set, itemsets are never extended with an ancestor or
+        // descendant of one of their items.
+        ItemHierarchy * itemHierarchy;
 
         // Properties that are updated in each batch.
         ItemIDNameHash * itemIDNameHash;
@@ -89,6 +97,8 @@ namespace Analytics {
         bool processingBatch;
         quint32 currentBatchID;
         FPGrowth * currentFPGrowth;
+        // The fraction of events that was sampled in the current batch.
+        double currentSamplingRate;
         QList<ItemIDList> supersetsBeingCalculated;
     };
 
@@ -1,4 +1,5 @@
 #include "Item.h"
+#include "TransactionBatch.h"
 
 namespace Analytics {
 
@@ -17,6 +18,7 @@ namespace Analytics {
         qRegisterMetaType<Analytics::FrequentItemset>("FrequentItemset");
         qRegisterMetaType< QList<Analytics::Confidence> >("QList<Analytics::Confidence>");
         qRegisterMetaType< QList<Analytics::AssociationRule> >("QList<Analytics::AssociationRule>");
+        qRegisterMetaType<Analytics::TransactionBatch>("Analytics::TransactionBatch");
     }
 
     uint qHash(const AssociationRule & r) {
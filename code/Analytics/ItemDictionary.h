@@ -0,0 +1,127 @@
+#ifndef ITEMDICTIONARY_H
+#define ITEMDICTIONARY_H
+
+#include <QReadWriteLock>
+#include <QReadLocker>
+#include <QWriteLocker>
+#include <QVector>
+
+#include "Item.h"
+
+
+namespace Analytics {
+
+    /**
+     * Maps item names to dense item IDs (0, 1, 2, ...) and back. Shared by
+     * whoever generates transactions (e.g. the EpisodesParser, from many
+     * threads at once) and the Analyst that mines them, so that
+     * transactions can be passed on as item IDs: see TransactionBatch.
+     *
+     * Interning takes a lock: generators are expected to cache the item IDs
+     * of the items they generate over and over. Interned items are never
+     * removed, so an item keeps its ID forever.
+     */
+    class ItemDictionary {
+    public:
+        ItemID intern(const ItemName & name);
+        bool find(const ItemName & name, ItemID & id) const;
+        ItemName name(ItemID id) const;
+        ItemNameList namesFrom(int firstID) const;
+        int size() const;
+
+    protected:
+        mutable QReadWriteLock lock;
+        ItemNameIDHash ids;
+        QVector<ItemName> names;
+    };
+
+
+    //---------------------------------------------------------------------------
+    // Public methods.
+
+    /**
+     * Map an item name to its item ID, assigning the next ID if it's a new
+     * item.
+     *
+     * @param name
+     *   An item name.
+     * @return
+     *   The item's ID.
+     */
+    inline ItemID ItemDictionary::intern(const ItemName & name) {
+        ItemID id;
+        if (this->find(name, id))
+            return id;
+
+        QWriteLocker locker(&this->lock);
+
+        // Another thread may have inserted it in the mean time.
+        ItemNameIDHash::const_iterator it = this->ids.constFind(name);
+        if (it != this->ids.constEnd())
+            return it.value();
+
+        id = this->names.size();
+        this->ids.insert(name, id);
+        this->names.append(name);
+        return id;
+    }
+
+    /**
+     * Find the item ID of an item name, without interning it.
+     *
+     * @param name
+     *   An item name.
+     * @param id
+     *   The item's ID, if it was found.
+     * @return
+     *   true if the item has been interned.
+     */
+    inline bool ItemDictionary::find(const ItemName & name, ItemID & id) const {
+        QReadLocker locker(&this->lock);
+
+        ItemNameIDHash::const_iterator it = this->ids.constFind(name);
+        if (it == this->ids.constEnd())
+            return false;
+
+        id = it.value();
+        return true;
+    }
+
+    /**
+     * @param id
+     *   An item ID that was returned by intern().
+     * @return
+     *   The corresponding item name, or an empty string for unknown IDs.
+     */
+    inline ItemName ItemDictionary::name(ItemID id) const {
+        QReadLocker locker(&this->lock);
+        return ((int) id < this->names.size()) ? this->names[id] : ItemName();
+    }
+
+    /**
+     * Get the names of all items that were interned after a given number of
+     * items, in order of their IDs. Allows consumers to keep their own copy
+     * of the dictionary up-to-date incrementally.
+     *
+     * @param firstID
+     *   The ID of the first item to return.
+     * @return
+     *   The names of the items with IDs firstID, firstID + 1, ...
+     */
+    inline ItemNameList ItemDictionary::namesFrom(int firstID) const {
+        QReadLocker locker(&this->lock);
+
+        ItemNameList names;
+        for (int id = firstID; id < this->names.size(); id++)
+            names.append(this->names[id]);
+        return names;
+    }
+
+    inline int ItemDictionary::size() const {
+        QReadLocker locker(&this->lock);
+        return this->names.size();
+    }
+
+}
+
+#endif // ITEMDICTIONARY_H
@@ -0,0 +1,107 @@
+#include "ItemHierarchy.h"
+
+namespace Analytics {
+
+    //------------------------------------------------------------------------
+    // Public methods.
+
+    /**
+     * Add the items that have been added to the item ID <-> name hashes
+     * since the previous update. Item IDs are dense, so this only has to look
+     * at the item IDs that are not yet known.
+     *
+     * @param itemIDNameHash
+     *   Item ID -> item name dictionary.
+     * @param itemNameIDHash
+     *   Item name -> item ID dictionary.
+     */
+    void ItemHierarchy::update(const ItemIDNameHash & itemIDNameHash, const ItemNameIDHash & itemNameIDHash) {
+        ItemName itemName, parentName;
+        for (ItemID itemID = this->parents.size(); (int) itemID < itemIDNameHash.size(); itemID++) {
+            itemName = itemIDNameHash.value(itemID);
+
+            // Look up the parent. If it isn't an item yet, it may become one
+            // later: remember the orphan, unless there are too many already.
+            // Then the orphan never gets a parent, which only means that
+            // fewer redundant itemsets are pruned.
+            ItemID parentID = ROOT_ITEMID;
+            parentName = ItemHierarchy::parentName(itemName);
+            if (!parentName.isEmpty()) {
+                if (itemNameIDHash.contains(parentName))
+                    parentID = itemNameIDHash.value(parentName);
+                else if (this->numOrphans < ITEMHIERARCHY_MAX_ORPHANS) {
+                    this->orphans[parentName].append(itemID);
+                    this->numOrphans++;
+                }
+            }
+            this->parents.append(parentID);
+
+            // Adopt the orphans of which this item is the parent.
+            if (this->orphans.contains(itemName)) {
+                foreach (ItemID orphanID, this->orphans.take(itemName)) {
+                    this->parents[orphanID] = itemID;
+                    this->numOrphans--;
+                }
+            }
+        }
+    }
+
+    /**
+     * @param ancestor
+     *   An item ID.
+     * @param itemID
+     *   An item ID.
+     * @return
+     *   true if ancestor is the parent of itemID, or the parent's parent,
+     *   and so on.
+     */
+    bool ItemHierarchy::isAncestorOf(ItemID ancestor, ItemID itemID) const {
+        for (ItemID id = this->parent(itemID); id != ROOT_ITEMID; id = this->parent(id)) {
+            if (id == ancestor)
+                return true;
+        }
+        return false;
+    }
+
+    /**
+     * @param itemID
+     *   An item ID.
+     * @param itemset
+     *   An itemset.
+     * @return
+     *   true if any item in the itemset is an ancestor or a descendant of
+     *   the given item.
+     */
+    bool ItemHierarchy::relatedToAny(ItemID itemID, const ItemIDList & itemset) const {
+        foreach (ItemID other, itemset) {
+            if (this->related(itemID, other))
+                return true;
+        }
+        return false;
+    }
+
+
+    //------------------------------------------------------------------------
+    // Protected static methods.
+
+    /**
+     * @param itemName
+     *   An item name, e.g. "location:EU:BE".
+     * @return
+     *   The name of its parent, e.g. "location:EU", or an empty string for
+     *   items at the first level of the hierarchy (e.g. "location:EU"),
+     *   whose parent ("location") is a category rather than an item, and
+     *   for "url:*" and "duration:*" items, whose ':'s don't separate
+     *   levels (e.g. "url:http://example.com:8080/").
+     */
+    ItemName ItemHierarchy::parentName(const ItemName & itemName) {
+        if (itemName.startsWith("url:") || itemName.startsWith("duration:"))
+            return ItemName();
+
+        int last = itemName.lastIndexOf(':');
+        if (last <= 0 || itemName.lastIndexOf(':', last - 1) == -1)
+            return ItemName();
+        return itemName.left(last);
+    }
+
+}
@@ -0,0 +1,51 @@
+#ifndef ITEMHIERARCHY_H
+#define ITEMHIERARCHY_H
+
+#include <QHash>
+#include <QVector>
+
+#include "Item.h"
+
+
+namespace Analytics {
+
+    // Maximum number of items waiting for their parent to become an item.
+    #define ITEMHIERARCHY_MAX_ORPHANS 65536
+
+    /**
+     * The concept hierarchy of the items, as in the browsable concept
+     * hierarchy of the Analyst: items are ':'-separated paths, and the
+     * parent of an item is the item one level up, if that is an item as well
+     * (e.g. "location:EU" is the parent of "location:EU:BE"). "url:*" and
+     * "duration:*" items are not paths and have no parent.
+     *
+     * An item and its ancestors always occur together, so itemsets that
+     * contain an item and one of its ancestors or descendants are redundant:
+     * see FPGrowth::setItemHierarchy().
+     */
+    class ItemHierarchy {
+    public:
+        ItemHierarchy() : numOrphans(0) {}
+
+        void update(const ItemIDNameHash & itemIDNameHash, const ItemNameIDHash & itemNameIDHash);
+
+        ItemID parent(ItemID itemID) const { return ((int) itemID < this->parents.size()) ? this->parents[itemID] : ROOT_ITEMID; }
+        bool isAncestorOf(ItemID ancestor, ItemID itemID) const;
+        bool related(ItemID a, ItemID b) const { return this->isAncestorOf(a, b) || this->isAncestorOf(b, a); }
+        bool relatedToAny(ItemID itemID, const ItemIDList & itemset) const;
+        int orphanCount() const { return this->numOrphans; }
+
+    protected:
+        static ItemName parentName(const ItemName & itemName);
+
+        // Parent item ID per item ID, ROOT_ITEMID for items without a
+        // parent item.
+        QVector<ItemID> parents;
+        // Items whose parent is not an item (yet), by parent name.
+        QHash<ItemName, ItemIDList> orphans;
+        int numOrphans;
+    };
+
+}
+
+#endif // ITEMHIERARCHY_H
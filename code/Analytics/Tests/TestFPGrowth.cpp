@@ -100,3 +100,200 @@ void TestFPGrowth::withConstraints() {
 
     delete fpgrowth;
 }
+
+void TestFPGrowth::transactionBatch() {
+    // The same transactions as in basic(), but as item IDs, with the two
+    // transactions that consist of B and C collapsed into a single one with
+    // weight 2, and built in two parts.
+    ItemDictionary dictionary;
+    ItemID A = dictionary.intern("A");
+    ItemID B = dictionary.intern("B");
+    ItemID C = dictionary.intern("C");
+    ItemID D = dictionary.intern("D");
+    ItemID E = dictionary.intern("E");
+    QCOMPARE(dictionary.intern("C"), C);
+    QCOMPARE(dictionary.size(), 5);
+
+    TransactionBatch first, second, transactions;
+    ItemID t1[] = { A, B, C, D };
+    ItemID t2[] = { A, B };
+    ItemID t3[] = { A, C };
+    ItemID t4[] = { A, B, C };
+    ItemID t5[] = { A, D };
+    first.append(t1, 4);
+    first.append(t2, 2);
+    first.append(t3, 2);
+    first.append(t4, 3);
+    first.append(t5, 2);
+    ItemID t6[] = { A, C, D };
+    ItemID t7[] = { C, B };
+    ItemID t8[] = { C, D };
+    ItemID t9[] = { C, E };
+    second.append(t6, 3);
+    second.append(t7, 2, 2);
+    second.append(t8, 2);
+    second.append(t9, 2);
+    transactions.append(first);
+    transactions.append(second);
+    QCOMPARE(transactions.size(), 9);
+    QCOMPARE(transactions.totalWeight(), (SupportCount) 10);
+    QCOMPARE(transactions.transactionSize(5), 3);
+    QCOMPARE(transactions.transaction(6)[0], C);
+    QCOMPARE(transactions.weight(6), (SupportCount) 2);
+
+    FPNode<SupportCount>::resetLastNodeID();
+    ItemIDNameHash itemIDNameHash;
+    ItemNameIDHash itemNameIDHash;
+    ItemIDList sortedFrequentItemIDs;
+    ItemID itemID = 0;
+    foreach (const ItemName & itemName, dictionary.namesFrom(0)) {
+        itemIDNameHash.insert(itemID, itemName);
+        itemNameIDHash.insert(itemName, itemID);
+        itemID++;
+    }
+    FPGrowth * fpgrowth = new FPGrowth(transactions, 0.4 * transactions.totalWeight(), &itemIDNameHash, &itemNameIDHash, &sortedFrequentItemIDs);
+    QList<FrequentItemset> frequentItemsets = fpgrowth->mineFrequentItemsets(FPGROWTH_SYNC);
+
+    // Verify the results: identical to those in basic().
+    QCOMPARE(frequentItemsets, QList<FrequentItemset>() << FrequentItemset(ItemIDList() << 0     , 6)
+                                                        << FrequentItemset(ItemIDList() << 2 << 0, 4)
+                                                        << FrequentItemset(ItemIDList() << 1     , 5)
+                                                        << FrequentItemset(ItemIDList() << 2 << 1, 4)
+                                                        << FrequentItemset(ItemIDList() << 2     , 8)
+                                                        << FrequentItemset(ItemIDList() << 3     , 4)
+    );
+
+    delete fpgrowth;
+}
+
+void TestFPGrowth::deduplicatedTransactions() {
+    TransactionBatch transactions;
+    ItemID t1[] = { 3, 1, 2 };
+    ItemID t2[] = { 1, 2 };
+    ItemID t3[] = { 2, 3, 1 };
+    ItemID t4[] = { 2, 1 };
+    ItemID t5[] = { 1, 2, 3, 4 };
+    transactions.append(t1, 3);
+    transactions.append(t2, 2);
+    transactions.append(t3, 3, 2);
+    transactions.append(t4, 2);
+    transactions.append(t5, 4);
+    transactions.append(t1, 3);
+
+    // Identical transactions (regardless of the order of their items) are
+    // collapsed, in order of their first occurrence, with their items
+    // sorted. The total weight is unaffected.
+    TransactionBatch deduplicated = transactions.deduplicated();
+    QCOMPARE(deduplicated.size(), 3);
+    QCOMPARE(deduplicated.totalWeight(), transactions.totalWeight());
+    QCOMPARE(deduplicated.items, QVector<ItemID>() << 1 << 2 << 3
+                                                   << 1 << 2
+                                                   << 1 << 2 << 3 << 4);
+    QCOMPARE(deduplicated.weights, QVector<SupportCount>() << 4 << 2 << 1);
+
+    // The original batch is left untouched.
+    QCOMPARE(transactions.size(), 6);
+    QCOMPARE(transactions.transaction(0)[0], (ItemID) 3);
+
+    // An empty batch stays empty.
+    QVERIFY(TransactionBatch().deduplicated().isEmpty());
+}
+
+void TestFPGrowth::conceptHierarchy() {
+    QList<QStringList> transactions;
+    transactions.append(QStringList() << "episode:css" << "location:EU:BE" << "location:EU" << "location:EU:BE:Ghent");
+    transactions.append(QStringList() << "episode:css" << "location:EU" << "location:EU:BE" << "location:EU:BE:Ghent");
+    transactions.append(QStringList() << "episode:css" << "location:EU" << "location:EU:BE" << "location:EU:BE:Antwerp");
+    transactions.append(QStringList() << "episode:js" << "location:EU" << "location:EU:NL" << "location:EU:NL:Delft");
+    transactions.append(QStringList() << "episode:js" << "location:EU" << "location:EU:BE" << "location:EU:BE:Ghent");
+    transactions.append(QStringList() << "episode:css" << "location:NA" << "location:NA:US" << "location:NA:US:Boston");
+
+    // Without the concept hierarchy.
+    FPNode<SupportCount>::resetLastNodeID();
+    ItemIDNameHash itemIDNameHash;
+    ItemNameIDHash itemNameIDHash;
+    ItemIDList sortedFrequentItemIDs;
+    FPGrowth * fpgrowth = new FPGrowth(transactions, 2, &itemIDNameHash, &itemNameIDHash, &sortedFrequentItemIDs);
+    QList<FrequentItemset> allFrequentItemsets = fpgrowth->mineFrequentItemsets(FPGROWTH_SYNC);
+    delete fpgrowth;
+
+    // With the concept hierarchy. Items are assigned the same IDs.
+    FPNode<SupportCount>::resetLastNodeID();
+    ItemIDNameHash prunedItemIDNameHash;
+    ItemNameIDHash prunedItemNameIDHash;
+    ItemIDList prunedSortedFrequentItemIDs;
+    ItemHierarchy hierarchy;
+    fpgrowth = new FPGrowth(transactions, 2, &prunedItemIDNameHash, &prunedItemNameIDHash, &prunedSortedFrequentItemIDs);
+    fpgrowth->setItemHierarchy(&hierarchy);
+    QList<FrequentItemset> frequentItemsets = fpgrowth->mineFrequentItemsets(FPGROWTH_SYNC);
+    delete fpgrowth;
+
+    // The hierarchy was learned, regardless of the order in which the items
+    // were encountered.
+    ItemID EU = prunedItemNameIDHash["location:EU"];
+    ItemID BE = prunedItemNameIDHash["location:EU:BE"];
+    ItemID Ghent = prunedItemNameIDHash["location:EU:BE:Ghent"];
+    ItemID css = prunedItemNameIDHash["episode:css"];
+    QCOMPARE(hierarchy.parent(BE), EU);
+    QCOMPARE(hierarchy.parent(Ghent), BE);
+    QCOMPARE(hierarchy.parent(EU), (ItemID) ROOT_ITEMID);
+    QVERIFY(hierarchy.isAncestorOf(EU, Ghent));
+    QVERIFY(!hierarchy.isAncestorOf(Ghent, EU));
+    QVERIFY(hierarchy.related(Ghent, EU));
+    QVERIFY(!hierarchy.related(css, EU));
+
+    // Exactly those frequent itemsets that don't contain both an item and
+    // one of its ancestors remain, with the same supports.
+    int related = 0;
+    foreach (const FrequentItemset & frequentItemset, allFrequentItemsets) {
+        bool containsRelatedItems = false;
+        for (int i = 0; i < frequentItemset.itemset.size(); i++) {
+            if (hierarchy.relatedToAny(frequentItemset.itemset[i], frequentItemset.itemset.mid(i + 1)))
+                containsRelatedItems = true;
+        }
+        if (containsRelatedItems)
+            related++;
+        QCOMPARE(frequentItemsets.contains(frequentItemset), !containsRelatedItems);
+    }
+    QVERIFY(related > 0);
+    QCOMPARE(frequentItemsets.size(), allFrequentItemsets.size() - related);
+}
+
+void TestFPGrowth::conceptHierarchyOrphans() {
+    ItemIDNameHash itemIDNameHash;
+    ItemNameIDHash itemNameIDHash;
+    ItemHierarchy hierarchy;
+    QStringList names;
+    names << "url:http://example.com/a.css" << "url:http://example.com:8080/b.js"
+          << "location:EU:BE" << "location:NA:US";
+    for (int i = 0; i < names.size(); i++) {
+        itemIDNameHash.insert((ItemID) i, names[i]);
+        itemNameIDHash.insert(names[i], (ItemID) i);
+    }
+    hierarchy.update(itemIDNameHash, itemNameIDHash);
+
+    // URLs are not paths: they never wait for a parent.
+    QCOMPARE(hierarchy.parent(0), (ItemID) ROOT_ITEMID);
+    QCOMPARE(hierarchy.parent(1), (ItemID) ROOT_ITEMID);
+    QCOMPARE(hierarchy.orphanCount(), 2);
+
+    // Adopted orphans no longer count.
+    itemIDNameHash.insert((ItemID) 4, "location:EU");
+    itemNameIDHash.insert("location:EU", (ItemID) 4);
+    hierarchy.update(itemIDNameHash, itemNameIDHash);
+    QCOMPARE(hierarchy.parent(2), (ItemID) 4);
+    QCOMPARE(hierarchy.orphanCount(), 1);
+
+    // Beyond the maximum, orphans are no longer remembered.
+    ItemHierarchy bounded;
+    itemIDNameHash.clear();
+    itemNameIDHash.clear();
+    for (int i = 0; i < ITEMHIERARCHY_MAX_ORPHANS + 10; i++) {
+        ItemName name = QString("location:%1:x").arg(i);
+        itemIDNameHash.insert((ItemID) i, name);
+        itemNameIDHash.insert(name, (ItemID) i);
+    }
+    bounded.update(itemIDNameHash, itemNameIDHash);
+    QCOMPARE(bounded.orphanCount(), ITEMHIERARCHY_MAX_ORPHANS);
+    QCOMPARE(bounded.parent(ITEMHIERARCHY_MAX_ORPHANS + 9), (ItemID) ROOT_ITEMID);
+}
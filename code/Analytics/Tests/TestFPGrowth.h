@@ -4,6 +4,9 @@
 #include <QtTest/QtTest>
 #include <QFile>
 #include "../FPGrowth.h"
+#include "../ItemDictionary.h"
+#include "../TransactionBatch.h"
+#include "../ItemHierarchy.h"
 
 using namespace Analytics;
 
@@ -17,6 +20,10 @@ private slots:
 //    void cleanup();
     void basic();
     void withConstraints();
+    void transactionBatch();
+    void deduplicatedTransactions();
+    void conceptHierarchy();
+    void conceptHierarchyOrphans();
 };
 
 #endif // TESTFPGROWTH_H
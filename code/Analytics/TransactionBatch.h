@@ -0,0 +1,112 @@
+#ifndef TRANSACTIONBATCH_H
+#define TRANSACTIONBATCH_H
+
+#include <QVector>
+#include <QMetaType>
+#include <string.h>
+
+#include "Item.h"
+
+
+namespace Analytics {
+
+    /**
+     * A batch of transactions, encoded as item IDs (see ItemDictionary).
+     *
+     * The items of all transactions are stored back to back, in a single
+     * array: transaction t consists of items[offsets[t]] up to (but not
+     * including) items[offsets[t + 1]], and it occurred weights[t] times.
+     *
+     * All members are implicitly shared: passing a batch on, e.g. through a
+     * queued signal/slot connection to another thread, does not copy it.
+     */
+    struct TransactionBatch {
+        TransactionBatch() { this->offsets.append(0); }
+
+        int size() const { return this->weights.size(); }
+        bool isEmpty() const { return this->weights.isEmpty(); }
+        int numItems() const { return this->items.size(); }
+
+        const ItemID * transaction(int t) const { return this->items.constData() + this->offsets[t]; }
+        int transactionSize(int t) const { return this->offsets[t + 1] - this->offsets[t]; }
+        SupportCount weight(int t) const { return this->weights[t]; }
+        SupportCount totalWeight() const;
+
+        void reserve(int transactions, int items);
+        void append(const ItemID * transactionItems, int numItems, SupportCount weight = 1);
+        void append(const TransactionBatch & other);
+
+        TransactionBatch deduplicated() const;
+
+        QVector<ItemID> items;
+        QVector<quint32> offsets;
+        QVector<SupportCount> weights;
+    };
+
+
+    //---------------------------------------------------------------------------
+    // Public methods.
+
+    /**
+     * @return
+     *   The number of transactions this batch represents: the sum of the
+     *   weights of its transactions.
+     */
+    inline SupportCount TransactionBatch::totalWeight() const {
+        SupportCount total = 0;
+        const SupportCount * weights = this->weights.constData();
+        for (int t = 0; t < this->weights.size(); t++)
+            total += weights[t];
+        return total;
+    }
+
+    inline void TransactionBatch::reserve(int transactions, int items) {
+        this->items.reserve(items);
+        this->offsets.reserve(transactions + 1);
+        this->weights.reserve(transactions);
+    }
+
+    /**
+     * Append a transaction.
+     *
+     * @param transactionItems
+     *   The item IDs of the transaction.
+     * @param numItems
+     *   The number of items in the transaction.
+     * @param weight
+     *   The number of times the transaction occurred.
+     */
+    inline void TransactionBatch::append(const ItemID * transactionItems, int numItems, SupportCount weight) {
+        const int first = this->items.size();
+        this->items.resize(first + numItems);
+        memcpy(this->items.data() + first, transactionItems, numItems * sizeof(ItemID));
+        this->offsets.append(first + numItems);
+        this->weights.append(weight);
+    }
+
+    /**
+     * Append all transactions of another batch.
+     *
+     * @param other
+     *   Another batch. If this batch is empty, it's shared rather than
+     *   copied.
+     */
+    inline void TransactionBatch::append(const TransactionBatch & other) {
+        if (this->isEmpty()) {
+            *this = other;
+            return;
+        }
+
+        const quint32 base = this->items.size();
+        this->items += other.items;
+        this->offsets.reserve(this->offsets.size() + other.size());
+        for (int t = 1; t <= other.size(); t++)
+            this->offsets.append(base + other.offsets[t]);
+        this->weights += other.weights;
+    }
+
+}
+
+Q_DECLARE_METATYPE(Analytics::TransactionBatch);
+
+#endif // TRANSACTIONBATCH_H
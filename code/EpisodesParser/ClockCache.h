@@ -0,0 +1,241 @@
+#ifndef CLOCKCACHE_H
+#define CLOCKCACHE_H
+
+#include <QtGlobal>
+#include <QHash>
+#include <QVector>
+#include <QMutex>
+#include <QMutexLocker>
+
+
+namespace EpisodesParser {
+
+    // Number of shards: threads that look up keys in different shards never
+    // contend.
+    #define CLOCKCACHE_SHARDS 16
+
+    /**
+     * A bounded, thread-safe cache with CLOCK (second chance) eviction.
+     *
+     * Every entry has a "referenced" bit that is set whenever it is hit. To
+     * make room, the clock hand sweeps over the entries, clearing the bits
+     * it passes, and evicts the first entry whose bit was already cleared.
+     * This approximates LRU, but a hit only sets a bit instead of
+     * reordering a list.
+     *
+     * The cache is split into shards, each with its own lock, index and
+     * hit/miss counters.
+     */
+    template <typename Key, typename Value>
+    class ClockCache {
+    public:
+        ClockCache(int capacity);
+
+        bool lookup(const Key & key, Value & value);
+        void insert(const Key & key, const Value & value);
+        void clear();
+        void setCapacity(int capacity);
+
+        int capacity() const { return this->shardCapacity * CLOCKCACHE_SHARDS; }
+        quint64 hits() const;
+        quint64 misses() const;
+        double hitRate() const;
+        void resetStatistics();
+
+    protected:
+        struct Slot {
+            Key key;
+            Value value;
+            bool referenced;
+        };
+
+        struct Shard {
+            Shard() : hand(0), hits(0), misses(0) {}
+
+            mutable QMutex mutex;
+            QHash<Key, int> index;
+            QVector<Slot> slots;
+            int hand;
+            quint64 hits;
+            quint64 misses;
+        };
+
+        Shard & shardFor(const Key & key);
+
+        int shardCapacity;
+        Shard shards[CLOCKCACHE_SHARDS];
+
+    private:
+        // Not copyable.
+        ClockCache(const ClockCache &);
+        ClockCache & operator=(const ClockCache &);
+    };
+
+
+    //---------------------------------------------------------------------------
+    // Public methods.
+
+    template <typename Key, typename Value>
+    ClockCache<Key, Value>::ClockCache(int capacity) {
+        this->shardCapacity = qMax(1, capacity / CLOCKCACHE_SHARDS);
+    }
+
+    /**
+     * Look up a key.
+     *
+     * @param key
+     *   The key to look up.
+     * @param value
+     *   The cached value, if the key was found.
+     * @return
+     *   true on a hit, false on a miss.
+     */
+    template <typename Key, typename Value>
+    bool ClockCache<Key, Value>::lookup(const Key & key, Value & value) {
+        Shard & shard = this->shardFor(key);
+        QMutexLocker locker(&shard.mutex);
+
+        typename QHash<Key, int>::const_iterator it = shard.index.constFind(key);
+        if (it == shard.index.constEnd()) {
+            shard.misses++;
+            return false;
+        }
+
+        Slot & slot = shard.slots[it.value()];
+        slot.referenced = true;
+        value = slot.value;
+        shard.hits++;
+        return true;
+    }
+
+    /**
+     * Insert a key, evicting another one if the cache is full. If the key
+     * is already cached (another thread may have inserted it since this
+     * thread's miss), its value is replaced.
+     *
+     * @param key
+     *   The key to insert.
+     * @param value
+     *   The value to cache for this key.
+     */
+    template <typename Key, typename Value>
+    void ClockCache<Key, Value>::insert(const Key & key, const Value & value) {
+        Shard & shard = this->shardFor(key);
+        QMutexLocker locker(&shard.mutex);
+
+        typename QHash<Key, int>::const_iterator it = shard.index.constFind(key);
+        if (it != shard.index.constEnd()) {
+            shard.slots[it.value()].value = value;
+            return;
+        }
+
+        int position;
+        if (shard.slots.size() < this->shardCapacity) {
+            // Not yet full: append.
+            position = shard.slots.size();
+            shard.slots.resize(position + 1);
+        }
+        else {
+            // Full: advance the hand until an unreferenced slot is found.
+            // This terminates within one revolution, because every slot the
+            // hand passes loses its reference bit.
+            while (shard.slots[shard.hand].referenced) {
+                shard.slots[shard.hand].referenced = false;
+                shard.hand = (shard.hand + 1) % shard.slots.size();
+            }
+            position = shard.hand;
+            shard.hand = (shard.hand + 1) % shard.slots.size();
+            shard.index.remove(shard.slots[position].key);
+        }
+
+        Slot & slot = shard.slots[position];
+        slot.key = key;
+        slot.value = value;
+        slot.referenced = false;
+        shard.index.insert(key, position);
+    }
+
+    /**
+     * Evict all keys. The hit/miss counters are retained.
+     */
+    template <typename Key, typename Value>
+    void ClockCache<Key, Value>::clear() {
+        for (int i = 0; i < CLOCKCACHE_SHARDS; i++) {
+            QMutexLocker locker(&this->shards[i].mutex);
+            this->shards[i].index.clear();
+            this->shards[i].slots.clear();
+            this->shards[i].hand = 0;
+        }
+    }
+
+    /**
+     * Change the capacity. Evicts all keys. Must not be called while other
+     * threads are using the cache.
+     *
+     * @param capacity
+     *   The maximum number of cached keys.
+     */
+    template <typename Key, typename Value>
+    void ClockCache<Key, Value>::setCapacity(int capacity) {
+        this->shardCapacity = qMax(1, capacity / CLOCKCACHE_SHARDS);
+        this->clear();
+    }
+
+    template <typename Key, typename Value>
+    quint64 ClockCache<Key, Value>::hits() const {
+        quint64 hits = 0;
+        for (int i = 0; i < CLOCKCACHE_SHARDS; i++) {
+            QMutexLocker locker(&this->shards[i].mutex);
+            hits += this->shards[i].hits;
+        }
+        return hits;
+    }
+
+    template <typename Key, typename Value>
+    quint64 ClockCache<Key, Value>::misses() const {
+        quint64 misses = 0;
+        for (int i = 0; i < CLOCKCACHE_SHARDS; i++) {
+            QMutexLocker locker(&this->shards[i].mutex);
+            misses += this->shards[i].misses;
+        }
+        return misses;
+    }
+
+    /**
+     * @return
+     *   The fraction of lookups that were hits, or 0 if there were none.
+     */
+    template <typename Key, typename Value>
+    double ClockCache<Key, Value>::hitRate() const {
+        quint64 hits = this->hits();
+        quint64 lookups = hits + this->misses();
+        return (lookups > 0) ? (double) hits / lookups : 0.0;
+    }
+
+    template <typename Key, typename Value>
+    void ClockCache<Key, Value>::resetStatistics() {
+        for (int i = 0; i < CLOCKCACHE_SHARDS; i++) {
+            QMutexLocker locker(&this->shards[i].mutex);
+            this->shards[i].hits = 0;
+            this->shards[i].misses = 0;
+        }
+    }
+
+
+    //---------------------------------------------------------------------------
+    // Protected methods.
+
+    template <typename Key, typename Value>
+    typename ClockCache<Key, Value>::Shard & ClockCache<Key, Value>::shardFor(const Key & key) {
+        // qHash() of an integer is the integer itself: mix the bits, so that
+        // e.g. IPv4 addresses from the same subnet are spread over shards.
+        uint hash = qHash(key);
+        hash ^= hash >> 16;
+        hash *= 0x45d9f3b;
+        hash ^= hash >> 16;
+        return this->shards[hash % CLOCKCACHE_SHARDS];
+    }
+
+}
+
+#endif // CLOCKCACHE_H
@@ -0,0 +1,141 @@
+#ifndef CONCURRENTIDTABLE_H
+#define CONCURRENTIDTABLE_H
+
+#include <QtGlobal>
+#include <QAtomicPointer>
+
+
+namespace EpisodesParser {
+
+    // Values are allocated in pages of this many IDs.
+    #define IDTABLE_PAGE_SIZE 4096
+    #define IDTABLE_MAX_PAGES 4096
+
+    /**
+     * Stores a value per dense ID (as assigned by a ConcurrentInterner),
+     * from many threads at once. Meant for values that are derived from the
+     * interned key and hence never change: the first value that is stored
+     * for an ID wins, later ones are discarded.
+     *
+     * Lookups never lock: a value is immutable once published.
+     */
+    template <typename ID, typename Value>
+    class ConcurrentIDTable {
+    public:
+        ConcurrentIDTable();
+        ~ConcurrentIDTable();
+
+        bool lookup(ID id, Value & value) const;
+        const Value * find(ID id) const;
+        const Value & insert(ID id, const Value & value);
+
+    protected:
+        struct Page {
+            QAtomicPointer<Value> values[IDTABLE_PAGE_SIZE];
+        };
+
+        QAtomicPointer<Page> pages[IDTABLE_MAX_PAGES];
+
+    private:
+        // Not copyable.
+        ConcurrentIDTable(const ConcurrentIDTable &);
+        ConcurrentIDTable & operator=(const ConcurrentIDTable &);
+    };
+
+
+    //---------------------------------------------------------------------------
+    // Public methods.
+
+    template <typename ID, typename Value>
+    ConcurrentIDTable<ID, Value>::ConcurrentIDTable() {
+    }
+
+    template <typename ID, typename Value>
+    ConcurrentIDTable<ID, Value>::~ConcurrentIDTable() {
+        for (int p = 0; p < IDTABLE_MAX_PAGES; p++) {
+            Page * page = this->pages[p];
+            if (page == NULL)
+                continue;
+            for (int i = 0; i < IDTABLE_PAGE_SIZE; i++)
+                delete (Value *) page->values[i];
+            delete page;
+        }
+    }
+
+    /**
+     * Look up the value for an ID. Never locks.
+     *
+     * @param id
+     *   An ID.
+     * @param value
+     *   The ID's value, if one has been stored.
+     * @return
+     *   true if a value has been stored for the ID.
+     */
+    template <typename ID, typename Value>
+    bool ConcurrentIDTable<ID, Value>::lookup(ID id, Value & value) const {
+        const Page * page = this->pages[(int) id / IDTABLE_PAGE_SIZE];
+        if (page == NULL)
+            return false;
+
+        const Value * stored = page->values[(int) id % IDTABLE_PAGE_SIZE];
+        if (stored == NULL)
+            return false;
+
+        value = *stored;
+        return true;
+    }
+
+    /**
+     * Look up the value for an ID without copying it. Never locks.
+     *
+     * @param id
+     *   An ID.
+     * @return
+     *   The ID's value, or NULL if none has been stored. Stays valid for as
+     *   long as the table exists, since stored values never change.
+     */
+    template <typename ID, typename Value>
+    const Value * ConcurrentIDTable<ID, Value>::find(ID id) const {
+        const Page * page = this->pages[(int) id / IDTABLE_PAGE_SIZE];
+        if (page == NULL)
+            return NULL;
+
+        return page->values[(int) id % IDTABLE_PAGE_SIZE];
+    }
+
+    /**
+     * Store the value for an ID, unless another thread beat us to it.
+     * Pages and values are installed with a compare-and-swap.
+     *
+     * @param id
+     *   An ID.
+     * @param value
+     *   The ID's value.
+     * @return
+     *   The stored value: either the given one or the one that was stored
+     *   first.
+     */
+    template <typename ID, typename Value>
+    const Value & ConcurrentIDTable<ID, Value>::insert(ID id, const Value & value) {
+        if ((int) id >= IDTABLE_PAGE_SIZE * IDTABLE_MAX_PAGES)
+            qFatal("ConcurrentIDTable: ID out of range.");
+
+        QAtomicPointer<Page> & pageSlot = this->pages[(int) id / IDTABLE_PAGE_SIZE];
+        if (pageSlot == NULL) {
+            Page * page = new Page();
+            if (!pageSlot.testAndSetOrdered(NULL, page))
+                delete page;
+        }
+
+        QAtomicPointer<Value> & slot = ((Page *) pageSlot)->values[(int) id % IDTABLE_PAGE_SIZE];
+        Value * stored = new Value(value);
+        if (!slot.testAndSetOrdered(NULL, stored))
+            delete stored;
+
+        return *(Value *) slot;
+    }
+
+}
+
+#endif // CONCURRENTIDTABLE_H
@@ -0,0 +1,332 @@
+#ifndef CONCURRENTINTERNER_H
+#define CONCURRENTINTERNER_H
+
+#include <QtGlobal>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QList>
+#include <QHash>
+
+
+namespace EpisodesParser {
+
+    // Number of shards: inserts in different shards never contend.
+    #define INTERNER_SHARDS 16
+    // Initial number of slots per shard; each shard grows independently.
+    #define INTERNER_INITIAL_CAPACITY 16
+    // The reverse (ID to key) table is allocated in pages of this many IDs.
+    #define INTERNER_PAGE_SIZE 4096
+    #define INTERNER_MAX_PAGES 4096
+
+    /**
+     * Maps keys to dense IDs (0, 1, 2, ...) and back, from many threads at
+     * once.
+     *
+     * Interned keys are never removed, which is what makes this cheap:
+     * - lookups (both key to ID and ID to key) never lock: entries are
+     *   immutable once published and tables are only ever replaced, never
+     *   modified in place, except for filling an empty slot;
+     * - inserts lock only the shard the key hashes to. When a shard grows,
+     *   its new table is published atomically, and the old one is retired
+     *   (but kept alive) because lock-free readers may still be probing it.
+     *
+     * The number of keys is limited by the ID type (and by the size of the
+     * reverse table): tryIntern() fails once it's exhausted, which callers
+     * that intern untrusted keys must handle.
+     *
+     * Key must have an operator==, and a qHash() overload that is cheap to
+     * call repeatedly (e.g. because it returns a precomputed hash).
+     */
+    template <typename Key, typename ID>
+    class ConcurrentInterner {
+    public:
+        ConcurrentInterner();
+        ~ConcurrentInterner();
+
+        ID intern(const Key & key);
+        bool tryIntern(const Key & key, ID & id);
+        bool find(const Key & key, ID & id) const;
+        Key value(ID id) const;
+        int size() const { return (int) this->count; }
+
+        static int capacity();
+
+    protected:
+        struct Entry {
+            Entry(const Key & key, uint hash, ID id) : key(key), hash(hash), id(id) {}
+
+            const Key key;
+            const uint hash;
+            const ID id;
+        };
+
+        struct Table {
+            Table(int capacity) : capacity(capacity), size(0) { this->slots = new QAtomicPointer<Entry>[capacity]; }
+            ~Table() { delete[] this->slots; }
+
+            const int capacity;
+            // Only modified while holding the shard's mutex.
+            int size;
+            QAtomicPointer<Entry> * slots;
+        };
+
+        struct Shard {
+            QAtomicPointer<Table> table;
+            QMutex mutex;
+            // Replaced tables, still referenced by lock-free readers.
+            QList<Table *> retired;
+        };
+
+        struct Page {
+            QAtomicPointer<Entry> entries[INTERNER_PAGE_SIZE];
+        };
+
+        static uint mix(uint hash);
+        static Entry * probe(const Table * table, const Key & key, uint hash);
+        static void place(Table * table, Entry * entry);
+        void publishReverse(Entry * entry);
+
+        Shard shards[INTERNER_SHARDS];
+        QAtomicPointer<Page> pages[INTERNER_MAX_PAGES];
+        QAtomicInt count;
+
+    private:
+        // Not copyable.
+        ConcurrentInterner(const ConcurrentInterner &);
+        ConcurrentInterner & operator=(const ConcurrentInterner &);
+    };
+
+
+    //---------------------------------------------------------------------------
+    // Public methods.
+
+    template <typename Key, typename ID>
+    ConcurrentInterner<Key, ID>::ConcurrentInterner() : count(0) {
+        for (int i = 0; i < INTERNER_SHARDS; i++)
+            this->shards[i].table = new Table(INTERNER_INITIAL_CAPACITY);
+    }
+
+    template <typename Key, typename ID>
+    ConcurrentInterner<Key, ID>::~ConcurrentInterner() {
+        for (int i = 0; i < INTERNER_SHARDS; i++) {
+            Table * table = this->shards[i].table;
+            // Every entry is in exactly one slot of the current table.
+            for (int s = 0; s < table->capacity; s++)
+                delete (Entry *) table->slots[s];
+            delete table;
+            qDeleteAll(this->shards[i].retired);
+        }
+        for (int p = 0; p < INTERNER_MAX_PAGES; p++)
+            delete (Page *) this->pages[p];
+    }
+
+    /**
+     * Map a key to its ID, assigning the next ID if it's a new key. Only for
+     * sets of keys that are known to fit in the ID type: see tryIntern().
+     *
+     * @param key
+     *   The key to intern.
+     * @return
+     *   The key's ID.
+     */
+    template <typename Key, typename ID>
+    ID ConcurrentInterner<Key, ID>::intern(const Key & key) {
+        ID id;
+        if (!this->tryIntern(key, id))
+            qFatal("ConcurrentInterner: too many keys for the ID type.");
+        return id;
+    }
+
+    /**
+     * Map a key to its ID, assigning the next ID if it's a new key and
+     * there are IDs left.
+     *
+     * @param key
+     *   The key to intern.
+     * @param id
+     *   The key's ID, if it could be interned.
+     * @return
+     *   false if it's a new key, but all IDs have been assigned already.
+     */
+    template <typename Key, typename ID>
+    bool ConcurrentInterner<Key, ID>::tryIntern(const Key & key, ID & id) {
+        const uint hash = ConcurrentInterner::mix(qHash(key));
+        Shard & shard = this->shards[(hash >> 28) & (INTERNER_SHARDS - 1)];
+
+        // Fast path: no locking.
+        Entry * entry = ConcurrentInterner::probe(shard.table, key, hash);
+        if (entry != NULL) {
+            id = entry->id;
+            return true;
+        }
+
+        QMutexLocker locker(&shard.mutex);
+
+        // Another thread may have inserted it in the mean time.
+        Table * table = shard.table;
+        entry = ConcurrentInterner::probe(table, key, hash);
+        if (entry != NULL) {
+            id = entry->id;
+            return true;
+        }
+
+        // Claim the next ID, unless they're exhausted. Inserts in other
+        // shards may claim IDs concurrently.
+        int next;
+        do {
+            next = this->count;
+            if (next >= ConcurrentInterner::capacity())
+                return false;
+        } while (!this->count.testAndSetOrdered(next, next + 1));
+        entry = new Entry(key, hash, (ID) next);
+
+        // Publish the reverse mapping before the forward mapping: whoever
+        // sees the ID must be able to look it up.
+        this->publishReverse(entry);
+
+        // Keep the load factor below 1/2, so probe sequences stay short.
+        if (2 * (table->size + 1) > table->capacity) {
+            Table * grown = new Table(2 * table->capacity);
+            for (int s = 0; s < table->capacity; s++) {
+                Entry * existing = table->slots[s];
+                if (existing != NULL)
+                    ConcurrentInterner::place(grown, existing);
+            }
+            grown->size = table->size;
+            shard.table.fetchAndStoreRelease(grown);
+            shard.retired.append(table);
+            table = grown;
+        }
+
+        ConcurrentInterner::place(table, entry);
+        table->size++;
+
+        id = entry->id;
+        return true;
+    }
+
+    /**
+     * Find the ID of a key, without interning it.
+     *
+     * @param key
+     *   The key to look up.
+     * @param id
+     *   The key's ID, if it was found.
+     * @return
+     *   true if the key has been interned.
+     */
+    template <typename Key, typename ID>
+    bool ConcurrentInterner<Key, ID>::find(const Key & key, ID & id) const {
+        const uint hash = ConcurrentInterner::mix(qHash(key));
+        const Shard & shard = this->shards[(hash >> 28) & (INTERNER_SHARDS - 1)];
+
+        Entry * entry = ConcurrentInterner::probe(shard.table, key, hash);
+        if (entry == NULL)
+            return false;
+
+        id = entry->id;
+        return true;
+    }
+
+    /**
+     * Map an ID back to its key. Never locks.
+     *
+     * @param id
+     *   An ID that was returned by intern().
+     * @return
+     *   The corresponding key, or a default-constructed key for unknown IDs.
+     */
+    template <typename Key, typename ID>
+    Key ConcurrentInterner<Key, ID>::value(ID id) const {
+        if ((quint64) id >= (quint64) ConcurrentInterner::capacity())
+            return Key();
+
+        const Page * page = this->pages[(int) id / INTERNER_PAGE_SIZE];
+        if (page == NULL)
+            return Key();
+
+        const Entry * entry = page->entries[(int) id % INTERNER_PAGE_SIZE];
+        return (entry != NULL) ? entry->key : Key();
+    }
+
+
+    /**
+     * @return
+     *   The maximum number of keys: the number of values of the ID type,
+     *   or the size of the reverse table if that is smaller.
+     */
+    template <typename Key, typename ID>
+    int ConcurrentInterner<Key, ID>::capacity() {
+        const quint64 idValues = (quint64) (ID) -1 + 1;
+        return (int) qMin(idValues, (quint64) INTERNER_PAGE_SIZE * INTERNER_MAX_PAGES);
+    }
+
+
+    //---------------------------------------------------------------------------
+    // Protected methods.
+
+    /**
+     * Spread the bits of a hash: qHash() of short strings tends to leave the
+     * high bits (which select the shard) unused.
+     */
+    template <typename Key, typename ID>
+    uint ConcurrentInterner<Key, ID>::mix(uint hash) {
+        hash ^= hash >> 16;
+        hash *= 0x45d9f3b;
+        hash ^= hash >> 16;
+        return hash;
+    }
+
+    /**
+     * Linear probing, without locking: slots are only ever filled, never
+     * emptied or overwritten.
+     */
+    template <typename Key, typename ID>
+    typename ConcurrentInterner<Key, ID>::Entry * ConcurrentInterner<Key, ID>::probe(const Table * table, const Key & key, uint hash) {
+        const int mask = table->capacity - 1;
+        for (int s = hash & mask; ; s = (s + 1) & mask) {
+            Entry * entry = table->slots[s];
+            if (entry == NULL)
+                return NULL;
+            if (entry->hash == hash && entry->key == key)
+                return entry;
+        }
+    }
+
+    /**
+     * Place an entry in the first empty slot of its probe sequence. Must be
+     * called while holding the shard's mutex.
+     */
+    template <typename Key, typename ID>
+    void ConcurrentInterner<Key, ID>::place(Table * table, Entry * entry) {
+        const int mask = table->capacity - 1;
+        int s = entry->hash & mask;
+        while (table->slots[s] != NULL)
+            s = (s + 1) & mask;
+        table->slots[s].fetchAndStoreRelease(entry);
+    }
+
+    /**
+     * Store an entry in the reverse table, allocating its page if necessary.
+     * Pages are installed with a compare-and-swap, since inserts in
+     * different shards may race for the same page.
+     */
+    template <typename Key, typename ID>
+    void ConcurrentInterner<Key, ID>::publishReverse(Entry * entry) {
+        const int id = (int) entry->id;
+        QAtomicPointer<Page> & slot = this->pages[id / INTERNER_PAGE_SIZE];
+
+        if (slot == NULL) {
+            Page * page = new Page();
+            if (!slot.testAndSetOrdered(NULL, page))
+                delete page;
+        }
+
+        ((Page *) slot)->entries[id % INTERNER_PAGE_SIZE].fetchAndStoreRelease(entry);
+    }
+
+}
+
+#endif // CONCURRENTINTERNER_H
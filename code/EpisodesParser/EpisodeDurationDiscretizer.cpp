@@ -2,6 +2,12 @@
 
 namespace EpisodesParser {
     EpisodeDurationDiscretizer::EpisodeDurationDiscretizer() {
+        this->internSpeed("unknown");
+    }
+
+    EpisodeDurationDiscretizer::~EpisodeDurationDiscretizer() {
+        for (int i = 0; i < 256; i++)
+            delete (SpeedTable *) this->tables[i];
     }
 
     bool EpisodeDurationDiscretizer::parseCsvFile(const QString & csvFile) {
@@ -34,6 +40,7 @@ namespace EpisodesParser {
                     else
                         maxDuration = -1; // This will automatically map to the highest value supported, right now that is 65535.
                     this->thresholds[episodeName].insert(maxDuration, episodeSpeed);
+                    this->internSpeed(episodeSpeed);
                 }
             }
 
@@ -42,13 +49,83 @@ namespace EpisodesParser {
     }
 
     EpisodeSpeed EpisodeDurationDiscretizer::mapToSpeed(const EpisodeName & name, const EpisodeDuration & duration) const {
-        EpisodeDuration maxDuration;
-        foreach (maxDuration, this->thresholds[name].keys()) {
-            if (duration <= maxDuration)
-                return this->thresholds[name][maxDuration];
+        const QMap<EpisodeDuration, EpisodeSpeed> & map = this->thresholds[name];
+        QMap<EpisodeDuration, EpisodeSpeed>::const_iterator it;
+        for (it = map.constBegin(); it != map.constEnd(); ++it) {
+            if (duration <= it.key())
+                return it.value();
         }
 
         qCritical("The duration %d for the Episode '%s' could not be mapped to a discretized speed.", duration, qPrintable(name));
         return "satisfy the compiler";
     }
+
+    /**
+     * Map an episode's duration to a speed ID, using the compiled thresholds
+     * of that episode. Thread-safe and lock-free: the thresholds of each
+     * episode are compiled on first use, and published atomically.
+     *
+     * @param id
+     *   The episode's ID.
+     * @param name
+     *   The episode's name, only used when its thresholds must be compiled.
+     * @param duration
+     *   The episode's duration.
+     * @return
+     *   The corresponding EpisodeSpeedID, EPISODE_SPEED_UNKNOWN if the
+     *   episode is not listed in the CSV file.
+     */
+    EpisodeSpeedID EpisodeDurationDiscretizer::mapToSpeedID(EpisodeID id, const EpisodeName & name, EpisodeDuration duration) {
+        const SpeedTable * table = this->tables[id];
+        if (table == NULL) {
+            SpeedTable * compiled = this->compile(name);
+            // Another thread may have compiled it in the mean time.
+            if (!this->tables[id].testAndSetOrdered(NULL, compiled))
+                delete compiled;
+            table = this->tables[id];
+        }
+
+        // There are only a handful of thresholds per episode: a linear scan
+        // beats a binary search.
+        const int numThresholds = table->maxDurations.size();
+        for (int i = 0; i < numThresholds; i++) {
+            if (duration <= table->maxDurations[i])
+                return table->speedIDs[i];
+        }
+
+        return EPISODE_SPEED_UNKNOWN;
+    }
+
+
+    //---------------------------------------------------------------------------
+    // Private methods.
+
+    EpisodeSpeedID EpisodeDurationDiscretizer::internSpeed(const EpisodeSpeed & speed) {
+        if (!this->speedIDs.contains(speed)) {
+            EpisodeSpeedID speedID = this->speeds.size();
+            this->speeds.append(speed);
+            this->speedIDs.insert(speed, speedID);
+            this->speedItems.append(QString("duration:") + speed);
+        }
+        return this->speedIDs[speed];
+    }
+
+    /**
+     * Compile the thresholds of an episode into a SpeedTable.
+     */
+    EpisodeDurationDiscretizer::SpeedTable * EpisodeDurationDiscretizer::compile(const EpisodeName & name) const {
+        SpeedTable * table = new SpeedTable();
+
+        if (!this->thresholds.contains(name))
+            qCritical("The Episode '%s' has no thresholds, its durations are mapped to an unknown speed.", qPrintable(name));
+
+        const QMap<EpisodeDuration, EpisodeSpeed> & map = this->thresholds[name];
+        QMap<EpisodeDuration, EpisodeSpeed>::const_iterator it;
+        for (it = map.constBegin(); it != map.constEnd(); ++it) {
+            table->maxDurations.append(it.key());
+            table->speedIDs.append(this->speedIDs.value(it.value()));
+        }
+
+        return table;
+    }
 }
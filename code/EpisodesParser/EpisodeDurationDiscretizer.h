@@ -4,20 +4,51 @@
 #include <QString>
 #include <QList>
 #include <QMap>
+#include <QHash>
+#include <QVector>
 #include <QFile>
 #include <QTextStream>
+#include <QAtomicPointer>
 #include "typedefs.h"
 
 namespace EpisodesParser {
+
+    // EpisodeSpeedID of the speed that is used for episodes that are not
+    // listed in the CSV file.
+    #define EPISODE_SPEED_UNKNOWN 0
+
     class EpisodeDurationDiscretizer {
     public:
         EpisodeDurationDiscretizer();
+        ~EpisodeDurationDiscretizer();
         bool parseCsvFile(const QString & csvFile);
         EpisodeSpeed mapToSpeed(const EpisodeName & name, const EpisodeDuration & duration) const;
+        EpisodeSpeedID mapToSpeedID(EpisodeID id, const EpisodeName & name, EpisodeDuration duration);
+        EpisodeSpeed speedIDToSpeed(EpisodeSpeedID speedID) const { return this->speeds[speedID]; }
+        const QString & speedIDToItem(EpisodeSpeedID speedID) const { return this->speedItems[speedID]; }
 
     private:
+        // Compiled thresholds of a single episode: the speed of a duration
+        // is that of the first maxDuration that is not exceeded.
+        struct SpeedTable {
+            QVector<EpisodeDuration> maxDurations;
+            QVector<EpisodeSpeedID> speedIDs;
+        };
+
+        EpisodeSpeedID internSpeed(const EpisodeSpeed & speed);
+        SpeedTable * compile(const EpisodeName & name) const;
+
         QString csvFile;
         QMap<EpisodeName, QMap<EpisodeDuration, EpisodeSpeed> > thresholds;
+
+        // Interned speeds and their association rule items ("duration:x").
+        // Only modified while parsing the CSV file.
+        QList<EpisodeSpeed> speeds;
+        QHash<EpisodeSpeed, EpisodeSpeedID> speedIDs;
+        QVector<QString> speedItems;
+
+        // Compiled on first use, per EpisodeID.
+        QAtomicPointer<SpeedTable> tables[256];
     };
 }
 
@@ -18,14 +18,36 @@ include("QGeoIP/QGeoIP.pri")
 SOURCES += \
     $${PWD}/Parser.cpp \
     $${PWD}/typedefs.cpp \
+    $${PWD}/LogLineTokenizer.cpp \
+    $${PWD}/LogReader.cpp \
+    $${PWD}/TimestampDecoder.cpp \
+    $${PWD}/ParsedLogCache.cpp \
+    $${PWD}/Resolvers.cpp \
+    $${PWD}/ParserHelperIndex.cpp \
+    $${PWD}/Sampler.cpp \
+    $${PWD}/QuarterReorderBuffer.cpp \
     EpisodesParser/EpisodeDurationDiscretizer.cpp
 
 HEADERS += \
     $${PWD}/Parser.h \
     $${PWD}/typedefs.h \
+    $${PWD}/ConcurrentInterner.h \
+    $${PWD}/ClockCache.h \
+    $${PWD}/ConcurrentIDTable.h \
+    $${PWD}/LogLineTokenizer.h \
+    $${PWD}/LogReader.h \
+    $${PWD}/TimestampDecoder.h \
+    $${PWD}/ParsedLogCache.h \
+    $${PWD}/Resolvers.h \
+    $${PWD}/ParserHelperIndex.h \
+    $${PWD}/Sampler.h \
+    $${PWD}/QuarterReorderBuffer.h \
     $${PWD}/QCachingLocale/QCachingLocale.h \
     EpisodesParser/EpisodeDurationDiscretizer.h
 
+# zlib, for reading gzipped logs.
+LIBS += -lz
+
 # Disable qDebug() output when in release mode.
 CONFIG(release, debug|release):DEFINES += QT_NO_DEBUG_OUTPUT
 
@@ -0,0 +1,381 @@
+#include "LogLineTokenizer.h"
+
+#include <string.h>
+
+namespace EpisodesParser {
+
+    #define IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+
+    /**
+     * Tokenize a raw line of an Episodes log file. A line looks like this:
+     *   218.56.155.59 [Sunday, 14-Nov-2010 06:27:03 +0100] "?ets=css:203,
+     *   headerjs:94" 200 "http://driverpacks.net/" "Mozilla/4.0 (...)"
+     *   "driverpacks.net"
+     *
+     * This is a single pass over the raw bytes, driven by a small state
+     * machine (one state per field). It never allocates memory and never
+     * locks: all textual fields point into the given line.
+     *
+     * @param line
+     *   Raw line, as read from the Episodes log file (without newline).
+     * @param length
+     *   The length of the line, in bytes.
+     * @param rawLine
+     *   The RawEpisodesLogLine data structure to fill.
+     * @param mode
+     *   TOKENIZER_STRICT or TOKENIZER_LENIENT.
+     * @return
+     *   true if the line could be tokenized, false if it is malformed. The
+     *   contents of rawLine are undefined in the latter case.
+     */
+    bool LogLineTokenizer::tokenize(const char * line, int length, RawEpisodesLogLine & rawLine, TokenizerMode mode) {
+        const bool lenient = (mode == TOKENIZER_LENIENT);
+        const char * p = line;
+        const char * end = line + length;
+
+        // Ignore trailing whitespace (e.g. the \r of CRLF line endings).
+        while (end > p && (end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'))
+            end--;
+        if (lenient) {
+            while (p < end && (*p == ' ' || *p == '\t'))
+                p++;
+        }
+
+        rawLine.numEpisodes = 0;
+        rawLine.domain.data = end;
+        rawLine.domain.length = 0;
+
+        State state = STATE_IP;
+        while (state != STATE_DONE) {
+            switch (state) {
+                case STATE_IP:
+                    if (!scanIPv4(p, end, rawLine.ip) || !scanSeparator(p, end, lenient))
+                        return false;
+                    state = STATE_TIME;
+                    break;
+
+                case STATE_TIME:
+                    if (!scanTime(p, end, rawLine.time, lenient) || !scanSeparator(p, end, lenient))
+                        return false;
+                    state = STATE_EPISODES;
+                    break;
+
+                case STATE_EPISODES:
+                    if (!scanEpisodes(p, end, rawLine, lenient) || !scanSeparator(p, end, lenient))
+                        return false;
+                    state = STATE_STATUS;
+                    break;
+
+                case STATE_STATUS:
+                    if (!scanStatus(p, end, rawLine.status, lenient) || !scanSeparator(p, end, lenient))
+                        return false;
+                    state = STATE_URL;
+                    break;
+
+                case STATE_URL:
+                    if (!scanQuoted(p, end, rawLine.url) || !scanSeparator(p, end, lenient))
+                        return false;
+                    state = STATE_UA;
+                    break;
+
+                case STATE_UA:
+                    if (!scanQuoted(p, end, rawLine.ua))
+                        return false;
+                    // The domain field is sometimes missing on truncated
+                    // lines. Only accept that in lenient mode.
+                    if (!scanSeparator(p, end, lenient)) {
+                        if (!lenient || p != end)
+                            return false;
+                        state = STATE_DONE;
+                    }
+                    else
+                        state = STATE_DOMAIN;
+                    break;
+
+                case STATE_DOMAIN:
+                    if (!scanQuoted(p, end, rawLine.domain) && !lenient)
+                        return false;
+                    // Only whitespace may follow in strict mode.
+                    if (!lenient && p != end)
+                        return false;
+                    state = STATE_DONE;
+                    break;
+
+                case STATE_DONE:
+                    break;
+            }
+        }
+
+        // Strict mode requires non-empty fields, just like the regular
+        // expression that was used before.
+        if (!lenient && (rawLine.url.length == 0 || rawLine.ua.length == 0 || rawLine.domain.length == 0))
+            return false;
+
+        // A page view without episodes is useless for analysis.
+        return rawLine.numEpisodes > 0;
+    }
+
+
+    /**
+     * Tokenize only the timestamp of a raw line, i.e. only scan as far as
+     * the timestamp. Used to order lines without tokenizing them entirely.
+     *
+     * @param line
+     *   Raw line, as read from the Episodes log file (without newline).
+     * @param length
+     *   The length of the line, in bytes.
+     * @param time
+     *   The timestamp field to fill.
+     * @param mode
+     *   TOKENIZER_STRICT or TOKENIZER_LENIENT.
+     * @return
+     *   true if the timestamp could be tokenized.
+     */
+    bool LogLineTokenizer::tokenizeTime(const char * line, int length, RawField & time, TokenizerMode mode) {
+        const bool lenient = (mode == TOKENIZER_LENIENT);
+        const char * p = line;
+        const char * end = line + length;
+        quint32 ip;
+
+        if (lenient) {
+            while (p < end && (*p == ' ' || *p == '\t'))
+                p++;
+        }
+
+        return scanIPv4(p, end, ip)
+               && scanSeparator(p, end, lenient)
+               && scanTime(p, end, time, lenient);
+    }
+
+
+    //---------------------------------------------------------------------------
+    // Protected static methods.
+
+    /**
+     * Scan the separator between two fields: a single space in strict mode,
+     * any amount of whitespace in lenient mode.
+     */
+    bool LogLineTokenizer::scanSeparator(const char * & p, const char * end, bool lenient) {
+        if (p == end || *p != ' ')
+            return false;
+        p++;
+
+        if (lenient) {
+            while (p < end && (*p == ' ' || *p == '\t'))
+                p++;
+        }
+
+        return true;
+    }
+
+    /**
+     * Scan a dotted-quad IPv4 address into a 32-bit integer (host byte
+     * order, i.e. the same value QHostAddress::toIPv4Address() returns).
+     */
+    bool LogLineTokenizer::scanIPv4(const char * & p, const char * end, quint32 & ip) {
+        ip = 0;
+        for (int octet = 0; octet < 4; octet++) {
+            if (octet > 0) {
+                if (p == end || *p != '.')
+                    return false;
+                p++;
+            }
+
+            uint value = 0;
+            int digits = 0;
+            while (p < end && IS_DIGIT(*p) && digits < 3) {
+                value = value * 10 + (*p - '0');
+                digits++;
+                p++;
+            }
+            if (digits == 0 || value > 255)
+                return false;
+
+            ip = (ip << 8) | value;
+        }
+
+        return true;
+    }
+
+    /**
+     * Scan the bracketed timestamp, e.g. "[Sunday, 14-Nov-2010 06:27:03
+     * +0100]". Only the part after the weekday is retained. In lenient mode,
+     * the weekday may be missing.
+     */
+    bool LogLineTokenizer::scanTime(const char * & p, const char * end, RawField & time, bool lenient) {
+        if (p == end || *p != '[')
+            return false;
+        p++;
+
+        const char * close = (const char *) memchr(p, ']', end - p);
+        if (close == NULL)
+            return false;
+
+        const char * start = (const char *) memchr(p, ',', close - p);
+        if (start != NULL)
+            start++;
+        else if (lenient)
+            start = p;
+        else
+            return false;
+
+        if (lenient) {
+            while (start < close && *start == ' ')
+                start++;
+            while (close > start && close[-1] == ' ')
+                close--;
+        }
+        else if (start < close && *start == ' ')
+            start++;
+
+        // "dd-MMM-yyyy HH:mm:ss +zzzz"
+        if (close - start != 26 || !LogLineTokenizer::isValidTime(start))
+            return false;
+
+        time.data = start;
+        time.length = 26;
+
+        // Continue after the closing bracket (which may be beyond "close" if
+        // trailing spaces were trimmed in lenient mode).
+        p = (const char *) memchr(start, ']', end - start) + 1;
+        return true;
+    }
+
+    /**
+     * Scan the episodes field, e.g. "?ets=css:203,headerjs:94". In strict
+     * mode, any malformed episode causes the line to be rejected. In lenient
+     * mode, malformed episodes are skipped, durations that exceed the
+     * EpisodeDuration range are clamped and excess episodes are ignored.
+     */
+    bool LogLineTokenizer::scanEpisodes(const char * & p, const char * end, RawEpisodesLogLine & rawLine, bool lenient) {
+        static const char prefix[] = "\"?ets=";
+        static const int prefixLength = sizeof(prefix) - 1;
+
+        if (end - p >= prefixLength && memcmp(p, prefix, prefixLength) == 0)
+            p += prefixLength;
+        else if (lenient && p < end && *p == '"') {
+            // Accept anything in front of "ets=", e.g. "/beacon?ets=".
+            p++;
+            const char * q = p;
+            while (q + 4 <= end && *q != '"' && memcmp(q, "ets=", 4) != 0)
+                q++;
+            if (q + 4 > end || *q == '"')
+                return false;
+            p = q + 4;
+        }
+        else
+            return false;
+
+        while (p < end && *p != '"') {
+            // Episode name.
+            const char * name = p;
+            while (p < end && *p != ':' && *p != ',' && *p != '"')
+                p++;
+            int nameLength = p - name;
+
+            // Episode duration.
+            uint duration = 0;
+            int digits = 0;
+            if (p < end && *p == ':') {
+                p++;
+                while (p < end && IS_DIGIT(*p)) {
+                    if (duration <= 65535)
+                        duration = duration * 10 + (*p - '0');
+                    digits++;
+                    p++;
+                }
+            }
+
+            bool valid = (nameLength > 0 && digits > 0 && p < end && (*p == ',' || *p == '"'));
+            if (valid && duration > 65535) {
+                if (!lenient)
+                    return false;
+                duration = 65535;
+            }
+
+            if (!valid) {
+                if (!lenient)
+                    return false;
+                // Skip to the next episode.
+                while (p < end && *p != ',' && *p != '"')
+                    p++;
+            }
+            else if (rawLine.numEpisodes < TOKENIZER_MAX_EPISODES) {
+                RawEpisode & episode = rawLine.episodes[rawLine.numEpisodes++];
+                episode.name.data = name;
+                episode.name.length = nameLength;
+                episode.duration = (EpisodeDuration) duration;
+            }
+            else if (!lenient)
+                return false;
+
+            if (p < end && *p == ',')
+                p++;
+        }
+
+        // Closing quote.
+        if (p == end)
+            return false;
+        p++;
+
+        return true;
+    }
+
+    /**
+     * Scan the HTTP status code: exactly three digits in strict mode, one to
+     * three digits in lenient mode.
+     */
+    bool LogLineTokenizer::scanStatus(const char * & p, const char * end, HTTPStatus & status, bool lenient) {
+        int digits = 0;
+        status = 0;
+        while (p < end && IS_DIGIT(*p) && digits < 3) {
+            status = status * 10 + (*p - '0');
+            digits++;
+            p++;
+        }
+
+        if (digits == 0 || (!lenient && digits != 3))
+            return false;
+        return (p == end || *p == ' ');
+    }
+
+    /**
+     * Scan a double-quoted field. Backslash-escaped characters (e.g. \") are
+     * retained as-is, since that is how the web server logged them.
+     */
+    bool LogLineTokenizer::scanQuoted(const char * & p, const char * end, RawField & field) {
+        if (p == end || *p != '"')
+            return false;
+        p++;
+
+        const char * start = p;
+        while (p < end && *p != '"') {
+            if (*p == '\\' && p + 1 < end)
+                p++;
+            p++;
+        }
+        if (p == end)
+            return false;
+
+        field.data = start;
+        field.length = p - start;
+        p++;
+        return true;
+    }
+
+    /**
+     * Verify the layout of a "dd-MMM-yyyy HH:mm:ss +zzzz" timestamp.
+     */
+    bool LogLineTokenizer::isValidTime(const char * t) {
+        return IS_DIGIT(t[0]) && IS_DIGIT(t[1]) && t[2] == '-'
+               && t[6] == '-'
+               && IS_DIGIT(t[7]) && IS_DIGIT(t[8]) && IS_DIGIT(t[9]) && IS_DIGIT(t[10])
+               && t[11] == ' '
+               && IS_DIGIT(t[12]) && IS_DIGIT(t[13]) && t[14] == ':'
+               && IS_DIGIT(t[15]) && IS_DIGIT(t[16]) && t[17] == ':'
+               && IS_DIGIT(t[18]) && IS_DIGIT(t[19])
+               && t[20] == ' '
+               && (t[21] == '+' || t[21] == '-')
+               && IS_DIGIT(t[22]) && IS_DIGIT(t[23]) && IS_DIGIT(t[24]) && IS_DIGIT(t[25]);
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef LOGLINETOKENIZER_H
+#define LOGLINETOKENIZER_H
+
+#include <QtGlobal>
+
+#include "typedefs.h"
+
+
+namespace EpisodesParser {
+
+    // The highest number of episodes that a single line can carry. Lines
+    // with more episodes are rejected in strict mode and truncated in
+    // lenient mode.
+    #define TOKENIZER_MAX_EPISODES 64
+
+    enum TokenizerMode {
+        // Reject every line that does not exactly match the Episodes log
+        // format.
+        TOKENIZER_STRICT,
+        // Accept slightly malformed lines: skip malformed episodes, tolerate
+        // a missing weekday, extra whitespace, a truncated domain field and
+        // trailing garbage.
+        TOKENIZER_LENIENT
+    };
+
+    // A field of a raw line: points into the line that was tokenized, hence
+    // it is only valid for as long as that line is.
+    struct RawField {
+        const char * data;
+        int length;
+    };
+
+    struct RawEpisode {
+        RawField name;
+        EpisodeDuration duration;
+    };
+
+    // Tokenized raw line from an Episodes log file: no strings have been
+    // materialized yet, every textual field still refers to the raw bytes.
+    struct RawEpisodesLogLine {
+        quint32 ip;
+        // Always in the "dd-MMM-yyyy HH:mm:ss +zzzz" format (26 bytes).
+        RawField time;
+        RawEpisode episodes[TOKENIZER_MAX_EPISODES];
+        int numEpisodes;
+        HTTPStatus status;
+        RawField url;
+        RawField ua;
+        RawField domain;
+    };
+
+    class LogLineTokenizer {
+    public:
+        static bool tokenize(const char * line, int length, RawEpisodesLogLine & rawLine, TokenizerMode mode = TOKENIZER_STRICT);
+        static bool tokenizeTime(const char * line, int length, RawField & time, TokenizerMode mode = TOKENIZER_STRICT);
+
+    protected:
+        enum State {
+            STATE_IP,
+            STATE_TIME,
+            STATE_EPISODES,
+            STATE_STATUS,
+            STATE_URL,
+            STATE_UA,
+            STATE_DOMAIN,
+            STATE_DONE
+        };
+
+        static bool scanSeparator(const char * & p, const char * end, bool lenient);
+        static bool scanIPv4(const char * & p, const char * end, quint32 & ip);
+        static bool scanTime(const char * & p, const char * end, RawField & time, bool lenient);
+        static bool scanEpisodes(const char * & p, const char * end, RawEpisodesLogLine & rawLine, bool lenient);
+        static bool scanStatus(const char * & p, const char * end, HTTPStatus & status, bool lenient);
+        static bool scanQuoted(const char * & p, const char * end, RawField & field);
+        static bool isValidTime(const char * time);
+    };
+
+}
+
+#endif // LOGLINETOKENIZER_H
@@ -0,0 +1,826 @@
+#include "LogReader.h"
+
+#include <algorithm>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace EpisodesParser {
+
+    //---------------------------------------------------------------------------
+    // LogReader.
+
+    LogReader::LogReader(const QString & fileName) {
+        this->file.setFileName(fileName);
+    }
+
+    LogReader::~LogReader() {
+    }
+
+    /**
+     * Create and open the most efficient LogReader for the given log:
+     * - a GzipLogReader (in its own thread) if the log is gzipped
+     * - a MappedLogReader if the log can be mapped into memory
+     * - a BufferedLogReader otherwise (e.g. on 32-bit hosts for multi-GB
+     *   logs)
+     *
+     * @param fileName
+     *   The full path to an Episodes log file.
+     * @return
+     *   An opened LogReader, or NULL if the log could not be opened. The
+     *   caller takes ownership.
+     */
+    LogReader * LogReader::create(const QString & fileName) {
+        LogReader * reader;
+
+        if (GzipLogReader::isGzipped(fileName)) {
+            reader = new PrefetchingLogReader(new GzipLogReader(fileName));
+            if (reader->open())
+                return reader;
+
+            qWarning("Could not open '%s' for reading: %s.", qPrintable(fileName), qPrintable(reader->errorString()));
+            delete reader;
+            return NULL;
+        }
+
+        reader = new MappedLogReader(fileName);
+        if (reader->open())
+            return reader;
+        delete reader;
+
+        reader = new BufferedLogReader(fileName);
+        if (reader->open())
+            return reader;
+
+        qWarning("Could not open '%s' for reading: %s.", qPrintable(fileName), qPrintable(reader->errorString()));
+        delete reader;
+        return NULL;
+    }
+
+
+    /**
+     * Create and open a LogReader that merges the given logs by timestamp.
+     * Every log is read in a separate thread.
+     *
+     * @param fileNames
+     *   The full paths to Episodes log files. Each of them must be ordered
+     *   by timestamp.
+     * @param mode
+     *   The tokenizer mode with which timestamps are tokenized.
+     * @return
+     *   An opened LogReader, or NULL if any of the logs could not be opened.
+     *   The caller takes ownership.
+     */
+    LogReader * LogReader::create(const QStringList & fileNames, TokenizerMode mode) {
+        if (fileNames.size() == 1)
+            return LogReader::create(fileNames.first());
+
+        // Every source is opened here, exactly once: the MergingLogReader
+        // doesn't open them again.
+        QList<LogReader *> sources;
+        foreach (const QString & fileName, fileNames) {
+            LogReader * source = LogReader::create(fileName);
+            if (source == NULL) {
+                qDeleteAll(sources);
+                return NULL;
+            }
+            // Gzipped logs are already read in a separate thread.
+            if (!GzipLogReader::isGzipped(fileName))
+                source = new PrefetchingLogReader(source);
+            sources.append(source);
+        }
+
+        LogReader * reader = new MergingLogReader(sources, mode);
+        if (reader->open())
+            return reader;
+
+        qWarning("Could not merge logs: %s.", qPrintable(reader->errorString()));
+        delete reader;
+        return NULL;
+    }
+
+
+    //---------------------------------------------------------------------------
+    // MappedLogReader.
+
+    MappedLogReader::MappedLogReader(const QString & fileName) : LogReader(fileName) {
+        this->map = NULL;
+        this->size = 0;
+        this->position = 0;
+        this->readAheadPosition = 0;
+    }
+
+    MappedLogReader::~MappedLogReader() {
+        if (this->map != NULL)
+            this->file.unmap((uchar *) this->map);
+    }
+
+    bool MappedLogReader::open() {
+        if (!this->file.open(QIODevice::ReadOnly)) {
+            this->error = this->file.errorString();
+            return false;
+        }
+
+        this->size = this->file.size();
+        if (this->size == 0 || (this->size > INT_MAX && sizeof(void *) < 8)) {
+            this->error = "Log cannot be mapped.";
+            return false;
+        }
+
+        this->map = (const char *) this->file.map(0, this->size);
+        if (this->map == NULL) {
+            this->error = this->file.errorString();
+            return false;
+        }
+
+#ifdef Q_OS_UNIX
+        // Lines are read exactly once, from start to end: let the kernel
+        // read ahead aggressively and drop pages once they've been read.
+        madvise((void *) this->map, this->size, MADV_SEQUENTIAL);
+#endif
+        this->adviseReadAhead();
+
+        return true;
+    }
+
+    /**
+     * Read the next chunk of lines.
+     *
+     * @param chunk
+     *   The chunk to fill. Its lines point into the mapping.
+     * @param maxLines
+     *   The maximum number of lines to read.
+     * @return
+     *   false if the end of the log was reached before a line could be read.
+     */
+    bool MappedLogReader::readChunk(LogChunk & chunk, int maxLines) {
+        LineSpan line;
+
+        chunk.clear();
+        chunk.offset = this->position;
+        chunk.lines.reserve(maxLines);
+
+        while (chunk.lines.size() < maxLines && this->position < this->size) {
+            const char * start = this->map + this->position;
+            const char * newline = (const char *) memchr(start, '\n', this->size - this->position);
+            const char * end = (newline != NULL) ? newline : this->map + this->size;
+
+            line.data = start;
+            line.length = end - start;
+            chunk.lines.append(line);
+
+            this->position = end - this->map + 1;
+        }
+
+        if (this->position >= this->readAheadPosition - LOGREADER_READAHEAD_SIZE / 2)
+            this->adviseReadAhead();
+
+        return !chunk.lines.isEmpty();
+    }
+
+    /**
+     * Ask the kernel to start reading the next window of the log, so that
+     * the disk is kept busy while the current chunk is being tokenized.
+     */
+    void MappedLogReader::adviseReadAhead() {
+        if (this->readAheadPosition >= this->size)
+            return;
+
+#ifdef Q_OS_UNIX
+        static const qint64 pageSize = sysconf(_SC_PAGESIZE);
+        qint64 start = this->readAheadPosition & ~(pageSize - 1);
+        qint64 length = qMin((qint64) LOGREADER_READAHEAD_SIZE, this->size - start);
+        madvise((void *) (this->map + start), length, MADV_WILLNEED);
+#endif
+
+        this->readAheadPosition += LOGREADER_READAHEAD_SIZE;
+    }
+
+
+    //---------------------------------------------------------------------------
+    // BufferedLogReader.
+
+    BufferedLogReader::BufferedLogReader(const QString & fileName) : LogReader(fileName) {
+        this->bufferPosition = 0;
+        this->bufferOffset = 0;
+        this->atEnd = false;
+    }
+
+    bool BufferedLogReader::open() {
+        if (!this->file.open(QIODevice::ReadOnly)) {
+            this->error = this->file.errorString();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Read the next chunk of lines.
+     *
+     * @param chunk
+     *   The chunk to fill. It keeps the blocks its lines point into alive.
+     * @param maxLines
+     *   The maximum number of lines to read.
+     * @return
+     *   false if the end of the log was reached before a line could be read,
+     *   or if it could not be read any further: see failed().
+     */
+    bool BufferedLogReader::readChunk(LogChunk & chunk, int maxLines) {
+        LineSpan line;
+
+        chunk.clear();
+        chunk.offset = this->bufferOffset + this->bufferPosition;
+        chunk.lines.reserve(maxLines);
+        chunk.buffers.append(this->buffer);
+
+        while (chunk.lines.size() < maxLines) {
+            const char * start = this->buffer.constData() + this->bufferPosition;
+            int available = this->buffer.size() - this->bufferPosition;
+            const char * newline = (const char *) memchr(start, '\n', available);
+
+            if (newline == NULL) {
+                // The remainder is an incomplete line: read the next block,
+                // unless this is the last line of the log.
+                if (!this->atEnd) {
+                    this->fillBuffer();
+                    chunk.buffers.append(this->buffer);
+                    continue;
+                }
+                if (available == 0)
+                    break;
+                newline = start + available;
+            }
+
+            line.data = start;
+            line.length = newline - start;
+            chunk.lines.append(line);
+
+            this->bufferPosition = qMin((int) (newline - this->buffer.constData()) + 1, this->buffer.size());
+        }
+
+        return !chunk.lines.isEmpty();
+    }
+
+    /**
+     * Replace the buffer by a new one that starts with the unread remainder
+     * of the current buffer, followed by the next block of the log. The old
+     * buffer is not modified: chunks may still point into it.
+     */
+    bool BufferedLogReader::fillBuffer() {
+        int remainder = this->buffer.size() - this->bufferPosition;
+
+        QByteArray next;
+        next.resize(remainder + LOGREADER_BLOCK_SIZE);
+        memcpy(next.data(), this->buffer.constData() + this->bufferPosition, remainder);
+        qint64 bytesRead = this->readBlock(next.data() + remainder, LOGREADER_BLOCK_SIZE);
+        if (bytesRead <= 0) {
+            if (bytesRead < 0 && this->error.isEmpty())
+                this->error = QString("Could not read '%1': %2.").arg(this->file.fileName()).arg(this->file.errorString());
+            bytesRead = 0;
+            this->atEnd = true;
+        }
+        next.resize(remainder + bytesRead);
+
+        this->bufferOffset += this->bufferPosition;
+        this->bufferPosition = 0;
+        this->buffer = next;
+
+        return bytesRead > 0;
+    }
+
+    /**
+     * Read the next block of the log.
+     *
+     * @return
+     *   The number of bytes read, 0 at the end of the log, -1 on errors.
+     */
+    qint64 BufferedLogReader::readBlock(char * data, qint64 maxSize) {
+        return this->file.read(data, maxSize);
+    }
+
+
+    //---------------------------------------------------------------------------
+    // TailLogReader.
+
+    /**
+     * @param fileName
+     *   The full path to an Episodes log file that is being appended to.
+     * @param startOffset
+     *   The offset up to which the log has already been read.
+     */
+    TailLogReader::TailLogReader(const QString & fileName, qint64 startOffset) : BufferedLogReader(fileName) {
+        this->start = startOffset;
+        this->end = startOffset;
+        this->truncated = false;
+    }
+
+    bool TailLogReader::open() {
+        if (!BufferedLogReader::open())
+            return false;
+
+        // A log that shrunk has been truncated or replaced (e.g. by log
+        // rotation): start over.
+        qint64 size = this->file.size();
+        if (size < this->start) {
+            this->start = 0;
+            this->truncated = true;
+        }
+
+        // Only read up to (and including) the last newline.
+        this->end = this->start;
+        qint64 blockStart = size;
+        while (blockStart > this->start && this->end == this->start) {
+            qint64 blockSize = qMin((qint64) LOGREADER_BLOCK_SIZE, blockStart - this->start);
+            blockStart -= blockSize;
+            this->file.seek(blockStart);
+            const QByteArray block = this->file.read(blockSize);
+            int newline = block.lastIndexOf('\n');
+            if (newline != -1)
+                this->end = blockStart + newline + 1;
+        }
+
+        this->file.seek(this->start);
+        this->bufferOffset = this->start;
+        return true;
+    }
+
+    qint64 TailLogReader::readBlock(char * data, qint64 maxSize) {
+        qint64 remaining = this->end - this->file.pos();
+        if (remaining <= 0)
+            return 0;
+        return this->file.read(data, qMin(maxSize, remaining));
+    }
+
+
+    //---------------------------------------------------------------------------
+    // StreamLogReader.
+
+    /**
+     * @param name
+     *   A name for the stream, for error messages only.
+     */
+    StreamLogReader::StreamLogReader(const QString & name) : LogReader(QString()) {
+        this->name = name;
+        this->bufferPosition = 0;
+        this->bufferOffset = 0;
+        this->finished = false;
+        this->skippingLine = false;
+        this->oversizedLines = 0;
+    }
+
+    bool StreamLogReader::open() {
+        return true;
+    }
+
+    /**
+     * Read the complete lines that have arrived so far.
+     *
+     * @param chunk
+     *   The chunk to fill. It keeps the buffer its lines point into alive.
+     * @param maxLines
+     *   The maximum number of lines to read.
+     * @return
+     *   false if no complete line has arrived.
+     */
+    bool StreamLogReader::readChunk(LogChunk & chunk, int maxLines) {
+        LineSpan line;
+
+        chunk.clear();
+        if (this->skippingLine && !this->skipRestOfLine())
+            return false;
+        chunk.offset = this->bufferOffset + this->bufferPosition;
+        chunk.buffers.append(this->buffer);
+
+        while (chunk.lines.size() < maxLines) {
+            const char * start = this->buffer.constData() + this->bufferPosition;
+            int available = this->buffer.size() - this->bufferPosition;
+            const char * newline = (const char *) memchr(start, '\n', available);
+
+            if (newline == NULL) {
+                // Keep an incomplete line until the rest of it arrives, but
+                // don't buffer an oversized one: drop it, and the rest of
+                // it as it arrives.
+                if (!this->finished && available > LOGREADER_MAX_LINE_LENGTH) {
+                    this->bufferPosition = this->buffer.size();
+                    this->skippingLine = true;
+                    this->oversizedLines++;
+                }
+                if (!this->finished || available == 0)
+                    break;
+                newline = start + available;
+            }
+
+            line.data = start;
+            line.length = newline - start;
+            chunk.lines.append(line);
+
+            this->bufferPosition = qMin((int) (newline - this->buffer.constData()) + 1, this->buffer.size());
+        }
+
+        return !chunk.lines.isEmpty();
+    }
+
+    /**
+     * Read whatever has arrived on a non-blocking file descriptor (e.g.
+     * stdin), in blocks of LOGREADER_BLOCK_SIZE.
+     *
+     * @param fd
+     *   A file descriptor in non-blocking mode.
+     * @return
+     *   The number of bytes read. The stream is marked as finished upon
+     *   end-of-file or an error.
+     */
+    qint64 StreamLogReader::readAvailable(int fd) {
+        QByteArray next = this->takeRemainder();
+        qint64 total = 0;
+
+#ifdef Q_OS_UNIX
+        forever {
+            int size = next.size();
+            next.resize(size + LOGREADER_BLOCK_SIZE);
+            ssize_t bytesRead = ::read(fd, next.data() + size, LOGREADER_BLOCK_SIZE);
+            next.resize(size + qMax((ssize_t) 0, bytesRead));
+
+            if (bytesRead > 0) {
+                total += bytesRead;
+                // A short read: the pipe (or socket) has been drained.
+                if (bytesRead < LOGREADER_BLOCK_SIZE)
+                    break;
+            }
+            else if (bytesRead == 0) {
+                this->finished = true;
+                break;
+            }
+            else if (errno != EINTR) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    this->error = QString("%1: %2").arg(this->name).arg(strerror(errno));
+                    this->finished = true;
+                }
+                break;
+            }
+        }
+#else
+        Q_UNUSED(fd);
+        this->finished = true;
+#endif
+
+        this->buffer = next;
+        return total;
+    }
+
+    /**
+     * Read whatever has arrived on a device (e.g. a QLocalSocket), in blocks
+     * of LOGREADER_BLOCK_SIZE. Never waits for more data to arrive.
+     *
+     * @param device
+     *   A sequential device.
+     * @return
+     *   The number of bytes read.
+     */
+    qint64 StreamLogReader::readAvailable(QIODevice * device) {
+        QByteArray next = this->takeRemainder();
+        qint64 total = 0;
+
+        while (device->bytesAvailable() > 0) {
+            int size = next.size();
+            next.resize(size + LOGREADER_BLOCK_SIZE);
+            qint64 bytesRead = device->read(next.data() + size, LOGREADER_BLOCK_SIZE);
+            next.resize(size + qMax((qint64) 0, bytesRead));
+            if (bytesRead <= 0)
+                break;
+            total += bytesRead;
+        }
+
+        this->buffer = next;
+        return total;
+    }
+
+    /**
+     * Skip what has arrived of the rest of an oversized line.
+     *
+     * @return
+     *   true if its end has arrived.
+     */
+    bool StreamLogReader::skipRestOfLine() {
+        const char * start = this->buffer.constData() + this->bufferPosition;
+        const char * newline = (const char *) memchr(start, '\n', this->buffer.size() - this->bufferPosition);
+        if (newline == NULL) {
+            this->bufferPosition = this->buffer.size();
+            return false;
+        }
+
+        this->bufferPosition = newline - this->buffer.constData() + 1;
+        this->skippingLine = false;
+        return true;
+    }
+
+    /**
+     * Start a new buffer with the unread remainder of the current one. The
+     * current buffer is not modified: chunks may still point into it.
+     */
+    QByteArray StreamLogReader::takeRemainder() {
+        QByteArray remainder(this->buffer.constData() + this->bufferPosition, this->buffer.size() - this->bufferPosition);
+        this->bufferOffset += this->bufferPosition;
+        this->bufferPosition = 0;
+        return remainder;
+    }
+
+
+    //---------------------------------------------------------------------------
+    // GzipLogReader.
+
+    GzipLogReader::GzipLogReader(const QString & fileName) : BufferedLogReader(fileName) {
+        this->streamInitialized = false;
+        this->inMember = false;
+    }
+
+    GzipLogReader::~GzipLogReader() {
+        if (this->streamInitialized)
+            inflateEnd(&this->stream);
+    }
+
+    /**
+     * Detect gzipped files by their magic number (0x1f 0x8b).
+     */
+    bool GzipLogReader::isGzipped(const QString & fileName) {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly))
+            return false;
+
+        const QByteArray magic = file.peek(2);
+        return magic.size() == 2 && (uchar) magic[0] == 0x1f && (uchar) magic[1] == 0x8b;
+    }
+
+    bool GzipLogReader::open() {
+        if (!BufferedLogReader::open())
+            return false;
+
+        memset(&this->stream, 0, sizeof(z_stream));
+        // 16 + MAX_WBITS: expect a gzip header and trailer.
+        if (inflateInit2(&this->stream, 16 + MAX_WBITS) != Z_OK) {
+            this->error = "Could not initialize zlib.";
+            return false;
+        }
+        this->streamInitialized = true;
+        this->input.resize(LOGREADER_BLOCK_SIZE);
+
+        return true;
+    }
+
+    /**
+     * Decompress the next block of the log.
+     *
+     * @return
+     *   The number of bytes decompressed, 0 at the end of the log, -1 on
+     *   errors (e.g. a corrupt or truncated file). The data decompressed
+     *   before an error is still returned; the error is returned upon the
+     *   next call.
+     */
+    qint64 GzipLogReader::readBlock(char * data, qint64 maxSize) {
+        if (!this->error.isEmpty())
+            return -1;
+
+        this->stream.next_out = (Bytef *) data;
+        this->stream.avail_out = (uInt) maxSize;
+
+        while (this->stream.avail_out > 0) {
+            if (this->stream.avail_in == 0) {
+                qint64 bytesRead = this->file.read(this->input.data(), this->input.size());
+                if (bytesRead < 0)
+                    this->error = QString("Could not read '%1': %2.").arg(this->file.fileName()).arg(this->file.errorString());
+                else if (bytesRead == 0 && this->inMember)
+                    this->error = QString("Could not decompress '%1': the file is truncated.").arg(this->file.fileName());
+                if (bytesRead <= 0)
+                    break;
+                this->stream.next_in = (Bytef *) this->input.data();
+                this->stream.avail_in = (uInt) bytesRead;
+            }
+
+            int result = inflate(&this->stream, Z_NO_FLUSH);
+            if (result == Z_STREAM_END) {
+                // Another gzip member may follow.
+                inflateReset(&this->stream);
+                this->inMember = false;
+            }
+            else if (result == Z_OK)
+                this->inMember = true;
+            else {
+                this->error = QString("Could not decompress '%1': %2.").arg(this->file.fileName()).arg(this->stream.msg != NULL ? this->stream.msg : "corrupt data");
+                break;
+            }
+        }
+
+        qint64 bytesDecompressed = maxSize - this->stream.avail_out;
+        if (bytesDecompressed == 0 && !this->error.isEmpty())
+            return -1;
+        return bytesDecompressed;
+    }
+
+
+    //---------------------------------------------------------------------------
+    // PrefetchingLogReader.
+
+    /**
+     * @param source
+     *   The LogReader to run in a separate thread. Ownership is taken.
+     */
+    PrefetchingLogReader::PrefetchingLogReader(LogReader * source) : LogReader(QString()) {
+        this->source = source;
+        this->maxLines = 0;
+        this->sourceExhausted = false;
+        this->stopped = false;
+    }
+
+    PrefetchingLogReader::~PrefetchingLogReader() {
+        this->mutex.lock();
+        this->stopped = true;
+        this->notFull.wakeAll();
+        this->mutex.unlock();
+
+        this->wait();
+        delete this->source;
+    }
+
+    bool PrefetchingLogReader::open() {
+        if (!this->source->open()) {
+            this->error = this->source->errorString();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Read the next chunk of lines. The reading thread is started upon the
+     * first call, since only then the chunk size is known.
+     */
+    bool PrefetchingLogReader::readChunk(LogChunk & chunk, int maxLines) {
+        QMutexLocker locker(&this->mutex);
+
+        if (this->maxLines == 0) {
+            this->maxLines = maxLines;
+            this->start();
+        }
+
+        while (this->queue.isEmpty() && !this->sourceExhausted)
+            this->notEmpty.wait(&this->mutex);
+
+        if (this->queue.isEmpty())
+            return false;
+
+        chunk = this->queue.dequeue();
+        this->notFull.wakeOne();
+        return true;
+    }
+
+    void PrefetchingLogReader::run() {
+        LogChunk chunk;
+        bool more = true;
+
+        while (more) {
+            more = this->source->readChunk(chunk, this->maxLines);
+
+            QMutexLocker locker(&this->mutex);
+            while (this->queue.size() >= LOGREADER_PREFETCH_DEPTH && !this->stopped)
+                this->notFull.wait(&this->mutex);
+            if (this->stopped)
+                break;
+
+            if (more)
+                this->queue.enqueue(chunk);
+            this->notEmpty.wakeOne();
+        }
+
+        QMutexLocker locker(&this->mutex);
+        this->error = this->source->errorString();
+        this->sourceExhausted = true;
+        this->notEmpty.wakeAll();
+    }
+
+
+    //---------------------------------------------------------------------------
+    // MergingLogReader.
+
+    /**
+     * @param sources
+     *   The LogReaders to merge, already opened (see LogReader::create()):
+     *   open() does not open them again, since that would fail for their
+     *   files, or map them again. Ownership is taken.
+     * @param mode
+     *   The tokenizer mode with which timestamps are tokenized.
+     */
+    MergingLogReader::MergingLogReader(const QList<LogReader *> & sources, TokenizerMode mode) : LogReader(QString()) {
+        Source source;
+        source.position = 0;
+        source.time = 0;
+        source.mergedChunk = -1;
+        foreach (LogReader * reader, sources) {
+            source.reader = reader;
+            this->sources.append(source);
+        }
+        this->mode = mode;
+        this->mergedChunks = 0;
+    }
+
+    MergingLogReader::~MergingLogReader() {
+        for (int i = 0; i < this->sources.size(); i++)
+            delete this->sources[i].reader;
+    }
+
+    bool MergingLogReader::open() {
+        if (this->sources.isEmpty()) {
+            this->error = "No logs to merge.";
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Read the next chunk of lines, merged by timestamp.
+     *
+     * @param chunk
+     *   The chunk to fill. It keeps the blocks of all sources its lines
+     *   point into alive.
+     * @param maxLines
+     *   The maximum number of lines to read.
+     * @return
+     *   false if the ends of all logs were reached.
+     */
+    bool MergingLogReader::readChunk(LogChunk & chunk, int maxLines) {
+        Cursor cursor;
+
+        chunk.clear();
+        chunk.lines.reserve(maxLines);
+
+        // Fill the heap upon the first call.
+        if (this->mergedChunks == 0) {
+            for (int i = 0; i < this->sources.size(); i++) {
+                if (this->advance(i, maxLines)) {
+                    cursor.time = this->sources[i].time;
+                    cursor.source = i;
+                    this->heap.append(cursor);
+                }
+            }
+            std::make_heap(this->heap.begin(), this->heap.end(), LaterCursor());
+        }
+        this->mergedChunks++;
+
+        while (chunk.lines.size() < maxLines && !this->heap.isEmpty()) {
+            std::pop_heap(this->heap.begin(), this->heap.end(), LaterCursor());
+            cursor = this->heap.last();
+            this->heap.pop_back();
+
+            Source & source = this->sources[cursor.source];
+            chunk.lines.append(source.chunk.lines[source.position]);
+            if (source.mergedChunk != this->mergedChunks) {
+                chunk.buffers.append(source.chunk.buffers);
+                source.mergedChunk = this->mergedChunks;
+            }
+
+            source.position++;
+            if (this->advance(cursor.source, maxLines)) {
+                cursor.time = source.time;
+                this->heap.append(cursor);
+                std::push_heap(this->heap.begin(), this->heap.end(), LaterCursor());
+            }
+        }
+
+        return !chunk.lines.isEmpty();
+    }
+
+    /**
+     * Make the next line of a source available, reading its next chunk if
+     * necessary, and tokenize its timestamp.
+     *
+     * @return
+     *   false if the end of the source's log was reached.
+     */
+    bool MergingLogReader::advance(int s, int maxLines) {
+        Source & source = this->sources[s];
+
+        if (source.position >= source.chunk.lines.size()) {
+            if (!source.reader->readChunk(source.chunk, maxLines)) {
+                // Keep merging the other logs, but remember the failure.
+                if (source.reader->failed() && this->error.isEmpty())
+                    this->error = source.reader->errorString();
+                return false;
+            }
+            source.position = 0;
+            source.mergedChunk = -1;
+        }
+
+        const LineSpan & line = source.chunk.lines[source.position];
+        RawField time;
+        Time decoded;
+        if (LogLineTokenizer::tokenizeTime(line.data, line.length, time, this->mode)
+            && TimestampDecoder::decode(time.data, decoded))
+        {
+            source.time = decoded;
+        }
+
+        return true;
+    }
+}
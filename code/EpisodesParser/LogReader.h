@@ -0,0 +1,278 @@
+#ifndef LOGREADER_H
+#define LOGREADER_H
+
+#include <QtGlobal>
+#include <QFile>
+#include <QByteArray>
+#include <QList>
+#include <QVector>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+#include <QQueue>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QIODevice>
+
+#include <zlib.h>
+
+#include "typedefs.h"
+#include "LogLineTokenizer.h"
+#include "TimestampDecoder.h"
+
+
+namespace EpisodesParser {
+
+    // Size of the blocks read by BufferedLogReader.
+    #define LOGREADER_BLOCK_SIZE (4 * 1024 * 1024)
+    // Size of the window that MappedLogReader asks the kernel to read ahead.
+    #define LOGREADER_READAHEAD_SIZE (64 * 1024 * 1024)
+    // Number of chunks PrefetchingLogReader reads ahead.
+    #define LOGREADER_PREFETCH_DEPTH 4
+    // Longest incomplete line that StreamLogReader keeps buffered.
+    #define LOGREADER_MAX_LINE_LENGTH (1024 * 1024)
+
+    // A single line, without its newline. Points into memory owned by the
+    // LogReader (for mapped files) or by the LogChunk (for buffered files).
+    struct LineSpan {
+        const char * data;
+        int length;
+    };
+
+    struct LogChunk {
+        LogChunk() : offset(0) {}
+
+        // Offset (in bytes) in the log of the first line in this chunk.
+        qint64 offset;
+        QVector<LineSpan> lines;
+        // Keeps the memory the lines point into alive for as long as this
+        // chunk (or a copy of it) exists. Empty for mapped files: those
+        // lines remain valid until the LogReader is deleted.
+        QList<QByteArray> buffers;
+
+        void clear() { this->lines.clear(); this->buffers.clear(); this->offset = 0; }
+    };
+
+    /**
+     * Reads an Episodes log in chunks of lines. No line is ever decoded:
+     * lines are handed out as spans of raw bytes, strings are only
+     * materialized once a field is interned.
+     */
+    class LogReader {
+    public:
+        LogReader(const QString & fileName);
+        virtual ~LogReader();
+
+        static LogReader * create(const QString & fileName);
+        static LogReader * create(const QStringList & fileNames, TokenizerMode mode);
+
+        virtual bool open() = 0;
+        virtual bool readChunk(LogChunk & chunk, int maxLines) = 0;
+        const QString & errorString() const { return this->error; }
+        bool failed() const { return !this->error.isEmpty(); }
+
+    protected:
+        QFile file;
+        QString error;
+    };
+
+    /**
+     * Maps the entire log into memory; lines are views into the mapping.
+     */
+    class MappedLogReader : public LogReader {
+    public:
+        MappedLogReader(const QString & fileName);
+        ~MappedLogReader();
+
+        bool open();
+        bool readChunk(LogChunk & chunk, int maxLines);
+
+    protected:
+        void adviseReadAhead();
+
+        const char * map;
+        qint64 size;
+        qint64 position;
+        qint64 readAheadPosition;
+    };
+
+    /**
+     * Reads the log in large blocks. Used when the log cannot be mapped.
+     */
+    class BufferedLogReader : public LogReader {
+    public:
+        BufferedLogReader(const QString & fileName);
+
+        bool open();
+        bool readChunk(LogChunk & chunk, int maxLines);
+
+    protected:
+        bool fillBuffer();
+        virtual qint64 readBlock(char * data, qint64 maxSize);
+
+        QByteArray buffer;
+        int bufferPosition;
+        qint64 bufferOffset;
+        bool atEnd;
+    };
+
+    /**
+     * Reads the complete lines that were appended to a growing log since a
+     * given offset. A trailing incomplete line (that is still being written)
+     * is left for the next TailLogReader.
+     */
+    class TailLogReader : public BufferedLogReader {
+    public:
+        TailLogReader(const QString & fileName, qint64 startOffset);
+
+        bool open();
+
+        bool wasTruncated() const { return this->truncated; }
+        qint64 endOffset() const { return this->end; }
+
+    protected:
+        qint64 readBlock(char * data, qint64 maxSize);
+
+        qint64 start;
+        qint64 end;
+        bool truncated;
+    };
+
+    /**
+     * Reads lines from a stream (stdin or a local socket) as they arrive,
+     * without ever blocking: readAvailable() takes whatever has arrived, in
+     * large reads, and readChunk() hands out the complete lines among it. An
+     * incomplete last line is kept until the rest of it arrives, or until
+     * the stream is finished, unless it grows beyond
+     * LOGREADER_MAX_LINE_LENGTH: then it's dropped.
+     */
+    class StreamLogReader : public LogReader {
+    public:
+        StreamLogReader(const QString & name);
+
+        bool open();
+        bool readChunk(LogChunk & chunk, int maxLines);
+
+        qint64 readAvailable(int fd);
+        qint64 readAvailable(QIODevice * device);
+        void setFinished() { this->finished = true; }
+        bool isFinished() const { return this->finished; }
+        int droppedLines() const { return this->oversizedLines; }
+
+    protected:
+        QByteArray takeRemainder();
+        bool skipRestOfLine();
+
+        QString name;
+        QByteArray buffer;
+        int bufferPosition;
+        qint64 bufferOffset;
+        bool finished;
+        // The rest of an oversized line has yet to arrive.
+        bool skippingLine;
+        int oversizedLines;
+    };
+
+    /**
+     * Decompresses a gzipped log as a stream: no decompressed copy is ever
+     * written to disk. Concatenated gzip members (e.g. from "cat a.gz b.gz")
+     * are supported.
+     */
+    class GzipLogReader : public BufferedLogReader {
+    public:
+        GzipLogReader(const QString & fileName);
+        ~GzipLogReader();
+
+        static bool isGzipped(const QString & fileName);
+
+        bool open();
+
+    protected:
+        qint64 readBlock(char * data, qint64 maxSize);
+
+        z_stream stream;
+        bool streamInitialized;
+        // A gzip member has been started but not yet ended.
+        bool inMember;
+        QByteArray input;
+    };
+
+    /**
+     * Runs another LogReader in a separate thread, which reads up to
+     * LOGREADER_PREFETCH_DEPTH chunks ahead. This overlaps reading (and
+     * decompressing) the log with tokenizing it.
+     */
+    class PrefetchingLogReader : public QThread, public LogReader {
+    public:
+        PrefetchingLogReader(LogReader * source);
+        ~PrefetchingLogReader();
+
+        bool open();
+        bool readChunk(LogChunk & chunk, int maxLines);
+
+    protected:
+        void run();
+
+        LogReader * source;
+        int maxLines;
+
+        QMutex mutex;
+        QWaitCondition notEmpty;
+        QWaitCondition notFull;
+        QQueue<LogChunk> queue;
+        bool sourceExhausted;
+        bool stopped;
+    };
+
+    /**
+     * Merges the lines of several logs (e.g. one per web server) into a
+     * single stream, ordered by timestamp. Each log must be ordered by
+     * timestamp itself. This is a k-way merge: a min-heap holds the next
+     * line of every log.
+     *
+     * Only the timestamps of lines are tokenized here. Lines whose timestamp
+     * cannot be tokenized keep their position relative to the line before
+     * them in the same log.
+     */
+    class MergingLogReader : public LogReader {
+    public:
+        MergingLogReader(const QList<LogReader *> & sources, TokenizerMode mode);
+        ~MergingLogReader();
+
+        bool open();
+        bool readChunk(LogChunk & chunk, int maxLines);
+
+    protected:
+        struct Source {
+            LogReader * reader;
+            LogChunk chunk;
+            int position;
+            Time time;
+            // The last merged chunk that references this source's chunk.
+            int mergedChunk;
+        };
+
+        struct Cursor {
+            Time time;
+            int source;
+        };
+
+        // Orders the heap such that the earliest line is on top; ties are
+        // broken by source, which keeps the merge deterministic.
+        struct LaterCursor {
+            bool operator()(const Cursor & a, const Cursor & b) const {
+                return a.time > b.time || (a.time == b.time && a.source > b.source);
+            }
+        };
+
+        bool advance(int source, int maxLines);
+
+        QVector<Source> sources;
+        QVector<Cursor> heap;
+        TokenizerMode mode;
+        int mergedChunks;
+    };
+
+}
+
+#endif // LOGREADER_H
@@ -0,0 +1,540 @@
+#include "ParsedLogCache.h"
+
+#include <string.h>
+#include <limits.h>
+
+namespace EpisodesParser {
+
+    //---------------------------------------------------------------------------
+    // ParsedLogCache public static methods.
+
+    /**
+     * The cache file for the given logs: it's named after their signature,
+     * so that a log that was modified (or a parser helper that was updated)
+     * results in a different cache file.
+     *
+     * @param directory
+     *   The directory in which caches are stored.
+     * @param logFileNames
+     *   The full paths to the Episodes log files that are parsed together.
+     * @param parserSignature
+     *   Identifies everything besides the logs that affects the expanded
+     *   lines: the parser helpers' data files, the tokenizer mode.
+     * @return
+     *   The full path to the cache file.
+     */
+    QString ParsedLogCache::fileNameFor(const QString & directory, const QStringList & logFileNames, const QByteArray & parserSignature) {
+        QByteArray signature = ParsedLogCache::signatureFor(logFileNames, parserSignature);
+        return QDir(directory).absoluteFilePath(QString(signature.toHex()) + PARSEDLOGCACHE_EXTENSION);
+    }
+
+    /**
+     * @return
+     *   A 16-byte signature of the given logs (path, size and modification
+     *   time of each) and the given parser signature.
+     */
+    QByteArray ParsedLogCache::signatureFor(const QStringList & logFileNames, const QByteArray & parserSignature) {
+        QCryptographicHash hash(QCryptographicHash::Md5);
+        hash.addData(parserSignature);
+        foreach (const QString & fileName, logFileNames) {
+            QFileInfo info(fileName);
+            hash.addData(info.absoluteFilePath().toUtf8());
+            hash.addData(QByteArray::number(info.size()));
+            hash.addData(QByteArray::number(info.lastModified().toTime_t()));
+        }
+        return hash.result();
+    }
+
+
+    //---------------------------------------------------------------------------
+    // ParsedLogCacheWriter public methods.
+
+    ParsedLogCacheWriter::ParsedLogCacheWriter(const QString & fileName, const QByteArray & signature, const ParsedLogCacheInterners & interners) {
+        this->fileName = fileName;
+        this->signature = signature;
+        this->interners = interners;
+        this->failed = false;
+        this->numQuarters = 0;
+    }
+
+    /**
+     * An unfinished cache is discarded.
+     */
+    ParsedLogCacheWriter::~ParsedLogCacheWriter() {
+        if (this->file.isOpen()) {
+            this->file.close();
+            this->file.remove();
+        }
+    }
+
+    bool ParsedLogCacheWriter::open() {
+        QDir().mkpath(QFileInfo(this->fileName).absolutePath());
+
+        this->file.setFileName(this->fileName + ".tmp");
+        if (!this->file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qWarning("Could not create parsed log cache '%s'.", qPrintable(this->fileName));
+            return false;
+        }
+
+        Header header;
+        memset(&header, 0, sizeof(Header));
+        memcpy(header.magic, PARSEDLOGCACHE_MAGIC, sizeof(header.magic));
+        header.version = PARSEDLOGCACHE_VERSION;
+        header.byteOrderMark = PARSEDLOGCACHE_BYTE_ORDER_MARK;
+        memcpy(header.signature, this->signature.constData(), qMin(this->signature.size(), (int) sizeof(header.signature)));
+
+        return this->writeColumn(&header, sizeof(Header));
+    }
+
+    /**
+     * Append the expanded lines of a quarter.
+     *
+     * @param quarterID
+     *   The quarter the lines belong to.
+     * @param batch
+     *   The expanded lines of that quarter, in the order they were parsed.
+     * @return
+     *   false if the cache could not be written to; the cache will then be
+     *   discarded.
+     */
+    bool ParsedLogCacheWriter::appendQuarter(uint quarterID, const ExpandedEpisodesLogBatch & batch) {
+        if (this->failed)
+            return false;
+
+        const int numLines = batch.size();
+        QVector<quint32> times(numLines);
+        QVector<quint32> locations(numLines);
+        QVector<quint32> urls(numLines);
+        QVector<quint16> uaHierarchies(numLines);
+        QVector<quint16> statuses(numLines);
+        QVector<quint8> numEpisodes(numLines);
+        QVector<quint8> episodeIDs;
+        QVector<quint16> durations;
+
+        for (int i = 0; i < numLines; i++) {
+            const ExpandedEpisodesLogLine & line = batch.lines[i];
+
+            times[i] = line.time;
+            statuses[i] = line.status;
+
+            if (!this->locationIDs.contains(line.location)) {
+                this->locationIDs.insert(line.location, this->locations.size());
+                this->locations.append(line.location);
+            }
+            locations[i] = this->locationIDs.value(line.location);
+
+            if (!this->uaHierarchyIDs.contains(line.ua)) {
+                this->uaHierarchyIDs.insert(line.ua, this->uaHierarchies.size());
+                this->uaHierarchies.append(line.ua);
+            }
+            uaHierarchies[i] = this->uaHierarchyIDs.value(line.ua);
+
+            if (!this->urlIDs.contains(line.url)) {
+                this->urlIDs.insert(line.url, this->urls.size());
+                this->urls.append(line.url);
+            }
+            urls[i] = this->urlIDs.value(line.url);
+
+            numEpisodes[i] = line.numEpisodes;
+            for (int e = 0; e < line.numEpisodes; e++) {
+                const Episode & episode = batch.episodes[line.firstEpisode + e];
+                episodeIDs.append(this->mapEpisodeID(episode.id));
+                durations.append(episode.duration);
+            }
+        }
+
+        QuarterHeader quarterHeader;
+        quarterHeader.quarterID = quarterID;
+        quarterHeader.numLines = numLines;
+        quarterHeader.numEpisodes = episodeIDs.size();
+        quarterHeader.reserved = 0;
+
+        this->failed = !(this->writeColumn(&quarterHeader, sizeof(QuarterHeader))
+                         && this->writeColumn(times.constData(), numLines * sizeof(quint32))
+                         && this->writeColumn(locations.constData(), numLines * sizeof(quint32))
+                         && this->writeColumn(urls.constData(), numLines * sizeof(quint32))
+                         && this->writeColumn(uaHierarchies.constData(), numLines * sizeof(quint16))
+                         && this->writeColumn(statuses.constData(), numLines * sizeof(quint16))
+                         && this->writeColumn(numEpisodes.constData(), numLines * sizeof(quint8))
+                         && this->writeColumn(episodeIDs.constData(), episodeIDs.size() * sizeof(quint8))
+                         && this->writeColumn(durations.constData(), durations.size() * sizeof(quint16)));
+        this->numQuarters++;
+
+        return !this->failed;
+    }
+
+    /**
+     * Write the dictionaries and the lines of the unfinished quarter, then
+     * replace the actual cache file.
+     *
+     * @param unfinishedQuarter
+     *   The lines of the last quarter, which has not been processed yet.
+     * @return
+     *   true if the cache was written successfully.
+     */
+    bool ParsedLogCacheWriter::finish(const EpisodesLogBatch & unfinishedQuarter) {
+        if (!this->file.isOpen())
+            return false;
+        if (this->failed) {
+            this->file.close();
+            this->file.remove();
+            return false;
+        }
+
+        // Serialize the unfinished quarter first: it may contain episodes
+        // that are not yet in the dictionary.
+        QByteArray pending;
+        QDataStream pendingStream(&pending, QIODevice::WriteOnly);
+        pendingStream.setVersion(QDataStream::Qt_4_6);
+        pendingStream << (quint32) unfinishedQuarter.size();
+        for (int i = 0; i < unfinishedQuarter.size(); i++) {
+            const EpisodesLogLine & line = unfinishedQuarter.lines[i];
+            pendingStream << (quint32) line.ip
+                          << (quint32) line.time
+                          << (quint16) line.status
+                          << this->interners.urls->value(line.url)
+                          << QByteArray(unfinishedQuarter.uas.constData() + line.uaOffset, line.uaLength)
+                          << this->interners.domainNames->value(line.domain.id)
+                          << (quint8) line.numEpisodes;
+            for (int e = 0; e < line.numEpisodes; e++) {
+                const Episode & episode = unfinishedQuarter.episodes[line.firstEpisode + e];
+                pendingStream << this->mapEpisodeID(episode.id) << (quint16) episode.duration;
+            }
+        }
+
+        Trailer trailer;
+        memset(&trailer, 0, sizeof(Trailer));
+        trailer.dictionariesOffset = this->file.pos();
+        trailer.numQuarters = this->numQuarters;
+        memcpy(trailer.magic, PARSEDLOGCACHE_MAGIC, sizeof(trailer.magic));
+
+        QDataStream out(&this->file);
+        out.setVersion(QDataStream::Qt_4_6);
+
+        out << (quint32) this->episodes.size();
+        foreach (EpisodeID id, this->episodes)
+            out << this->interners.episodeNames->value(id);
+
+        out << (quint32) this->locations.size();
+        foreach (LocationID id, this->locations) {
+            const Location location = this->interners.locations->value(id);
+            out << location.continent << location.country << location.region << location.city << location.isp;
+        }
+
+        out << (quint32) this->uaHierarchies.size();
+        foreach (UAHierarchyID id, this->uaHierarchies) {
+            const UAHierarchyDetails ua = this->interners.uaHierarchies->value(id);
+            out << ua.platform << ua.browser_name << ua.browser_version
+                << ua.browser_version_major << ua.browser_version_minor << ua.is_mobile;
+        }
+
+        out << (quint32) this->urls.size();
+        foreach (URLID id, this->urls)
+            out << this->interners.urls->value(id);
+        out.writeRawData(pending.constData(), pending.size());
+
+        if (out.status() != QDataStream::Ok || !this->writeColumn(&trailer, sizeof(Trailer))) {
+            this->file.close();
+            this->file.remove();
+            return false;
+        }
+
+        this->file.close();
+        QFile::remove(this->fileName);
+        if (!this->file.rename(this->fileName)) {
+            this->file.remove();
+            return false;
+        }
+        return true;
+    }
+
+
+    //---------------------------------------------------------------------------
+    // ParsedLogCacheWriter protected methods.
+
+    /**
+     * Write a column, padded to a multiple of 8 bytes so that the next
+     * column is aligned when the cache is mapped.
+     */
+    bool ParsedLogCacheWriter::writeColumn(const void * data, int size) {
+        static const char padding[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+        if (size > 0 && this->file.write((const char *) data, size) != size)
+            return false;
+        int paddingSize = ParsedLogCache::padded(size) - size;
+        return paddingSize == 0 || this->file.write(padding, paddingSize) == paddingSize;
+    }
+
+    quint8 ParsedLogCacheWriter::mapEpisodeID(EpisodeID id) {
+        if (!this->episodeIDs.contains(id)) {
+            this->episodeIDs.insert(id, this->episodes.size());
+            this->episodes.append(id);
+        }
+        return this->episodeIDs.value(id);
+    }
+
+
+    //---------------------------------------------------------------------------
+    // ParsedLogCacheReader public methods.
+
+    ParsedLogCacheReader::ParsedLogCacheReader(const ParsedLogCacheInterners & interners) {
+        this->interners = interners;
+        this->map = NULL;
+        this->position = 0;
+        this->dictionariesOffset = 0;
+        this->quartersLeft = 0;
+    }
+
+    ParsedLogCacheReader::~ParsedLogCacheReader() {
+        if (this->map != NULL)
+            this->file.unmap((uchar *) this->map);
+    }
+
+    /**
+     * Open a cache and load its dictionaries, interning their contents.
+     *
+     * @param fileName
+     *   The full path to the cache file.
+     * @param signature
+     *   The signature the cache must have been written with.
+     * @return
+     *   false if the cache does not exist, is corrupt, or is stale.
+     */
+    bool ParsedLogCacheReader::open(const QString & fileName, const QByteArray & signature) {
+        this->file.setFileName(fileName);
+        if (!this->file.open(QIODevice::ReadOnly))
+            return false;
+
+        const qint64 size = this->file.size();
+        if (size < (qint64) (sizeof(Header) + sizeof(Trailer)))
+            return false;
+
+        this->map = (const char *) this->file.map(0, size);
+        if (this->map == NULL)
+            return false;
+
+        const Header * header = (const Header *) this->map;
+        if (memcmp(header->magic, PARSEDLOGCACHE_MAGIC, sizeof(header->magic)) != 0
+            || header->version != PARSEDLOGCACHE_VERSION
+            || header->byteOrderMark != PARSEDLOGCACHE_BYTE_ORDER_MARK
+            || signature.size() != (int) sizeof(header->signature)
+            || memcmp(header->signature, signature.constData(), sizeof(header->signature)) != 0)
+            return false;
+
+        const Trailer * trailer = (const Trailer *) (this->map + size - sizeof(Trailer));
+        if (memcmp(trailer->magic, PARSEDLOGCACHE_MAGIC, sizeof(trailer->magic)) != 0
+            || trailer->dictionariesOffset < sizeof(Header)
+            || trailer->dictionariesOffset > (quint64) (size - sizeof(Trailer)))
+            return false;
+
+        this->dictionariesOffset = trailer->dictionariesOffset;
+        this->quartersLeft = trailer->numQuarters;
+        this->position = sizeof(Header);
+
+        return this->readDictionaries(this->map + this->dictionariesOffset, size - sizeof(Trailer) - this->dictionariesOffset);
+    }
+
+    /**
+     * Read the next quarter.
+     *
+     * @param quarterID
+     *   The quarter the lines belong to.
+     * @param batch
+     *   The expanded lines of that quarter.
+     * @return
+     *   false if there are no more quarters, or if the cache is corrupt.
+     */
+    bool ParsedLogCacheReader::readQuarter(uint & quarterID, ExpandedEpisodesLogBatch & batch) {
+        batch.lines.clear();
+        batch.episodes.clear();
+        if (this->quartersLeft == 0)
+            return false;
+        if (this->position + (qint64) sizeof(QuarterHeader) > this->dictionariesOffset)
+            return false;
+
+        // The counts are untrusted: check them against the number of bytes
+        // that are left before doing any arithmetic with them. Every line
+        // takes at least 17 bytes, every episode 3. Quarters are never
+        // empty.
+        const QuarterHeader * quarterHeader = (const QuarterHeader *) (this->map + this->position);
+        const qint64 remaining = this->dictionariesOffset - this->position - sizeof(QuarterHeader);
+        if (quarterHeader->numLines == 0
+            || (qint64) quarterHeader->numLines > remaining / 17
+            || (qint64) quarterHeader->numEpisodes > remaining / 3
+            || (qint64) quarterHeader->numLines > INT_MAX
+            || (qint64) quarterHeader->numEpisodes > INT_MAX)
+            return false;
+
+        const int numLines = quarterHeader->numLines;
+        const int numEpisodes = quarterHeader->numEpisodes;
+        const qint64 size = sizeof(QuarterHeader)
+                            + 3 * ParsedLogCache::padded((qint64) numLines * sizeof(quint32))
+                            + 2 * ParsedLogCache::padded((qint64) numLines * sizeof(quint16))
+                            + ParsedLogCache::padded((qint64) numLines * sizeof(quint8))
+                            + ParsedLogCache::padded((qint64) numEpisodes * sizeof(quint8))
+                            + ParsedLogCache::padded((qint64) numEpisodes * sizeof(quint16));
+        if (this->position + size > this->dictionariesOffset)
+            return false;
+
+        const char * p = this->map + this->position + sizeof(QuarterHeader);
+        const quint32 * times = (const quint32 *) p;
+        p += ParsedLogCache::padded(numLines * sizeof(quint32));
+        const quint32 * locations = (const quint32 *) p;
+        p += ParsedLogCache::padded(numLines * sizeof(quint32));
+        const quint32 * urls = (const quint32 *) p;
+        p += ParsedLogCache::padded(numLines * sizeof(quint32));
+        const quint16 * uaHierarchies = (const quint16 *) p;
+        p += ParsedLogCache::padded(numLines * sizeof(quint16));
+        const quint16 * statuses = (const quint16 *) p;
+        p += ParsedLogCache::padded(numLines * sizeof(quint16));
+        const quint8 * lineEpisodes = (const quint8 *) p;
+        p += ParsedLogCache::padded(numLines * sizeof(quint8));
+        const quint8 * episodeIDs = (const quint8 *) p;
+        p += ParsedLogCache::padded(numEpisodes * sizeof(quint8));
+        const quint16 * durations = (const quint16 *) p;
+
+        batch.lines.resize(numLines);
+        batch.episodes.resize(numEpisodes);
+        Episode * episodes = batch.episodes.data();
+        for (int e = 0; e < numEpisodes; e++) {
+            if (episodeIDs[e] >= this->episodes.size()) {
+                batch.episodes.clear();
+                return false;
+            }
+            episodes[e].id = this->episodes[episodeIDs[e]];
+            episodes[e].duration = durations[e];
+#ifdef DEBUG
+            episodes[e].IDNameHash = this->interners.episodeNames;
+#endif
+        }
+
+        ExpandedEpisodesLogLine * lines = batch.lines.data();
+        quint32 firstEpisode = 0;
+        for (int i = 0; i < numLines; i++) {
+            if (locations[i] >= (quint32) this->locations.size()
+                || urls[i] >= (quint32) this->urls.size()
+                || uaHierarchies[i] >= this->uaHierarchies.size()
+                || firstEpisode + lineEpisodes[i] > (quint32) numEpisodes) {
+                batch.lines.clear();
+                batch.episodes.clear();
+                return false;
+            }
+
+            lines[i].time = times[i];
+            lines[i].location = this->locations[locations[i]];
+            lines[i].url = this->urls[urls[i]];
+            lines[i].ua = this->uaHierarchies[uaHierarchies[i]];
+            lines[i].status = statuses[i];
+            lines[i].firstEpisode = firstEpisode;
+            lines[i].numEpisodes = lineEpisodes[i];
+            firstEpisode += lineEpisodes[i];
+        }
+
+        quarterID = quarterHeader->quarterID;
+        this->position += size;
+        this->quartersLeft--;
+        return true;
+    }
+
+
+    //---------------------------------------------------------------------------
+    // ParsedLogCacheReader protected methods.
+
+    /**
+     * Load the dictionaries: intern their contents, to map the cache's IDs
+     * to those of the current interners. Fails if an interner runs out of
+     * IDs.
+     */
+    bool ParsedLogCacheReader::readDictionaries(const char * data, qint64 size) {
+        const QByteArray dictionaries = QByteArray::fromRawData(data, size);
+        QDataStream in(dictionaries);
+        in.setVersion(QDataStream::Qt_4_6);
+        quint32 count;
+
+        EpisodeName episodeName;
+        EpisodeID episodeID;
+        in >> count;
+        for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+            in >> episodeName;
+            if (!this->interners.episodeNames->tryIntern(episodeName, episodeID))
+                return false;
+            this->episodes.append(episodeID);
+        }
+
+        Location location;
+        LocationID locationID;
+        in >> count;
+        for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+            in >> location.continent >> location.country >> location.region >> location.city >> location.isp;
+            location.computeHash();
+            if (!this->interners.locations->tryIntern(location, locationID))
+                return false;
+            this->locations.append(locationID);
+        }
+
+        UAHierarchyDetails ua;
+        UAHierarchyID uaHierarchyID;
+        in >> count;
+        for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+            in >> ua.platform >> ua.browser_name >> ua.browser_version
+               >> ua.browser_version_major >> ua.browser_version_minor >> ua.is_mobile;
+            ua.computeHash();
+            if (!this->interners.uaHierarchies->tryIntern(ua, uaHierarchyID))
+                return false;
+            this->uaHierarchies.append(uaHierarchyID);
+        }
+
+        // UNKNOWN_URL_ID is stored as a null URL.
+        URL url;
+        URLID urlID;
+        in >> count;
+        for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+            in >> url;
+            if (url.isNull())
+                urlID = UNKNOWN_URL_ID;
+            else if (!this->interners.urls->tryIntern(url, urlID))
+                return false;
+            this->urls.append(urlID);
+        }
+
+        // The unfinished quarter.
+        EpisodesLogLine line;
+        Episode episode;
+#ifdef DEBUG
+        episode.IDNameHash = this->interners.episodeNames;
+        line.domain.IDNameHash = this->interners.domainNames;
+#endif
+        quint32 ip, time;
+        quint16 status, duration;
+        quint8 localEpisodeID;
+        QByteArray userAgent;
+        DomainName domain;
+        in >> count;
+        for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+            in >> ip >> time >> status >> url >> userAgent >> domain >> line.numEpisodes;
+            line.ip = ip;
+            line.time = time;
+            line.status = status;
+            if (url.isNull())
+                line.url = UNKNOWN_URL_ID;
+            else if (!this->interners.urls->tryIntern(url, line.url))
+                return false;
+            if (!this->interners.domainNames->tryIntern(domain, line.domain.id))
+                return false;
+            this->pending.setUA(line, userAgent.constData(), userAgent.size());
+            line.firstEpisode = this->pending.episodes.size();
+            for (int j = 0; j < line.numEpisodes; j++) {
+                in >> localEpisodeID >> duration;
+                if (localEpisodeID >= this->episodes.size())
+                    return false;
+                episode.id = this->episodes[localEpisodeID];
+                episode.duration = duration;
+                this->pending.episodes.append(episode);
+            }
+            this->pending.lines.append(line);
+        }
+
+        return in.status() == QDataStream::Ok;
+    }
+
+}
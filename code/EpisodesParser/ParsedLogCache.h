@@ -0,0 +1,160 @@
+#ifndef PARSEDLOGCACHE_H
+#define PARSEDLOGCACHE_H
+
+#include <QtGlobal>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDir>
+#include <QByteArray>
+#include <QDataStream>
+#include <QHash>
+#include <QList>
+#include <QVector>
+#include <QString>
+#include <QStringList>
+#include <QHostAddress>
+#include <QCryptographicHash>
+
+#include "typedefs.h"
+
+
+namespace EpisodesParser {
+
+    #define PARSEDLOGCACHE_MAGIC "EPLCACHE"
+    #define PARSEDLOGCACHE_VERSION 2
+    // Detects caches that were written on a machine with another byte order.
+    #define PARSEDLOGCACHE_BYTE_ORDER_MARK 0x01020304
+    #define PARSEDLOGCACHE_EXTENSION ".eplcache"
+
+    // The interners whose IDs are stored in (or restored from) a cache.
+    struct ParsedLogCacheInterners {
+        EpisodeNameInterner * episodeNames;
+        DomainNameInterner * domainNames;
+        LocationInterner * locations;
+        UAHierarchyInterner * uaHierarchies;
+        URLInterner * urls;
+    };
+
+    /**
+     * A parsed log cache stores the expanded lines of one or more Episodes
+     * logs, so that they can be re-imported without tokenizing them and
+     * without GeoIP and browscap lookups.
+     *
+     * Layout, in native byte order:
+     * - header: magic, version, byte order mark, signature (an MD5 hash of
+     *   the logs and parser helpers this cache was generated from);
+     * - one block per quarter: a quarter header, followed by one column per
+     *   field (time, LocationID, URL ID, UAHierarchyID, status, number of
+     *   episodes), followed by two columns for the episodes of all lines
+     *   (EpisodeID, duration). Every column is padded to 8 bytes;
+     * - dictionaries (QDataStream): episode names, locations, UA hierarchies
+     *   and URLs, indexed by the IDs used in the columns, followed by the
+     *   lines of the last (unfinished) quarter, which have not been
+     *   expanded;
+     * - trailer: offset of the dictionaries, number of quarters, magic.
+     *
+     * IDs are local to the cache: they are remapped to the IDs of the
+     * current interners while loading, since the interners of the process
+     * that wrote the cache are gone.
+     */
+    class ParsedLogCache {
+    public:
+        static QString fileNameFor(const QString & directory, const QStringList & logFileNames, const QByteArray & parserSignature);
+        static QByteArray signatureFor(const QStringList & logFileNames, const QByteArray & parserSignature);
+
+    protected:
+        struct Header {
+            char magic[8];
+            quint32 version;
+            quint32 byteOrderMark;
+            char signature[16];
+        };
+
+        struct QuarterHeader {
+            quint32 quarterID;
+            quint32 numLines;
+            quint32 numEpisodes;
+            quint32 reserved;
+        };
+
+        struct Trailer {
+            quint64 dictionariesOffset;
+            quint32 numQuarters;
+            quint32 reserved;
+            char magic[8];
+        };
+
+        static qint64 padded(qint64 size) { return (size + 7) & ~Q_INT64_C(7); }
+    };
+
+    /**
+     * Writes a parsed log cache, one quarter at a time. The cache is written
+     * to a temporary file, which only replaces the actual cache file once
+     * it's complete.
+     */
+    class ParsedLogCacheWriter : public ParsedLogCache {
+    public:
+        ParsedLogCacheWriter(const QString & fileName, const QByteArray & signature, const ParsedLogCacheInterners & interners);
+        ~ParsedLogCacheWriter();
+
+        bool open();
+        bool appendQuarter(uint quarterID, const ExpandedEpisodesLogBatch & batch);
+        bool finish(const EpisodesLogBatch & unfinishedQuarter);
+
+    protected:
+        bool writeColumn(const void * data, int size);
+        quint8 mapEpisodeID(EpisodeID id);
+
+        QString fileName;
+        QByteArray signature;
+        ParsedLogCacheInterners interners;
+        QFile file;
+        bool failed;
+        quint32 numQuarters;
+
+        // Global (interner) ID to local (cache) ID.
+        QHash<EpisodeID, quint8> episodeIDs;
+        QHash<LocationID, quint32> locationIDs;
+        QHash<UAHierarchyID, quint16> uaHierarchyIDs;
+        QHash<URLID, quint32> urlIDs;
+        QList<EpisodeID> episodes;
+        QList<LocationID> locations;
+        QList<UAHierarchyID> uaHierarchies;
+        QList<URLID> urls;
+    };
+
+    /**
+     * Reads a parsed log cache. The cache is mapped into memory; quarters
+     * are read straight from the mapping.
+     */
+    class ParsedLogCacheReader : public ParsedLogCache {
+    public:
+        ParsedLogCacheReader(const ParsedLogCacheInterners & interners);
+        ~ParsedLogCacheReader();
+
+        bool open(const QString & fileName, const QByteArray & signature);
+        bool readQuarter(uint & quarterID, ExpandedEpisodesLogBatch & batch);
+        const EpisodesLogBatch & unfinishedQuarter() const { return this->pending; }
+
+    protected:
+        bool readDictionaries(const char * data, qint64 size);
+
+        ParsedLogCacheInterners interners;
+        QFile file;
+        const char * map;
+        qint64 position;
+        qint64 dictionariesOffset;
+        quint32 quartersLeft;
+
+        // Local (cache) ID to global (interner) ID.
+        QVector<EpisodeID> episodes;
+        QVector<LocationID> locations;
+        QVector<UAHierarchyID> uaHierarchies;
+        QVector<URLID> urls;
+        EpisodesLogBatch pending;
+    };
+
+}
+
+#endif // PARSEDLOGCACHE_H
@@ -1,35 +1,85 @@
 #include "Parser.h"
 
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 namespace EpisodesParser {
-    EpisodeNameIDHash Parser::episodeNameIDHash;
-    EpisodeIDNameHash Parser::episodeIDNameHash;
-    DomainNameIDHash Parser::domainNameIDHash;
-    DomainIDNameHash Parser::domainIDNameHash;
-    UAHierarchyDetailsIDHash Parser::uaHierarchyDetailsIDHash;
-    UAHierarchyIDDetailsHash Parser::uaHierarchyIDDetailsHash;
-    LocationToIDHash   Parser::locationToIDHash;
-    LocationFromIDHash Parser::locationFromIDHash;
+    EpisodeNameInterner Parser::episodeNameInterner;
+    DomainNameInterner Parser::domainNameInterner;
+    UAHierarchyInterner Parser::uaHierarchyInterner;
+    LocationInterner Parser::locationInterner;
+    URLInterner Parser::urlInterner;
+    int Parser::maxURLs = MAX_URLS;
+    QAtomicInt Parser::uninternableLines(0);
+    ClockCache<quint32, LocationID> Parser::locationCache(LOCATION_CACHE_SIZE);
+    QVector<LocationID> Parser::resolverLocationIDs;
+    ClockCache<quint64, UACacheEntry> Parser::uaCache(UA_CACHE_SIZE);
+    Analytics::ItemDictionary Parser::itemDictionary;
+    ConcurrentIDTable<LocationID, QVector<Analytics::ItemID> > Parser::locationItems;
+    ConcurrentIDTable<UAHierarchyID, QVector<Analytics::ItemID> > Parser::uaHierarchyItems;
+    ConcurrentIDTable<URLID, Analytics::ItemID> Parser::urlItems;
+    ConcurrentIDTable<EpisodeID, Analytics::ItemID> Parser::episodeItems;
+    ConcurrentIDTable<EpisodeSpeedID, Analytics::ItemID> Parser::speedItems;
+    ConcurrentIDTable<HTTPStatus, Analytics::ItemID> Parser::statusItems;
     bool Parser::parserHelpersInitialized = false;
+    QByteArray Parser::parserHelpersSignature;
+    TokenizerMode Parser::tokenizerMode = TOKENIZER_STRICT;
 
-    QBrowsCap Parser::browsCap;
-    QGeoIP Parser::geoIP;
+    LocationResolver * Parser::locationResolver = NULL;
+    UAResolver * Parser::uaResolver = NULL;
     EpisodeDurationDiscretizer Parser::episodeDiscretizer;
 
     QMutex Parser::parserHelpersInitMutex;
-    QMutex Parser::episodeHashMutex;
-    QMutex Parser::domainHashMutex;
-    QMutex Parser::uaHierarchyHashMutex;
-    QMutex Parser::mutex_hashAccess_location;
-    QMutex Parser::regExpMutex;
-    QMutex Parser::dateTimeMutex;
 
     Parser::Parser() {
+        this->batchSlots = NULL;
+        this->setBatchQueueDepth(BATCH_QUEUE_DEPTH);
+        this->cacheWriter = NULL;
+
+        this->following = false;
+        this->followOffset = 0;
+        this->followWatcher = NULL;
+        this->followPollTimer = NULL;
+        this->followQuarterTimer = NULL;
+
+        this->ingesting = false;
+        this->stdinReader = NULL;
+        this->stdinNotifier = NULL;
+        this->streamServer = NULL;
+
         Parser::parserHelpersInitMutex.lock();
         if (!Parser::parserHelpersInitialized)
             qFatal("Call Parser::initParserHelper()  before creating Parser instances.");
         Parser::parserHelpersInitMutex.unlock();
     }
 
+    Parser::~Parser() {
+        delete this->batchSlots;
+        delete this->cacheWriter;
+        delete this->stdinReader;
+        qDeleteAll(this->streamConnections);
+    }
+
+    /**
+     * Set the number of batches that may await analysis before the parser
+     * blocks. Must not be called while parsing.
+     *
+     * @param depth
+     *   The maximum number of batches that have been emitted through
+     *   parsedBatch() but whose analysis has not yet finished.
+     */
+    void Parser::setBatchQueueDepth(int depth) {
+        delete this->batchSlots;
+        this->batchQueueDepth = qMax(1, depth);
+        this->batchSlots = new QSemaphore(this->batchQueueDepth);
+    }
+
+    /**
+     * Initialize the parser helpers with the resolvers that wrap QGeoIP and
+     * QBrowsCap.
+     */
     void Parser::initParserHelpers(const QString & browsCapCSV,
                                    const QString & browsCapIndex,
                                    const QString & geoIPCityDB,
@@ -37,20 +87,72 @@ namespace EpisodesParser {
                                    const QString & episodeDiscretizerCSV)
     {
         Parser::parserHelpersInitMutex.lock();
-        if (!Parser::parserHelpersInitialized) {
-            // About 1.5 MB of permanent memory consumption.
-            Parser::browsCap.setCsvFile(browsCapCSV);
-            Parser::browsCap.setIndexFile(browsCapIndex);
-            Parser::browsCap.buildIndex();
+        bool initialized = Parser::parserHelpersInitialized;
+        Parser::parserHelpersInitMutex.unlock();
+        if (initialized)
+            return;
 
-            // About 25 MB of permanent memory consumption.
-            Parser::geoIP.openDatabases(geoIPCityDB, geoIPISPDB);
+        Parser::initParserHelpers(new QGeoIPLocationResolver(geoIPCityDB, geoIPISPDB),
+                                  new QBrowsCapUAResolver(browsCapCSV, browsCapIndex),
+                                  episodeDiscretizerCSV);
+    }
+
+    /**
+     * Initialize the parser helpers.
+     *
+     * @param locationResolver
+     *   Resolves IP addresses to Locations. The Parser takes ownership.
+     * @param uaResolver
+     *   Resolves User-Agents to UA hierarchies. The Parser takes ownership.
+     * @param episodeDiscretizerCSV
+     *   The full path to the CSV file that defines the episode speeds.
+     */
+    void Parser::initParserHelpers(LocationResolver * locationResolver,
+                                   UAResolver * uaResolver,
+                                   const QString & episodeDiscretizerCSV)
+    {
+        Parser::parserHelpersInitMutex.lock();
+        if (!Parser::parserHelpersInitialized) {
+            if (Parser::locationResolver != locationResolver)
+                delete Parser::locationResolver;
+            if (Parser::uaResolver != uaResolver)
+                delete Parser::uaResolver;
+            Parser::locationResolver = locationResolver;
+            Parser::uaResolver = uaResolver;
+
+            // Intern the resolver's Locations up front, if it has a fixed
+            // set of them. Their items are generated upon first use.
+            Parser::resolverLocationIDs.clear();
+            const int numLocations = locationResolver->numLocations();
+            if (numLocations > 0) {
+                Location location;
+                location.computeHash();
+                Parser::resolverLocationIDs.reserve(numLocations + 1);
+                Parser::resolverLocationIDs.append(Parser::locationInterner.intern(location));
+                for (int i = 0; i < numLocations; i++) {
+                    location = locationResolver->location(i);
+                    location.computeHash();
+                    Parser::resolverLocationIDs.append(Parser::locationInterner.intern(location));
+                }
+            }
 
             // No significant permanent memory consumption.
             Parser::episodeDiscretizer.parseCsvFile(episodeDiscretizerCSV);
 
+            // Parsed log caches must be invalidated whenever the data that
+            // the lines are expanded with changes. Episode durations are
+            // cached as-is, so the discretizer is irrelevant.
+            Parser::parserHelpersSignature = QCryptographicHash::hash(locationResolver->signature() + uaResolver->signature(), QCryptographicHash::Md5);
+
             Parser::parserHelpersInitialized = true;
         }
+        else {
+            // Already initialized: the given resolvers are not used.
+            if (Parser::locationResolver != locationResolver)
+                delete locationResolver;
+            if (Parser::uaResolver != uaResolver)
+                delete uaResolver;
+        }
         Parser::parserHelpersInitMutex.unlock();
     }
 
@@ -58,7 +160,12 @@ namespace EpisodesParser {
      * Clear parser helpers' caches.
      *
      * This clears as many parser helpers' caches as possible:
-     * - QBrowsCap's in-memory cache is cleared
+     * - the resolvers' caches are cleared (e.g. QBrowsCap's in-memory cache)
+     * - the IPv4 address to LocationID cache is cleared
+     *
+     * The User-Agent to UAHierarchyID cache is retained: UAHierarchyIDs are
+     * never invalidated, and the UA distribution is similar from one log to
+     * the next.
      *
      * Call this function whenever the Parser will not be used for long
      * periods of time.
@@ -66,7 +173,9 @@ namespace EpisodesParser {
     void Parser::clearParserHelperCaches() {
         Parser::parserHelpersInitMutex.lock();
         if (Parser::parserHelpersInitialized) {
-            Parser::browsCap.resetCache();
+            Parser::locationResolver->clearCache();
+            Parser::uaResolver->clearCache();
+            Parser::locationCache.clear();
 
             Parser::parserHelpersInitialized = false;
         }
@@ -79,55 +188,317 @@ namespace EpisodesParser {
 
 
     /**
-     * Parse the given Episodes log file.
-     *
-     * Emits a signal for every chunk (with CHUNK_SIZE lines). This signal can
-     * then be used to process that chunk. This allows multiple chunks to be
-     * processed in parallel (by using QtConcurrent), if that is desired.
+     * Parse the given Episodes log file, or all Episodes log files in the
+     * given directory (see parseFiles()).
      *
      * @param fileName
-     *   The full path to an Episodes log file.
+     *   The full path to an Episodes log file, or to a directory of them.
      */
     void Parser::parse(const QString & fileName) {
+        QFileInfo info(fileName);
+        if (!info.isDir()) {
+            this->parseFiles(QStringList() << fileName);
+            return;
+        }
+
+        QStringList fileNames;
+        QDir dir(fileName);
+        foreach (const QString & entry, dir.entryList(QStringList() << "*.log" << "*.gz", QDir::Files | QDir::Readable, QDir::Name))
+            fileNames << dir.absoluteFilePath(entry);
+        if (fileNames.isEmpty()) {
+            qWarning("No Episodes log files found in '%s'.", qPrintable(fileName));
+            return;
+        }
+        this->parseFiles(fileNames);
+    }
+
+    /**
+     * Parse the given Episodes log files. Multiple logs (e.g. one per web
+     * server) are read concurrently and merged by timestamp, so quarters
+     * are only cut on the merged stream: a quarter that spans several logs
+     * is processed as a whole.
+     *
+     * The logs are read through LogReaders (memory-mapped whenever possible,
+     * decompressed on the fly in a separate thread when gzipped) in chunks
+     * of CHUNK_SIZE lines. Lines are never decoded as a whole:
+     * they're tokenized straight from the raw bytes and only the fields that
+     * are stored or interned are converted to strings.
+     *
+     * @param fileNames
+     *   The full paths to Episodes log files, each ordered by timestamp.
+     */
+    void Parser::parseFiles(const QStringList & fileNames) {
         // Notify the UI.
         emit parsing(true);
 
-        QFile file;
-        QStringList chunk;
-        int numLines = 0;
+        // Re-import from the parsed log cache if there is one; otherwise
+        // generate it while parsing, unless quarters have been processed
+        // before (those would be missing from it).
+        QString cacheFile;
+        QByteArray signature;
+        if (!this->cacheDirectory.isEmpty()) {
+            QByteArray parserSignature = Parser::parserHelpersSignature + QByteArray::number(Parser::tokenizerMode);
+            cacheFile = ParsedLogCache::fileNameFor(this->cacheDirectory, fileNames, parserSignature);
+            signature = ParsedLogCache::signatureFor(fileNames, parserSignature);
+
+            if (QFile::exists(cacheFile) && this->parseCache(cacheFile, signature)) {
+                // Notify the UI.
+                emit parsing(false);
+                Parser::clearParserHelperCaches();
+                return;
+            }
 
-        file.setFileName(fileName);
-        if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            if (this->quarters.lastClosedQuarterID() == 0 && this->quarters.isEmpty()) {
+                this->cacheWriter = new ParsedLogCacheWriter(cacheFile, signature, Parser::cacheInterners());
+                if (!this->cacheWriter->open()) {
+                    delete this->cacheWriter;
+                    this->cacheWriter = NULL;
+                }
+            }
+        }
+
+        // Every path must reach the clean-up below: deleting an unfinished
+        // cache writer removes its temporary file.
+        LogReader * reader = LogReader::create(fileNames, Parser::tokenizerMode);
+        if (reader == NULL) {
             // TODO: emit signal indicating parsing failure.
-            return;
+            emit parsing(false);
         }
         else {
             this->timer.start();
-            QTextStream in(&file);
-            while (!in.atEnd()) {
-                chunk.append(in.readLine());
-                numLines++;
-                if (chunk.size() == CHUNK_SIZE) {
-                    this->processParsedChunk(chunk);
-                    chunk.clear();
-                }
-            }
-
-            // Check if we have another chunk (with size < CHUNK_SIZE).
-            if (chunk.size() > 0) {
+            LogChunk chunk;
+            Parser::locationCache.resetStatistics();
+            Parser::uaCache.resetStatistics();
+            const int uninternableLines = Parser::uninternableLines;
+            while (reader->readChunk(chunk, CHUNK_SIZE))
                 this->processParsedChunk(chunk);
-            }
+
+            // Don't cache a log that could only be read in part.
+            const bool failed = reader->failed();
+            if (failed)
+                qWarning("Parsing failed: %s", qPrintable(reader->errorString()));
+            delete reader;
+
+            if (Parser::uninternableLines != uninternableLines)
+                qWarning("Skipped %d lines: too many distinct episode names or domain names to intern.", Parser::uninternableLines - uninternableLines);
+
+            if (!failed && this->cacheWriter != NULL && !this->cacheWriter->finish(this->quarters.unclosedLines()))
+                qWarning("Could not write parsed log cache '%s'.", qPrintable(cacheFile));
+
+#ifdef DEBUG
+            qDebug() << "Location cache:"
+                     << Parser::locationCache.hits() << "hits,"
+                     << Parser::locationCache.misses() << "misses.";
+            qDebug() << "User-Agent cache:"
+                     << Parser::uaCache.hits() << "hits,"
+                     << Parser::uaCache.misses() << "misses.";
+#endif
 
             // Notify the UI.
             emit parsing(false);
         }
 
+        delete this->cacheWriter;
+        this->cacheWriter = NULL;
+
         Parser::clearParserHelperCaches();
     }
 
+    /**
+     * Follow the given Episodes log file: parse whatever has been appended to
+     * it since the last time it was followed, then keep watching it for
+     * appended lines, until stopFollowing() is called.
+     *
+     * Changes are detected through QFileSystemWatcher, with polling as a
+     * fallback (for file systems that do not support it, and for logs that
+     * are rotated). A batch is processed as soon as its quarter has ended
+     * (plus a grace period for lagging writes), rather than when the first
+     * line of the next quarter arrives.
+     *
+     * The offset up to which the log has been processed and the last
+     * processed quarter are checkpointed in QSettings, so that following
+     * the same log again (e.g. after a restart) resumes where it left off.
+     *
+     * Follow mode and ingestion share the quarter reorder buffer, so a log
+     * cannot be followed while ingesting.
+     *
+     * @param fileName
+     *   The full path to an Episodes log file.
+     */
+    void Parser::follow(const QString & fileName) {
+        if (this->ingesting) {
+            qWarning("Cannot follow '%s' while ingesting a stream.", qPrintable(fileName));
+            return;
+        }
+        if (this->following)
+            this->stopFollowing();
+
+        // Notify the UI.
+        emit parsing(true);
+
+        this->following = true;
+        this->followedFile = fileName;
+        this->loadFollowCheckpoint();
+
+        // These must be created in the thread the Parser lives in.
+        if (this->followWatcher == NULL) {
+            this->followWatcher = new QFileSystemWatcher(this);
+            connect(this->followWatcher, SIGNAL(fileChanged(QString)), SLOT(readAppendedLines()));
+
+            this->followPollTimer = new QTimer(this);
+            this->followPollTimer->setInterval(FOLLOW_POLL_INTERVAL);
+            connect(this->followPollTimer, SIGNAL(timeout()), SLOT(readAppendedLines()));
+        }
+        this->followWatcher->addPath(fileName);
+        this->followPollTimer->start();
+        this->startQuarterTimer();
+
+        this->timer.start();
+        this->readAppendedLines();
+    }
+
+    /**
+     * Stop following the log that is currently being followed. The batches
+     * of open quarters are not processed: they will be when following is
+     * resumed.
+     */
+    void Parser::stopFollowing() {
+        if (!this->following)
+            return;
+
+        this->followPollTimer->stop();
+        this->followQuarterTimer->stop();
+        if (!this->followWatcher->files().isEmpty())
+            this->followWatcher->removePaths(this->followWatcher->files());
+
+        // Only the followed log has lines in the reorder buffer: ingestion
+        // cannot run at the same time (see follow()).
+        this->saveFollowCheckpoint();
+        this->following = false;
+        this->quarters.reset(this->quarters.lastClosedQuarterID());
+
+        // Notify the UI.
+        emit parsing(false);
+    }
+
+    /**
+     * Ingest Episodes log lines as they are streamed to the parser, until
+     * stopIngesting() is called (or, for stdin, until it is closed).
+     *
+     * Streams are never waited for: whatever has arrived is read in large
+     * non-blocking reads, and the complete lines among it are tokenized
+     * and batched exactly like lines read from files. Quarters are closed
+     * when the watermark passes their end and, like in follow mode, when
+     * they have ended according to the wall clock.
+     *
+     * @param source
+     *   "-" to read from stdin (UNIX only), otherwise the path of a local
+     *   (UNIX domain) socket to listen on. Any number of writers may
+     *   connect to it; their lines are merged by the reorder buffer.
+     *
+     * Ingestion and follow mode share the quarter reorder buffer, so
+     * streams cannot be ingested while following a log.
+     */
+    void Parser::ingest(const QString & source) {
+        if (this->following) {
+            qWarning("Cannot ingest '%s' while following a log.", qPrintable(source));
+            return;
+        }
+        if (this->ingesting)
+            this->stopIngesting();
+
+        // Notify the UI.
+        emit parsing(true);
+
+        this->ingesting = true;
+        this->timer.start();
+
+        // These must be created in the thread the Parser lives in.
+        if (source == "-") {
+#ifdef Q_OS_UNIX
+            ::fcntl(STDIN_FILENO, F_SETFL, ::fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+            this->stdinReader = new StreamLogReader("stdin");
+            this->stdinNotifier = new QSocketNotifier(STDIN_FILENO, QSocketNotifier::Read, this);
+            connect(this->stdinNotifier, SIGNAL(activated(int)), SLOT(readStdin()));
+#else
+            qWarning("Ingesting from stdin is only supported on UNIX.");
+            this->stopIngesting();
+            return;
+#endif
+        }
+        else {
+            // Remove the socket file that a crashed instance may have left.
+            QLocalServer::removeServer(source);
+            this->streamServer = new QLocalServer(this);
+            if (!this->streamServer->listen(source)) {
+                qWarning("Could not listen on '%s': %s.", qPrintable(source), qPrintable(this->streamServer->errorString()));
+                this->stopIngesting();
+                return;
+            }
+            connect(this->streamServer, SIGNAL(newConnection()), SLOT(acceptStreamConnection()));
+        }
+
+        this->startQuarterTimer();
+    }
+
+    /**
+     * Stop ingesting. Unlike in follow mode, there is nothing to resume
+     * from: incomplete last lines and the batches of open quarters are
+     * processed right away.
+     */
+    void Parser::stopIngesting() {
+        if (!this->ingesting)
+            return;
+
+        if (this->stdinReader != NULL) {
+            // This may be called from within the notifier's activated()
+            // signal: it must not be deleted right away.
+            this->stdinNotifier->setEnabled(false);
+            disconnect(this->stdinNotifier, 0, this, 0);
+            this->stdinNotifier->deleteLater();
+            this->stdinNotifier = NULL;
+            this->stdinReader->setFinished();
+            this->processStream(this->stdinReader);
+            delete this->stdinReader;
+            this->stdinReader = NULL;
+        }
+
+        if (this->streamServer != NULL) {
+            this->streamServer->close();
+            this->streamServer->deleteLater();
+            this->streamServer = NULL;
+        }
+        foreach (QLocalSocket * socket, this->streamConnections.keys()) {
+            StreamLogReader * reader = this->streamConnections.take(socket);
+            disconnect(socket, 0, this, 0);
+            reader->readAvailable(socket);
+            reader->setFinished();
+            this->processStream(reader);
+            delete reader;
+            socket->deleteLater();
+        }
+
+        this->ingesting = false;
+
+        if (this->followQuarterTimer != NULL)
+            this->followQuarterTimer->stop();
+
+        uint quarterID;
+        EpisodesLogBatch openBatch;
+        while (this->quarters.takeQuarterBefore((uint) -1, quarterID, openBatch))
+            this->processBatch(openBatch);
+        emit reorderStatus(this->quarters.openQuarters(), (int) this->quarters.droppedLateLines());
+
+        // Notify the UI.
+        emit parsing(false);
+    }
+
+    /**
+     * Must be called whenever the analysis of a batch has finished, to make
+     * room in the batch queue.
+     */
     void Parser::continueParsing() {
-        QMutexLocker(&this->mutex);
-        this->condition.wakeOne();
+        this->batchSlots->release();
     }
 
 
@@ -139,25 +510,27 @@ namespace EpisodesParser {
      *
      * @param name
      *   Episode name.
-     * @return
+     * @param id
      *   The corresponding episode ID.
+     * @return
+     *   false if it's a new episode name, but all episode IDs are in use.
      *
-     * Modifies a class variable upon some calls (i.e. when a new key must be
-     * inserted in the QHash), hence we need to use a mutex to ensure thread
-     * safety.
+     * Thread-safe: lookups of known keys never lock, see ConcurrentInterner.
      */
-    EpisodeID Parser::mapEpisodeNameToID(EpisodeName name) {
-        if (!Parser::episodeNameIDHash.contains(name)) {
-            Parser::episodeHashMutex.lock();
-
-            EpisodeID id = Parser::episodeNameIDHash.size();
-            Parser::episodeNameIDHash.insert(name, id);
-            Parser::episodeIDNameHash.insert(id, name);
-
-            Parser::episodeHashMutex.unlock();
-        }
+    bool Parser::mapEpisodeNameToID(const EpisodeName & name, EpisodeID & id) {
+        return Parser::episodeNameInterner.tryIntern(name, id);
+    }
 
-        return Parser::episodeNameIDHash[name];
+    /**
+     * Map an episode ID back to its episode name.
+     *
+     * @param id
+     *   Episode ID.
+     * @return
+     *   The corresponding episode name.
+     */
+    EpisodeName Parser::mapEpisodeIDToName(EpisodeID id) {
+        return Parser::episodeNameInterner.value(id);
     }
 
     /**
@@ -165,27 +538,15 @@ namespace EpisodesParser {
      *
      * @param name
      *   Domain name.
-     * @return
+     * @param id
      *   The corresponding domain ID.
+     * @return
+     *   false if it's a new domain name, but all domain IDs are in use.
      *
-     * Modifies a class variable upon some calls (i.e. when a new key must be
-     * inserted in the QHash), hence we need to use a mutex to ensure thread
-     * safety.
+     * Thread-safe: lookups of known keys never lock, see ConcurrentInterner.
      */
-    DomainID Parser::mapDomainNameToID(DomainName name) {
-        if (!Parser::domainNameIDHash.contains(name)) {
-            Parser::domainHashMutex.lock();
-
-            DomainID id = Parser::domainNameIDHash.size();
-            Parser::domainNameIDHash.insert(name, id);
-#ifdef DEBUG
-            Parser::domainIDNameHash.insert(id, name);
-#endif
-
-            Parser::domainHashMutex.unlock();
-        }
-
-        return Parser::domainNameIDHash[name];
+    bool Parser::mapDomainNameToID(const DomainName & name, DomainID & id) {
+        return Parser::domainNameInterner.tryIntern(name, id);
     }
 
     /**
@@ -197,22 +558,16 @@ namespace EpisodesParser {
      * @return
      *   The corresponding UA hierarchy ID.
      *
-     * Modifies a class variable upon some calls (i.e. when a new key must be
-     * inserted in the QHash), hence we need to use a mutex to ensure thread
-     * safety.
+     * Thread-safe: lookups of known keys never lock, see ConcurrentInterner.
      */
-    UAHierarchyID Parser::mapUAHierarchyToID(UAHierarchyDetails ua) {
-        if (!Parser::uaHierarchyDetailsIDHash.contains(ua)) {
-            Parser::uaHierarchyHashMutex.lock();
-
-            UAHierarchyID id = Parser::uaHierarchyDetailsIDHash.size();
-            Parser::uaHierarchyDetailsIDHash.insert(ua, id);
-            Parser::uaHierarchyIDDetailsHash.insert(id, ua);
+    UAHierarchyID Parser::mapUAHierarchyToID(const UAHierarchyDetails & ua) {
+        UAHierarchyID id = Parser::uaHierarchyInterner.intern(ua);
 
-            Parser::uaHierarchyHashMutex.unlock();
-        }
+        // Generate its items upon first interning.
+        if (Parser::uaHierarchyItems.find(id) == NULL)
+            Parser::uaHierarchyItems.insert(id, Parser::mapItemsToIDs(ua.generateAssociationRuleItems()));
 
-        return Parser::uaHierarchyDetailsIDHash[ua];
+        return id;
     }
 
     /**
@@ -223,22 +578,150 @@ namespace EpisodesParser {
      * @return
      *   The corresponding location ID.
      *
-     * Modifies a class variable upon some calls (i.e. when a new key must be
-     * inserted in the QHash), hence we need to use a mutex to ensure thread
-     * safety.
+     * Thread-safe: lookups of known keys never lock, see ConcurrentInterner.
      */
     LocationID Parser::mapLocationToID(const Location & location) {
-        if (!Parser::locationToIDHash.contains(location)) {
-            Parser::mutex_hashAccess_location.lock();
+        LocationID id = Parser::locationInterner.intern(location);
 
-            LocationID id = Parser::locationToIDHash.size();
-            Parser::locationToIDHash.insert(location, id);
-            Parser::locationFromIDHash.insert(id, location);
+        // Generate its items upon first interning.
+        if (Parser::locationItems.find(id) == NULL)
+            Parser::locationItems.insert(id, Parser::mapItemsToIDs(location.generateAssociationRuleItems()));
 
-            Parser::mutex_hashAccess_location.unlock();
-        }
+        return id;
+    }
+
+    /**
+     * Map a URL to a URL ID. Generate a new ID when necessary, unless the
+     * maximum number of URLs (see setMaxURLs()) has been reached: new URLs
+     * then map to UNKNOWN_URL_ID. Concurrent inserts may overshoot that
+     * maximum slightly.
+     *
+     * @param url
+     *   URL.
+     * @return
+     *   The corresponding URL ID, or UNKNOWN_URL_ID.
+     *
+     * Thread-safe: lookups of known keys never lock, see ConcurrentInterner.
+     */
+    URLID Parser::mapURLToID(const URL & url) {
+        URLID id;
+        if (Parser::urlInterner.find(url, id))
+            return id;
+        if (Parser::urlInterner.size() >= Parser::maxURLs || !Parser::urlInterner.tryIntern(url, id))
+            return UNKNOWN_URL_ID;
+        return id;
+    }
+
+    /**
+     * Map association rule items to their item IDs in the item dictionary.
+     *
+     * @param items
+     *   Association rule items.
+     * @return
+     *   The corresponding item IDs, in the same order.
+     *
+     * Thread-safe: takes the item dictionary's lock, so it's only used when
+     * items are generated, not for every line.
+     */
+    QVector<Analytics::ItemID> Parser::mapItemsToIDs(const QStringList & items) {
+        QVector<Analytics::ItemID> ids;
+        ids.reserve(items.size());
+        foreach (const QString & item, items)
+            ids.append(Parser::itemDictionary.intern(item));
+        return ids;
+    }
+
+    /**
+     * Map a Location ID to its association rule items.
+     *
+     * @param id
+     *   Location ID.
+     * @return
+     *   The item IDs for the corresponding Location. They're generated only
+     *   once per ID; mostly upon first interning (IDs that were interned
+     *   elsewhere, e.g. while loading a parsed log cache, get them upon
+     *   first use).
+     *
+     * Thread-safe: never locks once generated, see ConcurrentIDTable.
+     */
+    const QVector<Analytics::ItemID> & Parser::mapLocationIDToItems(LocationID id) {
+        const QVector<Analytics::ItemID> * items = Parser::locationItems.find(id);
+        if (items != NULL)
+            return *items;
+        return Parser::locationItems.insert(id, Parser::mapItemsToIDs(Parser::locationInterner.value(id).generateAssociationRuleItems()));
+    }
+
+    /**
+     * Map a UA hierarchy ID to its association rule items.
+     *
+     * @param id
+     *   UA hierarchy ID.
+     * @return
+     *   The item IDs for the corresponding UA hierarchy. See
+     *   mapLocationIDToItems().
+     *
+     * Thread-safe: never locks once generated, see ConcurrentIDTable.
+     */
+    const QVector<Analytics::ItemID> & Parser::mapUAHierarchyIDToItems(UAHierarchyID id) {
+        const QVector<Analytics::ItemID> * items = Parser::uaHierarchyItems.find(id);
+        if (items != NULL)
+            return *items;
+        return Parser::uaHierarchyItems.insert(id, Parser::mapItemsToIDs(Parser::uaHierarchyInterner.value(id).generateAssociationRuleItems()));
+    }
+
+    /**
+     * Map a URL ID to its association rule item.
+     *
+     * @param id
+     *   URL ID.
+     * @return
+     *   The item ID for the corresponding URL. Generated upon first use
+     *   rather than upon first interning, to keep the tokenizer lean.
+     *
+     * Thread-safe: never locks once generated, see ConcurrentIDTable.
+     */
+    Analytics::ItemID Parser::mapURLIDToItem(URLID id) {
+        Analytics::ItemID item;
+        if (!Parser::urlItems.lookup(id, item))
+            item = Parser::urlItems.insert(id, Parser::itemDictionary.intern(QString("url:") + Parser::urlInterner.value(id)));
+        return item;
+    }
+
+    /**
+     * Map an episode ID to its association rule item ("episode:name").
+     *
+     * Thread-safe: never locks once generated, see ConcurrentIDTable.
+     */
+    Analytics::ItemID Parser::mapEpisodeIDToItem(EpisodeID id) {
+        Analytics::ItemID item;
+        if (!Parser::episodeItems.lookup(id, item))
+            item = Parser::episodeItems.insert(id, Parser::itemDictionary.intern(QString("episode:") + Parser::mapEpisodeIDToName(id)));
+        return item;
+    }
 
-        return Parser::locationToIDHash[location];
+    /**
+     * Map an episode speed ID to its association rule item ("duration:x").
+     * Speed IDs are never reassigned, see EpisodeDurationDiscretizer.
+     *
+     * Thread-safe: never locks once generated, see ConcurrentIDTable.
+     */
+    Analytics::ItemID Parser::mapSpeedIDToItem(EpisodeSpeedID speedID) {
+        Analytics::ItemID item;
+        if (!Parser::speedItems.lookup(speedID, item))
+            item = Parser::speedItems.insert(speedID, Parser::itemDictionary.intern(Parser::episodeDiscretizer.speedIDToItem(speedID)));
+        return item;
+    }
+
+    /**
+     * Map an HTTP status code to its association rule item ("status:x").
+     *
+     * Thread-safe: never locks once generated, see ConcurrentIDTable.
+     */
+    Analytics::ItemID Parser::mapStatusToItem(HTTPStatus status) {
+        Analytics::ItemID item;
+        if (!Parser::statusItems.lookup(status, item))
+            item = Parser::statusItems.insert(status, Parser::itemDictionary.intern(QString("status:") + QString::number(status)));
+        return item;
     }
 
     /**
@@ -246,77 +729,89 @@ namespace EpisodesParser {
      *
      * @param line
      *   Raw line, as read from the episodes log file.
+     * @param batch
+     *   The batch to append the EpisodesLogLine to.
      * @return
-     *   Corresponding EpisodesLogLine data structure.
+     *   false if the line was malformed, true otherwise.
      */
-    EpisodesLogLine Parser::mapLineToEpisodesLogLine(const QString & line) {
-        static QDateTime timeConvertor;
-        QStringList list, episodesRaw, episodeParts;
-        QString dateTime;
-        int timezoneOffset;
-        Episode episode;
+    bool Parser::mapLineToEpisodesLogLine(const QString & line, EpisodesLogBatch & batch) {
+        const QByteArray raw = line.toUtf8();
+        return Parser::mapLineToEpisodesLogLine(raw.constData(), raw.size(), batch);
+    }
+
+    /**
+     * Map a line (raw bytes) to an EpisodesLogLine data structure.
+     *
+     * The line is tokenized by LogLineTokenizer in the mode that was set
+     * through Parser::setTokenizerMode(). This requires neither a regular
+     * expression nor a lock, hence it can be called from many threads.
+     *
+     * @param line
+     *   Raw line, as read from the episodes log file (without newline).
+     * @param length
+     *   The length of the line, in bytes.
+     * @param batch
+     *   The batch to append the EpisodesLogLine to. Nothing is appended if
+     *   the line is malformed, or if one of its episode names or its domain
+     *   name can't be interned because all IDs are in use (such lines are
+     *   counted, see getUninternableLines()).
+     * @return
+     *   false if the line was not appended, true otherwise.
+     */
+    bool Parser::mapLineToEpisodesLogLine(const char * line, int length, EpisodesLogBatch & batch) {
+        RawEpisodesLogLine rawLine;
         EpisodesLogLine parsedLine;
+        Episode episode;
 
-        Parser::regExpMutex.lock();
-        QRegExp rx("((?:\\d{1,3}\\.){3}\\d{1,3}) \\[\\w+, ([^\\]]+)\\] \\\"\\?ets=([^\\\"]+)\\\" (\\d{3}) \\\"([^\\\"]+)\\\" \\\"([^\\\"]+)\\\" \\\"([^\\\"]+)\\\"");
-        rx.indexIn(line);
-        list = rx.capturedTexts();
-        Parser::regExpMutex.unlock();
+        if (!LogLineTokenizer::tokenize(line, length, rawLine, Parser::tokenizerMode))
+            return false;
 
         // IP address.
-        parsedLine.ip.setAddress(list[1]);
+        parsedLine.ip = rawLine.ip;
 
-        // Time.
-        dateTime = list[2].left(20);
-        timezoneOffset = list[2].right(5).left(3).toInt();
-        Parser::dateTimeMutex.lock();
-        timeConvertor = QDateTime::fromString(dateTime, "dd-MMM-yyyy HH:mm:ss");
-        // Mark this QDateTime as one with a certain offset from UTC, and
-        // set that offset.
-        timeConvertor.setTimeSpec(Qt::OffsetFromUTC);
-        timeConvertor.setUtcOffset(timezoneOffset * 3600);
-        // Convert this QDateTime to UTC.
-        timeConvertor = timeConvertor.toUTC();
-        // Store the UTC timestamp.
-        parsedLine.time = timeConvertor.toTime_t();
-        Parser::dateTimeMutex.unlock();
+        // Time: "dd-MMM-yyyy HH:mm:ss +zzzz", converted to a UTC timestamp.
+        if (!TimestampDecoder::decode(rawLine.time.data, parsedLine.time))
+            return false;
 
         // Episode names and durations.
-        episodesRaw = list[3].split(',');
-        foreach (QString episodeRaw, episodesRaw) {
-            episodeParts = episodeRaw.split(':');
-
-            episode.id       = Parser::mapEpisodeNameToID(episodeParts[0]);
-            episode.duration = episodeParts[1].toInt();
+        parsedLine.firstEpisode = batch.episodes.size();
+        parsedLine.numEpisodes = rawLine.numEpisodes;
+        for (int i = 0; i < rawLine.numEpisodes; i++) {
+            const RawEpisode & rawEpisode = rawLine.episodes[i];
+            if (!Parser::mapEpisodeNameToID(QString::fromLatin1(rawEpisode.name.data, rawEpisode.name.length), episode.id)) {
+                batch.episodes.resize(parsedLine.firstEpisode);
+                Parser::uninternableLines.ref();
+                return false;
+            }
+            episode.duration = rawEpisode.duration;
 #ifdef DEBUG
-            episode.IDNameHash = &Parser::episodeIDNameHash;
+            episode.IDNameHash = &Parser::episodeNameInterner;
 #endif
-            parsedLine.episodes.append(episode);
+            batch.episodes.append(episode);
         }
 
         // HTTP status code.
-        parsedLine.status = list[4].toShort();
+        parsedLine.status = rawLine.status;
 
         // URL.
-        parsedLine.url = list[5];
-
-        // User-Agent.
-        parsedLine.ua = list[6];
+        parsedLine.url = Parser::mapURLToID(QString::fromUtf8(rawLine.url.data, rawLine.url.length));
 
         // Domain name.
-        parsedLine.domain.id = Parser::mapDomainNameToID(list[7]);
+        if (!Parser::mapDomainNameToID(QString::fromLatin1(rawLine.domain.data, rawLine.domain.length), parsedLine.domain.id)) {
+            batch.episodes.resize(parsedLine.firstEpisode);
+            Parser::uninternableLines.ref();
+            return false;
+        }
 #ifdef DEBUG
-        parsedLine.domain.IDNameHash = &domainIDNameHash;
+        parsedLine.domain.IDNameHash = &Parser::domainNameInterner;
 #endif
 
-#ifdef DEBUG
-        /*
-        parsedLine.episodeIDNameHash = &Parser::episodeIDNameHash;
-        parsedLine.domainIDNameHash = &Parser::domainIDNameHash;
-        qDebug() << parsedLine;
-        */
-#endif
-        return parsedLine;
+        // User-Agent: only decoded when it's expanded, and only if it is not
+        // in the UA cache.
+        batch.setUA(parsedLine, rawLine.ua.data, rawLine.ua.length);
+
+        batch.lines.append(parsedLine);
+        return true;
     }
 
     /**
@@ -325,35 +820,40 @@ namespace EpisodesParser {
      * of the ip and User Agent values. I.e. these expanded versions provide
      * a concept hierarchy.
      *
-     * @param line
-     *   EpisodesLogLine data structure.
+     * @param batch
+     *   The batch that contains the EpisodesLogLine.
+     * @param index
+     *   The index of the EpisodesLogLine in the batch.
      * return
-     *   Corresponding ExpandedEpisodesLogLine data structure.
+     *   Corresponding ExpandedEpisodesLogLine data structure. Its episodes
+     *   are the same as those of the EpisodesLogLine.
      */
-    ExpandedEpisodesLogLine Parser::expandEpisodesLogLine(const EpisodesLogLine & line) {
+    ExpandedEpisodesLogLine Parser::expandEpisodesLogLine(const EpisodesLogBatch & batch, int index) {
+        const EpisodesLogLine & line = batch.lines[index];
         ExpandedEpisodesLogLine expandedLine;
-        QGeoIPRecord geoIPRecord;
-        QPair<bool, QBrowsCapRecord> browsCapResult;
         Location location;
         UAHierarchyDetails ua;
 
-        // IP address hierarchy.
-        geoIPRecord = Parser::geoIP.recordByAddr(line.ip);
-        location.continent = geoIPRecord.continentCode;
-        location.country   = geoIPRecord.country;
-        location.city      = geoIPRecord.city;
-        location.region    = geoIPRecord.region;
-        location.isp       = geoIPRecord.isp;
-
-        expandedLine.location = Parser::mapLocationToID(location);
-        expandedLine.locationFromIDHash = &Parser::locationFromIDHash;
+        // IP address hierarchy. If the resolver's Locations have been
+        // interned up front, a lookup yields the LocationID right away.
+        // Otherwise: the same IP addresses recur a lot, so avoid looking
+        // them up in the GeoIP databases again whenever possible.
+        if (!Parser::resolverLocationIDs.isEmpty())
+            expandedLine.location = Parser::resolverLocationIDs[Parser::locationResolver->resolveIndex(line.ip) + 1];
+        else if (!Parser::locationCache.lookup(line.ip, expandedLine.location)) {
+            location = Parser::locationResolver->resolve(line.ip);
+            location.computeHash();
+
+            expandedLine.location = Parser::mapLocationToID(location);
+            Parser::locationCache.insert(line.ip, expandedLine.location);
+        }
 
         // Time.
         expandedLine.time = line.time;
 
         // Episode name and durations.
-        // @TODO: discretize to fast/acceptable/slow.
-        expandedLine.episodes = line.episodes;
+        expandedLine.firstEpisode = line.firstEpisode;
+        expandedLine.numEpisodes = line.numEpisodes;
 
         // HTTP status code.
         expandedLine.status = line.status;
@@ -361,102 +861,195 @@ namespace EpisodesParser {
         // URL.
         expandedLine.url = line.url;
 
-        // User-Agent hierarchy.
-        browsCapResult = Parser::browsCap.matchUserAgent(line.ua);
-        ua.platform              = browsCapResult.second.platform;
-        ua.browser_name          = browsCapResult.second.browser_name;
-        ua.browser_version       = browsCapResult.second.browser_version;
-        ua.browser_version_major = browsCapResult.second.browser_version_major;
-        ua.browser_version_minor = browsCapResult.second.browser_version_minor;
-        ua.is_mobile             = browsCapResult.second.is_mobile;
+        // User-Agent hierarchy. Matching is expensive and the distribution
+        // of User-Agents is very skewed, so cache the results. A cached
+        // entry whose User-Agent differs is a hash collision: a miss.
+        UACacheEntry cached;
+        const QByteArray rawUA = batch.rawUA(index);
+        if (Parser::uaCache.lookup(line.uaHash, cached) && cached.ua == rawUA)
+            expandedLine.ua = cached.hierarchy;
+        else {
+            ua = Parser::uaResolver->resolve(batch.ua(index));
+            ua.computeHash();
 
-        expandedLine.ua = Parser::mapUAHierarchyToID(ua);
-        expandedLine.uaHierarchyIDDetailsHash = &Parser::uaHierarchyIDDetailsHash;
+            expandedLine.ua = Parser::mapUAHierarchyToID(ua);
+            cached.ua = QByteArray(rawUA.constData(), rawUA.size());
+            cached.hierarchy = expandedLine.ua;
+            Parser::uaCache.insert(line.uaHash, cached);
+        }
 
         return expandedLine;
     }
 
 
-    ExpandedEpisodesLogLine Parser::mapAndExpandToEpisodesLogLine(const QString & line) {
-        return Parser::expandEpisodesLogLine(Parser::mapLineToEpisodesLogLine(line));
-    }
-
-    QList<QStringList> Parser::mapExpandedEpisodesLogLineToTransactions(const ExpandedEpisodesLogLine & line) {
-        QList<QStringList> transactions;
-        QStringList itemList;
-        itemList << QString("url:") + QString(line.url)
-                 << Parser::locationFromIDHash.value(line.location).generateAssociationRuleItems()
-                 << Parser::uaHierarchyIDDetailsHash.value(line.ua).generateAssociationRuleItems();
+    /**
+     * Map an expanded line to transactions: one per episode, each consisting
+     * of the episode, its speed and the items that are shared by all
+     * episodes of the line.
+     *
+     * @param line
+     *   An expanded line.
+     * @param episodes
+     *   The episodes of the batch the line is in.
+     * @param transactions
+     *   The batch of transactions to append the transactions to.
+     */
+    void Parser::mapExpandedEpisodesLogLineToTransactions(const ExpandedEpisodesLogLine & line, const Episode * episodes, Analytics::TransactionBatch & transactions) {
+        // The first two items are those of the episode; the shared items
+        // follow. These are generated only once per ID: appending them only
+        // copies item IDs.
+        QVarLengthArray<Analytics::ItemID, 32> transaction(2);
+        if (line.url != UNKNOWN_URL_ID)
+            transaction.append(Parser::mapURLIDToItem(line.url));
+        const QVector<Analytics::ItemID> & locationItems = Parser::mapLocationIDToItems(line.location);
+        transaction.append(locationItems.constData(), locationItems.size());
+        const QVector<Analytics::ItemID> & uaItems = Parser::mapUAHierarchyIDToItems(line.ua);
+        transaction.append(uaItems.constData(), uaItems.size());
 
         // Only include the HTTP status code in the transaction if it's not a 200 status.
-        // TODO: improve performance of this: by simply omitting this check, the entire process becomes 5% faster!
         if (line.status != 200)
-            itemList << QString("status:") + QString::number(line.status);
-
-        Episode episode;
-        EpisodeName episodeName;
-        QStringList transaction;
-        foreach (episode, line.episodes) {
-            episodeName = Parser::episodeIDNameHash[episode.id];
-            transaction << QString("episode:") + episodeName
-                        << QString("duration:") + Parser::episodeDiscretizer.mapToSpeed(episodeName, episode.duration)
-                        // Append the shared items.
-                        << itemList;
-            transactions << transaction;
-            transaction.clear();
+            transaction.append(Parser::mapStatusToItem(line.status));
+
+        EpisodeSpeedID speedID;
+        for (int e = 0; e < line.numEpisodes; e++) {
+            const Episode & episode = episodes[line.firstEpisode + e];
+            speedID = Parser::episodeDiscretizer.mapToSpeedID(episode.id, Parser::mapEpisodeIDToName(episode.id), episode.duration);
+            transaction[0] = Parser::mapEpisodeIDToItem(episode.id);
+            transaction[1] = Parser::mapSpeedIDToItem(speedID);
+            transactions.append(transaction.constData(), transaction.size());
         }
+    }
+
+    /**
+     * Map a slice of an ExpandedEpisodesLogBatch to transactions. Runs on a
+     * thread of the global thread pool, concurrently with the other slices
+     * of the same batch.
+     *
+     * @param slice
+     *   A slice of an ExpandedEpisodesLogBatch.
+     * @return
+     *   The transactions for the lines in this slice, in the same order as
+     *   in the slice.
+     */
+    Analytics::TransactionBatch Parser::mapExpandedBatchSliceToTransactions(const ExpandedBatchSlice & slice) {
+        Analytics::TransactionBatch transactions;
+        const ExpandedEpisodesLogLine * lines = slice.batch->lines.constData();
+        const Episode * episodes = slice.batch->episodes.constData();
+
+        for (int i = slice.firstLine; i < slice.firstLine + slice.numLines; i++)
+            Parser::mapExpandedEpisodesLogLineToTransactions(lines[i], episodes, transactions);
 
         return transactions;
     }
 
+    /**
+     * Expand a slice of an EpisodesLogBatch. Runs on a thread of the global
+     * thread pool, concurrently with the other slices of the same batch.
+     *
+     * @param slice
+     *   A slice of an EpisodesLogBatch.
+     * @return
+     *   The expanded lines, in the same order as in the slice.
+     */
+    QVector<ExpandedEpisodesLogLine> Parser::expandBatchSlice(const BatchSlice & slice) {
+        QVector<ExpandedEpisodesLogLine> expandedLines;
+        expandedLines.reserve(slice.numLines);
+
+        for (int i = slice.firstLine; i < slice.firstLine + slice.numLines; i++)
+            expandedLines.append(Parser::expandEpisodesLogLine(*slice.batch, i));
+
+        return expandedLines;
+    }
+
 
     //---------------------------------------------------------------------------
     // Protected slots.
 
-    void Parser::processBatch(const QList<EpisodesLogLine> batch) {
+    void Parser::processBatch(const EpisodesLogBatch & batch) {
+        // Split the batch into slices: a few per thread, to compensate for
+        // slices that take longer than others.
+        QList<BatchSlice> slices;
+        BatchSlice slice;
+        slice.batch = &batch;
+        int numSlices = qMax(1, QThreadPool::globalInstance()->maxThreadCount() * 4);
+        int sliceSize = qMax(1, (batch.size() + numSlices - 1) / numSlices);
+        for (int i = 0; i < batch.size(); i += sliceSize) {
+            slice.firstLine = i;
+            slice.numLines = qMin(sliceSize, batch.size() - i);
+            slices.append(slice);
+        }
+
+        // Perform the expanding of the EpisodesLogLines concurrently: the
+        // resolvers are reentrant (or serialize lookups themselves). The
+        // results are in the same order as the slices.
+        QList< QVector<ExpandedEpisodesLogLine> > expandedSlices = QtConcurrent::blockingMapped(slices, Parser::expandBatchSlice);
+        ExpandedEpisodesLogBatch expandedBatch;
+        expandedBatch.lines.reserve(batch.size());
+        for (int s = 0; s < expandedSlices.size(); s++)
+            expandedBatch.lines += expandedSlices[s];
+        // Implicitly shared: not copied.
+        expandedBatch.episodes = batch.episodes;
+
+        if (this->cacheWriter != NULL)
+            this->cacheWriter->appendQuarter(batch.lines.first().time / 900, expandedBatch);
+
+        this->processExpandedBatch(expandedBatch);
+    }
+
+
+    //---------------------------------------------------------------------------
+    // Protected methods.
+
+    /**
+     * Sample a batch of expanded lines, map the sample to transactions and
+     * emit them, once there is room in the batch queue.
+     *
+     * @param expandedBatch
+     *   The expanded lines of a single quarter.
+     */
+    void Parser::processExpandedBatch(const ExpandedEpisodesLogBatch & expandedBatch) {
         double transactionsPerEvent;
 #ifdef DEBUG
         uint items = 0;
 #endif
 
-        // This 100% concurrent approach fails, because QGeoIP still has
-        // thread-safety issues. Hence, we only do the mapping from a QString
-        // to an EpisodesLogLine concurrently for now.
-        // QtConcurrent::blockingMapped(chunk, Parser::mapAndExpandToEpisodesLogLine);
-
-        // Perform the expanding of the EpisodesLogLines sequentially.
-        // Reason: see above.
-        QList<ExpandedEpisodesLogLine> expandedChunk;
-        EpisodesLogLine line;
-        foreach (line, batch) {
-            expandedChunk << Parser::expandEpisodesLogLine(line);
+        // Shed load if necessary: only a sample of the page views is mined
+        // then. The sampling rate is passed along, to scale support counts.
+        ExpandedEpisodesLogBatch sampledBatch;
+        double samplingRate = this->sampler.sample(expandedBatch, expandedBatch.lines.first().time / 900, sampledBatch);
+        const ExpandedEpisodesLogBatch & minedBatch = (samplingRate < 1.0) ? sampledBatch : expandedBatch;
+
+        // Split the batch into slices: a few per thread, to compensate for
+        // slices that take longer than others.
+        QList<ExpandedBatchSlice> slices;
+        ExpandedBatchSlice slice;
+        slice.batch = &minedBatch;
+        int numSlices = qMax(1, QThreadPool::globalInstance()->maxThreadCount() * 4);
+        int sliceSize = qMax(1, (minedBatch.size() + numSlices - 1) / numSlices);
+        for (int i = 0; i < minedBatch.size(); i += sliceSize) {
+            slice.firstLine = i;
+            slice.numLines = qMin(sliceSize, minedBatch.size() - i);
+            slices.append(slice);
         }
 
         // Perform the mapping from ExpandedEpisodesLogLines to groups of
-        // transactions concurrently
-//        QList< QList<QStringList> > groupedTransactions = QtConcurrent::blockingMapped(expandedChunk, Parser::mapExpandedEpisodesLogLineToTransactions);
-        QList< QList<QStringList> > groupedTransactions;
-        ExpandedEpisodesLogLine expLine;
-        foreach (expLine, expandedChunk) {
-            groupedTransactions << Parser::mapExpandedEpisodesLogLineToTransactions(expLine);
-        }
+        // transactions concurrently. The results are in the same order as
+        // the slices.
+        QList<Analytics::TransactionBatch> groupedTransactions = QtConcurrent::blockingMapped(slices, Parser::mapExpandedBatchSliceToTransactions);
 
-        // Perform the merging of transaction groups into a single list of
+        // Perform the merging of transaction groups into a single batch of
         // transactions sequentially (impossible to do concurrently).
-        QList<QStringList> transactions;
-        QList<QStringList> transactionGroup;
-        foreach (transactionGroup, groupedTransactions) {
-            transactions.append(transactionGroup);
+        Analytics::TransactionBatch transactions;
+        for (int g = 0; g < groupedTransactions.size(); g++)
+            transactions.append(groupedTransactions[g]);
 #ifdef DEBUG
-            foreach (const QStringList & transaction, transactionGroup)
-                items += transaction.size();
+        items = transactions.numItems();
 #endif
-        }
 
-        transactionsPerEvent = ((double) transactions.size()) / batch.size();
+        transactionsPerEvent = ((double) transactions.size()) / minedBatch.size();
 
         /*
-        qDebug() << "Processed batch of" << batch.size() << "lines!"
+        qDebug() << "Processed batch of" << expandedBatch.size() << "lines!"
                  << "Transactions generated:" << transactions.size() << "."
                  << "(" << transactionsPerEvent << "transactions/event)"
 #ifdef DEBUG
@@ -464,55 +1057,358 @@ namespace EpisodesParser {
                  << "(" << items << "items in total)"
 #endif
                  << "Events occurred between"
-                 << QDateTime::fromTime_t(batch.first().time).toString("yyyy-MM-dd hh:mm:ss").toStdString().c_str()
+                 << QDateTime::fromTime_t(expandedBatch.lines.first().time).toString("yyyy-MM-dd hh:mm:ss").toStdString().c_str()
                  << "and"
-                 << QDateTime::fromTime_t(batch.last().time).toString("yyyy-MM-dd hh:mm:ss").toStdString().c_str();
+                 << QDateTime::fromTime_t(expandedBatch.lines.last().time).toString("yyyy-MM-dd hh:mm:ss").toStdString().c_str();
     */
         emit parsedDuration(timer.elapsed());
-        emit parsedBatch(transactions, transactionsPerEvent, batch.first().time, batch.last().time);
 
+        // Let the parser run ahead of the analyst, but only by a bounded
+        // number of batches: block while the batch queue is full.
+        QTime stallTimer;
+        stallTimer.start();
+        this->batchSlots->acquire();
+        int stallDuration = stallTimer.elapsed();
+
+        emit parsedBatch(transactions, transactionsPerEvent, samplingRate, expandedBatch.lines.first().time, expandedBatch.lines.last().time);
+        emit batchQueueStatus(this->batchQueueDepth - this->batchSlots->available(), stallDuration);
 
-        // Pause the parsing until these transactions have been processed!
-        this->mutex.lock();
-        this->condition.wait(&this->mutex);
         this->timer.start(); // Restart the timer.
-        this->mutex.unlock();
     }
 
+    /**
+     * Tokenize a slice of a chunk. Runs on a thread of the global thread
+     * pool, concurrently with the other slices of the same chunk.
+     *
+     * @param slice
+     *   A slice of a LogChunk.
+     * @return
+     *   A batch with the EpisodesLogLines for the well-formed lines in this
+     *   slice, in the same order as in the slice.
+     */
+    EpisodesLogBatch Parser::mapChunkSliceToEpisodesLogBatch(const ChunkSlice & slice) {
+        EpisodesLogBatch mappedSlice;
 
-    //---------------------------------------------------------------------------
-    // Protected methods.
+        mappedSlice.lines.reserve(slice.numLines);
+        for (int i = 0; i < slice.numLines; i++)
+            Parser::mapLineToEpisodesLogLine(slice.lines[i].data, slice.lines[i].length, mappedSlice);
 
-    void Parser::processParsedChunk(const QStringList & chunk) {
-        static unsigned int quarterID = 0;
-        static QList<EpisodesLogLine> batch;
-
-
-        // Perform the mapping from strings to EpisodesLogLine concurrently.
-//        QList<EpisodesLogLine> mappedChunk = QtConcurrent::blockingMapped(chunk, Parser::mapLineToEpisodesLogLine);
-        QString rawLine;
-        EpisodesLogLine line;
-        foreach (rawLine, chunk) {
-            line = Parser::mapLineToEpisodesLogLine(rawLine);
-
-            // Create a batch for each quarter (900 seconds) and process it.
-            // TRICKY: this also ensures that quarters that have already been
-            // processed are not processed again (if it is attempted to parse
-            // the same file multiple times), plus it forces the user to parse
-            // older files first.
-            // FIXME: if file A does not end with a full quarter, i.e. a file B
-            // contains the remaining episodes of a quarter, these episodes are
-            // ignored. Considering that this only affects quarters, this bug
-            // is ignored for now. It doesn't significantly influence the
-            // results of the data set used for testing this master thesis.
-            if (line.time / 900 > quarterID) {
-                quarterID = line.time / 900;
-                if (!batch.isEmpty())
-                    this->processBatch(batch);
-                batch.clear();
-            }
+        return mappedSlice;
+    }
 
-            batch.append(line);
+    /**
+     * Process a chunk of raw lines: tokenize them in parallel, then
+     * reassemble them in their original order and cut them into batches,
+     * one per quarter.
+     *
+     * Because the order of the lines is preserved, the batches are identical
+     * to those that sequential tokenization would generate.
+     *
+     * @param chunk
+     *   A chunk of raw lines.
+     */
+    void Parser::processParsedChunk(const LogChunk & chunk) {
+        // Split the chunk into slices: a few per thread, to compensate for
+        // slices that take longer than others.
+        QList<ChunkSlice> slices;
+        ChunkSlice slice;
+        int numSlices = qMax(1, QThreadPool::globalInstance()->maxThreadCount() * 4);
+        int sliceSize = qMax(1, (chunk.lines.size() + numSlices - 1) / numSlices);
+        for (int i = 0; i < chunk.lines.size(); i += sliceSize) {
+            slice.lines = chunk.lines.constData() + i;
+            slice.numLines = qMin(sliceSize, chunk.lines.size() - i);
+            slices.append(slice);
         }
+
+        // Perform the mapping from raw lines to EpisodesLogLines
+        // concurrently. The results are in the same order as the slices.
+        QList<EpisodesLogBatch> mappedSlices = QtConcurrent::blockingMapped(slices, Parser::mapChunkSliceToEpisodesLogBatch);
+
+        // Perform the batching sequentially, in the original order.
+        foreach (const EpisodesLogBatch & mappedSlice, mappedSlices) {
+            for (int i = 0; i < mappedSlice.size(); i++)
+                this->appendToBatch(mappedSlice, i, chunk.offset);
+        }
+
+        emit reorderStatus(this->quarters.openQuarters(), (int) this->quarters.droppedLateLines());
+    }
+
+    /**
+     * Append a line to the batch of its quarter, then process the batches of
+     * the quarters that this closed (see QuarterReorderBuffer).
+     *
+     * @param source
+     *   The batch that contains the line.
+     * @param index
+     *   The index of the line in that batch.
+     * @param offset
+     *   Offset of the chunk the line was read from.
+     */
+    void Parser::appendToBatch(const EpisodesLogBatch & source, int index, qint64 offset) {
+        // Create a batch for each quarter (900 seconds) and process it.
+        // TRICKY: lines of quarters that have already been processed are
+        // dropped as late lines. This also ensures that quarters are not
+        // processed again (if it is attempted to parse the same file
+        // multiple times, or in follow mode after a restart or after the
+        // quarter timer closed them), plus it forces the user to parse older
+        // files first.
+        // Note: if file A does not end with a full quarter, i.e. a file B
+        // contains the remaining episodes of a quarter, these episodes are
+        // ignored when A and B are parsed one after the other. Parse them
+        // together (see parseFiles()) instead.
+        if (!this->quarters.append(source, index, offset))
+            return;
+
+        uint quarterID;
+        EpisodesLogBatch closedBatch;
+        while (this->quarters.takeClosedQuarter(quarterID, closedBatch))
+            this->processBatch(closedBatch);
+    }
+
+    /**
+     * Re-import logs from their parsed log cache: the quarters in it are
+     * processed without tokenizing or expanding any line.
+     *
+     * @param cacheFile
+     *   The full path to the parsed log cache.
+     * @param signature
+     *   The signature of the logs, see ParsedLogCache::signatureFor().
+     * @return
+     *   false if the cache could not be opened (it's stale or corrupt), in
+     *   which case nothing has been processed.
+     */
+    bool Parser::parseCache(const QString & cacheFile, const QByteArray & signature) {
+        ParsedLogCacheReader reader(Parser::cacheInterners());
+        if (!reader.open(cacheFile, signature)) {
+            qWarning("Ignoring invalid parsed log cache '%s'.", qPrintable(cacheFile));
+            return false;
+        }
+
+        this->timer.start();
+        uint quarter, openQuarter;
+        ExpandedEpisodesLogBatch expandedBatch;
+        EpisodesLogBatch openBatch;
+        while (reader.readQuarter(quarter, expandedBatch)) {
+            // Same rules as in appendToBatch(): skip quarters that have
+            // already been processed.
+            if (quarter <= this->quarters.lastClosedQuarterID())
+                continue;
+
+            // Open quarters that precede this one are complete now. Skip
+            // this one if lines of it (or of later quarters) have already
+            // been seen.
+            while (this->quarters.takeQuarterBefore(quarter, openQuarter, openBatch))
+                this->processBatch(openBatch);
+            if (!this->quarters.isEmpty())
+                continue;
+
+            this->processExpandedBatch(expandedBatch);
+            this->quarters.closeUpTo(quarter);
+        }
+
+        const EpisodesLogBatch & unfinishedQuarter = reader.unfinishedQuarter();
+        for (int i = 0; i < unfinishedQuarter.size(); i++)
+            this->appendToBatch(unfinishedQuarter, i, 0);
+
+        return true;
+    }
+
+    /**
+     * @return
+     *   The interners whose IDs parsed log caches store.
+     */
+    ParsedLogCacheInterners Parser::cacheInterners() {
+        ParsedLogCacheInterners interners;
+        interners.episodeNames = &Parser::episodeNameInterner;
+        interners.domainNames = &Parser::domainNameInterner;
+        interners.locations = &Parser::locationInterner;
+        interners.uaHierarchies = &Parser::uaHierarchyInterner;
+        interners.urls = &Parser::urlInterner;
+        return interners;
+    }
+
+    /**
+     * Parse the complete lines that have been appended to the followed log
+     * since the last call.
+     */
+    void Parser::readAppendedLines() {
+        if (!this->following)
+            return;
+
+        // QFileSystemWatcher stops watching files that are replaced, as
+        // happens upon log rotation.
+        if (!this->followWatcher->files().contains(this->followedFile))
+            this->followWatcher->addPath(this->followedFile);
+
+        TailLogReader reader(this->followedFile, this->followOffset);
+        if (!reader.open())
+            return;
+        if (reader.wasTruncated())
+            qWarning("Followed log '%s' was truncated, reading it from the start.", qPrintable(this->followedFile));
+        if (reader.endOffset() == this->followOffset && !reader.wasTruncated())
+            return;
+
+        LogChunk chunk;
+        while (reader.readChunk(chunk, CHUNK_SIZE))
+            this->processParsedChunk(chunk);
+        if (reader.failed())
+            qWarning("%s", qPrintable(reader.errorString()));
+        this->followOffset = reader.endOffset();
+
+        this->saveFollowCheckpoint();
+    }
+
+    /**
+     * Process the batch of the current quarter once that quarter has ended
+     * (according to the wall clock), without waiting for a line of the next
+     * quarter to arrive.
+     */
+    void Parser::closeEndedQuarter() {
+        if ((!this->following && !this->ingesting) || this->quarters.isEmpty())
+            return;
+
+        // Quarters that ended (according to the wall clock) longer ago than
+        // both the grace period and the reorder lateness.
+        uint now = QDateTime::currentDateTime().toTime_t();
+        uint endedBefore = (now - qMax((uint) FOLLOW_QUARTER_GRACE_PERIOD, this->quarters.getLateness())) / 900;
+
+        // Pick up any lines that were appended in the mean time first.
+        this->readAppendedLines();
+
+        uint quarterID;
+        EpisodesLogBatch closedBatch;
+        bool closed = false;
+        while (this->quarters.takeQuarterBefore(endedBefore, quarterID, closedBatch)) {
+            this->processBatch(closedBatch);
+            closed = true;
+        }
+
+        if (closed && this->following)
+            this->saveFollowCheckpoint();
+    }
+
+    /**
+     * Parse the lines that have arrived on stdin.
+     */
+    void Parser::readStdin() {
+        if (this->stdinReader == NULL)
+            return;
+
+#ifdef Q_OS_UNIX
+        this->stdinReader->readAvailable(STDIN_FILENO);
+#endif
+        this->processStream(this->stdinReader);
+
+        if (this->stdinReader->isFinished())
+            this->stopIngesting();
+    }
+
+    void Parser::acceptStreamConnection() {
+        while (this->streamServer != NULL && this->streamServer->hasPendingConnections()) {
+            QLocalSocket * socket = this->streamServer->nextPendingConnection();
+            this->streamConnections.insert(socket, new StreamLogReader(this->streamServer->fullServerName()));
+            connect(socket, SIGNAL(readyRead()), SLOT(readStreamConnection()));
+            connect(socket, SIGNAL(disconnected()), SLOT(closeStreamConnection()));
+
+            // Lines may have arrived before the signals were connected.
+            StreamLogReader * reader = this->streamConnections.value(socket);
+            if (reader->readAvailable(socket) > 0)
+                this->processStream(reader);
+        }
+    }
+
+    /**
+     * Parse the lines that have arrived on the connection that signalled.
+     */
+    void Parser::readStreamConnection() {
+        QLocalSocket * socket = qobject_cast<QLocalSocket *>(this->sender());
+        StreamLogReader * reader = this->streamConnections.value(socket, NULL);
+        if (reader == NULL)
+            return;
+
+        reader->readAvailable(socket);
+        this->processStream(reader);
+    }
+
+    /**
+     * Parse what remains of a connection that was closed by the writer,
+     * including an incomplete last line.
+     */
+    void Parser::closeStreamConnection() {
+        QLocalSocket * socket = qobject_cast<QLocalSocket *>(this->sender());
+        StreamLogReader * reader = this->streamConnections.take(socket);
+        if (reader == NULL)
+            return;
+
+        reader->readAvailable(socket);
+        reader->setFinished();
+        this->processStream(reader);
+        delete reader;
+        socket->deleteLater();
+    }
+
+
+    //---------------------------------------------------------------------------
+    // Protected methods: streaming.
+
+    /**
+     * Start the timer that closes quarters that have ended according to the
+     * wall clock; it's shared by follow mode and streaming ingestion.
+     */
+    void Parser::startQuarterTimer() {
+        // This must be created in the thread the Parser lives in.
+        if (this->followQuarterTimer == NULL) {
+            this->followQuarterTimer = new QTimer(this);
+            this->followQuarterTimer->setInterval(FOLLOW_QUARTER_CHECK_INTERVAL);
+            connect(this->followQuarterTimer, SIGNAL(timeout()), SLOT(closeEndedQuarter()));
+        }
+        this->followQuarterTimer->start();
+    }
+
+    /**
+     * Tokenize and batch the complete lines that a stream has delivered.
+     */
+    void Parser::processStream(StreamLogReader * reader) {
+        LogChunk chunk;
+        while (reader->readChunk(chunk, CHUNK_SIZE))
+            this->processParsedChunk(chunk);
+    }
+
+
+    //---------------------------------------------------------------------------
+    // Protected methods: follow mode checkpoints.
+
+    /**
+     * The QSettings key under which the checkpoint of the followed log is
+     * stored. File paths cannot be used as keys directly, because QSettings
+     * treats slashes as group separators.
+     */
+    QString Parser::followCheckpointKey() const {
+        QByteArray path = QFileInfo(this->followedFile).absoluteFilePath().toUtf8();
+        return QString("parser/followCheckpoints/") + QCryptographicHash::hash(path, QCryptographicHash::Md5).toHex();
+    }
+
+    void Parser::loadFollowCheckpoint() {
+        QSettings settings;
+        QString key = this->followCheckpointKey();
+
+        this->followOffset = settings.value(key + "/offset", 0).toLongLong();
+        this->quarters.reset(settings.value(key + "/lastQuarterID", 0).toUInt());
+    }
+
+    /**
+     * Checkpoint the offset from which the followed log must be read after a
+     * restart: that of the chunk in which the oldest open quarter started,
+     * or the end of what has been read if there are no open quarters.
+     * Lines read from there on that belong to already processed quarters
+     * will be skipped.
+     */
+    void Parser::saveFollowCheckpoint() {
+        QSettings settings;
+        QString key = this->followCheckpointKey();
+
+        settings.setValue(key + "/file", this->followedFile);
+        settings.setValue(key + "/offset", this->quarters.isEmpty() ? this->followOffset : this->quarters.oldestOffset());
+        settings.setValue(key + "/lastQuarterID", this->quarters.lastClosedQuarterID());
     }
 }
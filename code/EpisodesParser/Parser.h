@@ -2,95 +2,271 @@
 #define PARSER_H
 
 #include <QObject>
-#include <QFile>
-#include <QRegExp>
-#include <QTextStream>
 #include <QStringList>
 #include <QDateTime>
 #include <QThread>
 #include <QtConcurrentMap>
 #include <QMutex>
 #include <QMutexLocker>
-#include <QWaitCondition>
+#include <QThreadPool>
+#include <QSemaphore>
+#include <QAtomicInt>
+#include <QFileSystemWatcher>
+#include <QFileInfo>
+#include <QDir>
+#include <QTimer>
+#include <QSocketNotifier>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QHash>
+#include <QVector>
+#include <QVarLengthArray>
+#include <QSettings>
+#include <QCryptographicHash>
 #include <Qtime>
 
-#include "QBrowsCap.h"
-#include "QGeoIP.h"
 #include "EpisodeDurationDiscretizer.h"
+#include "LogLineTokenizer.h"
+#include "LogReader.h"
+#include "TimestampDecoder.h"
+#include "ClockCache.h"
+#include "ConcurrentIDTable.h"
+#include "ParsedLogCache.h"
+#include "Resolvers.h"
+#include "Sampler.h"
+#include "QuarterReorderBuffer.h"
 #include "typedefs.h"
 
+#include "../Analytics/ItemDictionary.h"
+#include "../Analytics/TransactionBatch.h"
+
 
 namespace EpisodesParser {
 
-    #define CHUNK_SIZE 4000
+    #define CHUNK_SIZE 16000
+    // Number of IPv4 addresses whose LocationID is cached.
+    #define LOCATION_CACHE_SIZE 65536
+    // Default number of User-Agent strings whose UAHierarchyID is cached.
+    #define UA_CACHE_SIZE 16384
+    // Default maximum number of distinct URLs that are interned. URLs are
+    // never evicted, so this bounds the memory that followed or streamed
+    // logs with ever new URLs consume.
+    #define MAX_URLS 1048576
+
+    // Default number of batches that may await analysis before the parser
+    // blocks.
+    #define BATCH_QUEUE_DEPTH 4
+
+    // Follow mode: how often the followed log is polled for appended lines
+    // (in case QFileSystemWatcher misses changes), how often it is checked
+    // whether the current quarter has ended, and how long after the end of
+    // a quarter its lines may still arrive (all in milliseconds, except for
+    // the grace period, which is in seconds).
+    #define FOLLOW_POLL_INTERVAL 5000
+    #define FOLLOW_QUARTER_CHECK_INTERVAL 10000
+    #define FOLLOW_QUARTER_GRACE_PERIOD 60
+
+    // A contiguous part of a LogChunk, tokenized by a single thread.
+    struct ChunkSlice {
+        const LineSpan * lines;
+        int numLines;
+    };
+
+    // A contiguous part of an EpisodesLogBatch, expanded by a single thread.
+    struct BatchSlice {
+        const EpisodesLogBatch * batch;
+        int firstLine;
+        int numLines;
+    };
+
+    // A contiguous part of an ExpandedEpisodesLogBatch, mapped to
+    // transactions by a single thread.
+    struct ExpandedBatchSlice {
+        const ExpandedEpisodesLogBatch * batch;
+        int firstLine;
+        int numLines;
+    };
 
     class Parser : public QObject {
         Q_OBJECT
 
     public:
         Parser();
+        ~Parser();
         static void initParserHelpers(const QString & browsCapCSV,
                                       const QString & browsCapIndex,
                                       const QString & geoIPCityDB,
                                       const QString & geoIPISPDB,
                                       const QString & episodeDiscretizerCSV);
+        static void initParserHelpers(LocationResolver * locationResolver,
+                                      UAResolver * uaResolver,
+                                      const QString & episodeDiscretizerCSV);
         static void clearParserHelperCaches();
+        static void setTokenizerMode(TokenizerMode mode) { Parser::tokenizerMode = mode; }
+        static void setUACacheCapacity(int capacity) { Parser::uaCache.setCapacity(capacity); }
+        static void setMaxURLs(int maxURLs) { Parser::maxURLs = qBound(0, maxURLs, URLInterner::capacity()); }
+        static double getLocationCacheHitRate() { return Parser::locationCache.hitRate(); }
+        static double getUACacheHitRate() { return Parser::uaCache.hitRate(); }
+        static Analytics::ItemDictionary * getItemDictionary() { return &Parser::itemDictionary; }
+        static int getUninternableLines() { return (int) Parser::uninternableLines; }
+
+        void setBatchQueueDepth(int depth);
+        void setCacheDirectory(const QString & directory) { this->cacheDirectory = directory; }
+        Sampler & getSampler() { return this->sampler; }
+        void setReorderLateness(uint seconds) { this->quarters.setLateness(seconds); }
+        void setReorderMaxBufferedLines(int lines) { this->quarters.setMaxBufferedLines(lines); }
 
         // Processing logic.
-        static EpisodesLogLine mapLineToEpisodesLogLine(const QString & line);
-        static ExpandedEpisodesLogLine expandEpisodesLogLine(const EpisodesLogLine & line);
-        static ExpandedEpisodesLogLine mapAndExpandToEpisodesLogLine(const QString & line);
-        static QList<QStringList> mapExpandedEpisodesLogLineToTransactions(const ExpandedEpisodesLogLine & line);
+        static bool mapLineToEpisodesLogLine(const QString & line, EpisodesLogBatch & batch);
+        static bool mapLineToEpisodesLogLine(const char * line, int length, EpisodesLogBatch & batch);
+        static EpisodesLogBatch mapChunkSliceToEpisodesLogBatch(const ChunkSlice & slice);
+        static ExpandedEpisodesLogLine expandEpisodesLogLine(const EpisodesLogBatch & batch, int line);
+        static QVector<ExpandedEpisodesLogLine> expandBatchSlice(const BatchSlice & slice);
+        static void mapExpandedEpisodesLogLineToTransactions(const ExpandedEpisodesLogLine & line, const Episode * episodes, Analytics::TransactionBatch & transactions);
+        static Analytics::TransactionBatch mapExpandedBatchSliceToTransactions(const ExpandedBatchSlice & slice);
 
     signals:
         void parsing(bool);
         void parsedDuration(int duration);
-        void parsedBatch(QList<QStringList> transactions, double transactionsPerEvent, Time start, Time end);
+        void parsedBatch(Analytics::TransactionBatch transactions, double transactionsPerEvent, double samplingRate, Time start, Time end);
+        void batchQueueStatus(int queuedBatches, int stallDuration);
+        void reorderStatus(int openQuarters, int droppedLateLines);
 
     public slots:
         void parse(const QString & fileName);
+        void parseFiles(const QStringList & fileNames);
+        void follow(const QString & fileName);
+        void stopFollowing();
+        void ingest(const QString & source);
+        void stopIngesting();
         void continueParsing();
 
     protected slots:
-        void processBatch(const QList<EpisodesLogLine> batch);
+        void processBatch(const EpisodesLogBatch & batch);
+        void readAppendedLines();
+        void closeEndedQuarter();
+        void readStdin();
+        void acceptStreamConnection();
+        void readStreamConnection();
+        void closeStreamConnection();
 
     protected:
-        void processParsedChunk(const QStringList & chunk);
+        void processParsedChunk(const LogChunk & chunk);
+        void appendToBatch(const EpisodesLogBatch & source, int line, qint64 offset);
+        void processExpandedBatch(const ExpandedEpisodesLogBatch & expandedBatch);
+        bool parseCache(const QString & cacheFile, const QByteArray & signature);
+        static ParsedLogCacheInterners cacheInterners();
 
-        QMutex mutex;
-        QWaitCondition condition;
         QTime timer;
 
+        // Bounded queue of batches awaiting analysis: one permit per batch
+        // that may still be queued.
+        QSemaphore * batchSlots;
+        int batchQueueDepth;
+
+        // Quarter batching state: quarters stay open until the watermark
+        // passes their end, so that lines that arrive out of order still end
+        // up in the right quarter.
+        QuarterReorderBuffer quarters;
 
-        // QHashes that are used to minimize memory usage.
-        static EpisodeNameIDHash episodeNameIDHash;
-        static EpisodeIDNameHash episodeIDNameHash;
-        static DomainNameIDHash domainNameIDHash;
-        static DomainIDNameHash domainIDNameHash;
-        static UAHierarchyDetailsIDHash uaHierarchyDetailsIDHash;
-        static UAHierarchyIDDetailsHash uaHierarchyIDDetailsHash;
-        static LocationToIDHash locationToIDHash;
-        static LocationFromIDHash locationFromIDHash;
+        // Parsed log cache: disabled when no directory is set. Only written
+        // while parsing files in a Parser that has not processed any quarter
+        // yet, otherwise it would be incomplete.
+        QString cacheDirectory;
+        ParsedLogCacheWriter * cacheWriter;
+
+        // Load shedding: page views may be sampled before they're mapped to
+        // transactions. Not applied to the parsed log cache.
+        Sampler sampler;
+
+        // Follow mode state.
+        QString followCheckpointKey() const;
+        void loadFollowCheckpoint();
+        void saveFollowCheckpoint();
+
+        bool following;
+        QString followedFile;
+        qint64 followOffset;
+        QFileSystemWatcher * followWatcher;
+        QTimer * followPollTimer;
+        QTimer * followQuarterTimer;
+
+        // Streaming ingestion state. Quarters are closed by the watermark
+        // and by the same wall clock timer as in follow mode.
+        void startQuarterTimer();
+        void processStream(StreamLogReader * reader);
+
+        bool ingesting;
+        StreamLogReader * stdinReader;
+        QSocketNotifier * stdinNotifier;
+        QLocalServer * streamServer;
+        QHash<QLocalSocket *, StreamLogReader *> streamConnections;
+
+
+        // Interners that are used to minimize memory usage. They're
+        // shared by all parser threads and read by the analyst thread.
+        static EpisodeNameInterner episodeNameInterner;
+        static DomainNameInterner domainNameInterner;
+        static UAHierarchyInterner uaHierarchyInterner;
+        static LocationInterner locationInterner;
+        static URLInterner urlInterner;
+        static int maxURLs;
+        // Lines that were skipped because one of their values could not be
+        // interned: all IDs of its interner were in use.
+        static QAtomicInt uninternableLines;
+
+        // Caches in front of the parser helpers.
+        static ClockCache<quint32, LocationID> locationCache;
+        // For location resolvers with a fixed set of Locations: the
+        // LocationID of every index they resolve to, shifted by one (the
+        // first is that of the unknown Location). When set, the location
+        // cache is bypassed.
+        static QVector<LocationID> resolverLocationIDs;
+        // Keyed by EpisodesLogBatch::hashUA(). Not cleared by
+        // clearParserHelperCaches(), so that subsequent parse() calls start
+        // warm.
+        static ClockCache<quint64, UACacheEntry> uaCache;
+
+        // Assigns the item IDs of the association rule items in the
+        // transactions; shared with the analyst.
+        static Analytics::ItemDictionary itemDictionary;
+
+        // The association rule items (as item IDs) of every interned
+        // Location, UA hierarchy, URL, episode, episode speed and HTTP
+        // status: each ID always maps to the same items, so they are
+        // generated and interned only once.
+        static ConcurrentIDTable<LocationID, QVector<Analytics::ItemID> > locationItems;
+        static ConcurrentIDTable<UAHierarchyID, QVector<Analytics::ItemID> > uaHierarchyItems;
+        static ConcurrentIDTable<URLID, Analytics::ItemID> urlItems;
+        static ConcurrentIDTable<EpisodeID, Analytics::ItemID> episodeItems;
+        static ConcurrentIDTable<EpisodeSpeedID, Analytics::ItemID> speedItems;
+        static ConcurrentIDTable<HTTPStatus, Analytics::ItemID> statusItems;
 
         static bool parserHelpersInitialized;
-        static QBrowsCap browsCap;
-        static QGeoIP geoIP;
+        // Identifies the resolvers' data, see initParserHelpers().
+        static QByteArray parserHelpersSignature;
+        static TokenizerMode tokenizerMode;
+        static LocationResolver * locationResolver;
+        static UAResolver * uaResolver;
         static EpisodeDurationDiscretizer episodeDiscretizer;
 
         // Mutexes used to ensure thread-safety.
         static QMutex parserHelpersInitMutex;
-        static QMutex episodeHashMutex;
-        static QMutex domainHashMutex;
-        static QMutex uaHierarchyHashMutex;
-        static QMutex mutex_hashAccess_location;
-        static QMutex regExpMutex;
-        static QMutex dateTimeMutex;
-
-        // Methods to actually use the above QHashes.
-        static EpisodeID mapEpisodeNameToID(EpisodeName name);
-        static DomainID mapDomainNameToID(DomainName name);
-        static UAHierarchyID mapUAHierarchyToID(UAHierarchyDetails ua);
+
+        // Methods to actually use the above interners.
+        static bool mapEpisodeNameToID(const EpisodeName & name, EpisodeID & id);
+        static EpisodeName mapEpisodeIDToName(EpisodeID id);
+        static bool mapDomainNameToID(const DomainName & name, DomainID & id);
+        static UAHierarchyID mapUAHierarchyToID(const UAHierarchyDetails & ua);
         static LocationID mapLocationToID(const Location & location);
+        static URLID mapURLToID(const URL & url);
+        static QVector<Analytics::ItemID> mapItemsToIDs(const QStringList & items);
+        static const QVector<Analytics::ItemID> & mapLocationIDToItems(LocationID id);
+        static const QVector<Analytics::ItemID> & mapUAHierarchyIDToItems(UAHierarchyID id);
+        static Analytics::ItemID mapURLIDToItem(URLID id);
+        static Analytics::ItemID mapEpisodeIDToItem(EpisodeID id);
+        static Analytics::ItemID mapSpeedIDToItem(EpisodeSpeedID speedID);
+        static Analytics::ItemID mapStatusToItem(HTTPStatus status);
     };
 
 }
@@ -0,0 +1,204 @@
+#include "ParserHelperIndex.h"
+#include "Resolvers.h"
+
+namespace EpisodesParser {
+
+    ParserHelperIndex::ParserHelperIndex() {
+        this->map = NULL;
+        for (int s = 0; s < NUM_SECTIONS; s++) {
+            this->sectionData[s] = NULL;
+            this->sectionSizes[s] = 0;
+        }
+    }
+
+    ParserHelperIndex::~ParserHelperIndex() {
+        if (this->map != NULL)
+            this->file.unmap((uchar *) this->map);
+    }
+
+    /**
+     * Open an index and map it into memory.
+     *
+     * @param fileName
+     *   The full path to the index file.
+     * @param signature
+     *   The signature the index must have been compiled with, see
+     *   signatureFor().
+     * @return
+     *   false if the index does not exist, is corrupt, or is stale.
+     */
+    bool ParserHelperIndex::open(const QString & fileName, const QByteArray & signature) {
+        this->file.setFileName(fileName);
+        if (!this->file.open(QIODevice::ReadOnly))
+            return false;
+
+        const qint64 size = this->file.size();
+        if (size < (qint64) sizeof(Header))
+            return false;
+
+        this->map = (const char *) this->file.map(0, size);
+        if (this->map == NULL)
+            return false;
+
+        const Header * header = (const Header *) this->map;
+        if (memcmp(header->magic, PARSERHELPERINDEX_MAGIC, sizeof(header->magic)) != 0
+            || header->version != PARSERHELPERINDEX_VERSION
+            || header->byteOrderMark != PARSERHELPERINDEX_BYTE_ORDER_MARK
+            || signature.size() != (int) sizeof(header->signature)
+            || memcmp(header->signature, signature.constData(), sizeof(header->signature)) != 0)
+            return false;
+
+        for (int s = 0; s < NUM_SECTIONS; s++) {
+            const SectionEntry & entry = header->sections[s];
+            if (entry.size == 0)
+                continue;
+            if (entry.offset < sizeof(Header) || entry.offset % 8 != 0
+                || entry.offset > (quint64) size || entry.size > (quint64) size - entry.offset)
+                return false;
+            this->sectionData[s] = this->map + entry.offset;
+            this->sectionSizes[s] = entry.size;
+        }
+
+        return true;
+    }
+
+    /**
+     * @param section
+     *   A section.
+     * @param size
+     *   Set to the size of the section, in bytes.
+     * @return
+     *   The start of the section in the mapping (8-byte aligned), NULL if
+     *   the index does not have it.
+     */
+    const char * ParserHelperIndex::section(Section section, quint64 & size) const {
+        size = this->sectionSizes[section];
+        return this->sectionData[section];
+    }
+
+    /**
+     * Write an index. It's written to a temporary file, which only replaces
+     * the actual index file once it's complete: processes that are starting
+     * up concurrently never map a partial index.
+     *
+     * @param fileName
+     *   The full path to the index file.
+     * @param signature
+     *   See signatureFor().
+     * @param sections
+     *   The contents of each section (NUM_SECTIONS of them); empty sections
+     *   are absent.
+     * @return
+     *   false if the index could not be written.
+     */
+    bool ParserHelperIndex::write(const QString & fileName, const QByteArray & signature, const QVector<QByteArray> & sections) {
+        QDir().mkpath(QFileInfo(fileName).absolutePath());
+
+        QFile file(fileName + ".tmp");
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qWarning("Could not create parser helper index '%s'.", qPrintable(fileName));
+            return false;
+        }
+
+        Header header;
+        memset(&header, 0, sizeof(Header));
+        memcpy(header.magic, PARSERHELPERINDEX_MAGIC, sizeof(header.magic));
+        header.version = PARSERHELPERINDEX_VERSION;
+        header.byteOrderMark = PARSERHELPERINDEX_BYTE_ORDER_MARK;
+        memcpy(header.signature, signature.constData(), qMin(signature.size(), (int) sizeof(header.signature)));
+
+        quint64 offset = ParserHelperIndex::padded(sizeof(Header));
+        for (int s = 0; s < NUM_SECTIONS && s < sections.size(); s++) {
+            header.sections[s].offset = sections[s].isEmpty() ? 0 : offset;
+            header.sections[s].size = sections[s].size();
+            offset += ParserHelperIndex::padded(sections[s].size());
+        }
+
+        static const char padding[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+        bool ok = (file.write((const char *) &header, sizeof(Header)) == sizeof(Header));
+        ok = ok && file.write(padding, ParserHelperIndex::padded(sizeof(Header)) - sizeof(Header)) != -1;
+        for (int s = 0; ok && s < NUM_SECTIONS && s < sections.size(); s++) {
+            ok = (file.write(sections[s]) == sections[s].size());
+            ok = ok && file.write(padding, ParserHelperIndex::padded(sections[s].size()) - sections[s].size()) != -1;
+        }
+        file.close();
+
+        QFile::remove(fileName);
+        if (!ok || !file.rename(fileName)) {
+            file.remove();
+            qWarning("Could not write parser helper index '%s'.", qPrintable(fileName));
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @param sourceFiles
+     *   The files an index is compiled from.
+     * @return
+     *   A signature of those files: path, size and modification time. Only
+     *   requires a stat() per file, not reading it.
+     */
+    QByteArray ParserHelperIndex::signatureFor(const QStringList & sourceFiles) {
+        QCryptographicHash hash(QCryptographicHash::Md5);
+        foreach (const QString & fileName, sourceFiles) {
+            QFileInfo info(fileName);
+            hash.addData(info.absoluteFilePath().toUtf8());
+            hash.addData(QByteArray::number(info.size()));
+            hash.addData(QByteArray::number(info.lastModified().toTime_t()));
+        }
+        return hash.result();
+    }
+
+    /**
+     * Open the index of the given CSV files; compile it first if it does not
+     * exist yet or if any of the CSV files has changed since.
+     *
+     * @param fileName
+     *   The full path to the index file.
+     * @param ipRangesCSV
+     *   The CSV file of an IPRangeLocationResolver, or an empty string.
+     * @param browsCapCSV
+     *   The browscap.csv file of a UAPatternResolver, or an empty string.
+     * @return
+     *   The opened index, or a null pointer if it could not be compiled.
+     */
+    QSharedPointer<ParserHelperIndex> ParserHelperIndex::openOrCompile(const QString & fileName, const QString & ipRangesCSV, const QString & browsCapCSV) {
+        QStringList sourceFiles;
+        if (!ipRangesCSV.isEmpty())
+            sourceFiles << ipRangesCSV;
+        if (!browsCapCSV.isEmpty())
+            sourceFiles << browsCapCSV;
+        const QByteArray signature = ParserHelperIndex::signatureFor(sourceFiles);
+
+        QSharedPointer<ParserHelperIndex> index(new ParserHelperIndex());
+        if (index->open(fileName, signature)
+            && (ipRangesCSV.isEmpty() || index->hasSection(IP_LOCATIONS))
+            && (browsCapCSV.isEmpty() || index->hasSection(UA_DETAILS)))
+            return index;
+
+#ifdef DEBUG
+        qDebug() << "Compiling parser helper index" << fileName;
+#endif
+
+        QVector<QByteArray> sections(NUM_SECTIONS);
+        if (!ipRangesCSV.isEmpty()) {
+            IPRangeLocationResolver ipRanges;
+            if (!ipRanges.parseCsvFile(ipRangesCSV))
+                return QSharedPointer<ParserHelperIndex>();
+            ipRanges.writeIndex(sections);
+        }
+        if (!browsCapCSV.isEmpty()) {
+            UAPatternResolver uaPatterns;
+            if (!uaPatterns.parseCsvFile(browsCapCSV))
+                return QSharedPointer<ParserHelperIndex>();
+            uaPatterns.writeIndex(sections);
+        }
+
+        index = QSharedPointer<ParserHelperIndex>(new ParserHelperIndex());
+        if (!ParserHelperIndex::write(fileName, signature, sections) || !index->open(fileName, signature))
+            return QSharedPointer<ParserHelperIndex>();
+        return index;
+    }
+
+}
@@ -0,0 +1,92 @@
+#ifndef PARSERHELPERINDEX_H
+#define PARSERHELPERINDEX_H
+
+#include <QtGlobal>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDir>
+#include <QByteArray>
+#include <QVector>
+#include <QString>
+#include <QStringList>
+#include <QSharedPointer>
+#include <QCryptographicHash>
+
+
+namespace EpisodesParser {
+
+    #define PARSERHELPERINDEX_MAGIC "EPHINDEX"
+    #define PARSERHELPERINDEX_VERSION 3
+    // Detects indexes that were written on a machine with another byte
+    // order.
+    #define PARSERHELPERINDEX_BYTE_ORDER_MARK 0x01020304
+    #define PARSERHELPERINDEX_EXTENSION ".ephindex"
+
+    /**
+     * A parser helper index stores the compiled tables of the in-memory
+     * resolvers (IPRangeLocationResolver, UAPatternResolver), so that they
+     * don't have to be rebuilt from their CSV files on every launch.
+     *
+     * The index is mapped into memory read-only and the resolvers look up
+     * straight from the mapping: loading it takes constant time for the
+     * large tables, and processes that load the same index share its pages.
+     *
+     * Layout, in native byte order:
+     * - header: magic, version, byte order mark, signature (an MD5 hash of
+     *   the CSV files this index was compiled from), followed by the offset
+     *   and size of every section (size 0: absent);
+     * - the sections, each padded to 8 bytes. Their contents are defined by
+     *   the resolvers, see their writeIndex() methods.
+     */
+    class ParserHelperIndex {
+    public:
+        enum Section {
+            IP_RANGES,
+            IP_LOCATIONS,
+            UA_PATTERNS,
+            UA_PATTERN_CHARS,
+            UA_AUTOMATON_STATES,
+            UA_AUTOMATON_TRANSITIONS,
+            UA_AUTOMATON_CANDIDATES,
+            UA_DETAILS,
+            IP_SEARCH_TREE,
+            NUM_SECTIONS
+        };
+
+        ParserHelperIndex();
+        ~ParserHelperIndex();
+
+        bool open(const QString & fileName, const QByteArray & signature);
+        bool hasSection(Section section) const { return this->sectionSizes[section] > 0; }
+        const char * section(Section section, quint64 & size) const;
+
+        static bool write(const QString & fileName, const QByteArray & signature, const QVector<QByteArray> & sections);
+        static QByteArray signatureFor(const QStringList & sourceFiles);
+        static QSharedPointer<ParserHelperIndex> openOrCompile(const QString & fileName, const QString & ipRangesCSV, const QString & browsCapCSV);
+
+    protected:
+        struct SectionEntry {
+            quint64 offset;
+            quint64 size;
+        };
+
+        struct Header {
+            char magic[8];
+            quint32 version;
+            quint32 byteOrderMark;
+            char signature[16];
+            SectionEntry sections[NUM_SECTIONS];
+        };
+
+        static int padded(int size) { return (size + 7) & ~7; }
+
+        QFile file;
+        const char * map;
+        const char * sectionData[NUM_SECTIONS];
+        quint64 sectionSizes[NUM_SECTIONS];
+    };
+
+}
+
+#endif // PARSERHELPERINDEX_H
@@ -0,0 +1,165 @@
+#include "QuarterReorderBuffer.h"
+
+namespace EpisodesParser {
+
+    QuarterReorderBuffer::QuarterReorderBuffer() {
+        this->lateness = REORDER_LATENESS;
+        this->maxBufferedLines = REORDER_MAX_BUFFERED_LINES;
+        this->numBufferedLines = 0;
+        this->maxTime = 0;
+        this->lastClosed = 0;
+        this->numDroppedLateLines = 0;
+    }
+
+
+    //---------------------------------------------------------------------------
+    // Public methods.
+
+    /**
+     * Append a line to the quarter it belongs to, unless that quarter has
+     * already been closed.
+     *
+     * @param source
+     *   The batch the line is in.
+     * @param index
+     *   The index of the line in that batch.
+     * @param offset
+     *   Offset of the chunk the line was read from.
+     * @return
+     *   false if the line was late, and hence dropped.
+     */
+    bool QuarterReorderBuffer::append(const EpisodesLogBatch & source, int index, qint64 offset) {
+        const Time time = source.lines[index].time;
+        const uint quarterID = time / 900;
+
+        if (quarterID <= this->lastClosed) {
+            this->numDroppedLateLines++;
+            return false;
+        }
+
+        QMap<uint, Quarter>::iterator it = this->quarters.find(quarterID);
+        if (it == this->quarters.end()) {
+            it = this->quarters.insert(quarterID, Quarter());
+            it.value().startOffset = offset;
+        }
+        it.value().batch.appendLine(source, index);
+        this->numBufferedLines++;
+
+        if (time > this->maxTime)
+            this->maxTime = time;
+
+        return true;
+    }
+
+    /**
+     * Take out the oldest quarter if it's closed: either because the
+     * watermark has passed its end, or because the buffer is full.
+     *
+     * @param quarterID
+     *   The ID of the quarter that was taken out.
+     * @param batch
+     *   Its lines, in the order they were appended.
+     * @return
+     *   false if no quarter is closed.
+     */
+    bool QuarterReorderBuffer::takeClosedQuarter(uint & quarterID, EpisodesLogBatch & batch) {
+        if (this->quarters.isEmpty())
+            return false;
+
+        const uint oldest = this->quarters.constBegin().key();
+        const Time watermark = (this->maxTime > this->lateness) ? this->maxTime - this->lateness : 0;
+        bool closed = watermark / 900 > oldest;
+
+        // Memory bound: never applies to the most recent quarter, otherwise
+        // a busy quarter would be cut in pieces.
+        if (!closed && this->quarters.size() > 1) {
+            const int recentLines = (this->quarters.constEnd() - 1).value().batch.size();
+            closed = this->numBufferedLines - recentLines > this->maxBufferedLines;
+        }
+
+        return closed && this->take(quarterID, batch);
+    }
+
+    /**
+     * Take out the oldest quarter, regardless of the watermark, if it's
+     * older than the given quarter.
+     *
+     * @param before
+     *   A quarter ID.
+     * @param quarterID
+     *   The ID of the quarter that was taken out.
+     * @param batch
+     *   Its lines, in the order they were appended.
+     * @return
+     *   false if there is no open quarter older than the given one.
+     */
+    bool QuarterReorderBuffer::takeQuarterBefore(uint before, uint & quarterID, EpisodesLogBatch & batch) {
+        if (this->quarters.isEmpty() || this->quarters.constBegin().key() >= before)
+            return false;
+
+        return this->take(quarterID, batch);
+    }
+
+    /**
+     * Mark all quarters up to and including the given one as closed, e.g.
+     * because they were processed in some other way. Take out open quarters
+     * before calling this, see takeQuarterBefore().
+     */
+    void QuarterReorderBuffer::closeUpTo(uint quarterID) {
+        Q_ASSERT(this->quarters.isEmpty() || this->quarters.constBegin().key() > quarterID);
+        this->lastClosed = qMax(this->lastClosed, quarterID);
+    }
+
+    /**
+     * Drop all open quarters and start over: quarters up to and including
+     * the given one are considered closed. Late lines remain counted.
+     */
+    void QuarterReorderBuffer::reset(uint lastClosedQuarterID) {
+        this->quarters.clear();
+        this->numBufferedLines = 0;
+        this->maxTime = 0;
+        this->lastClosed = lastClosedQuarterID;
+    }
+
+    /**
+     * @return
+     *   All lines in open quarters, oldest quarter first.
+     */
+    EpisodesLogBatch QuarterReorderBuffer::unclosedLines() const {
+        EpisodesLogBatch lines;
+        foreach (const Quarter & quarter, this->quarters) {
+            for (int i = 0; i < quarter.batch.size(); i++)
+                lines.appendLine(quarter.batch, i);
+        }
+        return lines;
+    }
+
+    /**
+     * @return
+     *   The offset of the chunk in which the first line of any open quarter
+     *   was read, or -1 if there are no open quarters.
+     */
+    qint64 QuarterReorderBuffer::oldestOffset() const {
+        qint64 offset = -1;
+        foreach (const Quarter & quarter, this->quarters) {
+            if (offset == -1 || quarter.startOffset < offset)
+                offset = quarter.startOffset;
+        }
+        return offset;
+    }
+
+
+    //---------------------------------------------------------------------------
+    // Protected methods.
+
+    bool QuarterReorderBuffer::take(uint & quarterID, EpisodesLogBatch & batch) {
+        QMap<uint, Quarter>::iterator oldest = this->quarters.begin();
+        quarterID = oldest.key();
+        batch = oldest.value().batch;
+        this->numBufferedLines -= batch.size();
+        this->lastClosed = qMax(this->lastClosed, quarterID);
+        this->quarters.erase(oldest);
+        return true;
+    }
+
+}
@@ -0,0 +1,79 @@
+#ifndef QUARTERREORDERBUFFER_H
+#define QUARTERREORDERBUFFER_H
+
+#include <QtGlobal>
+#include <QMap>
+
+#include "typedefs.h"
+
+
+namespace EpisodesParser {
+
+    // Default lateness (in seconds): how far a line may lag behind the most
+    // recent line and still end up in its own quarter.
+    #define REORDER_LATENESS 0
+    // Default maximum number of lines held in quarters other than the most
+    // recent one. When exceeded, the oldest quarter is closed early.
+    #define REORDER_MAX_BUFFERED_LINES 1000000
+
+    /**
+     * Cuts a stream of lines that is only roughly ordered by time into
+     * quarters (900 seconds).
+     *
+     * The watermark trails the most recent time seen by the configured
+     * lateness. A quarter stays open (i.e. it accepts lines) until the
+     * watermark passes its end; then it's closed and can be taken out.
+     * Lines for quarters that have already been closed are late: they're
+     * dropped and counted.
+     *
+     * Memory is bounded: when the quarters that are not the most recent one
+     * hold too many lines, the oldest one is closed early.
+     */
+    class QuarterReorderBuffer {
+    public:
+        QuarterReorderBuffer();
+
+        void setLateness(uint seconds) { this->lateness = seconds; }
+        void setMaxBufferedLines(int lines) { this->maxBufferedLines = qMax(0, lines); }
+        uint getLateness() const { return this->lateness; }
+
+        bool append(const EpisodesLogBatch & source, int index, qint64 offset);
+        bool takeClosedQuarter(uint & quarterID, EpisodesLogBatch & batch);
+        bool takeQuarterBefore(uint before, uint & quarterID, EpisodesLogBatch & batch);
+        void closeUpTo(uint quarterID);
+        void reset(uint lastClosedQuarterID);
+        EpisodesLogBatch unclosedLines() const;
+
+        bool isEmpty() const { return this->quarters.isEmpty(); }
+        int openQuarters() const { return this->quarters.size(); }
+        int bufferedLines() const { return this->numBufferedLines; }
+        uint lastClosedQuarterID() const { return this->lastClosed; }
+        qint64 oldestOffset() const;
+        quint64 droppedLateLines() const { return this->numDroppedLateLines; }
+
+    protected:
+        struct Quarter {
+            Quarter() : startOffset(0) {}
+
+            EpisodesLogBatch batch;
+            // Offset of the chunk in which the first line of this quarter
+            // was read.
+            qint64 startOffset;
+        };
+
+        bool take(uint & quarterID, EpisodesLogBatch & batch);
+
+        uint lateness;
+        int maxBufferedLines;
+
+        // Open quarters, by quarter ID.
+        QMap<uint, Quarter> quarters;
+        int numBufferedLines;
+        Time maxTime;
+        uint lastClosed;
+        quint64 numDroppedLateLines;
+    };
+
+}
+
+#endif // QUARTERREORDERBUFFER_H
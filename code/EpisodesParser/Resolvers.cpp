@@ -0,0 +1,884 @@
+#include "Resolvers.h"
+
+#include <string.h>
+#include <limits.h>
+
+namespace EpisodesParser {
+
+    //---------------------------------------------------------------------------
+    // Helpers.
+
+    /**
+     * Split a CSV line into fields. Fields may be double-quoted, in which
+     * case they may contain commas; "" is an escaped double quote.
+     */
+    static QStringList splitCsvLine(const QString & line) {
+        QStringList fields;
+        QString field;
+        bool quoted = false;
+
+        for (int i = 0; i < line.length(); i++) {
+            const QChar c = line[i];
+            if (quoted) {
+                if (c == '"' && i + 1 < line.length() && line[i + 1] == '"') {
+                    field += '"';
+                    i++;
+                }
+                else if (c == '"')
+                    quoted = false;
+                else
+                    field += c;
+            }
+            else if (c == '"')
+                quoted = true;
+            else if (c == ',') {
+                fields << field;
+                field.clear();
+            }
+            else
+                field += c;
+        }
+        fields << field;
+
+        return fields;
+    }
+
+    //---------------------------------------------------------------------------
+    // QGeoIPLocationResolver.
+
+    QGeoIPLocationResolver::QGeoIPLocationResolver(const QString & cityDB, const QString & ispDB) {
+        // About 25 MB of permanent memory consumption.
+        this->geoIP.openDatabases(cityDB, ispDB);
+        this->dataSignature = ParserHelperIndex::signatureFor(QStringList() << cityDB << ispDB);
+    }
+
+    Location QGeoIPLocationResolver::resolve(IPAddress ip) const {
+        QMutexLocker locker(&this->mutex);
+        QGeoIPRecord record = this->geoIP.recordByAddr(QHostAddress(ip));
+        locker.unlock();
+
+        Location location;
+        location.continent = record.continentCode;
+        location.country   = record.country;
+        location.city      = record.city;
+        location.region    = record.region;
+        location.isp       = record.isp;
+        return location;
+    }
+
+
+    //---------------------------------------------------------------------------
+    // QBrowsCapUAResolver.
+
+    QBrowsCapUAResolver::QBrowsCapUAResolver(const QString & csvFile, const QString & indexFile) {
+        // About 1.5 MB of permanent memory consumption.
+        this->browsCap.setCsvFile(csvFile);
+        this->browsCap.setIndexFile(indexFile);
+        this->browsCap.buildIndex();
+        this->dataSignature = ParserHelperIndex::signatureFor(QStringList() << csvFile);
+    }
+
+    UAHierarchyDetails QBrowsCapUAResolver::resolve(const UA & ua) const {
+        QMutexLocker locker(&this->mutex);
+        QPair<bool, QBrowsCapRecord> result = this->browsCap.matchUserAgent(ua);
+        locker.unlock();
+
+        UAHierarchyDetails details;
+        details.platform              = result.second.platform;
+        details.browser_name          = result.second.browser_name;
+        details.browser_version       = result.second.browser_version;
+        details.browser_version_major = result.second.browser_version_major;
+        details.browser_version_minor = result.second.browser_version_minor;
+        details.is_mobile             = result.second.is_mobile;
+        return details;
+    }
+
+    void QBrowsCapUAResolver::clearCache() {
+        QMutexLocker locker(&this->mutex);
+        this->browsCap.resetCache();
+    }
+
+
+
+
+    //---------------------------------------------------------------------------
+    // IPRangeLocationResolver.
+
+    IPRangeLocationResolver::IPRangeLocationResolver() {
+        this->rangeTable = NULL;
+        this->numRanges = 0;
+        this->searchTree = NULL;
+    }
+
+    /**
+     * Load the IPv4 ranges. Must be called before the resolver is shared
+     * with other threads.
+     *
+     * @param csvFile
+     *   The full path to the CSV file (see the class documentation).
+     * @return
+     *   false if the file could not be read.
+     */
+    bool IPRangeLocationResolver::parseCsvFile(const QString & csvFile) {
+        QFile csv(csvFile);
+        if (!csv.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            qCritical("Could not open '%s' file for reading: %s.", qPrintable(csvFile), qPrintable(csv.errorString()));
+            return false;
+        }
+
+        this->ranges.clear();
+        this->locations.clear();
+        this->index.clear();
+
+        QTextStream in(&csv);
+        QString line;
+        QStringList fields;
+        Range range;
+        Location location;
+        QHash<Location, int> locationIndices;
+        while (!in.atEnd()) {
+            line = in.readLine().trimmed();
+            if (line.isEmpty() || line.startsWith('#'))
+                continue;
+
+            fields = splitCsvLine(line);
+            if (fields.size() < 7
+                || !IPRangeLocationResolver::parseAddress(fields[0], range.start)
+                || !IPRangeLocationResolver::parseAddress(fields[1], range.end)
+                || range.end < range.start) {
+                qWarning("Ignoring malformed IPv4 range '%s'.", qPrintable(line));
+                continue;
+            }
+
+            location.continent = fields[2];
+            location.country   = fields[3];
+            location.region    = fields[4];
+            location.city      = fields[5];
+            location.isp       = fields[6];
+            location.computeHash();
+            if (!locationIndices.contains(location)) {
+                locationIndices.insert(location, this->locations.size());
+                this->locations.append(location);
+            }
+            range.location = locationIndices.value(location);
+
+            this->ranges.append(range);
+        }
+
+        // Sort by first address, then drop overlapping ranges: that makes
+        // a single binary search sufficient.
+        std::stable_sort(this->ranges.begin(), this->ranges.end());
+        int kept = 0;
+        for (int i = 0; i < this->ranges.size(); i++) {
+            if (kept > 0 && this->ranges[i].start <= this->ranges[kept - 1].end) {
+                qWarning("Ignoring IPv4 range that overlaps another one, starting at %s.", qPrintable(QHostAddress(this->ranges[i].start).toString()));
+                continue;
+            }
+            this->ranges[kept++] = this->ranges[i];
+        }
+        this->ranges.resize(kept);
+        this->ranges.squeeze();
+
+        this->rangeTable = this->ranges.constData();
+        this->numRanges = this->ranges.size();
+        this->buildSearchTree();
+
+        this->dataSignature = ParserHelperIndex::signatureFor(QStringList() << csvFile);
+        return true;
+    }
+
+    /**
+     * Look up from the ranges in an index, rather than from a CSV file.
+     * Only the (few) distinct Locations are loaded; the ranges are not.
+     * Must be called before the resolver is shared with other threads.
+     *
+     * @param index
+     *   An open index. The resolver keeps a reference to it.
+     * @return
+     *   false if the index has no (valid) IPv4 ranges. The ranges and the
+     *   search tree are validated, since lookups index the ranges through
+     *   the tree and the ranges' Locations without further checks.
+     */
+    bool IPRangeLocationResolver::loadIndex(QSharedPointer<ParserHelperIndex> index) {
+        quint64 size;
+        const char * data = index->section(ParserHelperIndex::IP_LOCATIONS, size);
+        if (data == NULL)
+            return false;
+
+        const QByteArray section = QByteArray::fromRawData(data, size);
+        QDataStream in(section);
+        in.setVersion(QDataStream::Qt_4_6);
+        QByteArray signature;
+        quint32 count;
+        in >> signature >> count;
+
+        QVector<Location> locations;
+        Location location;
+        for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+            in >> location.continent >> location.country >> location.region >> location.city >> location.isp;
+            locations.append(location);
+        }
+        if (in.status() != QDataStream::Ok)
+            return false;
+
+        data = index->section(ParserHelperIndex::IP_RANGES, size);
+        if (size % sizeof(Range) != 0 || size / sizeof(Range) >= INT_MAX / 2)
+            return false;
+        const int numRanges = size / sizeof(Range);
+
+        const char * tree = index->section(ParserHelperIndex::IP_SEARCH_TREE, size);
+        if (size != 2 * (numRanges + 1) * sizeof(quint32))
+            return false;
+
+        // The ranges must be sorted, must not overlap, and must point to
+        // loaded Locations, as if they had been parsed by parseCsvFile().
+        const Range * rangeTable = (const Range *) data;
+        for (int i = 0; i < numRanges; i++) {
+            if (rangeTable[i].end < rangeTable[i].start
+                || (i > 0 && rangeTable[i].start <= rangeTable[i - 1].end)
+                || rangeTable[i].location < 0 || rangeTable[i].location >= locations.size())
+                return false;
+        }
+
+        // The search tree is fully determined by the ranges: it must be
+        // identical to the one that is built from them. Then every rank in
+        // it is a valid index in the ranges.
+        IPRangeLocationResolver expected;
+        expected.rangeTable = rangeTable;
+        expected.numRanges = numRanges;
+        expected.buildSearchTree();
+        if (memcmp(expected.searchTree, tree, size) != 0)
+            return false;
+
+        this->ranges.clear();
+        this->tree.clear();
+        this->locations = locations;
+        this->index = index;
+        this->rangeTable = rangeTable;
+        this->numRanges = numRanges;
+        this->searchTree = (const quint32 *) tree;
+        this->dataSignature = signature;
+        return true;
+    }
+
+    /**
+     * Add the IP_RANGES, IP_SEARCH_TREE and IP_LOCATIONS sections of an
+     * index.
+     *
+     * @param sections
+     *   The sections of the index, see ParserHelperIndex::write().
+     */
+    void IPRangeLocationResolver::writeIndex(QVector<QByteArray> & sections) const {
+        sections[ParserHelperIndex::IP_RANGES] = QByteArray((const char *) this->rangeTable, this->numRanges * sizeof(Range));
+        sections[ParserHelperIndex::IP_SEARCH_TREE] = QByteArray((const char *) this->searchTree, 2 * (this->numRanges + 1) * sizeof(quint32));
+
+        QByteArray locations;
+        QDataStream out(&locations, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_4_6);
+        out << this->dataSignature << (quint32) this->locations.size();
+        foreach (const Location & location, this->locations)
+            out << location.continent << location.country << location.region << location.city << location.isp;
+        sections[ParserHelperIndex::IP_LOCATIONS] = locations;
+    }
+
+    Location IPRangeLocationResolver::resolve(IPAddress ip) const {
+        return this->location(this->resolveIndex(ip));
+    }
+
+    Location IPRangeLocationResolver::location(int index) const {
+        if (index < 0 || index >= this->locations.size())
+            return Location();
+
+        // Return it without its hash, like every other resolver.
+        Location location = this->locations[index];
+        location.hash = 0;
+        return location;
+    }
+
+    int IPRangeLocationResolver::resolveIndex(IPAddress ip) const {
+        const int rank = this->findRange(ip);
+        if (rank < 0 || ip > this->rangeTable[rank].end)
+            return -1;
+
+        const int location = this->rangeTable[rank].location;
+        return (location < this->locations.size()) ? location : -1;
+    }
+
+    /**
+     * Build the Eytzinger search tree of the (sorted) ranges.
+     */
+    void IPRangeLocationResolver::buildSearchTree() {
+        this->tree.fill(0, 2 * (this->numRanges + 1));
+        quint32 * starts = this->tree.data();
+        this->buildSearchTree(starts, starts + this->numRanges + 1, 0, 1);
+        this->searchTree = this->tree.constData();
+    }
+
+    /**
+     * Fill the subtree rooted at the given node with the ranges from the
+     * given rank on, through an in-order traversal.
+     *
+     * @return
+     *   The rank of the first range that is not in the subtree.
+     */
+    int IPRangeLocationResolver::buildSearchTree(quint32 * starts, quint32 * ranks, int rank, int node) const {
+        if (node > this->numRanges)
+            return rank;
+
+        rank = this->buildSearchTree(starts, ranks, rank, 2 * node);
+        starts[node] = this->rangeTable[rank].start;
+        ranks[node] = rank;
+        return this->buildSearchTree(starts, ranks, rank + 1, 2 * node + 1);
+    }
+
+    /**
+     * @param ip
+     *   An IPv4 address.
+     * @return
+     *   The rank of the last range that starts at or before the address, -1
+     *   if there is none.
+     */
+    int IPRangeLocationResolver::findRange(IPAddress ip) const {
+        const quint32 * starts = this->searchTree;
+        const quint32 * ranks = this->searchTree + this->numRanges + 1;
+        const uint n = this->numRanges;
+
+        // Descend without branching on the comparison: go right whenever
+        // the node starts at or before the address. The nodes four levels
+        // down are 16 nodes (one cache line) apart, prefetch them.
+        uint k = 1;
+        while (k <= n) {
+#ifdef __GNUC__
+            __builtin_prefetch(starts + 16 * k);
+#endif
+            k = 2 * k + (starts[k] <= ip);
+        }
+
+        // k's bits are the path taken. The first range that starts after
+        // the address is where the path last went left: drop the trailing
+        // right turns (1 bits), plus that left turn.
+        k >>= IPRangeLocationResolver::countTrailingOnes(k) + 1;
+
+        // None starts after the address: it's the last one.
+        const int after = (k == 0) ? (int) n : (int) ranks[k];
+        return after - 1;
+    }
+
+    /**
+     * Parse an IPv4 address: a dotted quad or an integer.
+     */
+    bool IPRangeLocationResolver::parseAddress(const QString & field, IPAddress & ip) {
+        bool ok;
+        ip = field.toUInt(&ok);
+        if (ok)
+            return true;
+
+        QHostAddress address;
+        if (!address.setAddress(field) || address.protocol() != QAbstractSocket::IPv4Protocol)
+            return false;
+        ip = address.toIPv4Address();
+        return true;
+    }
+
+
+    //---------------------------------------------------------------------------
+    // UAPatternResolver.
+
+    UAPatternResolver::UAPatternResolver() {
+        this->patternTable = NULL;
+        this->numPatterns = 0;
+        this->patternChars = NULL;
+        this->numPatternChars = 0;
+        this->stateTable = NULL;
+        this->numStates = 0;
+        this->transitionTable = NULL;
+        this->numTransitions = 0;
+        this->candidateTable = NULL;
+        this->numCandidates = 0;
+    }
+
+    /**
+     * Load the patterns from a browscap.csv file, resolve inheritance and
+     * compile them. Must be called before the resolver is shared with other
+     * threads.
+     *
+     * @param csvFile
+     *   The full path to a browscap.csv file. Columns are located through
+     *   its header row (the one that contains "PropertyName").
+     * @return
+     *   false if the file could not be read or has no header row.
+     */
+    bool UAPatternResolver::parseCsvFile(const QString & csvFile) {
+        QFile csv(csvFile);
+        if (!csv.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            qCritical("Could not open '%s' file for reading: %s.", qPrintable(csvFile), qPrintable(csv.errorString()));
+            return false;
+        }
+
+        this->patterns.clear();
+        this->chars.clear();
+        this->states.clear();
+        this->transitions.clear();
+        this->candidates.clear();
+        this->details.clear();
+        this->index.clear();
+
+        // Columns, located through the header row.
+        enum { NAME, PARENT, BROWSER, VERSION, MAJOR, MINOR, PLATFORM, MOBILE, NUM_COLUMNS };
+        static const char * columnNames[NUM_COLUMNS] = {
+            "propertyname", "parent", "browser", "version", "majorver", "minorver", "platform", "ismobiledevice"
+        };
+        int columns[NUM_COLUMNS];
+        bool headerFound = false;
+
+        QTextStream in(&csv);
+        QStringList fields;
+        QList<QStringList> rows;
+        QHash<QString, int> rowsByName;
+        while (!in.atEnd()) {
+            fields = splitCsvLine(in.readLine());
+
+            if (!headerFound) {
+                for (int c = 0; c < NUM_COLUMNS; c++)
+                    columns[c] = -1;
+                for (int f = 0; f < fields.size(); f++) {
+                    for (int c = 0; c < NUM_COLUMNS; c++) {
+                        if (fields[f].toLower() == columnNames[c])
+                            columns[c] = f;
+                    }
+                }
+                headerFound = (columns[NAME] != -1);
+                continue;
+            }
+
+            // Normalize the row to the known columns; missing values are
+            // empty, i.e. inherited.
+            QStringList row;
+            for (int c = 0; c < NUM_COLUMNS; c++) {
+                QString value = (columns[c] != -1 && columns[c] < fields.size()) ? fields[columns[c]] : QString();
+                if (c != NAME && value.toLower() == "default")
+                    value.clear();
+                row << value;
+            }
+            if (row[NAME].isEmpty())
+                continue;
+
+            rowsByName.insert(row[NAME], rows.size());
+            rows << row;
+        }
+
+        if (!headerFound) {
+            qCritical("'%s' is not a browscap.csv file: no header row.", qPrintable(csvFile));
+            return false;
+        }
+
+        // Resolve inheritance: walk up the Parent chain (guarding against
+        // cycles) until every property has a value. Many patterns end up
+        // with the same details: those are stored only once.
+        QVector<Pattern> compiled;
+        Pattern pattern;
+        UAHierarchyDetails details;
+        QHash<QString, int> detailsIndices;
+        for (int r = 0; r < rows.size(); r++) {
+            QStringList values = rows[r];
+            int ancestor = r;
+            for (int depth = 0; depth < 16; depth++) {
+                QHash<QString, int>::const_iterator parent = rowsByName.constFind(rows[ancestor][PARENT]);
+                if (parent == rowsByName.constEnd() || parent.value() == ancestor)
+                    break;
+                ancestor = parent.value();
+                for (int c = BROWSER; c < NUM_COLUMNS; c++) {
+                    if (values[c].isEmpty())
+                        values[c] = rows[ancestor][c];
+                }
+            }
+
+            details.browser_name          = values[BROWSER];
+            details.browser_version       = values[VERSION];
+            details.browser_version_major = values[MAJOR].toUShort();
+            details.browser_version_minor = values[MINOR].toUShort();
+            details.platform              = values[PLATFORM];
+            details.is_mobile             = (values[MOBILE].toLower() == "true");
+
+            const QString key = QStringList(values.mid(BROWSER)).join("\t");
+            if (!detailsIndices.contains(key)) {
+                detailsIndices.insert(key, this->details.size());
+                this->details.append(details);
+            }
+
+            pattern.pattern = values[NAME].toLower();
+            pattern.details = detailsIndices.value(key);
+            compiled.append(pattern);
+        }
+        std::stable_sort(compiled.begin(), compiled.end());
+
+        // Flatten the patterns.
+        PatternEntry entry;
+        for (int p = 0; p < compiled.size(); p++) {
+            const QString & lowerPattern = compiled[p].pattern;
+            entry.offset = this->chars.size();
+            entry.length = lowerPattern.length();
+            entry.details = compiled[p].details;
+            for (int c = 0; c < lowerPattern.length(); c++)
+                this->chars.append(lowerPattern.at(c));
+            this->patterns.append(entry);
+        }
+        this->compileAutomaton(compiled);
+
+        this->patternTable = this->patterns.constData();
+        this->numPatterns = this->patterns.size();
+        this->patternChars = this->chars.constData();
+        this->numPatternChars = this->chars.size();
+        this->stateTable = this->states.constData();
+        this->numStates = this->states.size();
+        this->transitionTable = this->transitions.constData();
+        this->numTransitions = this->transitions.size();
+        this->candidateTable = this->candidates.constData();
+        this->numCandidates = this->candidates.size();
+
+        this->dataSignature = ParserHelperIndex::signatureFor(QStringList() << csvFile);
+        return true;
+    }
+
+    /**
+     * Look up from the compiled patterns in an index, rather than from a
+     * CSV file. Only the distinct details are loaded; the patterns are not.
+     * Must be called before the resolver is shared with other threads.
+     *
+     * @param index
+     *   An open index. The resolver keeps a reference to it.
+     * @return
+     *   false if the index has no (valid) patterns.
+     */
+    bool UAPatternResolver::loadIndex(QSharedPointer<ParserHelperIndex> index) {
+        quint64 size;
+        const char * data = index->section(ParserHelperIndex::UA_DETAILS, size);
+        if (data == NULL)
+            return false;
+
+        const QByteArray section = QByteArray::fromRawData(data, size);
+        QDataStream in(section);
+        in.setVersion(QDataStream::Qt_4_6);
+        QByteArray signature;
+        quint32 count;
+        in >> signature >> count;
+
+        QVector<UAHierarchyDetails> details;
+        UAHierarchyDetails ua;
+        for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+            in >> ua.platform >> ua.browser_name >> ua.browser_version
+               >> ua.browser_version_major >> ua.browser_version_minor >> ua.is_mobile;
+            details.append(ua);
+        }
+        if (in.status() != QDataStream::Ok)
+            return false;
+
+        quint64 patternsSize, charsSize, statesSize, transitionsSize, candidatesSize;
+        const PatternEntry * patterns = (const PatternEntry *) index->section(ParserHelperIndex::UA_PATTERNS, patternsSize);
+        const QChar * chars = (const QChar *) index->section(ParserHelperIndex::UA_PATTERN_CHARS, charsSize);
+        const AutomatonState * states = (const AutomatonState *) index->section(ParserHelperIndex::UA_AUTOMATON_STATES, statesSize);
+        const AutomatonTransition * transitions = (const AutomatonTransition *) index->section(ParserHelperIndex::UA_AUTOMATON_TRANSITIONS, transitionsSize);
+        const quint32 * candidates = (const quint32 *) index->section(ParserHelperIndex::UA_AUTOMATON_CANDIDATES, candidatesSize);
+        if (patternsSize % sizeof(PatternEntry) != 0 || charsSize % sizeof(QChar) != 0
+            || statesSize % sizeof(AutomatonState) != 0 || statesSize == 0
+            || transitionsSize % sizeof(AutomatonTransition) != 0 || candidatesSize % sizeof(quint32) != 0)
+            return false;
+        const quint32 numPatterns = patternsSize / sizeof(PatternEntry);
+        const quint32 numChars = charsSize / sizeof(QChar);
+        const quint32 numStates = statesSize / sizeof(AutomatonState);
+        const quint32 numTransitions = transitionsSize / sizeof(AutomatonTransition);
+        const quint32 numCandidates = candidatesSize / sizeof(quint32);
+
+        // A corrupt index must neither make lookups read out of bounds nor
+        // loop forever (links must point to lower states).
+        for (quint32 p = 0; p < numPatterns; p++) {
+            if (patterns[p].length == 0
+                || patterns[p].offset > numChars || patterns[p].length > numChars - patterns[p].offset
+                || patterns[p].details >= (quint32) details.size())
+                return false;
+        }
+        for (quint32 s = 0; s < numStates; s++) {
+            const AutomatonState & state = states[s];
+            if (state.transitions > numTransitions || state.numTransitions > numTransitions - state.transitions
+                || state.candidates > numCandidates || state.numCandidates > numCandidates - state.candidates
+                || (s > 0 && state.failure >= s)
+                || (state.dictionary != UA_AUTOMATON_NO_STATE && (state.dictionary >= s || state.dictionary == 0)))
+                return false;
+        }
+        for (quint32 t = 0; t < numTransitions; t++) {
+            if (transitions[t].target >= numStates || transitions[t].target == 0)
+                return false;
+        }
+        for (quint32 c = 0; c < numCandidates; c++) {
+            if (candidates[c] >= numPatterns)
+                return false;
+        }
+
+        this->patterns.clear();
+        this->chars.clear();
+        this->states.clear();
+        this->transitions.clear();
+        this->candidates.clear();
+        this->details = details;
+        this->index = index;
+        this->patternTable = patterns;
+        this->numPatterns = numPatterns;
+        this->patternChars = chars;
+        this->numPatternChars = numChars;
+        this->stateTable = states;
+        this->numStates = numStates;
+        this->transitionTable = transitions;
+        this->numTransitions = numTransitions;
+        this->candidateTable = candidates;
+        this->numCandidates = numCandidates;
+        this->dataSignature = signature;
+        return true;
+    }
+
+    /**
+     * Add the UA_PATTERNS, UA_PATTERN_CHARS, UA_AUTOMATON_* and UA_DETAILS
+     * sections of an index.
+     *
+     * @param sections
+     *   The sections of the index, see ParserHelperIndex::write().
+     */
+    void UAPatternResolver::writeIndex(QVector<QByteArray> & sections) const {
+        sections[ParserHelperIndex::UA_PATTERNS] = QByteArray((const char *) this->patternTable, this->numPatterns * sizeof(PatternEntry));
+        sections[ParserHelperIndex::UA_PATTERN_CHARS] = QByteArray((const char *) this->patternChars, this->numPatternChars * sizeof(QChar));
+        sections[ParserHelperIndex::UA_AUTOMATON_STATES] = QByteArray((const char *) this->stateTable, this->numStates * sizeof(AutomatonState));
+        sections[ParserHelperIndex::UA_AUTOMATON_TRANSITIONS] = QByteArray((const char *) this->transitionTable, this->numTransitions * sizeof(AutomatonTransition));
+        sections[ParserHelperIndex::UA_AUTOMATON_CANDIDATES] = QByteArray((const char *) this->candidateTable, this->numCandidates * sizeof(quint32));
+
+        QByteArray details;
+        QDataStream out(&details, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_4_6);
+        out << this->dataSignature << (quint32) this->details.size();
+        foreach (const UAHierarchyDetails & ua, this->details) {
+            out << ua.platform << ua.browser_name << ua.browser_version
+                << ua.browser_version_major << ua.browser_version_minor << ua.is_mobile;
+        }
+        sections[ParserHelperIndex::UA_DETAILS] = details;
+    }
+
+    UAHierarchyDetails UAPatternResolver::resolve(const UA & ua) const {
+        if (this->stateTable == NULL)
+            return UAHierarchyDetails();
+
+        const QString lowerUA = ua.toLower();
+        const QChar * uaChars = lowerUA.constData();
+        const int uaLength = lowerUA.length();
+
+        // Collect the candidates: the patterns without an anchor, plus
+        // those of every anchor that occurs in the User-Agent.
+        QVarLengthArray<quint32, 256> found;
+        const AutomatonState & root = this->stateTable[0];
+        for (quint32 c = 0; c < root.numCandidates; c++)
+            found.append(this->candidateTable[root.candidates + c]);
+
+        quint32 state = 0;
+        for (int i = 0; i < uaLength; i++) {
+            state = this->step(state, uaChars[i].unicode());
+            quint32 match = (state != 0 && this->stateTable[state].numCandidates > 0) ? state : this->stateTable[state].dictionary;
+            while (match != UA_AUTOMATON_NO_STATE) {
+                const AutomatonState & matched = this->stateTable[match];
+                for (quint32 c = 0; c < matched.numCandidates; c++)
+                    found.append(this->candidateTable[matched.candidates + c]);
+                match = matched.dictionary;
+            }
+        }
+
+        // Try them longest first (i.e. in pattern order): the first match
+        // is the longest match.
+        std::sort(found.data(), found.data() + found.size());
+        quint32 previous = UA_AUTOMATON_NO_STATE;
+        for (int f = 0; f < found.size(); f++) {
+            const quint32 p = found[f];
+            if (p == previous)
+                continue;
+            previous = p;
+
+            const PatternEntry & pattern = this->patternTable[p];
+            if (UAPatternResolver::matches(this->patternChars + pattern.offset, pattern.length, uaChars, uaLength))
+                return this->details[pattern.details];
+        }
+
+        return UAHierarchyDetails();
+    }
+
+    /**
+     * @param pattern
+     *   A pattern with '*' and '?' wildcards.
+     * @return
+     *   Its anchor: its longest part without wildcards (the first one, if
+     *   there are several). Empty if it consists of wildcards only.
+     */
+    QString UAPatternResolver::anchorOf(const QString & pattern) {
+        int anchorStart = 0, anchorLength = 0;
+        int start = 0;
+        for (int i = 0; i <= pattern.length(); i++) {
+            if (i == pattern.length() || pattern.at(i) == '*' || pattern.at(i) == '?') {
+                if (i - start > anchorLength) {
+                    anchorStart = start;
+                    anchorLength = i - start;
+                }
+                start = i + 1;
+            }
+        }
+        return pattern.mid(anchorStart, anchorLength);
+    }
+
+    /**
+     * Compile the Aho-Corasick automaton of the patterns' anchors: build
+     * the trie of anchors, then number its states breadth-first and compute
+     * their failure and dictionary links.
+     *
+     * @param compiled
+     *   The patterns, in pattern order.
+     */
+    void UAPatternResolver::compileAutomaton(const QVector<Pattern> & compiled) {
+        // The trie, in order of creation.
+        QVector<QVector<AutomatonTransition> > children(1);
+        QVector<QVector<quint32> > trieCandidates(1);
+        AutomatonTransition transition;
+        transition.reserved = 0;
+        for (int p = 0; p < compiled.size(); p++) {
+            const QString anchor = UAPatternResolver::anchorOf(compiled[p].pattern);
+            quint32 node = 0;
+            for (int i = 0; i < anchor.length(); i++) {
+                const ushort c = anchor.at(i).unicode();
+                quint32 next = UA_AUTOMATON_NO_STATE;
+                for (int t = 0; t < children[node].size(); t++) {
+                    if (children[node][t].c == c) {
+                        next = children[node][t].target;
+                        break;
+                    }
+                }
+                if (next == UA_AUTOMATON_NO_STATE) {
+                    next = children.size();
+                    transition.c = c;
+                    transition.target = next;
+                    children[node].append(transition);
+                    children.append(QVector<AutomatonTransition>());
+                    trieCandidates.append(QVector<quint32>());
+                }
+                node = next;
+            }
+            trieCandidates[node].append(p);
+        }
+
+        // Number the states breadth-first.
+        const int numNodes = children.size();
+        QVector<quint32> order;
+        QVector<quint32> stateOf(numNodes);
+        order.reserve(numNodes);
+        order.append(0);
+        for (int i = 0; i < order.size(); i++) {
+            stateOf[order[i]] = i;
+            for (int t = 0; t < children[order[i]].size(); t++)
+                order.append(children[order[i]][t].target);
+        }
+
+        // Flatten the trie in that order, transitions ordered by character.
+        AutomatonState state;
+        this->states.resize(numNodes);
+        for (int s = 0; s < numNodes; s++) {
+            QVector<AutomatonTransition> nodeChildren = children[order[s]];
+            QMap<ushort, quint32> sorted;
+            for (int t = 0; t < nodeChildren.size(); t++)
+                sorted.insert(nodeChildren[t].c, stateOf[nodeChildren[t].target]);
+
+            state.transitions = this->transitions.size();
+            state.numTransitions = sorted.size();
+            for (QMap<ushort, quint32>::const_iterator it = sorted.constBegin(); it != sorted.constEnd(); ++it) {
+                transition.c = it.key();
+                transition.target = it.value();
+                this->transitions.append(transition);
+            }
+
+            state.candidates = this->candidates.size();
+            state.numCandidates = trieCandidates[order[s]].size();
+            this->candidates += trieCandidates[order[s]];
+
+            state.failure = 0;
+            state.dictionary = UA_AUTOMATON_NO_STATE;
+            this->states[s] = state;
+        }
+        this->stateTable = this->states.constData();
+        this->transitionTable = this->transitions.constData();
+
+        // Failure and dictionary links, breadth-first: those of the parent
+        // (and of all shallower states) are known.
+        for (int s = 0; s < numNodes; s++) {
+            const AutomatonState & parent = this->states[s];
+            for (quint32 t = parent.transitions; t < parent.transitions + parent.numTransitions; t++) {
+                const quint32 child = this->transitions[t].target;
+                quint32 failure = 0;
+                if (s != 0)
+                    failure = this->step(parent.failure, this->transitions[t].c);
+                this->states[child].failure = failure;
+                this->states[child].dictionary = (failure != 0 && this->states[failure].numCandidates > 0) ? failure : this->states[failure].dictionary;
+            }
+        }
+    }
+
+    /**
+     * Follow a transition of the automaton, falling back along the failure
+     * links until a state has a transition for the character (or the root
+     * is reached).
+     */
+    quint32 UAPatternResolver::step(quint32 state, ushort c) const {
+        forever {
+            const AutomatonState & current = this->stateTable[state];
+            const AutomatonTransition * first = this->transitionTable + current.transitions;
+            const AutomatonTransition * last = first + current.numTransitions;
+            while (first < last) {
+                const AutomatonTransition * middle = first + (last - first) / 2;
+                if (middle->c < c)
+                    first = middle + 1;
+                else
+                    last = middle;
+            }
+            if (first < this->transitionTable + current.transitions + current.numTransitions && first->c == c)
+                return first->target;
+            if (state == 0)
+                return 0;
+            state = current.failure;
+        }
+    }
+
+    /**
+     * Match a (lowercase) pattern with '*' and '?' wildcards against a
+     * (lowercase) User-Agent. Backtracks to the last '*' only, so it runs in
+     * O(pattern length * UA length) at worst.
+     */
+    bool UAPatternResolver::matches(const QChar * pattern, int patternLength, const QChar * ua, int uaLength) {
+        const QChar * p = pattern;
+        const QChar * pEnd = p + patternLength;
+        const QChar * s = ua;
+        const QChar * sEnd = s + uaLength;
+        const QChar * star = NULL;
+        const QChar * starMatch = NULL;
+
+        while (s < sEnd) {
+            if (p < pEnd && (*p == '?' || *p == *s)) {
+                p++;
+                s++;
+            }
+            else if (p < pEnd && *p == '*') {
+                star = p++;
+                starMatch = s;
+            }
+            else if (star != NULL) {
+                p = star + 1;
+                s = ++starMatch;
+            }
+            else
+                return false;
+        }
+        while (p < pEnd && *p == '*')
+            p++;
+
+        return p == pEnd;
+    }
+
+}
@@ -0,0 +1,340 @@
+#ifndef RESOLVERS_H
+#define RESOLVERS_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QVector>
+#include <QHash>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QTextStream>
+#include <QHostAddress>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QVarLengthArray>
+#include <QMap>
+#include <QSharedPointer>
+
+#include <algorithm>
+
+#include "QBrowsCap.h"
+#include "QGeoIP.h"
+#include "ParserHelperIndex.h"
+#include "typedefs.h"
+
+
+namespace EpisodesParser {
+
+    // Marks the absence of a state in UAPatternResolver's automaton.
+    #define UA_AUTOMATON_NO_STATE 0xffffffff
+
+    /**
+     * Resolves IPv4 addresses to Locations.
+     *
+     * Implementations must be reentrant: resolve() is called concurrently
+     * from many threads.
+     */
+    class LocationResolver {
+    public:
+        virtual ~LocationResolver() {}
+
+        /**
+         * @param ip
+         *   An IPv4 address.
+         * @return
+         *   Its Location (with empty fields if the address is unknown). Its
+         *   hash has not been computed.
+         */
+        virtual Location resolve(IPAddress ip) const = 0;
+
+        /**
+         * Resolvers with a fixed set of Locations may also resolve to an
+         * index into that set, which spares the caller from constructing
+         * (and interning) a Location on every lookup.
+         *
+         * @return
+         *   The number of Locations in the set, 0 if not supported.
+         */
+        virtual int numLocations() const { return 0; }
+
+        /**
+         * @param index
+         *   An index in [0, numLocations()).
+         * @return
+         *   The Location at that index. Its hash has not been computed.
+         */
+        virtual Location location(int index) const { Q_UNUSED(index); return Location(); }
+
+        /**
+         * @param ip
+         *   An IPv4 address.
+         * @return
+         *   The index of its Location, -1 if the address is unknown.
+         */
+        virtual int resolveIndex(IPAddress ip) const { Q_UNUSED(ip); return -1; }
+
+        /**
+         * @return
+         *   Identifies the data that is resolved with: it changes whenever
+         *   resolve() may return different results.
+         */
+        virtual QByteArray signature() const = 0;
+
+        virtual void clearCache() {}
+    };
+
+    /**
+     * Resolves User-Agent strings to UA hierarchies.
+     *
+     * Implementations must be reentrant: resolve() is called concurrently
+     * from many threads.
+     */
+    class UAResolver {
+    public:
+        virtual ~UAResolver() {}
+
+        /**
+         * @param ua
+         *   A User-Agent string.
+         * @return
+         *   Its UAHierarchyDetails. Its hash has not been computed.
+         */
+        virtual UAHierarchyDetails resolve(const UA & ua) const = 0;
+
+        /**
+         * @return
+         *   Identifies the data that is resolved with: it changes whenever
+         *   resolve() may return different results.
+         */
+        virtual QByteArray signature() const = 0;
+
+        virtual void clearCache() {}
+    };
+
+
+    //---------------------------------------------------------------------------
+    // Wrappers around QGeoIP and QBrowsCap.
+
+    /**
+     * Resolves through the GeoIP City and ISP databases. QGeoIP is not
+     * thread-safe, hence lookups are serialized.
+     */
+    class QGeoIPLocationResolver : public LocationResolver {
+    public:
+        QGeoIPLocationResolver(const QString & cityDB, const QString & ispDB);
+
+        Location resolve(IPAddress ip) const;
+        QByteArray signature() const { return this->dataSignature; }
+
+    protected:
+        mutable QGeoIP geoIP;
+        mutable QMutex mutex;
+        QByteArray dataSignature;
+    };
+
+    /**
+     * Resolves through QBrowsCap. QBrowsCap is not thread-safe, hence
+     * lookups are serialized.
+     */
+    class QBrowsCapUAResolver : public UAResolver {
+    public:
+        QBrowsCapUAResolver(const QString & csvFile, const QString & indexFile);
+
+        UAHierarchyDetails resolve(const UA & ua) const;
+        QByteArray signature() const { return this->dataSignature; }
+        void clearCache();
+
+    protected:
+        mutable QBrowsCap browsCap;
+        mutable QMutex mutex;
+        QByteArray dataSignature;
+    };
+
+
+    //---------------------------------------------------------------------------
+    // Reentrant, in-memory resolvers.
+
+    /**
+     * Resolves through an immutable table of IPv4 ranges, sorted by their
+     * first address, without any locking. A lookup is a branch-free binary
+     * search through the first addresses in Eytzinger (breadth-first)
+     * order, which keeps the top of the search tree in a few cache lines
+     * and lets the next levels be prefetched. Every range refers to an
+     * index into the distinct Locations, see resolveIndex().
+     *
+     * The table is loaded from a CSV file with one range per line:
+     *   start,end,continent,country,region,city,isp
+     * start and end (both inclusive) are dotted quads or integers. Fields
+     * may be double-quoted. Empty lines and lines that start with '#' are
+     * ignored, as are ranges that overlap a preceding range.
+     *
+     * Alternatively, the table is looked up straight from a (memory-mapped)
+     * ParserHelperIndex.
+     */
+    class IPRangeLocationResolver : public LocationResolver {
+    public:
+        IPRangeLocationResolver();
+
+        bool parseCsvFile(const QString & csvFile);
+        bool loadIndex(QSharedPointer<ParserHelperIndex> index);
+        void writeIndex(QVector<QByteArray> & sections) const;
+        int size() const { return this->numRanges; }
+
+        Location resolve(IPAddress ip) const;
+        int numLocations() const { return this->locations.size(); }
+        Location location(int index) const;
+        int resolveIndex(IPAddress ip) const;
+        QByteArray signature() const { return this->dataSignature; }
+
+    protected:
+        struct Range {
+            IPAddress start;
+            IPAddress end;
+            int location;
+
+            bool operator<(const Range & other) const { return this->start < other.start; }
+        };
+
+        static bool parseAddress(const QString & field, IPAddress & ip);
+        void buildSearchTree();
+        int buildSearchTree(quint32 * starts, quint32 * ranks, int rank, int node) const;
+        int findRange(IPAddress ip) const;
+        static int countTrailingOnes(uint k) {
+#ifdef __GNUC__
+            return __builtin_ctz(~k);
+#else
+            int ones = 0;
+            for (; k & 1; k >>= 1)
+                ones++;
+            return ones;
+#endif
+        }
+
+        // The ranges that are looked up: either those in ranges, or those
+        // in the index.
+        const Range * rangeTable;
+        int numRanges;
+        // The first address of every range in Eytzinger order (1-based: the
+        // children of node k are 2k and 2k + 1), followed by the rank (i.e.
+        // index in rangeTable) of the range at every node. Both numRanges
+        // + 1 long.
+        const quint32 * searchTree;
+
+        QVector<Range> ranges;
+        QVector<quint32> tree;
+        QVector<Location> locations;
+        QSharedPointer<ParserHelperIndex> index;
+        QByteArray dataSignature;
+    };
+
+    /**
+     * Resolves through an immutable index of browscap.csv patterns; a
+     * lookup never locks.
+     *
+     * Patterns may contain the '*' and '?' wildcards and are matched case-
+     * insensitively. Like browscap, the longest matching pattern wins.
+     * Properties that a pattern does not define are inherited from its
+     * Parent.
+     *
+     * Every pattern has an anchor: its longest literal part. A pattern can
+     * only match User-Agents that contain its anchor, so the User-Agent is
+     * first scanned for all anchors at once, by an Aho-Corasick automaton.
+     * Only the patterns whose anchor was found (plus those without one) are
+     * then tried, longest first. A lookup takes microseconds, regardless of
+     * the number of patterns.
+     *
+     * The patterns are compiled into flat tables, which are either owned or
+     * looked up straight from a (memory-mapped) ParserHelperIndex.
+     */
+    class UAPatternResolver : public UAResolver {
+    public:
+        UAPatternResolver();
+
+        bool parseCsvFile(const QString & csvFile);
+        bool loadIndex(QSharedPointer<ParserHelperIndex> index);
+        void writeIndex(QVector<QByteArray> & sections) const;
+        int size() const { return this->numPatterns; }
+
+        UAHierarchyDetails resolve(const UA & ua) const;
+        QByteArray signature() const { return this->dataSignature; }
+
+    protected:
+        // A lowercase pattern: a range of patternChars, and the index of
+        // its (inherited) details.
+        struct PatternEntry {
+            quint32 offset;
+            quint32 length;
+            quint32 details;
+        };
+
+        // A pattern while compiling.
+        struct Pattern {
+            QString pattern;
+            int details;
+
+            // Longest first.
+            bool operator<(const Pattern & other) const { return this->pattern.length() > other.pattern.length(); }
+        };
+
+        // A state of the automaton. States are numbered breadth-first, the
+        // root (the empty anchor) being 0, so failure and dictionary links
+        // always point to lower states.
+        struct AutomatonState {
+            // Range of transitionTable, ordered by character.
+            quint32 transitions;
+            quint32 numTransitions;
+            // The state of the longest proper suffix that is in the trie.
+            quint32 failure;
+            // The nearest state on the failure chain that has candidates,
+            // UA_AUTOMATON_NO_STATE if none.
+            quint32 dictionary;
+            // Range of candidateTable: the patterns whose anchor ends in
+            // this state, in pattern order. Those of the root have no
+            // anchor.
+            quint32 candidates;
+            quint32 numCandidates;
+        };
+
+        struct AutomatonTransition {
+            quint16 c;
+            quint16 reserved;
+            quint32 target;
+        };
+
+        static bool matches(const QChar * pattern, int patternLength, const QChar * ua, int uaLength);
+        static QString anchorOf(const QString & pattern);
+        void compileAutomaton(const QVector<Pattern> & compiled);
+        quint32 step(quint32 state, ushort c) const;
+
+        // The compiled tables. Patterns are ordered longest first.
+        const PatternEntry * patternTable;
+        int numPatterns;
+        const QChar * patternChars;
+        int numPatternChars;
+        const AutomatonState * stateTable;
+        int numStates;
+        const AutomatonTransition * transitionTable;
+        int numTransitions;
+        const quint32 * candidateTable;
+        int numCandidates;
+        QVector<UAHierarchyDetails> details;
+
+        // Storage for tables that were compiled from a CSV file.
+        QVector<PatternEntry> patterns;
+        QVector<QChar> chars;
+        QVector<AutomatonState> states;
+        QVector<AutomatonTransition> transitions;
+        QVector<quint32> candidates;
+        QSharedPointer<ParserHelperIndex> index;
+
+        QByteArray dataSignature;
+    };
+
+}
+
+#endif // RESOLVERS_H
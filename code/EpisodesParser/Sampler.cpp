@@ -0,0 +1,200 @@
+#include "Sampler.h"
+
+namespace EpisodesParser {
+
+    Sampler::Sampler() {
+        this->mode = SAMPLING_NONE;
+        this->rate = 1.0;
+        this->reservoirSize = 0;
+        this->configuredReservoirSize = 0;
+        this->targetDuration = 0;
+        this->minRate = 0.0;
+    }
+
+
+    //---------------------------------------------------------------------------
+    // Public methods.
+
+    void Sampler::setMode(SamplingMode mode) {
+        QMutexLocker locker(&this->mutex);
+        this->mode = mode;
+    }
+
+    /**
+     * @param rate
+     *   The fraction of page views to keep in SAMPLING_HASH mode, in the
+     *   (0, 1] range.
+     */
+    void Sampler::setRate(double rate) {
+        QMutexLocker locker(&this->mutex);
+        this->rate = qBound(0.0001, rate, 1.0);
+    }
+
+    /**
+     * @param size
+     *   The number of page views to keep per quarter in SAMPLING_RESERVOIR
+     *   mode. Adaptive sampling never grows the reservoir beyond it.
+     */
+    void Sampler::setReservoirSize(int size) {
+        QMutexLocker locker(&this->mutex);
+        this->reservoirSize = qMax(1, size);
+        this->configuredReservoirSize = this->reservoirSize;
+    }
+
+    /**
+     * @param targetDuration
+     *   The analysis duration per batch (in milliseconds) to aim for, or 0
+     *   to disable adaptive sampling.
+     * @param minRate
+     *   The sampling rate never drops below this rate.
+     */
+    void Sampler::setAdaptive(int targetDuration, double minRate) {
+        QMutexLocker locker(&this->mutex);
+        this->targetDuration = qMax(0, targetDuration);
+        this->minRate = qBound(0.0001, minRate, 1.0);
+    }
+
+    SamplingMode Sampler::getMode() const {
+        QMutexLocker locker(&this->mutex);
+        return this->mode;
+    }
+
+    double Sampler::getRate() const {
+        QMutexLocker locker(&this->mutex);
+        return this->rate;
+    }
+
+    int Sampler::getReservoirSize() const {
+        QMutexLocker locker(&this->mutex);
+        return this->reservoirSize;
+    }
+
+    /**
+     * Sample the page views of a quarter.
+     *
+     * @param batch
+     *   The expanded lines of a single quarter.
+     * @param quarterID
+     *   The quarter's ID, which seeds reservoir sampling.
+     * @param sampled
+     *   The sampled lines, in their original order. Episodes are shared
+     *   with batch. Left untouched if nothing was dropped.
+     * @return
+     *   The fraction of page views that was kept: 1.0 if nothing was
+     *   dropped. Support counts of the sample must be divided by it.
+     */
+    double Sampler::sample(const ExpandedEpisodesLogBatch & batch, uint quarterID, ExpandedEpisodesLogBatch & sampled) const {
+        this->mutex.lock();
+        SamplingMode mode = this->mode;
+        double rate = this->rate;
+        int reservoirSize = this->reservoirSize;
+        this->mutex.unlock();
+
+        if (mode == SAMPLING_NONE || batch.isEmpty())
+            return 1.0;
+
+        QVector<ExpandedEpisodesLogLine> lines;
+        if (mode == SAMPLING_HASH) {
+            if (rate >= 1.0)
+                return 1.0;
+
+            const quint32 threshold = (quint32) (rate * 4294967295.0);
+            lines.reserve((int) (batch.size() * rate * 1.1) + 16);
+            for (int i = 0; i < batch.size(); i++) {
+                if (Sampler::hashLine(batch, i) <= threshold)
+                    lines.append(batch.lines[i]);
+            }
+        }
+        else {
+            if (batch.size() <= reservoirSize)
+                return 1.0;
+
+            // Algorithm R, with a xorshift generator seeded by the quarter.
+            QVector<int> reservoir(reservoirSize);
+            for (int i = 0; i < reservoirSize; i++)
+                reservoir[i] = i;
+            quint32 random = quarterID * 2654435761u + 1;
+            for (int i = reservoirSize; i < batch.size(); i++) {
+                random ^= random << 13;
+                random ^= random >> 17;
+                random ^= random << 5;
+                int j = (int) (random % (quint32) (i + 1));
+                if (j < reservoirSize)
+                    reservoir[j] = i;
+            }
+
+            // Keep the original (chronological) order.
+            std::sort(reservoir.begin(), reservoir.end());
+            lines.reserve(reservoirSize);
+            for (int i = 0; i < reservoirSize; i++)
+                lines.append(batch.lines[reservoir[i]]);
+        }
+
+        // Too small a batch to sample: an empty sample tells nothing.
+        if (lines.isEmpty())
+            return 1.0;
+
+        sampled.lines = lines;
+        sampled.episodes = batch.episodes;
+        return ((double) sampled.size()) / batch.size();
+    }
+
+    /**
+     * Adapt the sampling rate (SAMPLING_HASH) or the reservoir size
+     * (SAMPLING_RESERVOIR) to the duration of the analysis of the last
+     * batch. Does nothing unless adaptive sampling is enabled.
+     *
+     * @param duration
+     *   The analysis duration of the last batch, in milliseconds.
+     */
+    void Sampler::reportAnalysisDuration(int duration) {
+        QMutexLocker locker(&this->mutex);
+        if (this->targetDuration == 0 || this->mode == SAMPLING_NONE || duration < 0)
+            return;
+
+        double factor = 1.0;
+        if (duration > this->targetDuration)
+            factor = qMax(SAMPLER_MAX_DECREASE, 0.9 * this->targetDuration / duration);
+        else if (duration < this->targetDuration / 2)
+            factor = SAMPLER_INCREASE;
+
+        if (this->mode == SAMPLING_HASH)
+            this->rate = qBound(this->minRate, this->rate * factor, 1.0);
+        else {
+            // Bounded before the conversion, so that it can't overflow.
+            const double minSize = qMin(SAMPLER_MIN_RESERVOIR_SIZE, this->configuredReservoirSize);
+            this->reservoirSize = (int) qBound(minSize, this->reservoirSize * factor, (double) this->configuredReservoirSize);
+        }
+    }
+
+    /**
+     * Hash a page view. Only raw values are hashed (no interned IDs, since
+     * those depend on the order in which lines were parsed), so a page view
+     * hashes the same in every run: its time, status and episode durations.
+     *
+     * @param batch
+     *   An expanded batch.
+     * @param line
+     *   The index of a line in the batch.
+     * @return
+     *   The page view's hash.
+     */
+    quint32 Sampler::hashLine(const ExpandedEpisodesLogBatch & batch, int line) {
+        const ExpandedEpisodesLogLine & l = batch.lines[line];
+
+        // FNV-1a, followed by a finalizer to spread the bits evenly over
+        // the whole range.
+        quint32 hash = 2166136261u;
+        hash = (hash ^ l.time) * 16777619u;
+        hash = (hash ^ (((quint32) l.status << 8) | l.numEpisodes)) * 16777619u;
+        for (int e = 0; e < l.numEpisodes; e++)
+            hash = (hash ^ batch.episodes[l.firstEpisode + e].duration) * 16777619u;
+        hash ^= hash >> 16;
+        hash *= 0x85ebca6b;
+        hash ^= hash >> 13;
+        hash *= 0xc2b2ae35;
+        hash ^= hash >> 16;
+        return hash;
+    }
+
+}
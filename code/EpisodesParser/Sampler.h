@@ -0,0 +1,78 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <QtGlobal>
+#include <QVector>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <algorithm>
+
+#include "typedefs.h"
+
+
+namespace EpisodesParser {
+
+    enum SamplingMode {
+        // Every page view is analyzed.
+        SAMPLING_NONE,
+        // A page view is analyzed if its hash falls below the sampling rate:
+        // the same page view always gets the same verdict.
+        SAMPLING_HASH,
+        // A fixed number of page views is analyzed per quarter, chosen
+        // uniformly at random (seeded by the quarter, hence repeatable).
+        SAMPLING_RESERVOIR
+    };
+
+    // Adaptive sampling: the rate is lowered at most this much per batch
+    // when analysis takes too long, and raised this much when analysis
+    // takes less than half of the target duration.
+    #define SAMPLER_MAX_DECREASE 0.5
+    #define SAMPLER_INCREASE 1.25
+    // The reservoir never shrinks below this many page views, and never
+    // grows beyond the configured reservoir size.
+    #define SAMPLER_MIN_RESERVOIR_SIZE 1000
+
+    /**
+     * Sheds load by sampling the page views of each quarter, when the
+     * analyst cannot keep up.
+     *
+     * sample() reports the fraction of page views that was kept, so that
+     * support counts can be scaled back up. When adaptive, the sampling
+     * rate (or reservoir size) follows the measured analysis duration per
+     * batch, see reportAnalysisDuration().
+     *
+     * Thread-safe: the parser samples while the analyst reports.
+     */
+    class Sampler {
+    public:
+        Sampler();
+
+        void setMode(SamplingMode mode);
+        void setRate(double rate);
+        void setReservoirSize(int size);
+        void setAdaptive(int targetDuration, double minRate);
+
+        SamplingMode getMode() const;
+        double getRate() const;
+        int getReservoirSize() const;
+
+        double sample(const ExpandedEpisodesLogBatch & batch, uint quarterID, ExpandedEpisodesLogBatch & sampled) const;
+        void reportAnalysisDuration(int duration);
+
+        static quint32 hashLine(const ExpandedEpisodesLogBatch & batch, int line);
+
+    protected:
+        mutable QMutex mutex;
+        SamplingMode mode;
+        double rate;
+        int reservoirSize;
+        int configuredReservoirSize;
+        // Adaptive sampling: disabled when targetDuration is 0.
+        int targetDuration;
+        double minRate;
+    };
+
+}
+
+#endif // SAMPLER_H
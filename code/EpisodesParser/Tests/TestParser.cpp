@@ -1,5 +1,27 @@
 #include "TestParser.h"
 
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Removes the files a test writes once the test returns, also when it
+ * fails: a failing QVERIFY() or QCOMPARE() returns right away. Declare it
+ * before anything that keeps those files open or mapped.
+ */
+class TestFiles {
+public:
+    TestFiles(const QStringList & fileNames) : fileNames(fileNames) {}
+    ~TestFiles() {
+        foreach (const QString & fileName, this->fileNames)
+            QFile::remove(fileName);
+    }
+
+protected:
+    QStringList fileNames;
+};
+
 void TestParser::init() {
     QFile logFile("episodes.log");
     if (!logFile.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate))
@@ -132,7 +154,7 @@ void TestParser::mapLineToEpisodesLogLine_data() {
 
 void TestParser::mapLineToEpisodesLogLine() {
     static Parser p;
-    static EpisodesLogLine e;
+    EpisodesLogBatch batch;
     QFETCH(QString, line);
     QFETCH(IPAddress, ip);
     QFETCH(Time, time);
@@ -140,11 +162,1097 @@ void TestParser::mapLineToEpisodesLogLine() {
     QFETCH(HTTPStatus, status);
     QFETCH(DomainID, domainID);
 
-    e = p.mapLineToEpisodesLogLine(line);
+    QVERIFY(p.mapLineToEpisodesLogLine(line, batch));
+    QCOMPARE(batch.size(), 1);
 
+    const EpisodesLogLine & e = batch.lines.first();
     QCOMPARE(e.ip, ip);
     QCOMPARE(e.time, time);
-    QCOMPARE(e.episodes, episodes);
+    QCOMPARE(batch.lineEpisodes(0), episodes);
     QCOMPARE(e.status, status);
     QCOMPARE(e.domain.id, domainID);
 }
+
+void TestParser::maxURLs() {
+    const QString line = "76.170.154.29 [Sunday, 14-Nov-2010 06:27:12 +0100] \"?ets=css:40\" 200 \"%1\" \"Mozilla/5.0\" \"driverpacks.net\"";
+    EpisodesLogBatch batch;
+
+    // Once the maximum number of URLs has been reached, known URLs still
+    // map to their IDs, new ones map to UNKNOWN_URL_ID. Lines are kept.
+    QVERIFY(Parser::mapLineToEpisodesLogLine(line.arg("http://driverpacks.net/known"), batch));
+    Parser::setMaxURLs(0);
+    bool knownMapped = Parser::mapLineToEpisodesLogLine(line.arg("http://driverpacks.net/known"), batch);
+    bool newMapped = Parser::mapLineToEpisodesLogLine(line.arg("http://driverpacks.net/new"), batch);
+    Parser::setMaxURLs(MAX_URLS);
+
+    QVERIFY(knownMapped);
+    QVERIFY(newMapped);
+    QCOMPARE(batch.size(), 3);
+    QVERIFY(batch.lines[0].url != UNKNOWN_URL_ID);
+    QCOMPARE(batch.lines[1].url, batch.lines[0].url);
+    QCOMPARE(batch.lines[2].url, (URLID) UNKNOWN_URL_ID);
+}
+
+void TestParser::tokenize_data() {
+    QTest::addColumn<QString>("line");
+    QTest::addColumn<bool>("strictResult");
+    QTest::addColumn<bool>("lenientResult");
+    QTest::addColumn<int>("lenientNumEpisodes");
+
+    QTest::newRow("valid line")
+      << "76.170.154.29 [Sunday, 14-Nov-2010 06:27:12 +0100] \"?ets=css:40,headerjs:90\" 200 \"http://driverpacks.net/\" \"Mozilla/5.0\" \"driverpacks.net\""
+      << true << true << 2;
+
+    QTest::newRow("malformed episode")
+      << "76.170.154.29 [Sunday, 14-Nov-2010 06:27:12 +0100] \"?ets=css:40,headerjs,tabs:1\" 200 \"http://driverpacks.net/\" \"Mozilla/5.0\" \"driverpacks.net\""
+      << false << true << 2;
+
+    QTest::newRow("missing weekday, extra whitespace")
+      << "76.170.154.29  [14-Nov-2010 06:27:12 +0100] \"?ets=css:40\" 200 \"http://driverpacks.net/\" \"Mozilla/5.0\" \"driverpacks.net\""
+      << false << true << 1;
+
+    QTest::newRow("truncated domain")
+      << "76.170.154.29 [Sunday, 14-Nov-2010 06:27:12 +0100] \"?ets=css:40\" 200 \"http://driverpacks.net/\" \"Mozilla/5.0\""
+      << false << true << 1;
+
+    QTest::newRow("invalid IP address")
+      << "76.170.154.290 [Sunday, 14-Nov-2010 06:27:12 +0100] \"?ets=css:40\" 200 \"http://driverpacks.net/\" \"Mozilla/5.0\" \"driverpacks.net\""
+      << false << false << 0;
+
+    QTest::newRow("no episodes")
+      << "76.170.154.29 [Sunday, 14-Nov-2010 06:27:12 +0100] \"?ets=css\" 200 \"http://driverpacks.net/\" \"Mozilla/5.0\" \"driverpacks.net\""
+      << false << false << 0;
+}
+
+void TestParser::tokenize() {
+    QFETCH(QString, line);
+    QFETCH(bool, strictResult);
+    QFETCH(bool, lenientResult);
+    QFETCH(int, lenientNumEpisodes);
+
+    RawEpisodesLogLine rawLine;
+    const QByteArray raw = line.toLatin1();
+
+    QCOMPARE(LogLineTokenizer::tokenize(raw.constData(), raw.size(), rawLine, TOKENIZER_STRICT), strictResult);
+    QCOMPARE(LogLineTokenizer::tokenize(raw.constData(), raw.size(), rawLine, TOKENIZER_LENIENT), lenientResult);
+    if (lenientResult) {
+        QCOMPARE(rawLine.numEpisodes, lenientNumEpisodes);
+        QCOMPARE(rawLine.ip, (quint32) 1286248989);
+        QCOMPARE(QByteArray(rawLine.time.data, rawLine.time.length), QByteArray("14-Nov-2010 06:27:12 +0100"));
+    }
+}
+
+void TestParser::decodeTimestamp_data() {
+    QTest::addColumn<QString>("timestamp");
+    QTest::addColumn<bool>("valid");
+    QTest::addColumn<uint>("time");
+
+    QTest::newRow("positive offset")     << "14-Nov-2010 06:27:12 +0100" << true  << (uint) 1289712432;
+    QTest::newRow("same hour")           << "14-Nov-2010 06:59:59 +0100" << true  << (uint) 1289714399;
+    QTest::newRow("epoch")               << "01-Jan-1970 00:00:00 +0000" << true  << (uint) 0;
+    QTest::newRow("leap day, negative half-hour offset")
+                                         << "29-Feb-2012 23:00:00 -0530" << true  << (uint) 1330576200;
+    QTest::newRow("no leap day")         << "29-Feb-2011 23:00:00 +0000" << false << (uint) 0;
+    QTest::newRow("invalid month")       << "14-Xyz-2010 06:27:12 +0100" << false << (uint) 0;
+    QTest::newRow("invalid hour")        << "14-Nov-2010 24:27:12 +0100" << false << (uint) 0;
+}
+
+void TestParser::decodeTimestamp() {
+    QFETCH(QString, timestamp);
+    QFETCH(bool, valid);
+    QFETCH(uint, time);
+
+    Time decoded = 0;
+    const QByteArray raw = timestamp.toLatin1();
+
+    QCOMPARE(TimestampDecoder::decode(raw.constData(), decoded), valid);
+    if (valid)
+        QCOMPARE(decoded, (Time) time);
+}
+
+void TestParser::concurrentInterner() {
+    ConcurrentInterner<QString, quint32> interner;
+
+    // Enough keys to make every shard grow a few times.
+    for (int i = 0; i < 5000; i++)
+        QCOMPARE(interner.intern(QString::number(i)), (quint32) i);
+    QCOMPARE(interner.size(), 5000);
+
+    // Interning again yields the same IDs, in both directions.
+    quint32 id;
+    for (int i = 0; i < 5000; i++) {
+        QCOMPARE(interner.intern(QString::number(i)), (quint32) i);
+        QCOMPARE(interner.value(i), QString::number(i));
+        QVERIFY(interner.find(QString::number(i), id));
+        QCOMPARE(id, (quint32) i);
+    }
+    QCOMPARE(interner.size(), 5000);
+
+    QVERIFY(!interner.find("unknown", id));
+    QCOMPARE(interner.value(5000), QString());
+    QCOMPARE(interner.value(0xffffffff), QString());
+
+    // Once all IDs are in use, new keys are refused, known keys are not.
+    ConcurrentInterner<QString, quint8> small;
+    quint8 smallID;
+    for (int i = 0; i < 256; i++)
+        QVERIFY(small.tryIntern(QString::number(i), smallID));
+    QVERIFY(!small.tryIntern("256", smallID));
+    QCOMPARE(small.size(), 256);
+    QVERIFY(small.tryIntern("255", smallID));
+    QCOMPARE(smallID, (quint8) 255);
+    QCOMPARE(small.value(255), QString("255"));
+}
+
+// Interned from many threads at once by the concurrentInternerThreads test.
+static ConcurrentInterner<QString, quint32> * sharedInterner = NULL;
+#define SHARED_KEYS 20000
+
+/**
+ * Intern all shared keys, each thread in a different order.
+ *
+ * @param thread
+ *   The thread's index.
+ * @return
+ *   The ID of every key.
+ */
+static QVector<quint32> internSharedKeys(const int & thread) {
+    QVector<quint32> ids(SHARED_KEYS);
+    for (int i = 0; i < SHARED_KEYS; i++) {
+        // 7919 is a prime, so this visits every key exactly once.
+        int key = (i * 7919 + thread * 1000) % SHARED_KEYS;
+        ids[key] = sharedInterner->intern(QString::number(key));
+    }
+    return ids;
+}
+
+void TestParser::concurrentInternerThreads() {
+    ConcurrentInterner<QString, quint32> interner;
+    QList<int> threads;
+    for (int t = 0; t < 16; t++)
+        threads << t;
+
+    sharedInterner = &interner;
+    QList<QVector<quint32> > ids = QtConcurrent::blockingMapped(threads, internSharedKeys);
+    sharedInterner = NULL;
+
+    // Every thread got the same ID for every key, and the IDs are dense.
+    QCOMPARE(interner.size(), SHARED_KEYS);
+    QVector<bool> assigned(SHARED_KEYS, false);
+    for (int key = 0; key < SHARED_KEYS; key++) {
+        const quint32 id = ids[0][key];
+        QVERIFY(id < (quint32) SHARED_KEYS);
+        QVERIFY(!assigned[id]);
+        assigned[id] = true;
+        QCOMPARE(interner.value(id), QString::number(key));
+        for (int t = 1; t < threads.size(); t++)
+            QCOMPARE(ids[t][key], id);
+    }
+}
+
+void TestParser::clockCache() {
+    // A single slot per shard, so that every insert in a full shard evicts.
+    ClockCache<quint32, LocationID> cache(CLOCKCACHE_SHARDS);
+    LocationID id;
+
+    QVERIFY(!cache.lookup(1, id));
+    cache.insert(1, 100);
+    QVERIFY(cache.lookup(1, id));
+    QCOMPARE(id, (LocationID) 100);
+    QCOMPARE(cache.hits(), (quint64) 1);
+    QCOMPARE(cache.misses(), (quint64) 1);
+
+    // The cache never holds more keys than its capacity.
+    for (quint32 ip = 0; ip < 1000; ip++)
+        cache.insert(ip, ip);
+    int cached = 0;
+    for (quint32 ip = 0; ip < 1000; ip++)
+        if (cache.lookup(ip, id)) {
+            QCOMPARE(id, (LocationID) ip);
+            cached++;
+        }
+    QVERIFY(cached <= cache.capacity());
+
+    cache.clear();
+    QVERIFY(!cache.lookup(999, id));
+}
+
+void TestParser::discretizer() {
+    TestFiles files(QStringList() << "speeds.csv");
+    QFile csvFile("speeds.csv");
+    if (!csvFile.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate))
+        QFAIL("Could not create sample discretizer CSV file.");
+    QTextStream out(&csvFile);
+    out << "domready,fast,150,acceptable,1000,slow" << "\n";
+    csvFile.close();
+
+    EpisodeDurationDiscretizer discretizer;
+    QVERIFY(discretizer.parseCsvFile("speeds.csv"));
+
+    // The compiled tables agree with the thresholds.
+    EpisodeDuration durations[] = { 0, 150, 151, 1000, 1001, 65535 };
+    for (uint i = 0; i < sizeof(durations) / sizeof(EpisodeDuration); i++) {
+        EpisodeSpeedID speedID = discretizer.mapToSpeedID(0, "domready", durations[i]);
+        QCOMPARE(discretizer.speedIDToSpeed(speedID), discretizer.mapToSpeed("domready", durations[i]));
+        QCOMPARE(discretizer.speedIDToItem(speedID), QString("duration:") + discretizer.mapToSpeed("domready", durations[i]));
+    }
+    QCOMPARE(discretizer.speedIDToSpeed(discretizer.mapToSpeedID(0, "domready", 151)), EpisodeSpeed("acceptable"));
+
+    QCOMPARE(discretizer.mapToSpeedID(1, "unlisted", 100), (EpisodeSpeedID) EPISODE_SPEED_UNKNOWN);
+}
+
+void TestParser::gzipLogReader() {
+    TestFiles files(QStringList() << "episodes.log.gz");
+
+    // Two concatenated gzip members.
+    for (int member = 0; member < 2; member++) {
+        gzFile gz = gzopen("episodes.log.gz", (member == 0) ? "wb" : "ab");
+        QVERIFY(gz != NULL);
+        for (int i = 0; i < 1000; i++) {
+            const QByteArray line = QByteArray::number(member * 1000 + i) + "\n";
+            gzwrite(gz, line.constData(), line.size());
+        }
+        gzclose(gz);
+    }
+
+    QVERIFY(GzipLogReader::isGzipped("episodes.log.gz"));
+    QVERIFY(!GzipLogReader::isGzipped("episodes.log"));
+
+    LogReader * reader = LogReader::create("episodes.log.gz");
+    QVERIFY(reader != NULL);
+
+    LogChunk chunk;
+    int lines = 0;
+    while (reader->readChunk(chunk, 300)) {
+        QVERIFY(chunk.lines.size() <= 300);
+        foreach (const LineSpan & line, chunk.lines) {
+            QCOMPARE(QByteArray(line.data, line.length), QByteArray::number(lines));
+            lines++;
+        }
+    }
+    QCOMPARE(lines, 2000);
+    QVERIFY(!reader->failed());
+
+    delete reader;
+}
+
+void TestParser::gzipLogReaderTruncated() {
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    gzFile gz = gzopen(file.fileName().toLocal8Bit().constData(), "wb");
+    QVERIFY(gz != NULL);
+    for (int i = 0; i < 10000; i++) {
+        const QByteArray line = QByteArray::number(i) + "\n";
+        gzwrite(gz, line.constData(), line.size());
+    }
+    gzclose(gz);
+
+    // Cut the file in half.
+    QVERIFY(file.resize(file.size() / 2));
+
+    LogReader * reader = LogReader::create(file.fileName());
+    QVERIFY(reader != NULL);
+
+    // The lines before the cut are read; then reading fails, rather than
+    // ending as if the log were complete.
+    LogChunk chunk;
+    int lines = 0;
+    while (reader->readChunk(chunk, 300))
+        lines += chunk.lines.size();
+    QVERIFY(lines > 0);
+    QVERIFY(lines < 10000);
+    QVERIFY(reader->failed());
+    QVERIFY(reader->errorString().contains(file.fileName()));
+
+    delete reader;
+}
+
+void TestParser::mergingLogReader() {
+    // Two logs, each ordered by time, with interleaved timestamps.
+    const char * fileNames[] = { "webhead1.log", "webhead2.log" };
+    TestFiles files(QStringList() << fileNames[0] << fileNames[1]);
+    for (int f = 0; f < 2; f++) {
+        QFile logFile(fileNames[f]);
+        if (!logFile.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate))
+            QFAIL("Could not create sample Episodes log file.");
+        QTextStream out(&logFile);
+        for (int second = f; second < 60; second += 2) {
+            out << "76.170.154.29 [Sunday, 14-Nov-2010 06:27:"
+                << QString::number(second).rightJustified(2, '0')
+                << " +0100] \"?ets=css:40\" 200 \"http://driverpacks.net/\" \"Mozilla/5.0\" \"driverpacks.net\"\n";
+        }
+        logFile.close();
+    }
+
+    LogReader * reader = LogReader::create(QStringList() << fileNames[0] << fileNames[1], TOKENIZER_STRICT);
+    QVERIFY(reader != NULL);
+
+    // Small chunks, to cross chunk boundaries in both sources.
+    LogChunk chunk;
+    RawField time;
+    int lines = 0;
+    while (reader->readChunk(chunk, 7)) {
+        foreach (const LineSpan & line, chunk.lines) {
+            QVERIFY(LogLineTokenizer::tokenizeTime(line.data, line.length, time));
+            QCOMPARE(QByteArray(time.data + 18, 2).toInt(), lines);
+            lines++;
+        }
+    }
+    QCOMPARE(lines, 60);
+    QVERIFY(!reader->failed());
+
+    delete reader;
+}
+
+void TestParser::parsedLogCache() {
+    TestFiles files(QStringList() << "test.eplcache" << "test.eplcache.tmp"
+                                  << "test-empty.eplcache" << "test-empty.eplcache.tmp");
+    EpisodeNameInterner episodeNames;
+    DomainNameInterner domainNames;
+    LocationInterner locations;
+    UAHierarchyInterner uaHierarchies;
+    URLInterner urls;
+    ParsedLogCacheInterners interners = { &episodeNames, &domainNames, &locations, &uaHierarchies, &urls };
+
+    Location location;
+    location.continent = "EU";
+    location.country = "BE";
+    location.region = "Limburg";
+    location.city = "Hasselt";
+    location.isp = "Telenet";
+    location.computeHash();
+    UAHierarchyDetails ua;
+    ua.platform = "MacOSX";
+    ua.browser_name = "Firefox";
+    ua.browser_version = "3.6";
+    ua.browser_version_major = 3;
+    ua.browser_version_minor = 6;
+    ua.computeHash();
+
+    // Two identical lines, that share their episodes.
+    ExpandedEpisodesLogBatch batch;
+    ExpandedEpisodesLogLine line;
+    line.time = 1289712432;
+    line.location = locations.intern(location);
+    line.ua = uaHierarchies.intern(ua);
+    line.status = 304;
+    line.url = urls.intern("http://driverpacks.net/");
+    line.firstEpisode = 0;
+    line.numEpisodes = 2;
+    batch.lines << line << line;
+    batch.episodes << Episode(episodeNames.intern("css"), 203)
+                   << Episode(episodeNames.intern("headerjs"), 94);
+
+    EpisodesLogBatch unfinished;
+    EpisodesLogLine unfinishedLine;
+    unfinishedLine.ip = 3661142843U;
+    unfinishedLine.time = 1289713500;
+    unfinishedLine.status = 200;
+    unfinishedLine.url = urls.intern("http://driverpacks.net/");
+    unfinishedLine.domain.id = domainNames.intern("driverpacks.net");
+    unfinishedLine.firstEpisode = 0;
+    unfinishedLine.numEpisodes = 1;
+    unfinished.setUA(unfinishedLine, "Mozilla/5.0", 11);
+    unfinished.lines << unfinishedLine;
+    unfinished.episodes << Episode(episodeNames.intern("footerjs"), 12);
+
+    QByteArray signature = ParsedLogCache::signatureFor(QStringList() << "foo.log", "parser");
+    ParsedLogCacheWriter * writer = new ParsedLogCacheWriter("test.eplcache", signature, interners);
+    QVERIFY(writer->open());
+    QVERIFY(writer->appendQuarter(line.time / 900, batch));
+    QVERIFY(writer->finish(unfinished));
+    delete writer;
+
+    // Load it into other interners: IDs must be remapped. Shift the IDs by
+    // interning a few keys upfront.
+    EpisodeNameInterner otherEpisodeNames;
+    DomainNameInterner otherDomainNames;
+    LocationInterner otherLocations;
+    UAHierarchyInterner otherUAHierarchies;
+    URLInterner otherURLs;
+    ParsedLogCacheInterners otherInterners = { &otherEpisodeNames, &otherDomainNames, &otherLocations, &otherUAHierarchies, &otherURLs };
+    otherEpisodeNames.intern("foo");
+    otherDomainNames.intern("example.com");
+
+    ParsedLogCacheReader staleReader(otherInterners);
+    QVERIFY(!staleReader.open("test.eplcache", ParsedLogCache::signatureFor(QStringList() << "bar.log", "parser")));
+
+    ParsedLogCacheReader reader(otherInterners);
+    QVERIFY(reader.open("test.eplcache", signature));
+
+    uint quarterID;
+    ExpandedEpisodesLogBatch restoredBatch;
+    QVERIFY(reader.readQuarter(quarterID, restoredBatch));
+    QCOMPARE(quarterID, line.time / 900);
+    QCOMPARE(restoredBatch.size(), 2);
+    const ExpandedEpisodesLogLine & restoredLine = restoredBatch.lines[1];
+    QCOMPARE(restoredLine.time, line.time);
+    QCOMPARE(restoredLine.status, line.status);
+    QCOMPARE(otherURLs.value(restoredLine.url), QString("http://driverpacks.net/"));
+    QCOMPARE(otherLocations.value(restoredLine.location).city, QString("Hasselt"));
+    QCOMPARE(otherUAHierarchies.value(restoredLine.ua).browser_version_minor, (quint16) 6);
+    QCOMPARE((int) restoredLine.numEpisodes, 2);
+    const Episode & restoredEpisode = restoredBatch.episodes[restoredLine.firstEpisode + 1];
+    QCOMPARE(otherEpisodeNames.value(restoredEpisode.id), QString("headerjs"));
+    QCOMPARE(restoredEpisode.duration, (EpisodeDuration) 94);
+    QVERIFY(!reader.readQuarter(quarterID, restoredBatch));
+
+    const EpisodesLogBatch & restoredUnfinished = reader.unfinishedQuarter();
+    QCOMPARE(restoredUnfinished.size(), 1);
+    QCOMPARE(restoredUnfinished.lines[0].ip, unfinishedLine.ip);
+    QCOMPARE(restoredUnfinished.lines[0].time, unfinishedLine.time);
+    QCOMPARE(restoredUnfinished.lines[0].uaHash, unfinishedLine.uaHash);
+    QCOMPARE(restoredUnfinished.ua(0), QString("Mozilla/5.0"));
+    QCOMPARE(otherDomainNames.value(restoredUnfinished.lines[0].domain.id), QString("driverpacks.net"));
+    QCOMPARE(otherEpisodeNames.value(restoredUnfinished.lineEpisodes(0).first().id), QString("footerjs"));
+
+    // An empty quarter is never written by the Parser: it's corrupt.
+    writer = new ParsedLogCacheWriter("test-empty.eplcache", signature, interners);
+    QVERIFY(writer->open());
+    QVERIFY(writer->appendQuarter(line.time / 900, ExpandedEpisodesLogBatch()));
+    QVERIFY(writer->finish(EpisodesLogBatch()));
+    delete writer;
+    ParsedLogCacheReader emptyReader(otherInterners);
+    QVERIFY(emptyReader.open("test-empty.eplcache", signature));
+    QVERIFY(!emptyReader.readQuarter(quarterID, restoredBatch));
+}
+
+void TestParser::ipRangeLocationResolver() {
+    TestFiles files(QStringList() << "test-ipranges.csv");
+    QFile csv("test-ipranges.csv");
+    QVERIFY(csv.open(QIODevice::WriteOnly | QIODevice::Text));
+    csv.write("# start,end,continent,country,region,city,isp\n"
+              "81.240.0.0,81.247.255.255,EU,BE,01,Hasselt,Belgacom\n"
+              "\n"
+              "1073741824,1073742079,NA,US,CA,\"Mountain View\",Google\n"
+              // Overlaps the first range: ignored.
+              "81.241.0.0,81.241.0.255,EU,NL,07,Amsterdam,KPN\n");
+    csv.close();
+
+    IPRangeLocationResolver resolver;
+    QVERIFY(resolver.parseCsvFile("test-ipranges.csv"));
+    QCOMPARE(resolver.size(), 2);
+
+    Location location = resolver.resolve(QHostAddress("81.241.0.10").toIPv4Address());
+    QCOMPARE(location.city, QString("Hasselt"));
+    QCOMPARE(location.isp, QString("Belgacom"));
+    location = resolver.resolve(QHostAddress("81.247.255.255").toIPv4Address());
+    QCOMPARE(location.country, QString("BE"));
+    location = resolver.resolve(1073741900);
+    QCOMPARE(location.city, QString("Mountain View"));
+
+    // Unknown addresses: in between, before and after the ranges.
+    QVERIFY(resolver.resolve(QHostAddress("81.248.0.0").toIPv4Address()).city.isEmpty());
+    QVERIFY(resolver.resolve(QHostAddress("1.2.3.4").toIPv4Address()).city.isEmpty());
+    QVERIFY(resolver.resolve(QHostAddress("255.255.255.255").toIPv4Address()).city.isEmpty());
+
+    QVERIFY(!resolver.signature().isEmpty());
+}
+
+void TestParser::uaPatternResolver() {
+    TestFiles files(QStringList() << "test-browscap.csv");
+    QFile csv("test-browscap.csv");
+    QVERIFY(csv.open(QIODevice::WriteOnly | QIODevice::Text));
+    csv.write("\"GJK_Browscap_Version\",\"GJK_Browscap_Version\"\n"
+              "\"4476\",\"Thu, 06 Jan 2011 01:04:01 -0000\"\n"
+              "\"PropertyName\",\"Parent\",\"Browser\",\"Version\",\"MajorVer\",\"MinorVer\",\"Platform\",\"isMobileDevice\"\n"
+              "\"Firefox 3.6\",\"DefaultProperties\",\"Firefox\",\"3.6\",\"3\",\"6\",\"default\",\"false\"\n"
+              "\"Mozilla/5.0 (Windows; U; Windows NT 6.1*; *; rv:1.9.2*) Gecko/* Firefox/3.6*\",\"Firefox 3.6\",\"default\",\"default\",\"default\",\"default\",\"Win7\",\"default\"\n"
+              "\"Mozilla/5.0 (*) Gecko/* Firefox/3.6*\",\"Firefox 3.6\",\"default\",\"default\",\"default\",\"default\",\"\",\"default\"\n"
+              "\"*iPhone*\",\"DefaultProperties\",\"iPhone\",\"\",\"\",\"\",\"iOS\",\"true\"\n");
+    csv.close();
+
+    UAPatternResolver resolver;
+    QVERIFY(resolver.parseCsvFile("test-browscap.csv"));
+    QCOMPARE(resolver.size(), 4);
+
+    // The longest matching pattern wins; the rest is inherited from Parent.
+    UAHierarchyDetails ua = resolver.resolve("Mozilla/5.0 (Windows; U; Windows NT 6.1; nl; rv:1.9.2.6) Gecko/20100625 Firefox/3.6.6");
+    QCOMPARE(ua.platform, QString("Win7"));
+    QCOMPARE(ua.browser_name, QString("Firefox"));
+    QCOMPARE(ua.browser_version_major, (quint16) 3);
+    QCOMPARE(ua.browser_version_minor, (quint16) 6);
+    QCOMPARE(ua.is_mobile, false);
+
+    // Matching is case-insensitive.
+    ua = resolver.resolve("MOZILLA/5.0 (X11; U; Linux i686) Gecko/20100625 Firefox/3.6.6");
+    QCOMPARE(ua.browser_name, QString("Firefox"));
+    QVERIFY(ua.platform.isEmpty());
+
+    // Patterns that start with a wildcard.
+    ua = resolver.resolve("Mozilla/5.0 (iPhone; U; CPU iPhone OS 4_0 like Mac OS X)");
+    QCOMPARE(ua.browser_name, QString("iPhone"));
+    QCOMPARE(ua.is_mobile, true);
+
+    // No match.
+    ua = resolver.resolve("curl/7.21.0");
+    QVERIFY(ua.browser_name.isEmpty());
+}
+
+void TestParser::concurrentIDTable() {
+    ConcurrentIDTable<LocationID, QStringList> table;
+    QStringList items;
+
+    QVERIFY(!table.lookup(0, items));
+    QVERIFY(!table.lookup(5000, items));
+
+    // Spans multiple pages.
+    for (LocationID id = 0; id < 5000; id++)
+        QCOMPARE(table.insert(id, QStringList() << QString::number(id)), QStringList() << QString::number(id));
+
+    // The first value stored for an ID wins.
+    QCOMPARE(table.insert(42, QStringList() << "other"), QStringList() << "42");
+
+    for (LocationID id = 0; id < 5000; id++) {
+        QVERIFY(table.lookup(id, items));
+        QCOMPARE(items, QStringList() << QString::number(id));
+    }
+    QVERIFY(!table.lookup(5000, items));
+}
+
+void TestParser::sampler() {
+    ExpandedEpisodesLogBatch batch;
+    ExpandedEpisodesLogLine line;
+    line.location = 0;
+    line.url = 0;
+    line.ua = 0;
+    line.status = 200;
+    line.numEpisodes = 1;
+    for (int i = 0; i < 10000; i++) {
+        line.time = 1272477600 + i / 20;
+        line.firstEpisode = i;
+        batch.lines << line;
+        batch.episodes << Episode(0, i % 1000);
+    }
+
+    Sampler sampler;
+    ExpandedEpisodesLogBatch sampled;
+
+    // By default, nothing is sampled.
+    QCOMPARE(sampler.sample(batch, 0, sampled), 1.0);
+    QVERIFY(sampled.isEmpty());
+
+    // Hash-based sampling: roughly the requested rate, and deterministic.
+    sampler.setMode(SAMPLING_HASH);
+    sampler.setRate(0.25);
+    double rate = sampler.sample(batch, 0, sampled);
+    QVERIFY(rate > 0.22 && rate < 0.28);
+    QCOMPARE(rate, ((double) sampled.size()) / batch.size());
+    ExpandedEpisodesLogBatch sampledAgain;
+    QCOMPARE(sampler.sample(batch, 1, sampledAgain), rate);
+    QCOMPARE(sampledAgain.size(), sampled.size());
+    for (int i = 0; i < sampled.size(); i++)
+        QCOMPARE(sampledAgain.lines[i].firstEpisode, sampled.lines[i].firstEpisode);
+
+    // Reservoir sampling: exactly the reservoir size, in the original order.
+    sampler.setMode(SAMPLING_RESERVOIR);
+    sampler.setReservoirSize(1000);
+    ExpandedEpisodesLogBatch reservoir;
+    QCOMPARE(sampler.sample(batch, 0, reservoir), 0.1);
+    QCOMPARE(reservoir.size(), 1000);
+    for (int i = 1; i < reservoir.size(); i++)
+        QVERIFY(reservoir.lines[i - 1].firstEpisode < reservoir.lines[i].firstEpisode);
+    QCOMPARE(reservoir.episodes.size(), batch.episodes.size());
+
+    // Adaptive sampling: slow analysis lowers the rate, fast analysis raises
+    // it again, within bounds.
+    sampler.setMode(SAMPLING_HASH);
+    sampler.setRate(1.0);
+    sampler.setAdaptive(1000, 0.1);
+    sampler.reportAnalysisDuration(4000);
+    QCOMPARE(sampler.getRate(), SAMPLER_MAX_DECREASE);
+    sampler.reportAnalysisDuration(800);
+    QCOMPARE(sampler.getRate(), SAMPLER_MAX_DECREASE);
+    sampler.reportAnalysisDuration(100);
+    QCOMPARE(sampler.getRate(), SAMPLER_MAX_DECREASE * SAMPLER_INCREASE);
+    for (int i = 0; i < 10; i++)
+        sampler.reportAnalysisDuration(100000);
+    QCOMPARE(sampler.getRate(), 0.1);
+    for (int i = 0; i < 20; i++)
+        sampler.reportAnalysisDuration(0);
+    QCOMPARE(sampler.getRate(), 1.0);
+
+    // Adaptive reservoir sampling: the reservoir shrinks down to the
+    // minimum size and grows back up to the configured size, but no
+    // further.
+    sampler.setMode(SAMPLING_RESERVOIR);
+    sampler.setReservoirSize(4000);
+    sampler.reportAnalysisDuration(4000);
+    QCOMPARE(sampler.getReservoirSize(), 2000);
+    sampler.reportAnalysisDuration(100);
+    QCOMPARE(sampler.getReservoirSize(), 2500);
+    for (int i = 0; i < 10; i++)
+        sampler.reportAnalysisDuration(100000);
+    QCOMPARE(sampler.getReservoirSize(), SAMPLER_MIN_RESERVOIR_SIZE);
+    for (int i = 0; i < 200; i++)
+        sampler.reportAnalysisDuration(0);
+    QCOMPARE(sampler.getReservoirSize(), 4000);
+    ExpandedEpisodesLogBatch grownReservoir;
+    QCOMPARE(sampler.sample(batch, 0, grownReservoir), 0.4);
+    QCOMPARE(grownReservoir.size(), 4000);
+}
+
+/**
+ * Exposes what the batch queue test needs of the Parser.
+ */
+class BatchQueueParser : public Parser {
+public:
+    using Parser::processExpandedBatch;
+    using Parser::mapEpisodeNameToID;
+    using Parser::mapLocationToID;
+    using Parser::mapUAHierarchyToID;
+};
+
+/**
+ * Feeds batches to a Parser, from a thread of its own: the Parser blocks
+ * this thread while its batch queue is full.
+ */
+class BatchProducer : public QThread {
+public:
+    BatchProducer(BatchQueueParser * parser, const QList<ExpandedEpisodesLogBatch> & batches)
+        : parser(parser), batches(batches) {}
+
+protected:
+    void run() {
+        foreach (const ExpandedEpisodesLogBatch & batch, this->batches)
+            this->parser->processExpandedBatch(batch);
+    }
+
+    BatchQueueParser * parser;
+    QList<ExpandedEpisodesLogBatch> batches;
+};
+
+/**
+ * Wait (for at most 5 seconds) until a number of batches was recorded.
+ */
+static bool waitForBatches(BatchRecorder & recorder, int batches) {
+    QTime timer;
+    timer.start();
+    while (recorder.starts().size() < batches && timer.elapsed() < 5000)
+        QTest::qSleep(10);
+    return recorder.starts().size() == batches;
+}
+
+void TestParser::batchQueue() {
+    BatchQueueParser parser;
+    parser.setBatchQueueDepth(2);
+    BatchRecorder recorder;
+    connect(&parser, SIGNAL(parsedBatch(Analytics::TransactionBatch,double,double,Time,Time)),
+            &recorder, SLOT(record(Analytics::TransactionBatch,double,double,Time,Time)),
+            Qt::DirectConnection);
+
+    // One batch per quarter, with a single page view each.
+    Location location;
+    location.computeHash();
+    UAHierarchyDetails ua;
+    ua.computeHash();
+    EpisodeID episodeID;
+    QVERIFY(BatchQueueParser::mapEpisodeNameToID("css", episodeID));
+    ExpandedEpisodesLogLine line;
+    line.location = BatchQueueParser::mapLocationToID(location);
+    line.ua = BatchQueueParser::mapUAHierarchyToID(ua);
+    line.url = UNKNOWN_URL_ID;
+    line.status = 200;
+    line.firstEpisode = 0;
+    line.numEpisodes = 1;
+    QList<ExpandedEpisodesLogBatch> batches;
+    for (int q = 0; q < 5; q++) {
+        ExpandedEpisodesLogBatch batch;
+        line.time = 1272477600 + q * 900;
+        batch.lines << line;
+        batch.episodes << Episode(episodeID, 100);
+        batches << batch;
+    }
+
+    BatchProducer producer(&parser, batches);
+    producer.start();
+
+    // The producer runs ahead by as many batches as the queue holds, then
+    // blocks until the consumer is done with a batch.
+    QVERIFY(waitForBatches(recorder, 2));
+    QTest::qSleep(100);
+    QCOMPARE(recorder.starts().size(), 2);
+    QVERIFY(producer.isRunning());
+
+    parser.continueParsing();
+    QVERIFY(waitForBatches(recorder, 3));
+    QTest::qSleep(100);
+    QCOMPARE(recorder.starts().size(), 3);
+
+    parser.continueParsing();
+    parser.continueParsing();
+    QVERIFY(producer.wait(5000));
+
+    // Batches are emitted in order.
+    QCOMPARE(recorder.starts().size(), 5);
+    for (int q = 0; q < 5; q++)
+        QCOMPARE(recorder.starts()[q], batches[q].lines.first().time);
+}
+
+void TestParser::quarterReorderBuffer() {
+    // Lines of three quarters (Q = 1433400, i.e. 1290060000), slightly out
+    // of order.
+    const Time q = 1290060000;
+    Time times[] = { q + 10, q + 890, q + 905, q + 880, q + 950, q + 1100, q + 895, q + 1801, q + 100 };
+    EpisodesLogBatch source;
+    EpisodesLogLine line;
+    memset(&line, 0, sizeof(line));
+    for (uint i = 0; i < sizeof(times) / sizeof(Time); i++) {
+        line.time = times[i];
+        source.lines << line;
+    }
+
+    uint quarterID;
+    EpisodesLogBatch batch;
+
+    // Lateness of 300 seconds: the first quarter stays open until a line
+    // with a time past its end + 300 s arrives.
+    QuarterReorderBuffer buffer;
+    buffer.setLateness(300);
+    for (int i = 0; i < 7; i++) {
+        QVERIFY(buffer.append(source, i, 1000 + i));
+        QVERIFY(!buffer.takeClosedQuarter(quarterID, batch));
+    }
+    QCOMPARE(buffer.openQuarters(), 2);
+    QCOMPARE(buffer.oldestOffset(), (qint64) 1000);
+
+    // q + 1801 moves the watermark to q + 1501: the first quarter closes.
+    QVERIFY(buffer.append(source, 7, 1007));
+    QVERIFY(buffer.takeClosedQuarter(quarterID, batch));
+    QCOMPARE(quarterID, q / 900);
+    QCOMPARE(batch.size(), 4);
+    QCOMPARE(batch.lines[3].time, q + 895);
+    QVERIFY(!buffer.takeClosedQuarter(quarterID, batch));
+    QCOMPARE(buffer.lastClosedQuarterID(), q / 900);
+
+    // Its lines are late from now on.
+    QVERIFY(!buffer.append(source, 8, 1008));
+    QCOMPARE(buffer.droppedLateLines(), (quint64) 1);
+
+    // Flushing takes out the remaining quarters, oldest first.
+    QVERIFY(buffer.takeQuarterBefore((uint) -1, quarterID, batch));
+    QCOMPARE(quarterID, q / 900 + 1);
+    QCOMPARE(batch.size(), 3);
+    QVERIFY(buffer.takeQuarterBefore((uint) -1, quarterID, batch));
+    QCOMPARE(quarterID, q / 900 + 2);
+    QVERIFY(buffer.isEmpty());
+    QCOMPARE(buffer.bufferedLines(), 0);
+
+    // Without lateness, a quarter closes as soon as a line of a later
+    // quarter arrives. With a memory bound, older quarters close early.
+    QuarterReorderBuffer strict;
+    for (int i = 0; i < 2; i++)
+        QVERIFY(strict.append(source, i, 0));
+    QVERIFY(strict.append(source, 2, 0));
+    QVERIFY(strict.takeClosedQuarter(quarterID, batch));
+    QCOMPARE(batch.size(), 2);
+    QVERIFY(!strict.append(source, 3, 0));
+
+    QuarterReorderBuffer bounded;
+    bounded.setLateness(3600);
+    bounded.setMaxBufferedLines(2);
+    for (int i = 0; i < 5; i++)
+        QVERIFY(bounded.append(source, i, 0));
+    QVERIFY(bounded.takeClosedQuarter(quarterID, batch));
+    QCOMPARE(quarterID, q / 900);
+    QCOMPARE(batch.size(), 3);
+    QVERIFY(!bounded.takeClosedQuarter(quarterID, batch));
+}
+
+void TestParser::streamLogReader() {
+#ifdef Q_OS_UNIX
+    int fds[2];
+    QCOMPARE(::pipe(fds), 0);
+    ::fcntl(fds[0], F_SETFL, ::fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+    StreamLogReader reader("pipe");
+    LogChunk chunk;
+
+    // Nothing has arrived yet: reading must not block.
+    QCOMPARE(reader.readAvailable(fds[0]), (qint64) 0);
+    QVERIFY(!reader.readChunk(chunk, 10));
+    QVERIFY(!reader.isFinished());
+
+    // Only complete lines are handed out.
+    QCOMPARE(::write(fds[1], "first\nsecond\nthi", 17), (ssize_t) 17);
+    QCOMPARE(reader.readAvailable(fds[0]), (qint64) 17);
+    QVERIFY(reader.readChunk(chunk, 10));
+    QCOMPARE(chunk.offset, (qint64) 0);
+    QCOMPARE(chunk.lines.size(), 2);
+    QCOMPARE(QByteArray(chunk.lines[0].data, chunk.lines[0].length), QByteArray("first"));
+    QCOMPARE(QByteArray(chunk.lines[1].data, chunk.lines[1].length), QByteArray("second"));
+    QVERIFY(!reader.readChunk(chunk, 10));
+
+    // The incomplete line is completed by the next read.
+    QCOMPARE(::write(fds[1], "rd\nfour", 7), (ssize_t) 7);
+    reader.readAvailable(fds[0]);
+    QVERIFY(reader.readChunk(chunk, 10));
+    QCOMPARE(chunk.offset, (qint64) 13);
+    QCOMPARE(chunk.lines.size(), 1);
+    QCOMPARE(QByteArray(chunk.lines[0].data, chunk.lines[0].length), QByteArray("third"));
+    QVERIFY(!reader.readChunk(chunk, 10));
+
+    // Once the writer is gone, the incomplete last line is handed out too.
+    ::close(fds[1]);
+    reader.readAvailable(fds[0]);
+    QVERIFY(reader.isFinished());
+    QVERIFY(reader.readChunk(chunk, 10));
+    QCOMPARE(chunk.lines.size(), 1);
+    QCOMPARE(QByteArray(chunk.lines[0].data, chunk.lines[0].length), QByteArray("four"));
+    QVERIFY(!reader.readChunk(chunk, 10));
+    ::close(fds[0]);
+#else
+    QSKIP("Requires pipes.", SkipAll);
+#endif
+}
+
+void TestParser::streamLogReaderOversizedLine() {
+    StreamLogReader reader("buffer");
+    LogChunk chunk;
+
+    // An incomplete line that grows too long is dropped rather than kept.
+    QByteArray bytes = QByteArray("ok\n") + QByteArray(LOGREADER_MAX_LINE_LENGTH + 1, 'x');
+    QBuffer first(&bytes);
+    QVERIFY(first.open(QIODevice::ReadOnly));
+    reader.readAvailable(&first);
+    QVERIFY(reader.readChunk(chunk, 10));
+    QCOMPARE(chunk.lines.size(), 1);
+    QCOMPARE(QByteArray(chunk.lines[0].data, chunk.lines[0].length), QByteArray("ok"));
+    QCOMPARE(reader.droppedLines(), 1);
+    QVERIFY(!reader.readChunk(chunk, 10));
+
+    // So is the rest of it, when it arrives; the next line is not.
+    QByteArray rest("xxxx\nnext\n");
+    QBuffer second(&rest);
+    QVERIFY(second.open(QIODevice::ReadOnly));
+    reader.readAvailable(&second);
+    QVERIFY(reader.readChunk(chunk, 10));
+    QCOMPARE(chunk.lines.size(), 1);
+    QCOMPARE(QByteArray(chunk.lines[0].data, chunk.lines[0].length), QByteArray("next"));
+    QCOMPARE(reader.droppedLines(), 1);
+}
+
+void TestParser::tailLogReader() {
+    QTemporaryFile log;
+    QVERIFY(log.open());
+    LogChunk chunk;
+
+    // Only complete lines are read; the incomplete last line is left for
+    // the next reader.
+    log.write("first\nsecond\nthi");
+    log.flush();
+    TailLogReader reader(log.fileName(), 0);
+    QVERIFY(reader.open());
+    QVERIFY(!reader.wasTruncated());
+    QCOMPARE(reader.endOffset(), (qint64) 13);
+    QVERIFY(reader.readChunk(chunk, 10));
+    QCOMPARE(chunk.offset, (qint64) 0);
+    QCOMPARE(chunk.lines.size(), 2);
+    QCOMPARE(QByteArray(chunk.lines[0].data, chunk.lines[0].length), QByteArray("first"));
+    QCOMPARE(QByteArray(chunk.lines[1].data, chunk.lines[1].length), QByteArray("second"));
+    QVERIFY(!reader.readChunk(chunk, 10));
+
+    // Nothing new has been completed.
+    TailLogReader unchanged(log.fileName(), 13);
+    QVERIFY(unchanged.open());
+    QCOMPARE(unchanged.endOffset(), (qint64) 13);
+    QVERIFY(!unchanged.readChunk(chunk, 10));
+
+    // Once completed, the line is read from where the last reader ended.
+    log.write("rd\nfour");
+    log.flush();
+    TailLogReader appended(log.fileName(), 13);
+    QVERIFY(appended.open());
+    QVERIFY(!appended.wasTruncated());
+    QCOMPARE(appended.endOffset(), (qint64) 19);
+    QVERIFY(appended.readChunk(chunk, 10));
+    QCOMPARE(chunk.offset, (qint64) 13);
+    QCOMPARE(chunk.lines.size(), 1);
+    QCOMPARE(QByteArray(chunk.lines[0].data, chunk.lines[0].length), QByteArray("third"));
+    QVERIFY(!appended.readChunk(chunk, 10));
+
+    // A log that shrunk has been truncated or rotated: it's read from the
+    // start.
+    QVERIFY(log.resize(0));
+    log.seek(0);
+    log.write("rotated\n");
+    log.flush();
+    TailLogReader rotated(log.fileName(), 19);
+    QVERIFY(rotated.open());
+    QVERIFY(rotated.wasTruncated());
+    QCOMPARE(rotated.endOffset(), (qint64) 8);
+    QVERIFY(rotated.readChunk(chunk, 10));
+    QCOMPARE(chunk.offset, (qint64) 0);
+    QCOMPARE(chunk.lines.size(), 1);
+    QCOMPARE(QByteArray(chunk.lines[0].data, chunk.lines[0].length), QByteArray("rotated"));
+}
+
+void TestParser::parserHelperIndex() {
+    TestFiles files(QStringList() << "test.ephindex" << "test-ip.ephindex" << "test-corrupt.ephindex"
+                                  << "test.ephindex.tmp" << "test-ip.ephindex.tmp" << "test-corrupt.ephindex.tmp"
+                                  << "test-index-ipranges.csv" << "test-index-browscap.csv");
+    QFile ipRangesCSV("test-index-ipranges.csv");
+    QVERIFY(ipRangesCSV.open(QIODevice::WriteOnly | QIODevice::Text));
+    ipRangesCSV.write("81.240.0.0,81.247.255.255,EU,BE,01,Hasselt,Belgacom\n"
+                      "1073741824,1073742079,NA,US,CA,\"Mountain View\",Google\n");
+    ipRangesCSV.close();
+
+    QFile browsCapCSV("test-index-browscap.csv");
+    QVERIFY(browsCapCSV.open(QIODevice::WriteOnly | QIODevice::Text));
+    browsCapCSV.write("\"PropertyName\",\"Parent\",\"Browser\",\"Version\",\"MajorVer\",\"MinorVer\",\"Platform\",\"isMobileDevice\"\n"
+                      "\"Firefox 3.6\",\"DefaultProperties\",\"Firefox\",\"3.6\",\"3\",\"6\",\"default\",\"false\"\n"
+                      "\"Mozilla/5.0 (Windows; *) Gecko/* Firefox/3.6*\",\"Firefox 3.6\",\"default\",\"default\",\"default\",\"default\",\"Win7\",\"default\"\n"
+                      "\"*iPhone*\",\"DefaultProperties\",\"iPhone\",\"\",\"\",\"\",\"iOS\",\"true\"\n");
+    browsCapCSV.close();
+
+    // Compiled on first use.
+    QFile::remove("test.ephindex");
+    QSharedPointer<ParserHelperIndex> index = ParserHelperIndex::openOrCompile("test.ephindex", "test-index-ipranges.csv", "test-index-browscap.csv");
+    QVERIFY(!index.isNull());
+    QVERIFY(QFile::exists("test.ephindex"));
+
+    // Resolvers that look up from the index behave like those that parsed
+    // the CSV files, and have the same signature.
+    IPRangeLocationResolver parsedIPRanges, indexedIPRanges;
+    QVERIFY(parsedIPRanges.parseCsvFile("test-index-ipranges.csv"));
+    QVERIFY(indexedIPRanges.loadIndex(index));
+    QCOMPARE(indexedIPRanges.size(), 2);
+    QCOMPARE(indexedIPRanges.signature(), parsedIPRanges.signature());
+    QCOMPARE(indexedIPRanges.resolve(QHostAddress("81.241.0.10").toIPv4Address()).city, QString("Hasselt"));
+    QCOMPARE(indexedIPRanges.resolve(1073741900).city, QString("Mountain View"));
+    QVERIFY(indexedIPRanges.resolve(QHostAddress("1.2.3.4").toIPv4Address()).city.isEmpty());
+
+    UAPatternResolver parsedPatterns, indexedPatterns;
+    QVERIFY(parsedPatterns.parseCsvFile("test-index-browscap.csv"));
+    QVERIFY(indexedPatterns.loadIndex(index));
+    QCOMPARE(indexedPatterns.size(), 3);
+    QCOMPARE(indexedPatterns.signature(), parsedPatterns.signature());
+    UAHierarchyDetails ua = indexedPatterns.resolve("Mozilla/5.0 (Windows; U; Windows NT 6.1; nl) Gecko/20100625 Firefox/3.6.6");
+    QCOMPARE(ua.platform, QString("Win7"));
+    QCOMPARE(ua.browser_name, QString("Firefox"));
+    QCOMPARE(ua.browser_version_minor, (quint16) 6);
+    ua = indexedPatterns.resolve("Mozilla/5.0 (iPhone; U; CPU iPhone OS 4_0 like Mac OS X)");
+    QCOMPARE(ua.browser_name, QString("iPhone"));
+    QCOMPARE(ua.is_mobile, true);
+    QVERIFY(indexedPatterns.resolve("curl/7.21.0").browser_name.isEmpty());
+
+    // An index without UA patterns cannot be loaded by a UAPatternResolver.
+    QSharedPointer<ParserHelperIndex> ipOnly = ParserHelperIndex::openOrCompile("test-ip.ephindex", "test-index-ipranges.csv", QString());
+    QVERIFY(!ipOnly.isNull());
+    UAPatternResolver unloadable;
+    QVERIFY(!unloadable.loadIndex(ipOnly));
+
+    // An index whose search tree points past the ranges, or whose ranges
+    // are out of order, is rejected.
+    QByteArray ipSignature = ParserHelperIndex::signatureFor(QStringList() << "test-index-ipranges.csv");
+    QVector<QByteArray> sections(ParserHelperIndex::NUM_SECTIONS);
+    parsedIPRanges.writeIndex(sections);
+    QVector<QByteArray> corruptTree = sections;
+    quint32 * ranks = (quint32 *) corruptTree[ParserHelperIndex::IP_SEARCH_TREE].data() + parsedIPRanges.size() + 1;
+    ranks[1] = 1000;
+    QVERIFY(ParserHelperIndex::write("test-corrupt.ephindex", ipSignature, corruptTree));
+    QSharedPointer<ParserHelperIndex> corrupt(new ParserHelperIndex());
+    QVERIFY(corrupt->open("test-corrupt.ephindex", ipSignature));
+    IPRangeLocationResolver rejecting;
+    QVERIFY(!rejecting.loadIndex(corrupt));
+    corrupt.clear();
+    QVector<QByteArray> unsortedRanges = sections;
+    QByteArray & rangeSection = unsortedRanges[ParserHelperIndex::IP_RANGES];
+    rangeSection = rangeSection.mid(rangeSection.size() / 2) + rangeSection.left(rangeSection.size() / 2);
+    QVERIFY(ParserHelperIndex::write("test-corrupt.ephindex", ipSignature, unsortedRanges));
+    corrupt = QSharedPointer<ParserHelperIndex>(new ParserHelperIndex());
+    QVERIFY(corrupt->open("test-corrupt.ephindex", ipSignature));
+    QVERIFY(!rejecting.loadIndex(corrupt));
+    corrupt.clear();
+
+    // A stale index is not opened: it's recompiled instead.
+    QVERIFY(ipRangesCSV.open(QIODevice::Append | QIODevice::Text));
+    ipRangesCSV.write("10.0.0.0,10.255.255.255,EU,NL,07,Amsterdam,KPN\n");
+    ipRangesCSV.close();
+    QStringList sources = QStringList() << "test-index-ipranges.csv" << "test-index-browscap.csv";
+    ParserHelperIndex stale;
+    QVERIFY(!stale.open("test.ephindex", ParserHelperIndex::signatureFor(sources)));
+    index = ParserHelperIndex::openOrCompile("test.ephindex", "test-index-ipranges.csv", "test-index-browscap.csv");
+    QVERIFY(!index.isNull());
+    IPRangeLocationResolver recompiled;
+    QVERIFY(recompiled.loadIndex(index));
+    QCOMPARE(recompiled.size(), 3);
+    QCOMPARE(recompiled.resolve(QHostAddress("10.1.2.3").toIPv4Address()).city, QString("Amsterdam"));
+}
+
+void TestParser::ipRangeSearchTree() {
+    TestFiles files(QStringList() << "test-searchtree.csv");
+    // Ranges of varying widths with gaps in between, spread over the entire
+    // address space, cycling through 7 Locations.
+    QFile csv("test-searchtree.csv");
+    QVERIFY(csv.open(QIODevice::WriteOnly | QIODevice::Text));
+    QList<QPair<IPAddress, IPAddress> > ranges;
+    IPAddress start = 1000;
+    for (int i = 0; i < 1000; i++) {
+        IPAddress end = start + (i % 13) * 1000;
+        ranges << qMakePair(start, end);
+        csv.write(QString("%1,%2,EU,BE,%3,City%3,ISP\n").arg(start).arg(end).arg(i % 7).toAscii());
+        start = end + 1 + (i % 3) * 3000000;
+    }
+    csv.close();
+
+    IPRangeLocationResolver resolver;
+    QVERIFY(resolver.parseCsvFile("test-searchtree.csv"));
+    QCOMPARE(resolver.size(), 1000);
+    QCOMPARE(resolver.numLocations(), 7);
+
+    // Every range's bounds resolve to its Location, the addresses around
+    // them to the neighbouring range or to nothing.
+    for (int i = 0; i < ranges.size(); i++) {
+        const QString city = QString("City%1").arg(i % 7);
+        QCOMPARE(resolver.location(resolver.resolveIndex(ranges[i].first)).city, city);
+        QCOMPARE(resolver.location(resolver.resolveIndex(ranges[i].second)).city, city);
+        QCOMPARE(resolver.resolve(ranges[i].second).city, city);
+        if (i == 0 || ranges[i - 1].second + 1 < ranges[i].first)
+            QCOMPARE(resolver.resolveIndex(ranges[i].first - 1), -1);
+    }
+    QCOMPARE(resolver.resolveIndex(0), -1);
+    QCOMPARE(resolver.resolveIndex(ranges.last().second + 1), -1);
+    QCOMPARE(resolver.resolveIndex((IPAddress) -1), -1);
+    QVERIFY(resolver.location(-1).city.isEmpty());
+}
+
+void TestParser::uaPatternAutomaton() {
+    TestFiles files(QStringList() << "test-automaton.csv");
+    QFile csv("test-automaton.csv");
+    QVERIFY(csv.open(QIODevice::WriteOnly | QIODevice::Text));
+    csv.write("\"PropertyName\",\"Parent\",\"Browser\",\"Platform\"\n"
+              // Without anchor: matches everything, but is the shortest.
+              "\"*\",\"\",\"Default Browser\",\"\"\n"
+              // Anchors that overlap, and that are suffixes of each other.
+              "\"*Chrome/*\",\"\",\"Chrome\",\"\"\n"
+              "\"*Chrome/?? Mobile*\",\"\",\"Chrome Mobile\",\"\"\n"
+              "\"*(Linux; Android*) * Chrome/* Mobile*\",\"\",\"Chrome Mobile\",\"Android\"\n"
+              "\"*rome/*\",\"\",\"Rome\",\"\"\n"
+              "\"Googlebot/2.?*\",\"\",\"Googlebot\",\"\"\n"
+              "\"*bot*\",\"\",\"Generic Bot\",\"\"\n");
+    csv.close();
+
+    UAPatternResolver resolver;
+    QVERIFY(resolver.parseCsvFile("test-automaton.csv"));
+    QCOMPARE(resolver.size(), 7);
+
+    // The longest matching pattern wins, even if its anchor is found after
+    // (or inside) that of a shorter pattern.
+    UAHierarchyDetails ua = resolver.resolve("Mozilla/5.0 (Linux; Android 4.0.4) AppleWebKit/535.19 Chrome/18.0 Mobile Safari/535.19");
+    QCOMPARE(ua.browser_name, QString("Chrome Mobile"));
+    QCOMPARE(ua.platform, QString("Android"));
+    ua = resolver.resolve("Mozilla/5.0 (iPhone) AppleWebKit/535.19 CHROME/18 Mobile Safari/535.19");
+    QCOMPARE(ua.browser_name, QString("Chrome Mobile"));
+    QVERIFY(ua.platform.isEmpty());
+    QCOMPARE(resolver.resolve("Mozilla/5.0 (X11) Chrome/18.0.1025.142 Safari/535.19").browser_name, QString("Chrome"));
+    QCOMPARE(resolver.resolve("Rome/1.0").browser_name, QString("Rome"));
+
+    // Wildcards in and around anchors.
+    QCOMPARE(resolver.resolve("Googlebot/2.1 (+http://www.google.com/bot.html)").browser_name, QString("Googlebot"));
+    QCOMPARE(resolver.resolve("Googlebot/3.0").browser_name, QString("Generic Bot"));
+
+    // Only the pattern without anchor matches.
+    QCOMPARE(resolver.resolve("curl/7.21.0").browser_name, QString("Default Browser"));
+    QCOMPARE(resolver.resolve("").browser_name, QString("Default Browser"));
+}
@@ -3,10 +3,36 @@
 
 #include <QtTest/QtTest>
 #include <QFile>
+#include <QTemporaryFile>
+#include <QBuffer>
 #include "../Parser.h"
 
 using namespace EpisodesParser;
 
+/**
+ * Records the start times of the batches a Parser emits, from whichever
+ * thread emits them.
+ */
+class BatchRecorder : public QObject {
+    Q_OBJECT
+
+public:
+    QList<Time> starts() {
+        QMutexLocker locker(&this->mutex);
+        return this->batchStarts;
+    }
+
+public slots:
+    void record(Analytics::TransactionBatch, double, double, Time start, Time) {
+        QMutexLocker locker(&this->mutex);
+        this->batchStarts.append(start);
+    }
+
+protected:
+    QMutex mutex;
+    QList<Time> batchStarts;
+};
+
 class TestParser: public QObject {
     Q_OBJECT
 
@@ -18,6 +44,31 @@ private slots:
     void parse();
     void mapLineToEpisodesLogLine_data();
     void mapLineToEpisodesLogLine();
+    void maxURLs();
+    void tokenize_data();
+    void tokenize();
+    void decodeTimestamp_data();
+    void decodeTimestamp();
+    void concurrentInterner();
+    void concurrentInternerThreads();
+    void clockCache();
+    void discretizer();
+    void gzipLogReader();
+    void gzipLogReaderTruncated();
+    void mergingLogReader();
+    void parsedLogCache();
+    void ipRangeLocationResolver();
+    void uaPatternResolver();
+    void concurrentIDTable();
+    void sampler();
+    void batchQueue();
+    void quarterReorderBuffer();
+    void streamLogReader();
+    void streamLogReaderOversizedLine();
+    void tailLogReader();
+    void parserHelperIndex();
+    void ipRangeSearchTree();
+    void uaPatternAutomaton();
 };
 
 #endif // TESTPARSER_H
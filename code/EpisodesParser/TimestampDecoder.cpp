@@ -0,0 +1,139 @@
+#include "TimestampDecoder.h"
+
+#include <string.h>
+
+namespace EpisodesParser {
+
+    #define DIGIT(c) ((c) - '0')
+
+    QThreadStorage<TimestampDecoder::HourCache *> TimestampDecoder::cache;
+
+    /**
+     * Decode a timestamp.
+     *
+     * @param timestamp
+     *   A timestamp in the "dd-MMM-yyyy HH:mm:ss +zzzz" format (26 bytes),
+     *   with an English month abbreviation. Its layout (i.e. the position of
+     *   the digits and separators) must already have been verified.
+     * @param time
+     *   The corresponding UTC timestamp.
+     * @return
+     *   false if the timestamp does not represent a valid date and time.
+     */
+    bool TimestampDecoder::decode(const char * timestamp, Time & time) {
+        if (!TimestampDecoder::cache.hasLocalData())
+            TimestampDecoder::cache.setLocalData(new HourCache());
+        HourCache * hour = TimestampDecoder::cache.localData();
+
+        // "dd-MMM-yyyy HH" and " +zzzz" identify the hour.
+        const char * offset = timestamp + 20;
+        if (!hour->valid
+            || memcmp(hour->key, timestamp, 14) != 0
+            || memcmp(hour->key + 14, offset, 6) != 0)
+        {
+            if (!TimestampDecoder::decodeHour(timestamp, hour->hourStart)) {
+                hour->valid = false;
+                return false;
+            }
+            memcpy(hour->key, timestamp, 14);
+            memcpy(hour->key + 14, offset, 6);
+            hour->valid = true;
+        }
+
+        // "mm:ss"
+        int minutes = DIGIT(timestamp[15]) * 10 + DIGIT(timestamp[16]);
+        int seconds = DIGIT(timestamp[18]) * 10 + DIGIT(timestamp[19]);
+        if (minutes > 59 || seconds > 59)
+            return false;
+
+        qint64 result = hour->hourStart + minutes * 60 + seconds;
+        if (result < 0 || result > 0xFFFFFFFFLL)
+            return false;
+
+        time = (Time) result;
+        return true;
+    }
+
+
+    //---------------------------------------------------------------------------
+    // Protected static methods.
+
+    /**
+     * Decode the "dd-MMM-yyyy HH" and "+zzzz" parts of a timestamp.
+     *
+     * @param timestamp
+     *   A timestamp in the "dd-MMM-yyyy HH:mm:ss +zzzz" format.
+     * @param hourStart
+     *   The UTC timestamp of the start of the hour.
+     * @return
+     *   false if the date, hour or time zone offset is invalid.
+     */
+    bool TimestampDecoder::decodeHour(const char * timestamp, qint64 & hourStart) {
+        static const int daysInMonth[12] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+        int day   = DIGIT(timestamp[0]) * 10 + DIGIT(timestamp[1]);
+        int month = TimestampDecoder::decodeMonth(timestamp + 3);
+        int year  = DIGIT(timestamp[7]) * 1000 + DIGIT(timestamp[8]) * 100 + DIGIT(timestamp[9]) * 10 + DIGIT(timestamp[10]);
+        int hours = DIGIT(timestamp[12]) * 10 + DIGIT(timestamp[13]);
+
+        if (month == 0 || day < 1 || day > daysInMonth[month - 1] || hours > 23)
+            return false;
+        bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+        if (month == 2 && day == 29 && !leap)
+            return false;
+
+        // "+zzzz": hours and minutes east of UTC.
+        const char * zone = timestamp + 21;
+        int offsetMinutes = (DIGIT(zone[1]) * 10 + DIGIT(zone[2])) * 60 + DIGIT(zone[3]) * 10 + DIGIT(zone[4]);
+        if (DIGIT(zone[3]) > 5)
+            return false;
+        if (zone[0] == '-')
+            offsetMinutes = -offsetMinutes;
+
+        hourStart = TimestampDecoder::daysFromCivil(year, month, day) * 86400
+                    + hours * 3600
+                    - offsetMinutes * 60;
+        return true;
+    }
+
+    /**
+     * Map an English three-letter month abbreviation to its number.
+     *
+     * @param month
+     *   Three characters, e.g. "Nov".
+     * @return
+     *   1-12, or 0 if it is not a month abbreviation.
+     */
+    int TimestampDecoder::decodeMonth(const char * month) {
+        // Pack the (case-insensitive) abbreviation into a single integer.
+        switch (((month[0] | 0x20) << 16) | ((month[1] | 0x20) << 8) | (month[2] | 0x20)) {
+            case ('j' << 16 | 'a' << 8 | 'n'): return 1;
+            case ('f' << 16 | 'e' << 8 | 'b'): return 2;
+            case ('m' << 16 | 'a' << 8 | 'r'): return 3;
+            case ('a' << 16 | 'p' << 8 | 'r'): return 4;
+            case ('m' << 16 | 'a' << 8 | 'y'): return 5;
+            case ('j' << 16 | 'u' << 8 | 'n'): return 6;
+            case ('j' << 16 | 'u' << 8 | 'l'): return 7;
+            case ('a' << 16 | 'u' << 8 | 'g'): return 8;
+            case ('s' << 16 | 'e' << 8 | 'p'): return 9;
+            case ('o' << 16 | 'c' << 8 | 't'): return 10;
+            case ('n' << 16 | 'o' << 8 | 'v'): return 11;
+            case ('d' << 16 | 'e' << 8 | 'c'): return 12;
+            default: return 0;
+        }
+    }
+
+    /**
+     * Number of days since 1970-01-01 of a date in the proleptic Gregorian
+     * calendar. See Howard Hinnant's "chrono-Compatible Low-Level Date
+     * Algorithms".
+     */
+    qint64 TimestampDecoder::daysFromCivil(int year, int month, int day) {
+        year -= (month <= 2) ? 1 : 0;
+        const int era = (year >= 0 ? year : year - 399) / 400;
+        const int yearOfEra = year - era * 400;                                      // [0, 399]
+        const int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1; // [0, 365]
+        const int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear; // [0, 146096]
+        return (qint64) era * 146097 + dayOfEra - 719468;
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef TIMESTAMPDECODER_H
+#define TIMESTAMPDECODER_H
+
+#include <QtGlobal>
+#include <QThreadStorage>
+
+#include "typedefs.h"
+
+
+namespace EpisodesParser {
+
+    // Length of the part of a timestamp that identifies the hour, including
+    // the time zone offset: "dd-MMM-yyyy HH" (14 bytes) + " +zzzz" (6 bytes).
+    #define TIMESTAMPDECODER_KEY_SIZE 20
+
+    /**
+     * Decodes "dd-MMM-yyyy HH:mm:ss +zzzz" timestamps into UTC timestamps,
+     * without QDateTime and without locking.
+     *
+     * Consecutive log lines nearly always fall within the same hour, hence
+     * every thread remembers the last hour it decoded: on a hit, only the
+     * minutes and seconds must be decoded.
+     */
+    class TimestampDecoder {
+    public:
+        static bool decode(const char * timestamp, Time & time);
+
+    protected:
+        struct HourCache {
+            HourCache() : valid(false) {}
+
+            bool valid;
+            char key[TIMESTAMPDECODER_KEY_SIZE];
+            // UTC timestamp of the start of the cached hour.
+            qint64 hourStart;
+        };
+
+        static bool decodeHour(const char * timestamp, qint64 & hourStart);
+        static int decodeMonth(const char * month);
+        static qint64 daysFromCivil(int year, int month, int day);
+
+        static QThreadStorage<HourCache *> cache;
+    };
+
+}
+
+#endif // TIMESTAMPDECODER_H
@@ -3,12 +3,119 @@
 
 namespace EpisodesParser {
 
+    void Location::computeHash() {
+        this->hash = ((::qHash(this->region) * 31) + ::qHash(this->city)) * 31 + ::qHash(this->isp);
+    }
+
     uint qHash(const Location & location) {
-        return qHash(location.region + location.city + location.isp);
+        return location.hash;
+    }
+
+    void UAHierarchyDetails::computeHash() {
+        this->hash = ((::qHash(this->platform) * 31) + ::qHash(this->browser_name)) * 31 + ::qHash(this->browser_version);
     }
 
     uint qHash(const UAHierarchyDetails & ua) {
-        return qHash(ua.platform + ua.browser_name + ua.browser_version);
+        return ua.hash;
+    }
+
+    void EpisodesLogBatch::clear() {
+        this->lines.clear();
+        this->episodes.clear();
+        this->uas.clear();
+        this->uaOffsets.clear();
+    }
+
+    /**
+     * Set the User-Agent of a line of this batch. Every distinct User-Agent
+     * is only stored once per batch.
+     *
+     * @param line
+     *   A line of this batch.
+     * @param data
+     *   The User-Agent (UTF-8).
+     * @param length
+     *   The length of the User-Agent, in bytes.
+     */
+    void EpisodesLogBatch::setUA(EpisodesLogLine & line, const char * data, int length) {
+        line.uaHash = EpisodesLogBatch::hashUA(data, length);
+        line.uaLength = length;
+
+        QHash<quint64, quint32>::const_iterator it = this->uaOffsets.constFind(line.uaHash);
+        if (it != this->uaOffsets.constEnd()
+            && (int) it.value() + length <= this->uas.size()
+            && memcmp(this->uas.constData() + it.value(), data, length) == 0)
+        {
+            line.uaOffset = it.value();
+        }
+        else {
+            line.uaOffset = this->uas.size();
+            this->uas.append(data, length);
+            if (it == this->uaOffsets.constEnd())
+                this->uaOffsets.insert(line.uaHash, line.uaOffset);
+        }
+    }
+
+    /**
+     * Append a line of another batch to this batch, along with its episodes
+     * and its User-Agent.
+     *
+     * @param other
+     *   Another batch.
+     * @param line
+     *   The index of a line in the other batch.
+     */
+    void EpisodesLogBatch::appendLine(const EpisodesLogBatch & other, int line) {
+        EpisodesLogLine copy = other.lines[line];
+
+        copy.firstEpisode = this->episodes.size();
+        for (int e = 0; e < copy.numEpisodes; e++)
+            this->episodes.append(other.episodes[other.lines[line].firstEpisode + e]);
+
+        this->setUA(copy, other.uas.constData() + copy.uaOffset, copy.uaLength);
+
+        this->lines.append(copy);
+    }
+
+    UA EpisodesLogBatch::ua(int line) const {
+        return QString::fromUtf8(this->uas.constData() + this->lines[line].uaOffset, this->lines[line].uaLength);
+    }
+
+    QByteArray EpisodesLogBatch::rawUA(int line) const {
+        return QByteArray::fromRawData(this->uas.constData() + this->lines[line].uaOffset, this->lines[line].uaLength);
+    }
+
+    EpisodeList EpisodesLogBatch::lineEpisodes(int line) const {
+        EpisodeList episodes;
+        for (int e = 0; e < this->lines[line].numEpisodes; e++)
+            episodes.append(this->episodes[this->lines[line].firstEpisode + e]);
+        return episodes;
+    }
+
+    /**
+     * Hash a User-Agent string to 64 bits (FNV-1a, followed by a finalizer
+     * to spread the bits). Collisions are rare at this width, but not
+     * impossible: whoever looks up User-Agents by their hash must still
+     * compare the User-Agents themselves.
+     *
+     * @param data
+     *   A User-Agent string (UTF-8).
+     * @param length
+     *   The length of the string, in bytes.
+     * @return
+     *   Its 64-bit hash.
+     */
+    quint64 EpisodesLogBatch::hashUA(const char * data, int length) {
+        quint64 hash = Q_UINT64_C(14695981039346656037);
+        for (int i = 0; i < length; i++) {
+            hash ^= (uchar) data[i];
+            hash *= Q_UINT64_C(1099511628211);
+        }
+
+        hash ^= hash >> 33;
+        hash *= Q_UINT64_C(0xff51afd7ed558ccd);
+        hash ^= hash >> 33;
+        return hash;
     }
 
 #ifdef DEBUG
@@ -54,12 +161,12 @@ namespace EpisodesParser {
         const static char * eol = ", \n";
 
         dbg.nospace() << "{\n"
-                      << "IP = " << line.ip << eol
+                      << "IP = " << QHostAddress(line.ip) << eol
                       << "time = " << line.time << eol
-                      << "episodes = " << line.episodes << eol
+                      << "episodes = " << (int) line.numEpisodes << " from " << line.firstEpisode << eol
                       << "status = " << line.status << eol
                       << "URL = " << line.url << eol
-                      << "user-agent = " << line.ua << eol
+                      << "user-agent = " << line.uaHash << eol
                       << "domain = " << line.domain << eol
                       << "}";
 
@@ -88,10 +195,10 @@ namespace EpisodesParser {
         dbg.nospace() << "{\n"
                       << "location = " << line.location << eol
                       << "time = " << line.time << eol
-                      << "episodes = " << line.episodes << eol
+                      << "episodes = " << (int) line.numEpisodes << " from " << line.firstEpisode << eol
                       << "status = " << line.status << eol
                       << "URL = " << line.url << eol
-                      << "user-agent = " << line.ua << " -> " << line.uaHierarchyIDDetailsHash->value(line.ua) << eol
+                      << "user-agent = " << line.ua << eol
                       << "}";
 
         return dbg.nospace();
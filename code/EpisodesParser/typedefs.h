@@ -4,11 +4,15 @@
 #include <QtGlobal>
 #include <QMetaType>
 #include <QList>
+#include <QVector>
+#include <QByteArray>
 #include <QHostAddress>
 #include <QStringList>
 #include <QString>
 #include <QHash>
 
+#include "ConcurrentInterner.h"
+
 #ifdef DEBUG
 #include <QDebug>
 #endif
@@ -24,14 +28,14 @@ typedef uint Time;
 // should be more than sufficient.
 typedef QString EpisodeName;
 typedef quint8 EpisodeID;
-typedef QHash<EpisodeName, EpisodeID> EpisodeNameIDHash;
-typedef QHash<EpisodeID, EpisodeName> EpisodeIDNameHash;
+typedef ConcurrentInterner<EpisodeName, EpisodeID> EpisodeNameInterner;
 
 // Store Episode durations as 16-bit uints.
 typedef quint16 EpisodeDuration;
 // The EpisodeDuration will be discretized to an EpisodeSpeed for association
 // rule mining.
 typedef QString EpisodeSpeed;
+typedef quint8 EpisodeSpeedID;
 
 struct Episode {
     Episode() {}
@@ -40,7 +44,7 @@ struct Episode {
     EpisodeID id;
     EpisodeDuration duration;
 #ifdef DEBUG
-    EpisodeIDNameHash * IDNameHash;
+    EpisodeNameInterner * IDNameHash;
 #endif
 };
 inline bool operator==(const Episode &e1, const Episode &e2) {
@@ -55,33 +59,83 @@ typedef quint16 HTTPStatus;
 typedef QString URL;
 typedef QString UA;
 
+// Efficient storage of URLs: the same URLs recur a lot.
+typedef quint32 URLID;
+typedef ConcurrentInterner<URL, URLID> URLInterner;
+// The URL of lines whose URL was not interned because the maximum number of
+// URLs had been reached. Beyond the interner's capacity, so it never is the
+// ID of an interned URL, and it maps back to a null URL.
+#define UNKNOWN_URL_ID 0xFFFFFFFF
+
+// IPv4 address, in host byte order (i.e. the same value that
+// QHostAddress::toIPv4Address() returns).
+typedef quint32 IPAddress;
+
 // Efficient storage of domain names.
 typedef QString DomainName;
 typedef quint8 DomainID;
-typedef QHash<DomainName, DomainID> DomainNameIDHash;
-typedef QHash<DomainID, DomainName> DomainIDNameHash;
+typedef ConcurrentInterner<DomainName, DomainID> DomainNameInterner;
 struct Domain {
     DomainID id;
     // TODO: allow multiple domains to be analyzed as one whole by providing
     // a common identifier.
 #ifdef DEBUG
-    EpisodeIDNameHash * IDNameHash;
+    DomainNameInterner * IDNameHash;
 #endif
 };
 
 // Parsed raw line from Episodes log file: no processing applied whatsoever.
+// A fixed-size record: its episodes and User-Agent are stored in the
+// EpisodesLogBatch it belongs to.
 struct EpisodesLogLine {
-    QHostAddress ip;
+    IPAddress ip;
     Time time;
-    EpisodeList episodes;
     HTTPStatus status;
-    URL url;
-    UA ua;
     Domain domain;
-#ifdef DEBUG
-    EpisodeIDNameHash * episodeIDNameHash;
-    DomainIDNameHash * domainIDNameHash;
-#endif
+    URLID url;
+    // Episodes: EpisodesLogBatch::episodes[firstEpisode] and onwards.
+    quint32 firstEpisode;
+    quint8 numEpisodes;
+    // User-Agent: EpisodesLogBatch::uas, from uaOffset onwards (UTF-8).
+    quint32 uaOffset;
+    quint32 uaLength;
+    // See EpisodesLogBatch::hashUA().
+    quint64 uaHash;
+};
+
+/**
+ * A batch of parsed lines. It consists of only a few contiguous arrays,
+ * so it's cheap to iterate and it's freed in one shot.
+ */
+struct EpisodesLogBatch {
+    QVector<EpisodesLogLine> lines;
+    QVector<Episode> episodes;
+    // The User-Agents of the lines in this batch, each distinct one stored
+    // only once.
+    QByteArray uas;
+    // UA hash to offset in uas. Upon a hash collision, the second
+    // User-Agent is stored again rather than being indexed.
+    QHash<quint64, quint32> uaOffsets;
+
+    int size() const { return this->lines.size(); }
+    bool isEmpty() const { return this->lines.isEmpty(); }
+    void clear();
+
+    void setUA(EpisodesLogLine & line, const char * data, int length);
+    void appendLine(const EpisodesLogBatch & other, int line);
+    UA ua(int line) const;
+    QByteArray rawUA(int line) const;
+    EpisodeList lineEpisodes(int line) const;
+
+    static quint64 hashUA(const char * data, int length);
+};
+
+// A UAHierarchyID cached by its User-Agent's hash. The User-Agent itself is
+// stored along with it, so that a hash collision can't resolve one
+// User-Agent to the hierarchy of another.
+struct UACacheEntry {
+    QByteArray ua;
+    UAHierarchyID hierarchy;
 };
 
 
@@ -93,15 +147,23 @@ struct Location{
     QString city;
     QString isp;
 
-    // @TODO this is a likely performance bottleneck.
+    // Precomputed by computeHash(), to avoid rehashing three strings on
+    // every probe while interning.
+    uint hash;
+
+    Location() : hash(0) {}
+
     // @TRICKY: Note that we don't check continent and country, we assume each
     // (region, city, isp) tuple is unique on its own!
     bool operator==(const Location & other) const {
-        return (this->region == other.region
+        return (this->hash == other.hash
+                && this->region == other.region
                 && this->city == other.city
                 && this->isp == other.isp);
     }
 
+    void computeHash();
+
     /**
      * Generate the items for this Location, to allow for association rule
      * mining. This takes the concept hierarchy into account.
@@ -122,9 +184,8 @@ struct Location{
     }
 };
 typedef quint32 LocationID;
-typedef QHash<Location, LocationID> LocationToIDHash;
-typedef QHash<LocationID, Location> LocationFromIDHash;
 uint qHash(const Location & location);
+typedef ConcurrentInterner<Location, LocationID> LocationInterner;
 
 struct UAHierarchyDetails {
     // OS details.
@@ -136,11 +197,21 @@ struct UAHierarchyDetails {
     quint16 browser_version_minor;
     bool is_mobile;
 
-    // @TODO this is a likely performance bottleneck.
+    // Precomputed by computeHash(), to avoid rehashing three strings on
+    // every probe while interning.
+    uint hash;
+
+    UAHierarchyDetails() : browser_version_major(0), browser_version_minor(0), is_mobile(false), hash(0) {}
+
     bool operator==(const UAHierarchyDetails & other) const {
-        return (this->platform == other.platform && this->browser_name == other.browser_name && this->browser_version == other.browser_version);
+        return (this->hash == other.hash
+                && this->platform == other.platform
+                && this->browser_name == other.browser_name
+                && this->browser_version == other.browser_version);
     }
 
+    void computeHash();
+
     /**
      * Generate the items for this UA, to allow for association rule
      * mining. This takes the concept hierarchy into account.
@@ -171,23 +242,27 @@ struct UAHierarchyDetails {
     }
 };
 typedef quint16 UAHierarchyID;
-typedef QHash<UAHierarchyDetails, UAHierarchyID> UAHierarchyDetailsIDHash;
-typedef QHash<UAHierarchyID, UAHierarchyDetails> UAHierarchyIDDetailsHash;
 uint qHash(const UAHierarchyDetails & ua);
+typedef ConcurrentInterner<UAHierarchyDetails, UAHierarchyID> UAHierarchyInterner;
 
 struct ExpandedEpisodesLogLine {
-    LocationID location;
     Time time;
-    EpisodeList episodes;
+    LocationID location;
+    URLID url;
     HTTPStatus status;
-    URL url;
     UAHierarchyID ua;
+    // Episodes: ExpandedEpisodesLogBatch::episodes[firstEpisode] and onwards.
+    quint32 firstEpisode;
+    quint8 numEpisodes;
+};
 
-    LocationFromIDHash * locationFromIDHash;
-    UAHierarchyIDDetailsHash * uaHierarchyIDDetailsHash;
-#ifdef DEBUG
-    EpisodeIDNameHash * episodeIDNameHash;
-#endif
+struct ExpandedEpisodesLogBatch {
+    QVector<ExpandedEpisodesLogLine> lines;
+    // Episodes are not expanded: usually shared with the EpisodesLogBatch.
+    QVector<Episode> episodes;
+
+    int size() const { return this->lines.size(); }
+    bool isEmpty() const { return this->lines.isEmpty(); }
 };
 
 
@@ -208,6 +283,11 @@ QDebug operator<<(QDebug dbg, const ExpandedEpisodesLogLine & episodesLogLine);
 
 }
 
+// Line records are plain data: let QVector move them with memcpy().
+Q_DECLARE_TYPEINFO(EpisodesParser::Episode, Q_MOVABLE_TYPE);
+Q_DECLARE_TYPEINFO(EpisodesParser::EpisodesLogLine, Q_PRIMITIVE_TYPE);
+Q_DECLARE_TYPEINFO(EpisodesParser::ExpandedEpisodesLogLine, Q_PRIMITIVE_TYPE);
+
 // Register metatypes to allow these types to be streamed in QTests.
 Q_DECLARE_METATYPE(EpisodesParser::EpisodeList)
 Q_DECLARE_METATYPE(EpisodesParser::Episode)
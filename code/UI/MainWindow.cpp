@@ -4,8 +4,10 @@ MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent)
 {
     this->parsing = false;
+    this->following = false;
     this->totalPatternsExaminedWhileMining = 0;
     this->totalParsingDuration = 0;
+    this->totalParserStallDuration = 0;
     this->totalAnalyzingDuration = 0;
     this->totalMiningDuration = 0;
 
@@ -15,6 +17,14 @@ MainWindow::MainWindow(QWidget *parent) :
     this->initUI();
     this->connectUI();
     this->assignLogicToThreads();
+
+    // Stream lines in from stdin ("-") or a local socket right away.
+    QStringList arguments = QCoreApplication::arguments();
+    int ingestArgument = arguments.indexOf("--ingest");
+    if (ingestArgument != -1 && ingestArgument + 1 < arguments.size()) {
+        this->following = true;
+        emit ingest(arguments.at(ingestArgument + 1));
+    }
 }
 
 MainWindow::~MainWindow() {
@@ -34,8 +44,32 @@ void MainWindow::updateParsingStatus(bool parsing) {
     this->parsing = parsing;
     this->updateStatus();
     this->menuFileImport->setEnabled(!parsing);
-    if (!parsing)
+    this->menuFileFollow->setEnabled(!parsing);
+    this->menuFileListen->setEnabled(!parsing);
+    this->menuFileStopFollowing->setEnabled(parsing && this->following);
+    if (!parsing) {
+        this->following = false;
         this->mineOrCompare();
+    }
+}
+
+void MainWindow::updateBatchQueueStatus(int queuedBatches, int stallDuration) {
+    QMutexLocker(&this->statusMutex);
+    this->totalParserStallDuration += stallDuration;
+    this->status_performance_batchQueue->setText(
+                QString("%1 queued (%2 s stalled)")
+                .arg(queuedBatches)
+                .arg(QString::number(this->totalParserStallDuration / 1000.0, 'f', 2))
+    );
+}
+
+void MainWindow::updateReorderStatus(int openQuarters, int droppedLateLines) {
+    QMutexLocker(&this->statusMutex);
+    this->status_performance_lateLines->setText(
+                QString("%1 dropped (%2 quarters open)")
+                .arg(droppedLateLines)
+                .arg(openQuarters)
+    );
 }
 
 void MainWindow::updateParsingDuration(int duration) {
@@ -49,6 +83,9 @@ void MainWindow::updateParsingDuration(int duration) {
 }
 
 void MainWindow::updateAnalyzingDuration(int duration) {
+    // Adaptive sampling: let the parser shed more or less load. Thread-safe.
+    this->parser->getSampler().reportAnalysisDuration(duration);
+
     QMutexLocker(&this->statusMutex);
     this->totalAnalyzingDuration += duration;
     this->status_performance_analyzing->setText(
@@ -328,11 +365,39 @@ void MainWindow::importFile() {
     QSettings settings;
     QString lastDirectory = settings.value("UI/lastImportDirectory", QDesktopServices::storageLocation(QDesktopServices::DesktopLocation)).toString();
 
-    QString logFile = QFileDialog::getOpenFileName(this, tr("Open Episodes log file"), lastDirectory, tr("Episodes log files (*.log)"), NULL, QFileDialog::ReadOnly);
+    // Selecting multiple files (e.g. one per web server) merges them.
+    QStringList logFiles = QFileDialog::getOpenFileNames(this, tr("Open Episodes log files"), lastDirectory, tr("Episodes log files (*.log *.log.gz *.gz)"), NULL, QFileDialog::ReadOnly);
+
+    if (!logFiles.isEmpty()) {
+        settings.setValue("UI/lastImportDirectory", QFileInfo(logFiles.first()).path());
+        emit parseFiles(logFiles);
+    }
+}
+
+void MainWindow::followFile() {
+    QSettings settings;
+    QString lastDirectory = settings.value("UI/lastImportDirectory", QDesktopServices::storageLocation(QDesktopServices::DesktopLocation)).toString();
+
+    QString logFile = QFileDialog::getOpenFileName(this, tr("Follow Episodes log file"), lastDirectory, tr("Episodes log files (*.log)"), NULL, QFileDialog::ReadOnly);
 
     if (!logFile.isEmpty()) {
         settings.setValue("UI/lastImportDirectory", QFileInfo(logFile).path());
-        emit parse(logFile);
+        this->following = true;
+        emit follow(logFile);
+    }
+}
+
+void MainWindow::listen() {
+    QSettings settings;
+    QString lastSource = settings.value("UI/lastIngestSource", "/tmp/wpoanalytics.sock").toString();
+
+    bool ok;
+    QString source = QInputDialog::getText(this, tr("Listen for Episodes log lines"), tr("Local socket path, or - for stdin:"), QLineEdit::Normal, lastSource, &ok);
+
+    if (ok && !source.isEmpty()) {
+        settings.setValue("UI/lastIngestSource", source);
+        this->following = true;
+        emit ingest(source);
     }
 }
 
@@ -348,7 +413,6 @@ void MainWindow::settingsDialog() {
 // Private methods: logic.
 
 void MainWindow::initLogic() {
-    qRegisterMetaType< QList<QStringList> >("QList<QStringList>");
     qRegisterMetaType< QList<float> >("QList<float>");
     qRegisterMetaType<Time>("Time");
     Analytics::registerBasicMetaTypes();
@@ -358,20 +422,91 @@ void MainWindow::initLogic() {
     QString defaultValue = basePath + "/config/EpisodesSpeeds.csv";
     QString episodeDiscretizerCSV = settings.value("parser/episodeDiscretizerCSVFile", defaultValue).toString();
 
-    EpisodesParser::Parser::initParserHelpers(basePath + "/config/browscap.csv",
-                                              basePath + "/config/browscap-index.db",
-                                              basePath + "/config/GeoIPCity.dat",
-                                              basePath + "/config/GeoIPASNum.dat",
-                                              episodeDiscretizerCSV
-                                              );
+    bool lenientTokenizer = settings.value("parser/lenientTokenizer", false).toBool();
+    EpisodesParser::Parser::setTokenizerMode(lenientTokenizer ? EpisodesParser::TOKENIZER_LENIENT : EpisodesParser::TOKENIZER_STRICT);
+    EpisodesParser::Parser::setUACacheCapacity(settings.value("parser/uaCacheSize", UA_CACHE_SIZE).toInt());
+    EpisodesParser::Parser::setMaxURLs(settings.value("parser/maxURLs", MAX_URLS).toInt());
+
+    // The in-memory resolvers are loaded from a prebuilt index, which is
+    // mapped into memory. It's compiled on first use, and again whenever
+    // their CSV files change.
+    bool useIPRanges = (settings.value("parser/locationResolver", "geoip").toString() == "ipranges");
+    bool useUAPatterns = (settings.value("parser/uaResolver", "browscap").toString() == "patterns");
+    QString ipRangesCSV = settings.value("parser/ipRangesCSVFile", basePath + "/config/ipranges.csv").toString();
+    QSharedPointer<EpisodesParser::ParserHelperIndex> helperIndex;
+    if (useIPRanges || useUAPatterns) {
+        QString indexFile = settings.value("parser/helperIndexFile", basePath + "/config/parserhelpers" PARSERHELPERINDEX_EXTENSION).toString();
+        helperIndex = EpisodesParser::ParserHelperIndex::openOrCompile(indexFile,
+                                                                       useIPRanges ? ipRangesCSV : QString(),
+                                                                       useUAPatterns ? basePath + "/config/browscap.csv" : QString());
+        if (helperIndex.isNull())
+            qWarning("Could not compile the parser helper index %s.", qPrintable(indexFile));
+    }
+
+    // Location resolver: the GeoIP databases (default), or an in-memory
+    // table of IP ranges, which can be looked up without locking.
+    EpisodesParser::LocationResolver * locationResolver = NULL;
+    if (useIPRanges) {
+        EpisodesParser::IPRangeLocationResolver * ipRanges = new EpisodesParser::IPRangeLocationResolver();
+        if ((!helperIndex.isNull() && ipRanges->loadIndex(helperIndex)) || ipRanges->parseCsvFile(ipRangesCSV))
+            locationResolver = ipRanges;
+        else {
+            qWarning("Could not load the IP ranges in %s, falling back to GeoIP.", qPrintable(ipRangesCSV));
+            delete ipRanges;
+        }
+    }
+    if (locationResolver == NULL)
+        locationResolver = new EpisodesParser::QGeoIPLocationResolver(basePath + "/config/GeoIPCity.dat",
+                                                                      basePath + "/config/GeoIPASNum.dat");
+
+    // UA resolver: QBrowsCap (default), or an in-memory index of the same
+    // browscap.csv patterns, which can be looked up without locking.
+    EpisodesParser::UAResolver * uaResolver = NULL;
+    if (useUAPatterns) {
+        EpisodesParser::UAPatternResolver * patterns = new EpisodesParser::UAPatternResolver();
+        if ((!helperIndex.isNull() && patterns->loadIndex(helperIndex)) || patterns->parseCsvFile(basePath + "/config/browscap.csv"))
+            uaResolver = patterns;
+        else {
+            qWarning("Could not load the browscap patterns, falling back to QBrowsCap.");
+            delete patterns;
+        }
+    }
+    if (uaResolver == NULL)
+        uaResolver = new EpisodesParser::QBrowsCapUAResolver(basePath + "/config/browscap.csv",
+                                                             basePath + "/config/browscap-index.db");
+
+    EpisodesParser::Parser::initParserHelpers(locationResolver, uaResolver, episodeDiscretizerCSV);
 
     // Instantiate the EpisodesParser and the Analytics. Then connect them.
     this->parser = new EpisodesParser::Parser();
+    this->parser->setBatchQueueDepth(settings.value("parser/batchQueueDepth", BATCH_QUEUE_DEPTH).toInt());
+    // Lines may lag this many seconds behind and still be batched in their
+    // own quarter (e.g. merged logs of servers with buffered writes).
+    this->parser->setReorderLateness(settings.value("parser/reorderLateness", REORDER_LATENESS).toUInt());
+    this->parser->setReorderMaxBufferedLines(settings.value("parser/reorderMaxBufferedLines", REORDER_MAX_BUFFERED_LINES).toInt());
+    // Optional: re-imports are much faster with a parsed log cache.
+    this->parser->setCacheDirectory(settings.value("parser/cacheDirectory", "").toString());
+    // Optional: sample page views when the analyst can't keep up.
+    EpisodesParser::Sampler & sampler = this->parser->getSampler();
+    QString samplingMode = settings.value("parser/samplingMode", "none").toString();
+    if (samplingMode == "hash")
+        sampler.setMode(EpisodesParser::SAMPLING_HASH);
+    else if (samplingMode == "reservoir")
+        sampler.setMode(EpisodesParser::SAMPLING_RESERVOIR);
+    sampler.setRate(settings.value("parser/samplingRate", 1.0).toDouble());
+    sampler.setReservoirSize(settings.value("parser/samplingReservoirSize", 50000).toInt());
+    sampler.setAdaptive(settings.value("parser/samplingTargetDuration", 0).toInt(),
+                        settings.value("parser/samplingMinimumRate", 0.05).toDouble());
 
     double minSupport = settings.value("analyst/minimumSupport", 0.05).toDouble();
     double minPatternTreeSupport = settings.value("analyst/minimumPatternTreeSupport", 0.04).toDouble();
     double minConfidence = settings.value("analyst/minimumConfidence", 0.2).toDouble();
     this->analyst = new Analytics::Analyst(minSupport, minPatternTreeSupport, minConfidence);
+    // The parser emits transactions as item IDs; the analyst looks up their
+    // names in the same dictionary.
+    this->analyst->setItemDictionary(EpisodesParser::Parser::getItemDictionary());
+    // Skip itemsets like {location:EU, location:EU:BE}.
+    this->analyst->setConceptHierarchyPruning(settings.value("analyst/pruneConceptHierarchy", true).toBool());
 
     // Set constraints. This defines which associations will be found. By
     // default, only causes for slow episodes will be searched.
@@ -383,7 +518,7 @@ void MainWindow::initLogic() {
 
 void MainWindow::connectLogic() {
     // Pure logic.
-    connect(this->parser, SIGNAL(parsedBatch(QList<QStringList>, double, Time, Time)), this->analyst, SLOT(analyzeTransactions(QList<QStringList>, double, Time, Time)));
+    connect(this->parser, SIGNAL(parsedBatch(Analytics::TransactionBatch, double, double, Time, Time)), this->analyst, SLOT(analyzeTransactions(Analytics::TransactionBatch, double, double, Time, Time)));
 
     // Logic -> main thread -> logic (wake up sleeping threads).
     connect(this->analyst, SIGNAL(processedBatch()), SLOT(wakeParser()));
@@ -391,6 +526,8 @@ void MainWindow::connectLogic() {
     // Logic -> UI.
     connect(this->parser, SIGNAL(parsing(bool)), SLOT(updateParsingStatus(bool)));
     connect(this->parser, SIGNAL(parsedDuration(int)), SLOT(updateParsingDuration(int)));
+    connect(this->parser, SIGNAL(batchQueueStatus(int,int)), SLOT(updateBatchQueueStatus(int,int)));
+    connect(this->parser, SIGNAL(reorderStatus(int,int)), SLOT(updateReorderStatus(int,int)));
     connect(this->analyst, SIGNAL(analyzing(bool,Time,Time,int,int)), SLOT(updateAnalyzingStatus(bool,Time,Time,int,int)));
     connect(this->analyst, SIGNAL(analyzedDuration(int)), SLOT(updateAnalyzingDuration(int)));
     connect(this->analyst, SIGNAL(mining(bool)), SLOT(updateMiningStatus(bool)));
@@ -405,6 +542,11 @@ void MainWindow::connectLogic() {
 
     // UI -> logic.
     connect(this, SIGNAL(parse(QString)), this->parser, SLOT(parse(QString)));
+    connect(this, SIGNAL(parseFiles(QStringList)), this->parser, SLOT(parseFiles(QStringList)));
+    connect(this, SIGNAL(follow(QString)), this->parser, SLOT(follow(QString)));
+    connect(this, SIGNAL(stopFollowing()), this->parser, SLOT(stopFollowing()));
+    connect(this, SIGNAL(ingest(QString)), this->parser, SLOT(ingest(QString)));
+    connect(this, SIGNAL(stopFollowing()), this->parser, SLOT(stopIngesting()));
     connect(this, SIGNAL(mine(uint,uint)), this->analyst, SLOT(mineRules(uint,uint)));
     connect(this, SIGNAL(mineAndCompare(uint,uint,uint,uint)), this->analyst, SLOT(mineAndCompareRules(uint,uint,uint,uint)));
 }
@@ -720,6 +862,10 @@ void MainWindow::createStatusGroupbox() {
     QHBoxLayout * performanceLayout = new QHBoxLayout();
     QLabel * mir2_1 = new QLabel(tr("Parsing:"));
     this->status_performance_parsing = new QLabel("0 s");
+    QLabel * mir2_4 = new QLabel(tr("Batch queue:"));
+    this->status_performance_batchQueue = new QLabel(tr("0 queued"));
+    QLabel * mir2_5 = new QLabel(tr("Late lines:"));
+    this->status_performance_lateLines = new QLabel(tr("0 dropped"));
     QLabel * mir2_2 = new QLabel(tr("Analyzing:"));
     this->status_performance_analyzing = new QLabel("0 s");
     QLabel * mir2_3 = new QLabel(tr("Mining:"));
@@ -727,6 +873,12 @@ void MainWindow::createStatusGroupbox() {
     performanceLayout->addWidget(mir2_1);
     performanceLayout->addWidget(this->status_performance_parsing);
     performanceLayout->addStretch();
+    performanceLayout->addWidget(mir2_4);
+    performanceLayout->addWidget(this->status_performance_batchQueue);
+    performanceLayout->addStretch();
+    performanceLayout->addWidget(mir2_5);
+    performanceLayout->addWidget(this->status_performance_lateLines);
+    performanceLayout->addStretch();
     performanceLayout->addWidget(mir2_2);
     performanceLayout->addWidget(this->status_performance_analyzing);
     performanceLayout->addStretch();
@@ -746,6 +898,18 @@ void MainWindow::createMenuBar() {
     this->menuFileImport->setShortcut(QKeySequence(Qt::CTRL + Qt::Key_I));
     this->menuFile->addAction(this->menuFileImport);
 
+    this->menuFileFollow = new QAction(tr("Follow"), this->menuFile);
+    this->menuFileFollow->setShortcut(QKeySequence(Qt::CTRL + Qt::Key_F));
+    this->menuFile->addAction(this->menuFileFollow);
+
+    this->menuFileListen = new QAction(tr("Listen"), this->menuFile);
+    this->menuFileListen->setShortcut(QKeySequence(Qt::CTRL + Qt::Key_L));
+    this->menuFile->addAction(this->menuFileListen);
+
+    this->menuFileStopFollowing = new QAction(tr("Stop following"), this->menuFile);
+    this->menuFileStopFollowing->setEnabled(false);
+    this->menuFile->addAction(this->menuFileStopFollowing);
+
     this->menuFileSettings = new QAction(tr("Settings"), this->menuFile);
     this->menuFile->addAction(this->menuFileSettings);
 
@@ -760,5 +924,8 @@ void MainWindow::connectUI() {
 
     // Menus.
     connect(this->menuFileImport, SIGNAL(triggered()), SLOT(importFile()));
+    connect(this->menuFileFollow, SIGNAL(triggered()), SLOT(followFile()));
+    connect(this->menuFileListen, SIGNAL(triggered()), SLOT(listen()));
+    connect(this->menuFileStopFollowing, SIGNAL(triggered()), SIGNAL(stopFollowing()));
     connect(this->menuFileSettings, SIGNAL(triggered()), SLOT(settingsDialog()));
 }
@@ -29,6 +29,7 @@
 #include <QFileDialog>
 #include <QDesktopServices>
 #include <QDialog>
+#include <QInputDialog>
 
 #include <QTableView>
 #include <QHeaderView>
@@ -65,6 +66,10 @@ public:
 
 signals:
     void parse(QString file);
+    void parseFiles(QStringList files);
+    void follow(QString file);
+    void stopFollowing();
+    void ingest(QString source);
     void mine(uint from, uint to);
     void mineAndCompare(uint fromOlder, uint toOlder, uint fromNewer, uint toNewer);
 
@@ -73,6 +78,8 @@ public slots:
     void wakeParser();
     void updateParsingStatus(bool parsing);
     void updateParsingDuration(int duration);
+    void updateBatchQueueStatus(int queuedBatches, int stallDuration);
+    void updateReorderStatus(int openQuarters, int droppedLateLines);
 
     // Analyst: analyzing.
     void updateAnalyzingStatus(bool analyzing, Time start, Time end, int numPageViews, int numTransactions);
@@ -101,6 +108,8 @@ protected slots:
     void causesFilterChanged(QString filterString);
 
     void importFile();
+    void followFile();
+    void listen();
     void settingsDialog();
 
 private:
@@ -133,6 +142,8 @@ private:
     // Stats.
     QMutex statusMutex;
     bool parsing;
+    bool following;
+    int totalParserStallDuration;
     int patternTreeSize;
     Time startTime;
     Time endTime;
@@ -176,6 +187,8 @@ private:
     QLabel * status_measurements_pageViews;
     QLabel * status_measurements_episodes;
     QLabel * status_performance_parsing;
+    QLabel * status_performance_batchQueue;
+    QLabel * status_performance_lateLines;
     QLabel * status_performance_analyzing;
     QLabel * status_performance_mining;
     QLabel * status_mining_uniqueItems;
@@ -185,6 +198,9 @@ private:
     // Menu bar.
     QMenu * menuFile;
     QAction * menuFileImport;
+    QAction * menuFileFollow;
+    QAction * menuFileListen;
+    QAction * menuFileStopFollowing;
     QAction * menuFileSettings;
 };
 